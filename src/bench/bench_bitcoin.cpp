@@ -4,6 +4,7 @@
 
 #include "bench.h"
 
+#include "crypto/progpow/ethash.hpp"
 #include "crypto/sha256.h"
 #include "key.h"
 #include "validation.h"
@@ -14,6 +15,7 @@ int
 main(int argc, char** argv)
 {
     SHA256AutoDetect();
+    ethash::progpow_autodetect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
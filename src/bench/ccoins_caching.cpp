@@ -5,8 +5,10 @@
 #include "bench.h"
 #include "coins.h"
 #include "policy/policy.h"
+#include "random.h"
 #include "wallet/crypter.h"
 
+#include <iostream>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
@@ -84,4 +86,66 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+/** Number of coins in the caches of the insertion and lookup benchmarks */
+static const size_t CACHE_COINS = 1 << 20;
+
+static std::vector<COutPoint> RandomOutPoints(size_t nCount)
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(nCount);
+    for (size_t i = 0; i < nCount; i++) {
+        outpoints.emplace_back(rng.rand256(), rng.randrange(4));
+    }
+    return outpoints;
+}
+
+/** A coin with a pay-to-pubkey-hash script, which like most fits the prevector inline */
+static Coin DummyCoin()
+{
+    CTxOut out(50 * CENT, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG);
+    return Coin(std::move(out), 100, false);
+}
+
+// Adds coins to a cache, which is flushed each time it holds CACHE_COINS.
+static void CCoinsCacheInsert(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    const std::vector<COutPoint> outpoints = RandomOutPoints(CACHE_COINS);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        coins.AddCoin(outpoints[i], DummyCoin(), false);
+        if (++i == outpoints.size()) {
+            coins.SetBestBlock(uint256S("1"));
+            coins.Flush();
+            i = 0;
+        }
+    }
+}
+
+// Looks coins up in a cache of CACHE_COINS, in an order defeating the CPU caches.
+// Also reports on stderr, away from the results, how many such coins fit a
+// gigabyte of -dbcache.
+static void CCoinsCacheLookup(benchmark::State& state)
+{
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+    const std::vector<COutPoint> outpoints = RandomOutPoints(CACHE_COINS);
+    for (const COutPoint& outpoint : outpoints) {
+        coins.AddCoin(outpoint, DummyCoin(), false);
+    }
+    const double nEntriesPerGB = (double)coins.GetCacheSize() * (1 << 30) / coins.DynamicMemoryUsage();
+    std::cerr << "CCoinsCacheLookup: " << (uint64_t)nEntriesPerGB << " coins fit a GiB of cache\n";
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        // A stride coprime with the power of two size visits all the coins.
+        const Coin& coin = coins.AccessCoin(outpoints[(i++ * 7919) & (CACHE_COINS - 1)]);
+        assert(!coin.IsSpent());
+    }
+}
+
 BENCHMARK(CCoinsCaching);
+BENCHMARK(CCoinsCacheInsert);
+BENCHMARK(CCoinsCacheLookup);
@@ -0,0 +1,99 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "crypto/equihash.h"
+#include "uint256.h"
+
+#include <cassert>
+#include <string>
+
+// The solvers run on the largest parameters they handle in about a second,
+// and on the parameters of -regtest.
+static eh_HashState EquihashBenchState(unsigned int n, unsigned int k, uint32_t nonce)
+{
+    const std::string I = "block header";
+    uint256 V;
+    *V.begin() = nonce & 0xff;
+    eh_HashState state;
+    EhInitialiseState(n, k, state);
+    crypto_generichash_blake2b_update(&state, (const unsigned char*)I.data(), I.size());
+    crypto_generichash_blake2b_update(&state, V.begin(), V.size());
+    return state;
+}
+
+static void EquihashIsValidSolutionParams(benchmark::State& state, unsigned int n, unsigned int k)
+{
+    // Not every nonce has a solution.
+    eh_HashState eh_state;
+    std::vector<unsigned char> soln;
+    for (uint32_t nonce = 0; soln.empty(); nonce++) {
+        eh_state = EquihashBenchState(n, k, nonce);
+        EhOptimisedSolveUncancellable(n, k, eh_state, [&soln](std::vector<unsigned char> s) {
+            soln = s;
+            return true;
+        });
+    }
+    while (state.KeepRunning()) {
+        bool isValid;
+        EhIsValidSolution(n, k, eh_state, soln, isValid);
+        assert(isValid);
+    }
+}
+
+static void EquihashIsValidSolution(benchmark::State& state)
+{
+    EquihashIsValidSolutionParams(state, 96, 5);
+}
+
+static void EquihashIsValidSolutionRegtest(benchmark::State& state)
+{
+    EquihashIsValidSolutionParams(state, 48, 5);
+}
+
+static void EquihashOptimisedSolveParams(benchmark::State& state, unsigned int n, unsigned int k)
+{
+    uint32_t nonce = 0;
+    while (state.KeepRunning()) {
+        EhOptimisedSolveUncancellable(n, k, EquihashBenchState(n, k, nonce++),
+                                      [](std::vector<unsigned char> soln) { return false; });
+    }
+}
+
+static void EquihashOptimisedSolve(benchmark::State& state)
+{
+    EquihashOptimisedSolveParams(state, 96, 5);
+}
+
+static void EquihashOptimisedSolveRegtest(benchmark::State& state)
+{
+    EquihashOptimisedSolveParams(state, 48, 5);
+}
+
+static void EquihashRadixSolveParams(benchmark::State& state, unsigned int n, unsigned int k)
+{
+    EhSolverArena arena;
+    uint32_t nonce = 0;
+    while (state.KeepRunning()) {
+        EhRadixSolveUncancellable(n, k, EquihashBenchState(n, k, nonce++),
+                                  [](std::vector<unsigned char> soln) { return false; }, arena);
+    }
+}
+
+static void EquihashRadixSolve(benchmark::State& state)
+{
+    EquihashRadixSolveParams(state, 96, 5);
+}
+
+static void EquihashRadixSolveRegtest(benchmark::State& state)
+{
+    EquihashRadixSolveParams(state, 48, 5);
+}
+
+BENCHMARK(EquihashIsValidSolution);
+BENCHMARK(EquihashIsValidSolutionRegtest);
+BENCHMARK(EquihashOptimisedSolve);
+BENCHMARK(EquihashOptimisedSolveRegtest);
+BENCHMARK(EquihashRadixSolve);
+BENCHMARK(EquihashRadixSolveRegtest);
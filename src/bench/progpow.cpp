@@ -0,0 +1,165 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "primitives/block.h"
+#include "uint256.h"
+#include "util.h"
+#include "crypto/progpow/ethash-internal.hpp"
+#include "crypto/progpow/keccak.h"
+
+#include <cassert>
+#include <cstring>
+
+// The epochs of the multi-epoch variants. The light cache grows by 128 KiB
+// and the dataset by 8 MiB per epoch.
+static const int LATER_EPOCH = 100;
+
+static ethash::hash256 BenchHeaderHash()
+{
+    ethash::hash256 header_hash;
+    std::memset(header_hash.bytes, 0x42, sizeof(header_hash.bytes));
+    return header_hash;
+}
+
+static void ProgPowVerifyLightEpoch(benchmark::State& state, int epoch)
+{
+    const ethash::epoch_context_ptr context = ethash::create_epoch_context(epoch);
+    const ethash::hash256 header_hash = BenchHeaderHash();
+    ethash::hash256 boundary;
+    std::memset(boundary.bytes, 0xff, sizeof(boundary.bytes));
+    const uint64_t nonce = 0x1234;
+    const ethash::result r = ethash::progpow(*context, header_hash, nonce);
+    while (state.KeepRunning()) {
+        bool ok = ethash::verify_progpow(*context, header_hash, r.mix_hash, nonce, boundary);
+        assert(ok);
+    }
+}
+
+static void ProgPowVerifyLight(benchmark::State& state)
+{
+    ProgPowVerifyLightEpoch(state, 0);
+}
+
+static void ProgPowVerifyLightLaterEpoch(benchmark::State& state)
+{
+    ProgPowVerifyLightEpoch(state, LATER_EPOCH);
+}
+
+// Hashes with a complete dataset, which is built once on all cores the first
+// time this benchmark runs.
+static void ProgPowFull(benchmark::State& state)
+{
+    static const ethash::epoch_context_full_ptr context = [] {
+        ethash::epoch_context_full_ptr c = ethash::create_epoch_context_full(0);
+        bool ready = ethash::build_full_dataset(*c, std::max(GetNumCores(), 1));
+        assert(ready);
+        return c;
+    }();
+    const ethash::hash256 header_hash = BenchHeaderHash();
+    uint64_t nonce = 0;
+    while (state.KeepRunning()) {
+        ethash::progpow(*context, header_hash, nonce++);
+    }
+}
+
+static void CreateEpochContextLightEpoch(benchmark::State& state, int epoch)
+{
+    while (state.KeepRunning()) {
+        ethash::epoch_context_ptr context = ethash::create_epoch_context(epoch);
+        assert(context);
+    }
+}
+
+static void CreateEpochContextLight(benchmark::State& state)
+{
+    CreateEpochContextLightEpoch(state, 0);
+}
+
+static void CreateEpochContextLightLaterEpoch(benchmark::State& state)
+{
+    CreateEpochContextLightEpoch(state, LATER_EPOCH);
+}
+
+// Builds the light cache and allocates the dataset, without generating it.
+static void CreateEpochContextFullEpoch(benchmark::State& state, int epoch)
+{
+    while (state.KeepRunning()) {
+        ethash::epoch_context_full_ptr context = ethash::create_epoch_context_full(epoch);
+        assert(context);
+    }
+}
+
+static void CreateEpochContextFull(benchmark::State& state)
+{
+    CreateEpochContextFullEpoch(state, 0);
+}
+
+static void CreateEpochContextFullLaterEpoch(benchmark::State& state)
+{
+    CreateEpochContextFullEpoch(state, LATER_EPOCH);
+}
+
+static void CalculateDatasetItemProgPowEpoch(benchmark::State& state, int epoch)
+{
+    const ethash::epoch_context_ptr context = ethash::create_epoch_context(epoch);
+    const uint32_t num_items = context->full_dataset_num_items;
+    uint32_t index = 0;
+    while (state.KeepRunning()) {
+        ethash::calculate_dataset_item_progpow(*context, index);
+        index = (index + 7919) % num_items;
+    }
+}
+
+static void CalculateDatasetItemProgPow(benchmark::State& state)
+{
+    CalculateDatasetItemProgPowEpoch(state, 0);
+}
+
+static void CalculateDatasetItemProgPowLaterEpoch(benchmark::State& state)
+{
+    CalculateDatasetItemProgPowEpoch(state, LATER_EPOCH);
+}
+
+static void KeccakF800(benchmark::State& state)
+{
+    uint32_t st[25] = {0};
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 100000; i++) {
+            ethash_keccakf800(st);
+        }
+    }
+}
+
+// The hash of a header after the ProgPoW fork, with a new nonce every time so
+// that the memoized hash is not returned.
+static void BlockHeaderGetHashProgPow(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& consensus = chainParams->GetConsensus();
+    CBlockHeader header = chainParams->GenesisBlock().GetBlockHeader();
+    header.SetHeight(std::max(consensus.ProgForkHeight, 0) + 1);
+    header.SetSolution(std::vector<unsigned char>(32, 0x5a));
+    uint256 nNonce = header.GetNonce();
+    uint64_t nonce = 0;
+    while (state.KeepRunning()) {
+        WriteLE64(nNonce.begin() + 24, nonce++);
+        header.SetNonce(nNonce);
+        header.GetHash(consensus);
+    }
+}
+
+BENCHMARK(ProgPowVerifyLight);
+BENCHMARK(ProgPowVerifyLightLaterEpoch);
+BENCHMARK(ProgPowFull);
+BENCHMARK(CreateEpochContextLight);
+BENCHMARK(CreateEpochContextLightLaterEpoch);
+BENCHMARK(CreateEpochContextFull);
+BENCHMARK(CreateEpochContextFullLaterEpoch);
+BENCHMARK(CalculateDatasetItemProgPow);
+BENCHMARK(CalculateDatasetItemProgPowLaterEpoch);
+BENCHMARK(KeccakF800);
+BENCHMARK(BlockHeaderGetHashProgPow);
@@ -5,6 +5,39 @@
 
 #include "chain.h"
 
+void CBlockIndexSolution::assign(const unsigned char* pbegin, const unsigned char* pend)
+{
+    const size_t nNewSize = pend - pbegin;
+    if (nNewSize <= INLINE_SIZE) {
+        // Copy first, the source may be our own out of line storage.
+        unsigned char vNew[INLINE_SIZE];
+        std::copy(pbegin, pend, vNew);
+        clear();
+        std::copy(vNew, vNew + nNewSize, vData);
+    } else {
+        unsigned char* p = new unsigned char[nNewSize];
+        std::copy(pbegin, pend, p);
+        clear();
+        memcpy(vData, &p, sizeof(p));
+    }
+    nSize = nNewSize;
+}
+
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (nChunkUsed == CHUNK_ENTRIES) {
+        vChunks.emplace_back(new CBlockIndex[CHUNK_ENTRIES]);
+        nChunkUsed = 0;
+    }
+    return &vChunks.back()[nChunkUsed++];
+}
+
+void CBlockIndexArena::Clear()
+{
+    vChunks.clear();
+    nChunkUsed = CHUNK_ENTRIES;
+}
+
 /**
  * CChain implementation
  */
@@ -117,6 +150,14 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CBlockIndex::BuildDifficultyCache()
+{
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits);
+    nChainTarget = (pprev ? pprev->nChainTarget : 0) + bnTarget;
+    nMedianTimePast = GetMedianTimePast();
+}
+
 arith_uint256 GetBlockProof(const CBlockIndex& block)
 {
     arith_uint256 bnTarget;
@@ -12,6 +12,7 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <memory>
 #include <vector>
 #include <string.h>
 
@@ -163,6 +164,80 @@ enum BlockStatus: uint32_t {
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
 };
 
+/** The solution of a block index entry. ProgPoW solutions are a 32 byte mix
+ * hash and are stored inline, the longer Equihash solutions of the blocks
+ * before the fork are allocated out of line. Serializes like a byte vector.
+ */
+class CBlockIndexSolution
+{
+private:
+    static const size_t INLINE_SIZE = 32;
+
+    uint32_t nSize;
+    //! The solution if it fits, otherwise a pointer to its out of line copy
+    unsigned char vData[INLINE_SIZE];
+
+    bool IsInline() const { return nSize <= INLINE_SIZE; }
+
+    unsigned char* GetOutOfLine() const
+    {
+        unsigned char* p;
+        memcpy(&p, vData, sizeof(p));
+        return p;
+    }
+
+    static_assert(sizeof(unsigned char*) <= INLINE_SIZE, "the pointer must fit the inline storage");
+
+public:
+    CBlockIndexSolution() : nSize(0) {}
+    CBlockIndexSolution(const CBlockIndexSolution& other) : nSize(0) { assign(other.begin(), other.end()); }
+    ~CBlockIndexSolution() { clear(); }
+
+    CBlockIndexSolution& operator=(const CBlockIndexSolution& other)
+    {
+        if (this != &other)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+
+    CBlockIndexSolution& operator=(const std::vector<unsigned char>& vch)
+    {
+        assign(vch.data(), vch.data() + vch.size());
+        return *this;
+    }
+
+    void assign(const unsigned char* pbegin, const unsigned char* pend);
+
+    void clear()
+    {
+        if (!IsInline())
+            delete[] GetOutOfLine();
+        nSize = 0;
+    }
+
+    const unsigned char* data() const { return IsInline() ? vData : GetOutOfLine(); }
+    const unsigned char* begin() const { return data(); }
+    const unsigned char* end() const { return data() + nSize; }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        WriteCompactSize(s, nSize);
+        if (nSize)
+            s.write((const char*)data(), nSize);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        std::vector<unsigned char> vch;
+        s >> vch;
+        *this = vch;
+    }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -207,21 +282,28 @@ public:
     //! Verification status of this block. See enum BlockStatus
     unsigned int nStatus;
 
-    //! block header
-    int nVersion;
-    uint256 hashMerkleRoot;
-    uint32_t nReserved[7];
-    unsigned int nTime;
-    unsigned int nBits;
-    uint256 nNonce;
-    std::vector<unsigned char> nSolution;
-
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     int32_t nSequenceId;
 
     //! (memory only) Maximum nTime in the chain upto and including this block.
     unsigned int nTimeMax;
 
+    //! (memory only) Sum of the targets of the blocks in the chain up to and including this block, modulo 2^256.
+    //! The target sum of a difficulty averaging window is the difference of two entries.
+    arith_uint256 nChainTarget;
+
+    //! (memory only) GetMedianTimePast() of this block, 0 until BuildDifficultyCache() was called
+    int64_t nMedianTimePast;
+
+    //! block header
+    int nVersion;
+    unsigned int nTime;
+    unsigned int nBits;
+    uint256 hashMerkleRoot;
+    uint32_t nReserved[7];
+    uint256 nNonce;
+    CBlockIndexSolution nSolution;
+
     void SetNull()
     {
         phashBlock = nullptr;
@@ -237,6 +319,8 @@ public:
         nStatus = 0;
         nSequenceId = 0;
         nTimeMax = 0;
+        nChainTarget = arith_uint256();
+        nMedianTimePast = 0;
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
@@ -256,15 +340,15 @@ public:
     {
         SetNull();
 
-        nVersion       = block.nVersion;
-        hashMerkleRoot = block.hashMerkleRoot;
+        nVersion       = block.GetVersion();
+        hashMerkleRoot = block.GetMerkleRoot();
         // TODO(h4x3rotab): Copy nHeight or not?
-        nHeight        = block.nHeight;
-        memcpy(nReserved, block.nReserved, sizeof(nReserved));
-        nTime          = block.nTime;
-        nBits          = block.nBits;
-        nNonce         = block.nNonce;
-        nSolution      = block.nSolution;
+        nHeight        = block.GetHeight();
+        memcpy(nReserved, block.GetReserved(), sizeof(nReserved));
+        nTime          = block.GetTime();
+        nBits          = block.GetBits();
+        nNonce         = block.GetNonce();
+        nSolution      = block.GetSolution();
     }
 
     CDiskBlockPos GetBlockPos() const {
@@ -288,16 +372,16 @@ public:
     CBlockHeader GetBlockHeader() const
     {
         CBlockHeader block;
-        block.nVersion       = nVersion;
+        block.SetVersion(nVersion);
         if (pprev)
-            block.hashPrevBlock = pprev->GetBlockHash();
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nHeight        = nHeight;
-        memcpy(block.nReserved, nReserved, sizeof(block.nReserved));
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
+            block.SetPrevBlockHash(pprev->GetBlockHash());
+        block.SetMerkleRoot(hashMerkleRoot);
+        block.SetHeight(nHeight);
+        block.SetReserved(nReserved);
+        block.SetTime(nTime);
+        block.SetBits(nBits);
+        block.SetNonce(nNonce);
+        block.SetSolution(std::vector<unsigned char>(nSolution.begin(), nSolution.end()));
         return block;
     }
 
@@ -366,6 +450,12 @@ public:
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
 
+    //! Compute nChainTarget and nMedianTimePast, once those of the predecessor are known.
+    void BuildDifficultyCache();
+
+    //! Whether BuildDifficultyCache() was called on this entry.
+    bool HasDifficultyCache() const { return nMedianTimePast != 0; }
+
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
@@ -426,15 +516,15 @@ public:
     uint256 GetBlockHash() const
     {
         CBlockHeader block;
-        block.nVersion        = nVersion;
-        block.hashPrevBlock   = hashPrev;
-        block.hashMerkleRoot  = hashMerkleRoot;
-        block.nHeight         = nHeight;
-        memcpy(block.nReserved, nReserved, sizeof(block.nReserved));
-        block.nTime           = nTime;
-        block.nBits           = nBits;
-        block.nNonce          = nNonce;
-        block.nSolution       = nSolution;
+        block.SetVersion(nVersion);
+        block.SetPrevBlockHash(hashPrev);
+        block.SetMerkleRoot(hashMerkleRoot);
+        block.SetHeight(nHeight);
+        block.SetReserved(nReserved);
+        block.SetTime(nTime);
+        block.SetBits(nBits);
+        block.SetNonce(nNonce);
+        block.SetSolution(std::vector<unsigned char>(nSolution.begin(), nSolution.end()));
         return block.GetHash();
     }
 
@@ -450,6 +540,32 @@ public:
     }
 };
 
+/** Allocates block index entries in large chunks, so that the entries are
+ * contiguous in memory and do not pay for a heap allocation each. Entries
+ * are only released all at once by Clear().
+ */
+class CBlockIndexArena
+{
+private:
+    static const size_t CHUNK_ENTRIES = 4096;
+
+    std::vector<std::unique_ptr<CBlockIndex[]>> vChunks;
+    //! Number of entries handed out from the last chunk
+    size_t nChunkUsed;
+
+public:
+    CBlockIndexArena() : nChunkUsed(CHUNK_ENTRIES) {}
+
+    CBlockIndexArena(const CBlockIndexArena&) = delete;
+    CBlockIndexArena& operator=(const CBlockIndexArena&) = delete;
+
+    /** Returns a new null entry, owned by the arena */
+    CBlockIndex* Allocate();
+
+    /** Releases all entries */
+    void Clear();
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
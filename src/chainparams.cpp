@@ -38,15 +38,15 @@ static CBlock CreateGenesisBlock(const char* pszTimestamp, const CScript& genesi
     txNew.vout[0].scriptPubKey = genesisOutputScript;
 
     CBlock genesis;
-    genesis.nTime    = nTime;
-    genesis.nBits    = nBits;
-    genesis.nNonce   = nNonce;
-    genesis.nVersion = nVersion;
+    genesis.SetTime(nTime);
+    genesis.SetBits(nBits);
+    genesis.SetNonce(nNonce);
+    genesis.SetVersion(nVersion);
     genesis.vtx.push_back(MakeTransactionRef(std::move(txNew)));
-    genesis.hashPrevBlock.SetNull();
-    genesis.nHeight  = 0;
-    genesis.nSolution = nSolution;
-    genesis.hashMerkleRoot = BlockMerkleRoot(genesis);
+    genesis.SetPrevBlockHash(uint256());
+    genesis.SetHeight(0);
+    genesis.SetSolution(nSolution);
+    genesis.SetMerkleRoot(BlockMerkleRoot(genesis));
     return genesis;
 }
 
@@ -75,6 +75,11 @@ void CChainParams::UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64
     consensus.vDeployments[d].nTimeout = nTimeout;
 }
 
+void CChainParams::UpdateAssumeutxo(int nHeight, const AssumeutxoData& data)
+{
+    mapAssumeutxo[nHeight] = data;
+}
+
 /**
  * Main network
  */
@@ -183,7 +188,7 @@ public:
         //std::cout << "genesis.hashMerkleRoot     " << genesis.hashMerkleRoot.GetHex().c_str() << " <<\n";
 
         assert(consensus.hashGenesisBlock == uint256S("00000d74c4f0d40f1bc6c269081440297f72939b13faaec052023e3899f59078"));
-        assert(genesis.hashMerkleRoot == uint256S("41c651eff815a1d1d12b0267ea8515b3587ea9267a7ee8878bc588aab4fb4ae1"));
+        assert(genesis.GetMerkleRoot() == uint256S("41c651eff815a1d1d12b0267ea8515b3587ea9267a7ee8878bc588aab4fb4ae1"));
 
 
         vFixedSeeds.clear();
@@ -219,6 +224,10 @@ public:
                 3.1         // * estimated number of transactions per second after that timestamp
 
         };
+
+        mapAssumeutxo = MapAssumeutxo{
+            // {height, {block hash, muhash, chain tx count}}
+        };
     }
 };
 
@@ -314,7 +323,7 @@ public:
         //std::cout << "genesis.hashMerkleRoot     " << genesis.hashMerkleRoot.GetHex().c_str() << " <<\n";
        
         assert(consensus.hashGenesisBlock == uint256S("0x00002057b3b31636c2b061faf2bab4b49f7eb13a7d01bfbae978f0e33e3b7a07"));
-        assert(genesis.hashMerkleRoot == uint256S("0xb917ca598bd6459676df61884f8cba97c03263c32f81cc57b27ceab2cdeb988f"));
+        assert(genesis.GetMerkleRoot() == uint256S("0xb917ca598bd6459676df61884f8cba97c03263c32f81cc57b27ceab2cdeb988f"));
 
         vFixedSeeds.clear();
         vSeeds.clear();
@@ -424,7 +433,7 @@ public:
         consensus.hashGenesisBlock = genesis.GetHash(consensus);
         
         assert(consensus.hashGenesisBlock == uint256S("0x0000000013f165e067d2a68f758d3aab1cc55ca8ee52af1ad26ebec76a4842cb"));
-        assert(genesis.hashMerkleRoot == uint256S("0x2769af5d0f7b8847433d17a064e4c8f82a3e4d7e26e98748177c3725c1ca063f"));
+        assert(genesis.GetMerkleRoot() == uint256S("0x2769af5d0f7b8847433d17a064e4c8f82a3e4d7e26e98748177c3725c1ca063f"));
 
         vFixedSeeds.clear(); //!< Regtest mode doesn't have any fixed seeds.
         vSeeds.clear();      //!< Regtest mode doesn't have any DNS seeds.
@@ -445,6 +454,12 @@ public:
             0
         };
 
+        // The chains of the tests are mined as they run, so their snapshots
+        // are committed with -assumeutxo.
+        mapAssumeutxo = MapAssumeutxo{
+            // {height, {block hash, muhash, chain tx count}}
+        };
+
         base58Prefixes[PUBKEY_ADDRESS] = std::vector<unsigned char>(1,111);
         base58Prefixes[SCRIPT_ADDRESS] = std::vector<unsigned char>(1,196);
         base58Prefixes[SECRET_KEY] =     std::vector<unsigned char>(1,239);
@@ -500,4 +515,9 @@ void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime,
     globalChainParams->UpdateVersionBitsParameters(d, nStartTime, nTimeout);
 }
 
+void UpdateAssumeutxo(int nHeight, const AssumeutxoData& data)
+{
+    globalChainParams->UpdateAssumeutxo(nHeight, data);
+}
+
 
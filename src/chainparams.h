@@ -11,6 +11,7 @@
 #include "primitives/block.h"
 #include "protocol.h"
 
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -37,6 +38,17 @@ struct ChainTxData {
     double dTxRate;
 };
 
+/** The UTXO set at a block, which a snapshot made by dumptxoutset must match to be loaded */
+struct AssumeutxoData {
+    uint256 hashBlock;
+    //! The MuHash of the coins at the block, as returned by dumptxoutset
+    uint256 hashMuHash;
+    //! The number of transactions up to and including the block
+    unsigned int nChainTx;
+};
+
+typedef std::map<int, AssumeutxoData> MapAssumeutxo;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -79,7 +91,10 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    /** The UTXO set snapshots which can be loaded, by height */
+    const MapAssumeutxo& Assumeutxo() const { return mapAssumeutxo; }
     void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
+    void UpdateAssumeutxo(int nHeight, const AssumeutxoData& data);
 
 protected:
     CChainParams() {}
@@ -102,6 +117,7 @@ protected:
     bool fMineBlocksOnDemand;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapAssumeutxo mapAssumeutxo;
 };
 
 /**
@@ -134,4 +150,9 @@ void SelectParams(const std::string& chain);
  */
 void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 
+/**
+ * Allows adding a UTXO set snapshot commitment on regtest.
+ */
+void UpdateAssumeutxo(int nHeight, const AssumeutxoData& data);
+
 #endif // BITCOIN_CHAINPARAMS_H
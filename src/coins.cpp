@@ -14,6 +14,7 @@ bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return f
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWritePartial(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return 0; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -29,6 +30,7 @@ uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWritePartial(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWritePartial(mapCoins, hashBlock); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
@@ -37,7 +39,7 @@ SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<ui
 CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage + (dirtyCoins.size() + writingCoins.size()) * sizeof(COutPoint);
 }
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
@@ -82,6 +84,8 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
         }
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
+    if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+        dirtyCoins.push_back(outpoint);
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
@@ -108,6 +112,8 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     if (it->second.flags & CCoinsCacheEntry::FRESH) {
         cacheCoins.erase(it);
     } else {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+            dirtyCoins.push_back(outpoint);
         it->second.flags |= CCoinsCacheEntry::DIRTY;
         it->second.coin.Clear();
     }
@@ -164,6 +170,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // and already exist in the grandparent
                     if (it->second.flags & CCoinsCacheEntry::FRESH)
                         entry.flags |= CCoinsCacheEntry::FRESH;
+                    dirtyCoins.push_back(it->first);
                 }
             } else {
                 // Assert that the child cache entry was not marked FRESH if the
@@ -182,6 +189,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    if (!(itUs->second.flags & CCoinsCacheEntry::DIRTY))
+                        dirtyCoins.push_back(it->first);
                     cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                     itUs->second.coin = std::move(it->second.coin);
                     cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
@@ -201,13 +210,90 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
     return true;
 }
 
+bool CCoinsViewCache::BatchWritePartial(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+    // A cache has no durable state to keep marked as in transition.
+    return BatchWrite(mapCoins, hashBlockIn);
+}
+
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
-    cacheCoins.clear();
+    // Swap in a new map to release the pool of the old one, clear() would
+    // keep its chunks.
+    CCoinsMap().swap(cacheCoins);
     cachedCoinsUsage = 0;
+    dirtyCoins.clear();
+    writingCoins.clear();
     return fOk;
 }
 
+bool CCoinsViewCache::WriteDirty(size_t nMaxCoins) {
+    CCoinsMap mapWrite;
+    const bool fFinal = GetDirty(nMaxCoins, mapWrite);
+    const CCoinsMap mapWritten(mapWrite);
+
+    // The last part also marks the base as consistent with our best block.
+    const uint256 hashBlockWrite = GetBestBlock();
+    const bool fOk = fFinal ? base->BatchWrite(mapWrite, hashBlockWrite) : base->BatchWritePartial(mapWrite, hashBlockWrite);
+    if (!fOk)
+        return false;
+    MarkWritten(mapWritten, true);
+    return true;
+}
+
+bool CCoinsViewCache::GetDirty(size_t nMaxCoins, CCoinsMap& mapWrite) {
+    // The coins of a write not marked yet may have changed after their copy.
+    dirtyCoins.insert(dirtyCoins.begin(), writingCoins.begin(), writingCoins.end());
+    writingCoins.clear();
+    while (!dirtyCoins.empty() && mapWrite.size() < nMaxCoins) {
+        CCoinsMap::iterator it = cacheCoins.find(dirtyCoins.front());
+        dirtyCoins.pop_front();
+        if (it == cacheCoins.end() || !(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        CCoinsCacheEntry& entry = mapWrite[it->first];
+        if (entry.flags & CCoinsCacheEntry::DIRTY)
+            continue; // Listed twice in this batch.
+        entry.coin = it->second.coin;
+        entry.flags = CCoinsCacheEntry::DIRTY;
+        // Spending it before MarkWritten() must reach the base.
+        it->second.flags &= ~CCoinsCacheEntry::FRESH;
+        writingCoins.push_back(it->first);
+    }
+    return dirtyCoins.empty();
+}
+
+static bool SameCoin(const Coin& a, const Coin& b) {
+    return a.out == b.out && a.fCoinBase == b.fCoinBase && a.nHeight == b.nHeight;
+}
+
+void CCoinsViewCache::MarkWritten(const CCoinsMap& mapWritten, bool fBaseUnchanged) {
+    writingCoins.clear();
+    for (const auto& written : mapWritten) {
+        CCoinsMap::iterator it = cacheCoins.find(written.first);
+        if (it == cacheCoins.end() || !(it->second.flags & CCoinsCacheEntry::DIRTY))
+            continue;
+        if (!fBaseUnchanged || !SameCoin(it->second.coin, written.second.coin)) {
+            dirtyCoins.push_back(written.first);
+        } else if (it->second.coin.IsSpent()) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            cacheCoins.erase(it);
+        } else {
+            it->second.flags = 0;
+        }
+    }
+}
+
+void CCoinsViewCache::EvictClean(size_t nTargetUsage) {
+    CCoinsMap::iterator it = cacheCoins.begin();
+    while (it != cacheCoins.end() && DynamicMemoryUsage() > nTargetUsage) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            ++it;
+            continue;
+        }
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        it = cacheCoins.erase(it);
+    }
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -217,6 +303,15 @@ void CCoinsViewCache::Uncache(const COutPoint& hash)
     }
 }
 
+bool CCoinsViewCache::AddFetchedCoin(const COutPoint &outpoint, Coin&& coin) {
+    assert(!coin.IsSpent());
+    std::pair<CCoinsMap::iterator, bool> inserted = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(coin)));
+    if (!inserted.second)
+        return false;
+    cachedCoinsUsage += inserted.first->second.coin.DynamicMemoryUsage();
+    return true;
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -12,11 +12,14 @@
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
 #include <stdint.h>
 
+#include <deque>
+
 #include <unordered_map>
 
 /**
@@ -85,7 +88,7 @@ class SaltedOutpointHasher
 {
 private:
     /** Salt */
-    const uint64_t k0, k1;
+    uint64_t k0, k1;
 
 public:
     SaltedOutpointHasher();
@@ -119,7 +122,11 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+/** The coins cache map. Its nodes are allocated from a pool owned by the map,
+ *  which packs them without malloc overhead and is released all at once when
+ *  the map is replaced by an empty one. */
+typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher, std::equal_to<COutPoint>,
+                           PoolAllocator<std::pair<const COutPoint, CCoinsCacheEntry> > > CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -167,6 +174,11 @@ public:
     //! The passed mapCoins can be modified.
     virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
 
+    //! Do a bulk modification with a part of the Coin changes up to hashBlock.
+    //! The view stays in transition to hashBlock (see GetHeadBlocks) until
+    //! the rest is written by a BatchWrite. Returns false if not supported.
+    virtual bool BatchWritePartial(CCoinsMap &mapCoins, const uint256 &hashBlock);
+
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
 
@@ -192,6 +204,7 @@ public:
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWritePartial(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -211,6 +224,13 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* The outpoints of the entries which became DIRTY, in order. An entry
+     * may be listed more than once, or not be DIRTY anymore. */
+    std::deque<COutPoint> dirtyCoins;
+
+    /* The outpoints taken from dirtyCoins by GetDirty() until MarkWritten(). */
+    std::vector<COutPoint> writingCoins;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -220,6 +240,7 @@ public:
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWritePartial(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -263,12 +284,56 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push up to nMaxCoins modified coins to the base, in the order they were
+     * modified, keeping them in this cache as unmodified. Until all of them
+     * are written, the base is left in transition to the best block of this
+     * cache. If false is returned, the state of this cache (and its backing
+     * view) will be undefined.
+     */
+    bool WriteDirty(size_t nMaxCoins);
+
+    /**
+     * Copy up to nMaxCoins modified coins to mapWrite, in the order they were
+     * modified, for the caller to write them to the base while this cache is
+     * in use. They stay modified until MarkWritten(), but are not FRESH
+     * anymore as the base may have them from then on, and are copied again
+     * by a GetDirty() call before it. Returns whether no other modified
+     * coins remain.
+     */
+    bool GetDirty(size_t nMaxCoins, CCoinsMap& mapWrite);
+
+    /**
+     * Mark the coins of mapWritten, copied by GetDirty() and written to the
+     * base, as unmodified unless they changed since. If fBaseUnchanged is
+     * false, the base was written by others in between, and the coins still
+     * modified are only listed again for a later write.
+     */
+    void MarkWritten(const CCoinsMap& mapWritten, bool fBaseUnchanged);
+
+    //! Whether WriteDirty may have coins left to write
+    bool HasDirtyCoins() const { return !dirtyCoins.empty() || !writingCoins.empty(); }
+
+    /**
+     * Remove unmodified coins from the cache, in no particular order, until
+     * its memory usage is at most nTargetUsage or only modified ones remain.
+     */
+    void EvictClean(size_t nTargetUsage);
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
      */
     void Uncache(const COutPoint &outpoint);
 
+    /**
+     * Add an unspent coin read from the backing view beforehand, unless the
+     * outpoint is already cached. The caller must ensure that the backing
+     * view has not been modified since the coin was read.
+     * Returns whether the coin was added.
+     */
+    bool AddFetchedCoin(const COutPoint &outpoint, Coin&& coin);
+
     //! Calculate the size of the cache (in number of transaction outputs)
     unsigned int GetCacheSize() const;
 
@@ -0,0 +1,167 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinsprefetch.h"
+
+#include "txdb.h"
+#include "util.h"
+
+#include <set>
+
+namespace {
+/** Number of outpoints read by a thread at a time */
+const size_t PREFETCH_CHUNK_SIZE = 64;
+/** Coins kept aside at most until the next Apply(), the others are dropped */
+const size_t MAX_PREFETCHED_COINS = 1 << 18;
+/** Number of queued blocks remembered to skip queueing them again */
+const size_t MAX_RECENT_BLOCKS = 64;
+}
+
+CCoinsPrefetcher::CCoinsPrefetcher(const CCoinsViewDB& dbIn, int nThreads) : db(dbIn), fStop(false)
+{
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back([this] { TraceThread("prefetch", [this] { ThreadPrefetch(); }); });
+    }
+}
+
+CCoinsPrefetcher::~CCoinsPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fStop = true;
+    }
+    cond.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+bool CCoinsPrefetcher::IsRecent(const uint256& hash)
+{
+    for (const uint256& recent : vRecent) {
+        if (recent == hash)
+            return true;
+    }
+    vRecent.push_back(hash);
+    if (vRecent.size() > MAX_RECENT_BLOCKS)
+        vRecent.pop_front();
+    return false;
+}
+
+void CCoinsPrefetcher::Prefetch(const std::shared_ptr<const CBlock>& pblock)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (threads.empty() || IsRecent(pblock->GetHash()))
+            return;
+        Task task;
+        task.pblock = pblock;
+        queue.push_back(std::move(task));
+    }
+    cond.notify_one();
+}
+
+size_t CCoinsPrefetcher::Apply(CCoinsViewCache& cache)
+{
+    std::vector<Fetched> vApply;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        vApply.swap(vFetched);
+    }
+
+    // Coins read before or during a write of the database may have been
+    // modified by it, and were possibly evicted from the cache since.
+    const uint64_t nWriteSequence = db.GetWriteSequence();
+    size_t nAdded = 0;
+    for (Fetched& fetched : vApply) {
+        if (fetched.nWriteSequence == nWriteSequence && cache.AddFetchedCoin(fetched.outpoint, std::move(fetched.coin)))
+            nAdded++;
+    }
+    if (!vApply.empty())
+        LogPrint(BCLog::COINDB, "Prefetched %u coins, %u of them new to the cache\n", vApply.size(), nAdded);
+    return nAdded;
+}
+
+void CCoinsPrefetcher::QueueInputs(const CBlock& block)
+{
+    // The coins created by the block itself are not in the database yet.
+    std::set<uint256> setTxids;
+    for (const CTransactionRef& tx : block.vtx) {
+        setTxids.insert(tx->GetHash());
+    }
+
+    std::vector<Task> vTasks;
+    Task task;
+    for (const CTransactionRef& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (setTxids.count(txin.prevout.hash))
+                continue;
+            task.vOutPoints.push_back(txin.prevout);
+            if (task.vOutPoints.size() == PREFETCH_CHUNK_SIZE) {
+                vTasks.push_back(std::move(task));
+                task = Task();
+            }
+        }
+    }
+    if (!task.vOutPoints.empty())
+        vTasks.push_back(std::move(task));
+    if (vTasks.empty())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Task& chunk : vTasks) {
+            queue.push_back(std::move(chunk));
+        }
+    }
+    cond.notify_all();
+}
+
+void CCoinsPrefetcher::ReadCoins(const std::vector<COutPoint>& vOutPoints)
+{
+    const uint64_t nWriteSequence = db.GetWriteSequence();
+    if (nWriteSequence % 2)
+        return;
+
+    std::vector<Fetched> vRead;
+    vRead.reserve(vOutPoints.size());
+    for (const COutPoint& outpoint : vOutPoints) {
+        Fetched fetched;
+        if (db.GetCoin(outpoint, fetched.coin)) {
+            fetched.outpoint = outpoint;
+            fetched.nWriteSequence = nWriteSequence;
+            vRead.push_back(std::move(fetched));
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Fetched& fetched : vRead) {
+        if (vFetched.size() >= MAX_PREFETCHED_COINS)
+            break;
+        vFetched.push_back(std::move(fetched));
+    }
+}
+
+void CCoinsPrefetcher::ThreadPrefetch()
+{
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return fStop || !queue.empty(); });
+            if (fStop)
+                return;
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        if (!task.vOutPoints.empty()) {
+            ReadCoins(task.vOutPoints);
+        } else {
+            QueueInputs(*task.pblock);
+        }
+    }
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include "coins.h"
+#include "primitives/block.h"
+#include "uint256.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class CCoinsViewDB;
+
+/** Default for -prefetchthreads, the threads reading coins ahead of ConnectBlock */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of threads reading coins ahead of ConnectBlock */
+static const int MAX_PREFETCH_THREADS = 16;
+/** Number of blocks after the one being connected whose coins are prefetched */
+static const int PREFETCH_BLOCKS_AHEAD = 2;
+
+/**
+ * Reads the coins spent by upcoming blocks from the coin database on a pool
+ * of threads, so that connecting the blocks finds them in the coins cache
+ * instead of reading them one by one.
+ *
+ * The reads do not take cs_main. The coins read are kept aside, and moved to
+ * the coins cache by Apply() before a block is connected, unless the database
+ * was written in the meantime.
+ */
+class CCoinsPrefetcher
+{
+public:
+    CCoinsPrefetcher(const CCoinsViewDB& dbIn, int nThreads);
+    ~CCoinsPrefetcher();
+
+    /** Read the coins spent by a block, except those it creates itself */
+    void Prefetch(const std::shared_ptr<const CBlock>& pblock);
+
+    /** Move the coins read so far to the cache, which must be backed by the
+     *  coin database without modifications in between. Requires cs_main.
+     *  Returns the number of coins added. */
+    size_t Apply(CCoinsViewCache& cache);
+
+private:
+    /** A block to read the inputs of, or a part of the inputs of a block */
+    struct Task {
+        std::shared_ptr<const CBlock> pblock;
+        std::vector<COutPoint> vOutPoints;
+    };
+
+    /** A coin read, with the write sequence number of the database before the read */
+    struct Fetched {
+        COutPoint outpoint;
+        Coin coin;
+        uint64_t nWriteSequence;
+    };
+
+    const CCoinsViewDB& db;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Task> queue;
+    std::vector<Fetched> vFetched;
+    //! The most recently queued blocks, to queue each one once
+    std::deque<uint256> vRecent;
+    bool fStop;
+    std::vector<std::thread> threads;
+
+    bool IsRecent(const uint256& hash);
+    void ThreadPrefetch();
+    void ReadCoins(const std::vector<COutPoint>& vOutPoints);
+    void QueueInputs(const CBlock& block);
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
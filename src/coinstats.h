@@ -0,0 +1,128 @@
+// Copyright (c) 2010 Satoshi Nakamoto
+// Copyright (c) 2009-2016 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include "amount.h"
+#include "coins.h"
+#include "crypto/muhash.h"
+#include "hash.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <map>
+#include <stdint.h>
+
+class CCoinsView;
+
+/** Version of the UTXO set snapshots written by dumptxoutset */
+static const int32_t SNAPSHOT_VERSION = 1;
+/** Number of coins in each checksummed chunk of a snapshot */
+static const uint32_t SNAPSHOT_CHUNK_COINS = 50000;
+
+/**
+ * Start of a UTXO set snapshot, after the network magic. It is followed by
+ * the block headers from height 1 to the base block, then by the coins in
+ * the order of the coin database, in chunks: the number of coins, the coins
+ * and the hash of their serialization. An empty chunk ends the snapshot.
+ */
+struct SnapshotMetadata
+{
+    int32_t nVersion;
+    uint256 hashBaseBlock;
+    int32_t nHeight;
+
+    SnapshotMetadata() : nVersion(SNAPSHOT_VERSION), nHeight(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nVersion);
+        READWRITE(hashBaseBlock);
+        READWRITE(nHeight);
+    }
+};
+
+struct CCoinsStats
+{
+    int nHeight;
+    uint256 hashBlock;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    uint256 hashSerialized;
+    uint64_t nDiskSize;
+    CAmount nTotalAmount;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
+};
+
+/**
+ * Accumulates the statistics and the serialized hash of a set of coins,
+ * given in the order of the coin database, so that the outputs of each
+ * transaction are consecutive.
+ */
+class CCoinsStatsBuilder
+{
+public:
+    //! Start the statistics of the coins at stats.hashBlock
+    explicit CCoinsStatsBuilder(CCoinsStats& statsIn);
+
+    void Add(const COutPoint& outpoint, const Coin& coin);
+
+    //! Account for the last transaction and set stats.hashSerialized
+    void Finish();
+
+private:
+    CCoinsStats& stats;
+    CHashWriter ss;
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
+
+    void ApplyStats();
+};
+
+/**
+ * Running statistics of the unspent transaction output set, kept in the block
+ * tree database for each block connected with -coinstatsindex. Unlike
+ * hash_serialized_2, the MuHash of the coins does not depend on their order,
+ * so the entry of a block follows from the one of its parent and the coins it
+ * creates and spends.
+ */
+struct CBlockCoinsStats
+{
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CBlockCoinsStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void Add(const COutPoint& outpoint, const Coin& coin);
+    void Remove(const COutPoint& outpoint, const Coin& coin);
+
+    //! Finalize a copy of the MuHash, which takes a modular inversion
+    uint256 GetMuHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(VARINT(nTransactionOutputs));
+        READWRITE(VARINT(nBogoSize));
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+//! Calculate statistics about the unspent transaction output set
+bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats);
+
+//! Calculate the running statistics of the unspent transaction output set from scratch
+bool GetBlockCoinsStats(CCoinsView *view, CBlockCoinsStats &stats);
+
+#endif // BITCOIN_COINSTATS_H
@@ -721,8 +721,205 @@ invalidsolution:
     return false;
 }
 
+// Sorts the first nRows rows of width rowWidth by their first keyLen bytes,
+// leaving the sorted row numbers in arena.vOrder[0]. This is an LSD radix sort,
+// one stable counting pass per key byte.
+static void RadixSortRows(EhSolverArena& arena, const unsigned char* rows, size_t nRows,
+                          size_t rowWidth, size_t keyLen)
+{
+    assert(keyLen <= sizeof(uint64_t));
+    for (int b = 0; b < 2; b++) {
+        if (arena.vKeys[b].size() < nRows) arena.vKeys[b].resize(nRows);
+        if (arena.vOrder[b].size() < nRows) arena.vOrder[b].resize(nRows);
+    }
+
+    // Keys are read big-endian so that integer order is memcmp order.
+    uint64_t* keys = arena.vKeys[0].data();
+    uint32_t* order = arena.vOrder[0].data();
+    for (size_t i = 0; i < nRows; i++) {
+        uint64_t key = 0;
+        for (size_t j = 0; j < keyLen; j++) {
+            key = (key << 8) | rows[i*rowWidth + j];
+        }
+        keys[i] = key;
+        order[i] = i;
+    }
+
+    for (size_t pass = 0; pass < keyLen; pass++) {
+        const unsigned int shift = 8*pass;
+        size_t count[256] = {0};
+        for (size_t i = 0; i < nRows; i++) {
+            count[(arena.vKeys[0][i] >> shift) & 0xFF]++;
+        }
+        size_t pos = 0;
+        for (size_t d = 0; d < 256; d++) {
+            size_t c = count[d];
+            count[d] = pos;
+            pos += c;
+        }
+        for (size_t i = 0; i < nRows; i++) {
+            size_t p = count[(arena.vKeys[0][i] >> shift) & 0xFF]++;
+            arena.vKeys[1][p] = arena.vKeys[0][i];
+            arena.vOrder[1][p] = arena.vOrder[0][i];
+        }
+        arena.vKeys[0].swap(arena.vKeys[1]);
+        arena.vOrder[0].swap(arena.vOrder[1]);
+    }
+}
+
+// Checks if the intersection of the indices of two rows is empty
+static bool DistinctRowIndices(const unsigned char* a, const unsigned char* b, size_t len, size_t lenIndices)
+{
+    for (size_t i = 0; i < lenIndices; i += sizeof(eh_index)) {
+        for (size_t j = 0; j < lenIndices; j += sizeof(eh_index)) {
+            if (memcmp(a+len+i, b+len+j, sizeof(eh_index)) == 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Writes the row X_a ^ X_b with the first trim bytes dropped, followed by the
+// indices of a and b in order, like the merging FullStepRow constructor.
+static void MergeRows(unsigned char* out, const unsigned char* a, const unsigned char* b,
+                      size_t len, size_t lenIndices, size_t trim)
+{
+    for (size_t i = trim; i < len; i++)
+        out[i-trim] = a[i] ^ b[i];
+    if (memcmp(a+len, b+len, lenIndices) < 0) {
+        memcpy(out+len-trim, a+len, lenIndices);
+        memcpy(out+len-trim+lenIndices, b+len, lenIndices);
+    } else {
+        memcpy(out+len-trim, b+len, lenIndices);
+        memcpy(out+len-trim+lenIndices, a+len, lenIndices);
+    }
+}
+
+template<unsigned int N, unsigned int K>
+bool Equihash<N,K>::RadixSolve(const eh_HashState& base_state,
+                               const std::function<bool(std::vector<unsigned char>)> validBlock,
+                               const std::function<bool(EhSolverCancelCheck)> cancelled,
+                               EhSolverArena& arena)
+{
+    // This finds the same tuples as BasicSolve: every round still collides all
+    // pairs of rows that share the next CollisionByteLength bytes. Only the order
+    // in which solutions are passed to validBlock may differ.
+    const size_t init_size { size_t{1} << (CollisionBitLength + 1) };
+    const size_t rowWidth { FullWidth };
+
+    // 1) Generate first list
+    LogPrint(BCLog::POW, "Generating first list\n");
+    size_t hashLen = HashLength;
+    size_t lenIndices = sizeof(eh_index);
+    std::vector<unsigned char>* X = &arena.vRows[0];
+    std::vector<unsigned char>* Xc = &arena.vRows[1];
+    if (X->size() < init_size*rowWidth) X->resize(init_size*rowWidth);
+    size_t nRows = 0;
+    unsigned char tmpHash[HashOutput];
+    for (eh_index g = 0; nRows < init_size; g++) {
+        GenerateHash(base_state, g, tmpHash, HashOutput);
+        for (eh_index i = 0; i < IndicesPerHashOutput && nRows < init_size; i++) {
+            unsigned char* row = X->data() + nRows*rowWidth;
+            ExpandArray(tmpHash+(i*N/8), N/8, row, HashLength, CollisionBitLength);
+            EhIndexToArray((g*IndicesPerHashOutput)+i, row+HashLength);
+            nRows++;
+        }
+        if (cancelled(ListGeneration)) throw solver_cancelled;
+    }
+
+    // 3) Repeat step 2 until 2n/(k+1) bits remain
+    for (int r = 1; r < K && nRows > 0; r++) {
+        LogPrint(BCLog::POW, "Round %d:\n", r);
+        // 2a) Sort the list
+        LogPrint(BCLog::POW, "- Sorting list\n");
+        RadixSortRows(arena, X->data(), nRows, rowWidth, CollisionByteLength);
+        if (cancelled(ListSorting)) throw solver_cancelled;
+
+        LogPrint(BCLog::POW, "- Finding collisions\n");
+        const uint64_t* keys = arena.vKeys[0].data();
+        const uint32_t* order = arena.vOrder[0].data();
+        size_t nNext = 0;
+        size_t i = 0;
+        while (i < nRows) {
+            // 2b) Find next set of unordered pairs with collisions on the next n/(k+1) bits
+            size_t j = 1;
+            while (i+j < nRows && keys[i+j] == keys[i]) {
+                j++;
+            }
+
+            // 2c) Calculate tuples (X_i ^ X_j, (i, j)) into the other list
+            for (size_t l = 0; l + 1 < j; l++) {
+                const unsigned char* a = X->data() + order[i+l]*rowWidth;
+                for (size_t m = l + 1; m < j; m++) {
+                    const unsigned char* b = X->data() + order[i+m]*rowWidth;
+                    if (DistinctRowIndices(a, b, hashLen, lenIndices)) {
+                        if (Xc->size() < (nNext+1)*rowWidth) {
+                            Xc->resize(std::max(2*Xc->size(), (nNext+1)*rowWidth));
+                        }
+                        MergeRows(Xc->data() + nNext*rowWidth, a, b, hashLen, lenIndices, CollisionByteLength);
+                        nNext++;
+                    }
+                }
+            }
+
+            i += j;
+            if (cancelled(ListColliding)) throw solver_cancelled;
+        }
+
+        std::swap(X, Xc);
+        nRows = nNext;
+        hashLen -= CollisionByteLength;
+        lenIndices *= 2;
+        if (cancelled(RoundEnd)) throw solver_cancelled;
+    }
+
+    // k+1) Find a collision on last 2n(k+1) bits
+    LogPrint(BCLog::POW, "Final round:\n");
+    if (nRows > 1) {
+        LogPrint(BCLog::POW, "- Sorting list\n");
+        RadixSortRows(arena, X->data(), nRows, rowWidth, hashLen);
+        if (cancelled(FinalSorting)) throw solver_cancelled;
+        LogPrint(BCLog::POW, "- Finding collisions\n");
+        const uint64_t* keys = arena.vKeys[0].data();
+        const uint32_t* order = arena.vOrder[0].data();
+        unsigned char res[FinalFullWidth];
+        size_t i = 0;
+        while (i < nRows) {
+            size_t j = 1;
+            while (i+j < nRows && keys[i+j] == keys[i]) {
+                j++;
+            }
+
+            for (size_t l = 0; l + 1 < j; l++) {
+                const unsigned char* a = X->data() + order[i+l]*rowWidth;
+                for (size_t m = l + 1; m < j; m++) {
+                    const unsigned char* b = X->data() + order[i+m]*rowWidth;
+                    if (DistinctRowIndices(a, b, hashLen, lenIndices)) {
+                        MergeRows(res, a, b, hashLen, lenIndices, 0);
+                        size_t minLen { (CollisionBitLength+1)*(2*lenIndices)/(8*sizeof(eh_index)) };
+                        size_t bytePad { sizeof(eh_index) - ((CollisionBitLength+1)+7)/8 };
+                        std::vector<unsigned char> soln(minLen);
+                        CompressArray(res+hashLen, 2*lenIndices, soln.data(), minLen, CollisionBitLength+1, bytePad);
+                        assert(soln.size() == equihash_solution_size(N, K));
+                        if (validBlock(soln)) {
+                            return true;
+                        }
+                    }
+                }
+            }
+
+            i += j;
+            if (cancelled(FinalColliding)) throw solver_cancelled;
+        }
+    } else
+        LogPrint(BCLog::POW, "- List is empty\n");
+
+    return false;
+}
+
 template<unsigned int N, unsigned int K>
-bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln)
+bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln)
 {
     if (soln.size() != SolutionWidth) {
         LogPrint(BCLog::POW, "Invalid solution length: %d (expected %d)\n",
@@ -730,43 +927,73 @@ bool Equihash<N,K>::IsValidSolution(const eh_HashState& base_state, std::vector<
         return false;
     }
 
-    std::vector<FullStepRow<FinalFullWidth>> X;
-    X.reserve(1 << K);
+    // All buffers are sized at compile time and live on the stack, so no
+    // allocation is needed to walk the tree.
+    static constexpr size_t NumIndices = 1 << K;
+    static constexpr size_t IndexBytePad = sizeof(eh_index) - ((CollisionBitLength+1)+7)/8;
+
+    unsigned char indicesArray[NumIndices*sizeof(eh_index)];
+    ExpandArray(soln.data(), soln.size(), indicesArray, sizeof(indicesArray),
+                CollisionBitLength+1, IndexBytePad);
+    eh_index indices[NumIndices];
+    for (size_t i = 0; i < NumIndices; i++) {
+        indices[i] = ArrayToEhIndex(indicesArray+(i*sizeof(eh_index)));
+    }
+
+    // Any two indices meet in the subtree where their branches are merged,
+    // so checking the whole solution once is the same as checking each merge.
+    eh_index sortedIndices[NumIndices];
+    std::copy(indices, indices+NumIndices, sortedIndices);
+    std::sort(sortedIndices, sortedIndices+NumIndices);
+    if (std::adjacent_find(sortedIndices, sortedIndices+NumIndices) != sortedIndices+NumIndices) {
+        LogPrint(BCLog::POW, "Invalid solution: duplicate indices\n");
+        return false;
+    }
+
+    unsigned char hashes[NumIndices][HashLength];
     unsigned char tmpHash[HashOutput];
-    for (eh_index i : GetIndicesFromMinimal(soln, CollisionBitLength)) {
-        GenerateHash(base_state, i/IndicesPerHashOutput, tmpHash, HashOutput);
-        X.emplace_back(tmpHash+((i % IndicesPerHashOutput) * N/8),
-                       N/8, HashLength, CollisionBitLength, i);
+    eh_index tmpHashIndex = 0;
+    for (size_t i = 0; i < NumIndices; i++) {
+        // Consecutive indices often come from the same hash output.
+        const eh_index g = indices[i]/IndicesPerHashOutput;
+        if (i == 0 || g != tmpHashIndex) {
+            GenerateHash(base_state, g, tmpHash, HashOutput);
+            tmpHashIndex = g;
+        }
+        ExpandArray(tmpHash+((indices[i] % IndicesPerHashOutput) * N/8), N/8,
+                    hashes[i], HashLength, CollisionBitLength);
     }
 
-    size_t hashLen = HashLength;
-    size_t lenIndices = sizeof(eh_index);
-    while (X.size() > 1) {
-        std::vector<FullStepRow<FinalFullWidth>> Xc;
-        for (int i = 0; i < X.size(); i += 2) {
-            if (!HasCollision(X[i], X[i+1], CollisionByteLength)) {
+    // Merge the branches in place: after round r, hashes[i] for i a multiple
+    // of 2^r holds the XOR of its 2^r leaves, whose first r collisions have
+    // already been checked. The first index of a branch is its leftmost leaf.
+    size_t offset = 0;
+    for (size_t stride = 1; stride < NumIndices; stride *= 2) {
+        for (size_t i = 0; i < NumIndices; i += 2*stride) {
+            unsigned char* a = hashes[i];
+            const unsigned char* b = hashes[i+stride];
+            if (memcmp(a+offset, b+offset, CollisionByteLength) != 0) {
                 LogPrint(BCLog::POW, "Invalid solution: invalid collision length between StepRows\n");
-                LogPrint(BCLog::POW, "X[i]   = %s\n", X[i].GetHex(hashLen));
-                LogPrint(BCLog::POW, "X[i+1] = %s\n", X[i+1].GetHex(hashLen));
+                LogPrint(BCLog::POW, "X[i]   = %s\n", HexStr(a+offset, a+HashLength));
+                LogPrint(BCLog::POW, "X[i+1] = %s\n", HexStr(b+offset, b+HashLength));
                 return false;
             }
-            if (X[i+1].IndicesBefore(X[i], hashLen, lenIndices)) {
+            if (indices[i+stride] < indices[i]) {
                 LogPrint(BCLog::POW, "Invalid solution: Index tree incorrectly ordered\n");
                 return false;
             }
-            if (!DistinctIndices(X[i], X[i+1], hashLen, lenIndices)) {
-                LogPrint(BCLog::POW, "Invalid solution: duplicate indices\n");
-                return false;
+            for (size_t j = offset+CollisionByteLength; j < HashLength; j++) {
+                a[j] ^= b[j];
             }
-            Xc.emplace_back(X[i], X[i+1], hashLen, lenIndices, CollisionByteLength);
         }
-        X = Xc;
-        hashLen -= CollisionByteLength;
-        lenIndices *= 2;
+        offset += CollisionByteLength;
     }
 
-    assert(X.size() == 1);
-    return X[0].IsZero(hashLen);
+    for (size_t j = offset; j < HashLength; j++) {
+        if (hashes[0][j] != 0)
+            return false;
+    }
+    return true;
 }
 
 // Explicit instantiations for Equihash<96,3>
@@ -777,7 +1004,11 @@ template bool Equihash<96,3>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,3>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,3>::RadixSolve(const eh_HashState& base_state,
+                                         const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                         const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                         EhSolverArena& arena);
+template bool Equihash<96,3>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<200,9>
 template int Equihash<200,9>::InitialiseState(eh_HashState& base_state);
@@ -787,7 +1018,11 @@ template bool Equihash<200,9>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<200,9>::OptimisedSolve(const eh_HashState& base_state,
                                               const std::function<bool(std::vector<unsigned char>)> validBlock,
                                               const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<200,9>::RadixSolve(const eh_HashState& base_state,
+                                          const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                          const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                          EhSolverArena& arena);
+template bool Equihash<200,9>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<96,5>
 template int Equihash<96,5>::InitialiseState(eh_HashState& base_state);
@@ -797,7 +1032,11 @@ template bool Equihash<96,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<96,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<96,5>::RadixSolve(const eh_HashState& base_state,
+                                         const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                         const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                         EhSolverArena& arena);
+template bool Equihash<96,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 
 // Explicit instantiations for Equihash<48,5>
 template int Equihash<48,5>::InitialiseState(eh_HashState& base_state);
@@ -807,4 +1046,8 @@ template bool Equihash<48,5>::BasicSolve(const eh_HashState& base_state,
 template bool Equihash<48,5>::OptimisedSolve(const eh_HashState& base_state,
                                              const std::function<bool(std::vector<unsigned char>)> validBlock,
                                              const std::function<bool(EhSolverCancelCheck)> cancelled);
-template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+template bool Equihash<48,5>::RadixSolve(const eh_HashState& base_state,
+                                         const std::function<bool(std::vector<unsigned char>)> validBlock,
+                                         const std::function<bool(EhSolverCancelCheck)> cancelled,
+                                         EhSolverArena& arena);
+template bool Equihash<48,5>::IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
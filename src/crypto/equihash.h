@@ -154,6 +154,18 @@ class EhSolverCancelledException : public std::exception
     }
 };
 
+/** Buffers of Equihash<N,K>::RadixSolve, kept between runs so that solving
+ *  many nonces allocates only while the buffers grow. An arena must not be
+ *  used by two solvers at once. */
+struct EhSolverArena
+{
+    /** Current and next list of rows, each laid out like a FullStepRow */
+    std::vector<unsigned char> vRows[2];
+    /** Sort keys and row numbers, double-buffered for the radix passes */
+    std::vector<uint64_t> vKeys[2];
+    std::vector<uint32_t> vOrder[2];
+};
+
 inline constexpr const size_t max(const size_t A, const size_t B) { return A > B ? A : B; }
 
 inline constexpr size_t equihash_solution_size(unsigned int N, unsigned int K) {
@@ -189,7 +201,11 @@ public:
     bool OptimisedSolve(const eh_HashState& base_state,
                         const std::function<bool(std::vector<unsigned char>)> validBlock,
                         const std::function<bool(EhSolverCancelCheck)> cancelled);
-    bool IsValidSolution(const eh_HashState& base_state, std::vector<unsigned char> soln);
+    bool RadixSolve(const eh_HashState& base_state,
+                    const std::function<bool(std::vector<unsigned char>)> validBlock,
+                    const std::function<bool(EhSolverCancelCheck)> cancelled,
+                    EhSolverArena& arena);
+    bool IsValidSolution(const eh_HashState& base_state, const std::vector<unsigned char>& soln);
 };
 
 #include "equihash.tcc"
@@ -260,6 +276,32 @@ inline bool EhOptimisedSolveUncancellable(unsigned int n, unsigned int k, const
                             [](EhSolverCancelCheck pos) { return false; });
 }
 
+inline bool EhRadixSolve(unsigned int n, unsigned int k, const eh_HashState& base_state,
+                    const std::function<bool(std::vector<unsigned char>)> validBlock,
+                    const std::function<bool(EhSolverCancelCheck)> cancelled,
+                    EhSolverArena& arena)
+{
+    if (n == 96 && k == 3) {
+        return Eh96_3.RadixSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 200 && k == 9) {
+        return Eh200_9.RadixSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 96 && k == 5) {
+        return Eh96_5.RadixSolve(base_state, validBlock, cancelled, arena);
+    } else if (n == 48 && k == 5) {
+        return Eh48_5.RadixSolve(base_state, validBlock, cancelled, arena);
+    } else {
+        throw std::invalid_argument("Unsupported Equihash parameters");
+    }
+}
+
+inline bool EhRadixSolveUncancellable(unsigned int n, unsigned int k, const eh_HashState& base_state,
+                    const std::function<bool(std::vector<unsigned char>)> validBlock,
+                    EhSolverArena& arena)
+{
+    return EhRadixSolve(n, k, base_state, validBlock,
+                        [](EhSolverCancelCheck pos) { return false; }, arena);
+}
+
 #define EhIsValidSolution(n, k, base_state, soln, ret)   \
     if (n == 96 && k == 3) {                             \
         ret = Eh96_3.IsValidSolution(base_state, soln);  \
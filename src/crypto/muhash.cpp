@@ -0,0 +1,178 @@
+// Copyright (c) 2017-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/chacha20.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace {
+
+/** 2^3072 - MAX_PRIME_DIFF is the modulus */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+/** Whether a number below 2^3072 is at least the modulus */
+bool IsOverflow(const Num3072& a)
+{
+    if (a.limbs[0] <= (uint32_t)0 - MAX_PRIME_DIFF - 1) return false;
+    for (int i = 1; i < Num3072::LIMBS; ++i) {
+        if (a.limbs[i] != (uint32_t)-1) return false;
+    }
+    return true;
+}
+
+/** Add c * 2^3072, which is c * MAX_PRIME_DIFF modulo the prime */
+void FoldCarry(Num3072& a, uint64_t c)
+{
+    while (c) {
+        uint64_t acc = c * MAX_PRIME_DIFF;
+        c = 0;
+        for (int i = 0; i < Num3072::LIMBS && acc; ++i) {
+            acc += a.limbs[i];
+            a.limbs[i] = (uint32_t)acc;
+            acc >>= 32;
+            if (i == Num3072::LIMBS - 1) c = acc;
+        }
+    }
+}
+
+/** Subtract the modulus from a number below 2^3072 if it is at least the modulus */
+void FullReduce(Num3072& a)
+{
+    if (!IsOverflow(a)) return;
+    // a - p = a + MAX_PRIME_DIFF - 2^3072
+    uint64_t acc = MAX_PRIME_DIFF;
+    for (int i = 0; i < Num3072::LIMBS; ++i) {
+        acc += a.limbs[i];
+        a.limbs[i] = (uint32_t)acc;
+        acc >>= 32;
+    }
+}
+
+} // namespace
+
+Num3072::Num3072(const unsigned char (&data)[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+    FullReduce(*this);
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+void Num3072::ToBytes(unsigned char (&out)[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+void Num3072::Reduce(const uint32_t (&product)[2 * LIMBS])
+{
+    // The high half counts MAX_PRIME_DIFF times, which leaves a carry below 2^22.
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t acc = (uint64_t)product[i] + (uint64_t)product[i + LIMBS] * MAX_PRIME_DIFF + carry;
+        limbs[i] = (uint32_t)acc;
+        carry = acc >> 32;
+    }
+    FoldCarry(*this, carry);
+    FullReduce(*this);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    uint32_t product[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            uint64_t acc = (uint64_t)limbs[i] * a.limbs[j] + product[i + j] + carry;
+            product[i + j] = (uint32_t)acc;
+            carry = acc >> 32;
+        }
+        product[i + LIMBS] = (uint32_t)carry;
+    }
+    Reduce(product);
+}
+
+void Num3072::Square()
+{
+    Num3072 copy(*this);
+    Multiply(copy);
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // By Fermat's little theorem the inverse is the power p - 2, whose low
+    // limb is 2^32 - MAX_PRIME_DIFF - 2 and whose other limbs are all ones.
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const uint32_t exponent = i == 0 ? (uint32_t)0 - MAX_PRIME_DIFF - 2 : (uint32_t)-1;
+        for (int bit = 31; bit >= 0; --bit) {
+            result.Square();
+            if ((exponent >> bit) & 1) result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hash);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    ChaCha20(hash, sizeof(hash)).Output(expanded, sizeof(expanded));
+    return Num3072(expanded);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
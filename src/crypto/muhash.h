@@ -0,0 +1,103 @@
+// Copyright (c) 2017-2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An integer modulo the prime 2^3072 - 1103717. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+    static const int LIMBS = 96;
+
+    uint32_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    //! Read a little endian number, reduced modulo the prime
+    explicit Num3072(const unsigned char (&data)[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    //! Multiply by the inverse of a, which must not be zero
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char (&out)[BYTE_SIZE]) const;
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char data[BYTE_SIZE];
+        ToBytes(data);
+        s.write((const char*)data, BYTE_SIZE);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char data[BYTE_SIZE];
+        s.read((char*)data, BYTE_SIZE);
+        *this = Num3072(data);
+    }
+
+private:
+    void Square();
+    void Reduce(const uint32_t (&product)[2 * LIMBS]);
+};
+
+/**
+ * A hash of a set of byte strings which does not depend on the order in which
+ * they were added, and from which a string can be removed again. Each string
+ * is hashed to a number modulo a 3072-bit prime, and the set hash is their
+ * product: the MuHash construction of "A New Paradigm for Collision-free
+ * Hashing: Incrementality at Reduced Cost" by Bellare and Micciancio.
+ *
+ * The removed strings are kept in a separate product, so that inserting and
+ * removing both take one multiplication, and the only division is done by
+ * Finalize.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Combine with the hash of a disjoint set
+    MuHash3072& operator*=(const MuHash3072& mul);
+    //! Remove the strings of a subset
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Write the SHA256 of the set hash, leaving an equivalent state
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        numerator.Serialize(s);
+        denominator.Serialize(s);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        numerator.Unserialize(s);
+        denominator.Unserialize(s);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -12,9 +12,48 @@
 
 #include "endianness.hpp"
 
+#include <atomic>
 #include <memory>
+#include <string>
 #include <vector>
 
+/// A merge() step of the ProgPoW program with its random selector decoded.
+struct ethash_progpow_merge
+{
+    uint8_t op;
+    uint8_t rotation;
+};
+
+/// The random ProgPoW program of an epoch.
+///
+/// The program only depends on the epoch number, so the KISS99 sequence that
+/// selects the registers and operations is run once when the epoch context is
+/// created instead of once per lane for every dataset access.
+extern "C" struct ethash_progpow_program
+{
+    struct
+    {
+        uint8_t src;
+        uint8_t dst;
+        ethash_progpow_merge merge;
+    } cache[ETHASH_PROGPOW_CNT_CACHE];
+
+    struct
+    {
+        uint8_t src1;
+        uint8_t src2;
+        uint8_t op;
+        uint8_t dst;
+        ethash_progpow_merge merge;
+    } math[ETHASH_PROGPOW_CNT_MATH];
+
+    ethash_progpow_merge merge_lo;
+    uint8_t dst_hi;
+    ethash_progpow_merge merge_hi;
+};
+
+struct ethash_full_dataset_state;
+
 extern "C" struct ethash_epoch_context_full : ethash_epoch_context
 {
     //ethash_hash2048* full_dataset;
@@ -22,17 +61,37 @@ extern "C" struct ethash_epoch_context_full : ethash_epoch_context
         ethash_hash1024* full_dataset;
         ethash_hash2048* full_dataset2;
     };
-	ethash_hash32* full_l1_dataset;
+
+    /// The generation progress of the dataset, null if it is never generated.
+    struct ethash_full_dataset_state* full_dataset_state;
 
     constexpr ethash_epoch_context_full(int epoch_number, int light_cache_num_items,
-        const ethash_hash512* light_cache, int full_dataset_num_items,
-        ethash_hash2048* full_dataset, ethash_hash32* full_l1_dataset) noexcept
-      : ethash_epoch_context{epoch_number, light_cache_num_items, light_cache,
-            full_dataset_num_items, 0},
-        full_dataset2{full_dataset}, full_l1_dataset{ full_l1_dataset }
+        const ethash_hash512* light_cache, const uint32_t* l1_cache,
+        const ethash_progpow_program* program, int full_dataset_num_items,
+        ethash_hash2048* full_dataset, ethash_full_dataset_state* full_dataset_state) noexcept
+      : ethash_epoch_context{epoch_number, light_cache_num_items, light_cache, l1_cache,
+            program, full_dataset_num_items, 0},
+        full_dataset2{full_dataset},
+        full_dataset_state{full_dataset_state}
     {}
 };
 
+/// The generation progress of the full dataset of an epoch context, kept out
+/// of the context so that it stays a C struct.
+struct ethash_full_dataset_state
+{
+    /// The first item not handed out to a worker of build_full_dataset() yet,
+    /// so that a build resumes where a cancelled one stopped.
+    std::atomic<int> next_item{0};
+
+    /// The number of ProgPoW dataset items generated so far.
+    std::atomic<int> num_items_built{0};
+
+    /// Set once every item of the dataset has been generated. The dataset is
+    /// immutable afterwards, until then hashes compute the items from the light cache.
+    std::atomic<bool> ready{false};
+};
+
 namespace ethash
 {
 inline bool is_less_or_equal(const hash256& a, const hash256& b) noexcept
@@ -53,4 +112,55 @@ hash1024 calculate_dataset_item(const epoch_context& context, uint32_t index) no
 
 hash2048 calculate_dataset_item_progpow(const epoch_context& context, uint32_t index) noexcept;
 
+hash32 calculate_L1dataset_item(const epoch_context& context, uint32_t index) noexcept;
+
+void build_l1_cache(uint32_t cache[], const epoch_context& context) noexcept;
+
+void build_progpow_program(ethash_progpow_program& program, uint64_t prog_seed) noexcept;
+
+/// Creates a light epoch context using light and L1 caches owned by the caller,
+/// e.g. mapped from a cache file. Only the context itself is allocated and it
+/// must be destroyed with ethash_destroy_epoch_context() before the caches.
+epoch_context* create_epoch_context_with_caches(
+    int epoch_number, const hash512* light_cache, const uint32_t* l1_cache) noexcept;
+
+/// Maps the light context of the epoch from <dir>/epoch-N.cache, or builds it
+/// and writes the file first. Falls back to a context in memory if the file
+/// cannot be used. Returns null if the context could not be created.
+std::shared_ptr<epoch_context> load_epoch_context_file(const std::string& dir, int epoch_number);
+
+/// Deletes the cache file of the epoch from <dir>, if any.
+void remove_epoch_context_file(const std::string& dir, int epoch_number);
+
+/// Executes one round of the ProgPoW program on all lanes of the mix, merging
+/// in the dataset item loaded for the round.
+using progpow_round_fn = void (*)(const epoch_context& context, const hash2048& data256,
+    uint32_t mix[ETHASH_PROGPOW_REGS][ETHASH_PROGPOW_LANES]);
+
+void progpow_round(const epoch_context& context, const hash2048& data256,
+    uint32_t mix[ETHASH_PROGPOW_REGS][ETHASH_PROGPOW_LANES]) noexcept;
+
+/// Computes keccak512() of four independent 64-byte inputs, as needed by the
+/// four mixes of calculate_dataset_item_progpow().
+using keccak512_64x4_fn = void (*)(hash512 out[4], const hash512 in[4]);
+
+void keccak512_64x4(hash512 out[4], const hash512 in[4]) noexcept;
+
+#if (defined(__x86_64__) || defined(__amd64__)) && defined(__GNUC__)
+#define ETHASH_PROGPOW_AVX2 1
+
+namespace progpow_avx2
+{
+/// Whether the CPU and OS support AVX2.
+bool supported() noexcept;
+
+/// progpow_round() processing 8 lanes per AVX2 vector.
+void progpow_round(const epoch_context& context, const hash2048& data256,
+    uint32_t mix[ETHASH_PROGPOW_REGS][ETHASH_PROGPOW_LANES]) noexcept;
+
+/// keccak512_64x4() running the four permutations in the 64-bit lanes of AVX2 vectors.
+void keccak512_64x4(hash512 out[4], const hash512 in[4]) noexcept;
+}  // namespace progpow_avx2
+#endif
+
 }  // namespace ethash
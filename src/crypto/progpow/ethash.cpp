@@ -10,10 +10,14 @@
 #include "keccak.hpp"
 #include "math_ops.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
 #include <limits>
+#include <new>
+#include <thread>
+#include <vector>
 
 #if __clang__
 #define ATTRIBUTE_NO_SANITIZE_UNSIGNED_INTEGER_OVERFLOW \
@@ -25,12 +29,12 @@
 namespace ethash
 {
 
-#define PROGPOW_LANES                   32
-#define PROGPOW_REGS                    16
-#define PROGPOW_CACHE_BYTES             (16*1024)
+#define PROGPOW_LANES                   ETHASH_PROGPOW_LANES
+#define PROGPOW_REGS                    ETHASH_PROGPOW_REGS
+#define PROGPOW_CACHE_BYTES             ETHASH_PROGPOW_L1_CACHE_SIZE
 #define PROGPOW_CNT_MEM                 ETHASH_NUM_DATASET_ACCESSES
-#define PROGPOW_CNT_CACHE               8
-#define PROGPOW_CNT_MATH                8
+#define PROGPOW_CNT_CACHE               ETHASH_PROGPOW_CNT_CACHE
+#define PROGPOW_CNT_MATH                ETHASH_PROGPOW_CNT_MATH
 #define PROGPOW_CACHE_WORDS  (PROGPOW_CACHE_BYTES / sizeof(uint32_t))
 #define PROGPOW_EPOCH_START            (0)
 
@@ -864,7 +868,7 @@ uint32_t fnv1a(uint32_t *h, uint32_t d)
 void fill_mix(
 	uint64_t seed,
 	uint32_t lane_id,
-	uint32_t mix[PROGPOW_REGS]
+	uint32_t mix[PROGPOW_REGS][PROGPOW_LANES]
 )
 {
 	// Use FNV to expand the per-warp seed to per-lane
@@ -876,7 +880,7 @@ void fill_mix(
 	st.jsr = fnv1a(&fnv_hash, lane_id);
 	st.jcong = fnv1a(&fnv_hash, lane_id);
 	for (int i = 0; i < PROGPOW_REGS; i++)
-		mix[i] = kiss99(&st);
+		mix[i][lane_id] = kiss99(&st);
 }
 
 
@@ -887,18 +891,24 @@ void swap(uint32_t *a, uint32_t *b)
 	*b = t;
 }
 
+// Decode the random value selecting a merge() operation
+ethash_progpow_merge merge_select(uint32_t r)
+{
+	return {static_cast<uint8_t>(r % 4), static_cast<uint8_t>((r >> 16) % 32)};
+}
+
 // Merge new data from b into the value in a
 // Assuming A has high entropy only do ops that retain entropy
 // even if B is low entropy
 // (IE don't do A&B)
-void merge(uint32_t *a, uint32_t b, uint32_t r)
+void merge(uint32_t *a, uint32_t b, const ethash_progpow_merge& m)
 {
-	switch (r % 4)
+	switch (m.op)
 	{
 	case 0: *a = (*a * 33) + b; break;
 	case 1: *a = (*a ^ b) * 33; break;
-	case 2: *a = ROTL32(*a, ((r >> 16) % 32)) ^ b; break;
-	case 3: *a = ROTR32(*a, ((r >> 16) % 32)) ^ b; break;
+	case 2: *a = ROTL32(*a, m.rotation) ^ b; break;
+	case 3: *a = ROTR32(*a, m.rotation) ^ b; break;
 	}
 }
 
@@ -932,6 +942,60 @@ uint32_t math(uint32_t a, uint32_t b, uint32_t r)
 
 }  // namespace
 
+void progpow_round(const epoch_context& context, const hash2048& data256,
+    uint32_t mix[PROGPOW_REGS][PROGPOW_LANES]) noexcept
+{
+    const ethash_progpow_program& prog = *context.program;
+
+    // Lanes can execute in parallel and will be convergent
+    for (uint32_t l = 0; l < PROGPOW_LANES; l++)
+    {
+        // global load to sequential locations
+        uint64_t data64 = data256.words[l];
+
+        uint32_t offset, data32;
+        //int max_i = max(PROGPOW_CNT_CACHE, PROGPOW_CNT_MATH);
+        uint32_t max_i;
+        if (PROGPOW_CNT_CACHE > PROGPOW_CNT_MATH)
+            max_i = PROGPOW_CNT_CACHE;
+        else
+            max_i = PROGPOW_CNT_MATH;
+        for (uint32_t i = 0; i < max_i; i++)
+        {
+            if (i < PROGPOW_CNT_CACHE)
+            {
+                // Cached memory access
+                // lanes access random location
+                offset = mix[prog.cache[i].src][l] % (uint32_t)PROGPOW_CACHE_WORDS;
+                data32 = fix_endianness(context.l1_cache[offset]);
+                merge(&mix[prog.cache[i].dst][l], data32, prog.cache[i].merge);
+            }
+
+            if (i < PROGPOW_CNT_MATH)
+            {
+                // Random Math
+                data32 = math(mix[prog.math[i].src1][l], mix[prog.math[i].src2][l], prog.math[i].op);
+                merge(&mix[prog.math[i].dst][l], data32, prog.math[i].merge);
+            }
+        }
+
+        merge(&mix[0][l], (uint32_t)data64, prog.merge_lo);
+        merge(&mix[prog.dst_hi][l], (uint32_t)(data64 >> 32), prog.merge_hi);
+    }
+}
+
+void keccak512_64x4(hash512 out[4], const hash512 in[4]) noexcept
+{
+    for (int k = 0; k < 4; ++k)
+        out[k] = keccak512(in[k]);
+}
+
+namespace
+{
+progpow_round_fn progpow_round_impl = progpow_round;
+keccak512_64x4_fn keccak512_64x4_impl = keccak512_64x4;
+}  // namespace
+
 int find_epoch_number(const hash256& seed) noexcept
 {
     static constexpr int num_tries = ETHASH_EPOCH_LENGTH;  // Divisible by 16.
@@ -1062,6 +1126,20 @@ hash32 calculate_L1dataset_item(const epoch_context& context, uint32_t index) no
     return ret;
 }
 
+/// Builds the ProgPoW L1 cache of the epoch.
+///
+/// Equivalent to calling calculate_L1dataset_item() for every index, but every
+/// dataset item is computed once for the 32 cache words taken from it.
+void build_l1_cache(uint32_t cache[], const epoch_context& context) noexcept
+{
+    for (uint32_t i = 0; i < PROGPOW_CACHE_WORDS / 32; ++i)
+    {
+        const hash2048 dag = fix_endianness32(calculate_dataset_item_progpow(context, i));
+        for (uint32_t k = 0; k < 32; ++k)
+            cache[i * 32 + k] = dag.hwords[(k * 2) - (k % 2)];
+    }
+}
+
 /// Calculates a full dataset item for progpow
 ///
 /// This consist of four 512-bit items produced by calculate_dataset_item_partial().
@@ -1094,10 +1172,12 @@ hash2048 calculate_dataset_item_progpow(const epoch_context& context, uint32_t i
     mix3.half_words[0] ^= fix_endianness(init3);
 
     // Hash and convert to little-endian 32-bit words.
-    mix0 = fix_endianness32(keccak512(mix0));
-    mix1 = fix_endianness32(keccak512(mix1));
-    mix2 = fix_endianness32(keccak512(mix2));
-    mix3 = fix_endianness32(keccak512(mix3));
+    hash512 mixes[4] = {mix0, mix1, mix2, mix3};
+    keccak512_64x4_impl(mixes, mixes);
+    mix0 = fix_endianness32(mixes[0]);
+    mix1 = fix_endianness32(mixes[1]);
+    mix2 = fix_endianness32(mixes[2]);
+    mix3 = fix_endianness32(mixes[3]);
 
     for (uint32_t j = 0; j < full_dataset_item_parents; ++j)
     {
@@ -1119,19 +1199,19 @@ hash2048 calculate_dataset_item_progpow(const epoch_context& context, uint32_t i
     }
 
     // Covert 32-bit words back to bytes and hash.
-    mix0 = keccak512(fix_endianness32(mix0));
-    mix1 = keccak512(fix_endianness32(mix1));
-    mix2 = keccak512(fix_endianness32(mix2));
-    mix3 = keccak512(fix_endianness32(mix3));
-
-    return hash2048{{mix0, mix1, mix2, mix3}};
+    mixes[0] = fix_endianness32(mix0);
+    mixes[1] = fix_endianness32(mix1);
+    mixes[2] = fix_endianness32(mix2);
+    mixes[3] = fix_endianness32(mix3);
+    hash2048 item;
+    keccak512_64x4_impl(item.hashes, mixes);
+    return item;
 }
 
 namespace
 {
 using lookup_fn = hash1024 (*)(const epoch_context&, uint32_t);
 using lookup_fn2 = hash2048 (*)(const epoch_context&, uint32_t);
-using lookup_fn_l1 = hash32(*)(const epoch_context&, uint32_t);
 
 inline hash512 hash_seed(const hash256& header_hash, uint64_t nonce) noexcept
 {
@@ -1159,11 +1239,7 @@ uint64_t keccak_f800(const ethash_hash256& header, const uint64_t seed, const ui
     st[8] = (uint32_t)seed;
     st[9] = (uint32_t)(seed >> 32);
 
-    for (int r = 0; r < 21; r++) {
-        keccak_f800_round(st, r);
-    }
-    // last round can be simplified due to partial output
-    keccak_f800_round(st, 21);
+    ethash_keccakf800(st);
 
     return (uint64_t)st[0] << 32 | st[1];
 }
@@ -1185,11 +1261,7 @@ void keccak_f800(uint32_t* out, const ethash_hash256 header, const uint64_t seed
     st[8] = (uint32_t)seed;
     st[9] = (uint32_t)(seed >> 32);
 
-    for (int r = 0; r < 21; r++) {
-        keccak_f800_round(st, r);
-    }
-    // last round can be simplified due to partial output
-    keccak_f800_round(st, 21);
+    ethash_keccakf800(st);
 
     for (int i = 0; i < 8; ++i)
         out[i] = st[i];
@@ -1232,78 +1304,17 @@ void progPowInit(kiss99_t& prog_rnd, uint64_t prog_seed, uint32_t mix_seq[PROGPO
 
 void progPowLoop(
     const epoch_context& context,
-    const uint64_t prog_seed,
     const uint32_t loop,
-    uint32_t mix[PROGPOW_LANES][PROGPOW_REGS],
-    lookup_fn2  g_lut,
-    lookup_fn_l1 c_lut)
+    uint32_t mix[PROGPOW_REGS][PROGPOW_LANES],
+    lookup_fn2  g_lut)
 {
     // All lanes share a base address for the global load
     // Global offset uses mix[0] to guarantee it depends on the load result
-    uint32_t offset_g = mix[loop%PROGPOW_LANES][0] % (uint32_t)(context.full_dataset_num_items);
+    uint32_t offset_g = mix[0][loop%PROGPOW_LANES] % (uint32_t)(context.full_dataset_num_items);
 
     const hash2048 data256 = fix_endianness32(g_lut(context, offset_g));
 
-
-    // Lanes can execute in parallel and will be convergent
-    for (uint32_t l = 0; l < PROGPOW_LANES; l++)
-    {
-        // global load to sequential locations
-        uint64_t data64 = data256.words[l];
-
-        // initialize the seed and mix destination sequence
-        uint32_t mix_seq[PROGPOW_REGS];
-        int mix_seq_cnt = 0;
-        kiss99_t prog_rnd;
-        progPowInit(prog_rnd, prog_seed, mix_seq);
-
-        uint32_t src1, src2, dest, r, r1, r2, src11;
-        uint32_t offset, data32;
-        //int max_i = max(PROGPOW_CNT_CACHE, PROGPOW_CNT_MATH);
-        uint32_t max_i;
-        if (PROGPOW_CNT_CACHE > PROGPOW_CNT_MATH)
-            max_i = PROGPOW_CNT_CACHE;
-        else
-            max_i = PROGPOW_CNT_MATH;
-        for (uint32_t i = 0; i < max_i; i++)
-        {
-            if (i < PROGPOW_CNT_CACHE)
-            {
-                // Cached memory access
-                // lanes access random location
-                src1 = kiss99(&prog_rnd) % PROGPOW_REGS;
-                offset = mix[l][src1] % (uint32_t)PROGPOW_CACHE_WORDS;
-                data32 = fix_endianness(c_lut(context, offset).hwords[0]);
-                dest = mix_seq[mix_seq_cnt % PROGPOW_REGS];
-                mix_seq_cnt++;
-                r = kiss99(&prog_rnd);
-                merge(&mix[l][dest], data32, r);
-            }
-
-            if (i < PROGPOW_CNT_MATH)
-            {
-                // Random Math
-                src11 = kiss99(&prog_rnd);
-                src1 = src11 % PROGPOW_REGS;
-                src2 = kiss99(&prog_rnd) % PROGPOW_REGS;
-                r1 = kiss99(&prog_rnd);
-                r2 = kiss99(&prog_rnd);
-                dest = mix_seq[mix_seq_cnt % PROGPOW_REGS];
-                mix_seq_cnt++;
-                data32 = math(mix[l][src1], mix[l][src2], r1);
-                merge(&mix[l][dest], data32, r2);
-            }
-        }
-
-        r1 = kiss99(&prog_rnd);
-        r2 = kiss99(&prog_rnd);
-
-        merge(&mix[l][0], (uint32_t)data64, r1);
-        dest = mix_seq[mix_seq_cnt % PROGPOW_REGS];
-        mix_seq_cnt++;
-        merge(&mix[l][dest], (uint32_t)(data64 >> 32), r2);
-    }
-    return;
+    progpow_round_impl(context, data256, mix);
 }
 
 inline hash256 hash_kernel(
@@ -1337,10 +1348,9 @@ inline hash256 hash_kernel(
 }
 
 inline hash256 progpow_kernel(
-    const epoch_context& context, const uint64_t& seed, lookup_fn2 g_lut, lookup_fn_l1 c_lut) noexcept
+    const epoch_context& context, const uint64_t& seed, lookup_fn2 g_lut) noexcept
 {
-    uint32_t mix[PROGPOW_LANES][PROGPOW_REGS];
-    for(int i=0;i<PROGPOW_LANES;i++)for(int j=0;j<PROGPOW_REGS;j++)mix[i][j]=0;
+    alignas(32) uint32_t mix[PROGPOW_REGS][PROGPOW_LANES];
     hash256 result;
     for (int i = 0; i < 8; i++)
         result.hwords[i] = 0;
@@ -1348,22 +1358,23 @@ inline hash256 progpow_kernel(
     // initialize mix for all lanes
     for (uint32_t l = 0; l < PROGPOW_LANES; l++)
     {
-        fill_mix(seed, l, mix[l]);
+        fill_mix(seed, l, mix);
     }
 
     // execute the randomly generated inner loop
     for (uint32_t i = 0; i < PROGPOW_CNT_MEM; i++)
     {
-        progPowLoop(context, (uint64_t)context.epoch_number, i, mix, g_lut, c_lut);
+        progPowLoop(context, i, mix, g_lut);
     }
 
     // Reduce mix data to a single per-lane result
     uint32_t lane_hash[PROGPOW_LANES];
     for (int l = 0; l < PROGPOW_LANES; l++)
-    {
         lane_hash[l] = 0x811c9dc5;
-        for (int i = 0; i < PROGPOW_REGS; i++) {
-            fnv1a(&lane_hash[l], mix[l][i]);
+    for (int i = 0; i < PROGPOW_REGS; i++)
+    {
+        for (int l = 0; l < PROGPOW_LANES; l++) {
+            fnv1a(&lane_hash[l], mix[i][l]);
         }
     }
     // Reduce all lanes to a single 128-bit result
@@ -1382,30 +1393,169 @@ inline hash256 progpow_kernel(
 }
 }  // namespace
 
-result hash(const epoch_context& context, const hash256& header_hash, uint64_t nonce) noexcept
+void build_progpow_program(ethash_progpow_program& program, uint64_t prog_seed) noexcept
 {
-    const hash512 seed = hash_seed(header_hash, nonce);
-    const hash256 mix_hash = hash_kernel(context, seed, calculate_dataset_item);
-    return {hash_final(seed, mix_hash), mix_hash};
+    // initialize the seed and mix destination sequence
+    uint32_t mix_seq[PROGPOW_REGS];
+    int mix_seq_cnt = 0;
+    kiss99_t prog_rnd;
+    progPowInit(prog_rnd, prog_seed, mix_seq);
+
+    // The KISS99 draws must stay in the order the reference kernel makes them
+    for (uint32_t i = 0; i < PROGPOW_CNT_CACHE || i < PROGPOW_CNT_MATH; i++)
+    {
+        if (i < PROGPOW_CNT_CACHE)
+        {
+            auto& op = program.cache[i];
+            op.src = kiss99(&prog_rnd) % PROGPOW_REGS;
+            op.dst = mix_seq[mix_seq_cnt++ % PROGPOW_REGS];
+            op.merge = merge_select(kiss99(&prog_rnd));
+        }
+
+        if (i < PROGPOW_CNT_MATH)
+        {
+            auto& op = program.math[i];
+            op.src1 = kiss99(&prog_rnd) % PROGPOW_REGS;
+            op.src2 = kiss99(&prog_rnd) % PROGPOW_REGS;
+            op.op = kiss99(&prog_rnd) % 11;
+            op.merge = merge_select(kiss99(&prog_rnd));
+            op.dst = mix_seq[mix_seq_cnt++ % PROGPOW_REGS];
+        }
+    }
+
+    program.merge_lo = merge_select(kiss99(&prog_rnd));
+    program.merge_hi = merge_select(kiss99(&prog_rnd));
+    program.dst_hi = mix_seq[mix_seq_cnt++ % PROGPOW_REGS];
 }
 
-result hash(const epoch_context_full& context, const hash256& header_hash, uint64_t nonce) noexcept
+namespace
+{
+/// Compares a ProgPoW round implementation with progpow_round() on random
+/// programs, cache contents and mix states.
+bool progpow_round_self_test(progpow_round_fn candidate)
+{
+    static uint32_t l1_cache[PROGPOW_CACHE_WORDS];
+    kiss99_t st{362436069, 521288629, 123456789, 380116160};
+    for (size_t i = 0; i < PROGPOW_CACHE_WORDS; ++i)
+        l1_cache[i] = kiss99(&st);
+
+    for (uint64_t prog_seed = 0; prog_seed < 64; ++prog_seed)
+    {
+        ethash_progpow_program program;
+        build_progpow_program(program, prog_seed);
+        const epoch_context context{0, 0, nullptr, l1_cache, &program, 1, 0};
+
+        hash2048 data256;
+        for (size_t i = 0; i < sizeof(data256) / sizeof(data256.hwords[0]); ++i)
+            data256.hwords[i] = kiss99(&st);
+
+        alignas(32) uint32_t expected[PROGPOW_REGS][PROGPOW_LANES];
+        alignas(32) uint32_t mix[PROGPOW_REGS][PROGPOW_LANES];
+        for (uint32_t l = 0; l < PROGPOW_LANES; ++l)
+            fill_mix(prog_seed, l, expected);
+        // Zero registers exercise the clz() and rotation corner cases.
+        expected[prog_seed % PROGPOW_REGS][prog_seed % PROGPOW_LANES] = 0;
+        std::memcpy(mix, expected, sizeof(mix));
+
+        progpow_round(context, data256, expected);
+        candidate(context, data256, mix);
+        if (std::memcmp(mix, expected, sizeof(mix)) != 0)
+            return false;
+    }
+    return true;
+}
+
+/// Compares the Keccak permutations with the portable ones, and the unrolled
+/// Keccak-f[800] with the reference rounds, on pseudo-random states.
+bool keccak_self_test(ethash_keccakf1600_fn f1600, ethash_keccakf800_fn f800)
+{
+    kiss99_t st{362436069, 521288629, 123456789, 380116160};
+    for (int n = 0; n < 16; ++n)
+    {
+        uint64_t state[25], expected[25];
+        for (int i = 0; i < 25; ++i)
+            expected[i] = state[i] = uint64_t{kiss99(&st)} << 32 | kiss99(&st);
+        ethash_keccakf1600_generic(expected);
+        f1600(state);
+        if (std::memcmp(state, expected, sizeof(state)) != 0)
+            return false;
+
+        uint32_t state32[25], expected32[25];
+        for (int i = 0; i < 25; ++i)
+            expected32[i] = state32[i] = kiss99(&st);
+        for (int r = 0; r < 22; ++r)
+            keccak_f800_round(expected32, r);
+        f800(state32);
+        if (std::memcmp(state32, expected32, sizeof(state32)) != 0)
+            return false;
+    }
+    return true;
+}
+
+/// Compares a 4-way keccak512 with four keccak512() calls.
+bool keccak512_64x4_self_test(keccak512_64x4_fn candidate)
 {
-    static const auto lazy_lookup = [](const epoch_context& context, uint32_t index) noexcept
+    kiss99_t st{362436069, 521288629, 123456789, 380116160};
+    for (int n = 0; n < 16; ++n)
     {
-        auto full_dataset = static_cast<const epoch_context_full&>(context).full_dataset;
-        hash1024& item = full_dataset[index];
-        if (item.words[0] == 0)
+        hash512 in[4], out[4];
+        for (hash512& h : in)
+            for (uint32_t& w : h.half_words)
+                w = kiss99(&st);
+        candidate(out, in);
+        for (int k = 0; k < 4; ++k)
         {
-            // TODO: Copy elision here makes it thread-safe?
-            item = calculate_dataset_item(context, index);
+            const hash512 expected = keccak512(in[k]);
+            if (std::memcmp(&out[k], &expected, sizeof(expected)) != 0)
+                return false;
         }
+    }
+    return true;
+}
+}  // namespace
 
-        return item;
-    };
+const char* progpow_autodetect() noexcept
+{
+    bool bmi2 = false;
+    bool avx2 = false;
+#if defined(ETHASH_KECCAK_BMI2)
+    if (ethash_keccak_bmi2_supported())
+    {
+        ethash_keccakf1600_impl = ethash_keccakf1600_bmi2;
+        ethash_keccakf800_impl = ethash_keccakf800_bmi2;
+        bmi2 = true;
+    }
+#endif
+    assert(keccak_self_test(ethash_keccakf1600_impl, ethash_keccakf800_impl));
+
+#if defined(ETHASH_PROGPOW_AVX2)
+    if (progpow_avx2::supported())
+    {
+        progpow_round_impl = progpow_avx2::progpow_round;
+        keccak512_64x4_impl = progpow_avx2::keccak512_64x4;
+        avx2 = true;
+    }
+#endif
+    assert(progpow_round_self_test(progpow_round_impl));
+    assert(keccak512_64x4_self_test(keccak512_64x4_impl));
+
+    if (avx2)
+        return bmi2 ? "avx2,bmi2" : "avx2";
+    return bmi2 ? "bmi2" : "standard";
+}
 
+result hash(const epoch_context& context, const hash256& header_hash, uint64_t nonce) noexcept
+{
+    const hash512 seed = hash_seed(header_hash, nonce);
+    const hash256 mix_hash = hash_kernel(context, seed, calculate_dataset_item);
+    return {hash_final(seed, mix_hash), mix_hash};
+}
+
+result hash(const epoch_context_full& context, const hash256& header_hash, uint64_t nonce) noexcept
+{
+    // The full dataset holds ProgPoW items, Ethash items are computed from the light cache.
     const hash512 seed = hash_seed(header_hash, nonce);
-    const hash256 mix_hash = hash_kernel(context, seed, lazy_lookup);
+    const hash256 mix_hash = hash_kernel(context, seed, calculate_dataset_item);
     return {hash_final(seed, mix_hash), mix_hash};
 }
 
@@ -1423,7 +1573,7 @@ result progpow(const epoch_context& context, const hash256& header_hash, uint64_
 
     uint64_t seed = keccak_f800(header_hash_reversed, nonce, result);
 
-    const hash256 mix_hash = progpow_kernel(context, seed, calculate_dataset_item_progpow, calculate_L1dataset_item);
+    const hash256 mix_hash = progpow_kernel(context, seed, calculate_dataset_item_progpow);
 
     hash256 ret_hash = ethash_keccak256(header_hash_reversed, seed, &mix_hash.hwords[0]);
     hash256 final_hash;
@@ -1436,43 +1586,30 @@ result progpow(const epoch_context& context, const hash256& header_hash, uint64_
 
 result progpow(const epoch_context_full& context, const hash256& header_hash, uint64_t nonce) noexcept
 {
-    static const auto lazy_lookup = [](const epoch_context& context, uint32_t index) noexcept
+    static const auto full_lookup = [](const epoch_context& context, uint32_t index) noexcept
     {
-        auto full_dataset = static_cast<const epoch_context_full&>(context).full_dataset2;
-        hash2048& item = full_dataset[index];
-        if (item.words[0] == 0)
-        {
-            // TODO: Copy elision here makes it thread-safe?
-            item = calculate_dataset_item_progpow(context, index);
-        }
-
-        return item;
+        return static_cast<const epoch_context_full&>(context).full_dataset2[index];
     };
 
-    static const auto lazy_l1_lookup = [](const epoch_context& context, uint32_t index) noexcept
-    {
-        auto full_l1_dataset = static_cast<const epoch_context_full&>(context).full_l1_dataset;
-        hash32& item = full_l1_dataset[index];
-        if (item.hwords[0] == 0)
-        {
-            // TODO: Copy elision here makes it thread-safe?
-            item = calculate_L1dataset_item(context, index);
-        }
-
-        return item;
-    };
+    // Until the dataset is built the items are computed, so that it is never
+    // written while being read.
+    const lookup_fn2 lookup = context.full_dataset_state &&
+                                      context.full_dataset_state->ready.load(std::memory_order_acquire) ?
+                                  lookup_fn2{full_lookup} :
+                                  calculate_dataset_item_progpow;
 
 
     ethash_hash256 header_hash_reversed;
     for (int i = 0; i < 32; i++)
         header_hash_reversed.bytes[i] = header_hash.bytes[31-i];
 
-    uint32_t result[4];
-    for (int i = 0; i < 4; i++)
+    // keccak_f800() absorbs 8 words of the result, as in the light version.
+    uint32_t result[8];
+    for (int i = 0; i < 8; i++)
         result[i] = 0;
     uint64_t seed = keccak_f800(header_hash_reversed, nonce, result);
 
-    const hash256 mix_hash = progpow_kernel(context, seed, lazy_lookup, lazy_l1_lookup);
+    const hash256 mix_hash = progpow_kernel(context, seed, lookup);
 
     hash256 ret_hash = ethash_keccak256(header_hash_reversed, seed, &mix_hash.hwords[0]);
     hash256 final_hash;
@@ -1483,6 +1620,45 @@ result progpow(const epoch_context_full& context, const hash256& header_hash, ui
     return {final_hash, mix_hash};
 }
 
+bool build_full_dataset(epoch_context_full& context, unsigned num_threads, const std::atomic<bool>* cancel)
+{
+    // Items are handed out in chunks so that faster workers take more of them.
+    static constexpr int chunk_size = 4096;
+
+    ethash_full_dataset_state& state = *context.full_dataset_state;
+    if (state.ready.load(std::memory_order_acquire))
+        return true;
+
+    // A worker only stops between chunks, so the items handed out are built
+    // exactly once across cancelled and resumed builds.
+    const int num_items = context.full_dataset_num_items;
+    const auto worker = [&context, &state, num_items, cancel] {
+        while (!cancel || !cancel->load(std::memory_order_relaxed))
+        {
+            const int begin = state.next_item.fetch_add(chunk_size, std::memory_order_relaxed);
+            if (begin >= num_items)
+                break;
+            const int end = std::min(begin + chunk_size, num_items);
+            for (int i = begin; i < end; ++i)
+                context.full_dataset2[i] = calculate_dataset_item_progpow(context, static_cast<uint32_t>(i));
+            state.num_items_built.fetch_add(end - begin, std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < num_threads; ++i)
+        workers.emplace_back(worker);
+    worker();
+    for (auto& t : workers)
+        t.join();
+
+    if (state.num_items_built.load(std::memory_order_relaxed) != num_items)
+        return false;
+
+    state.ready.store(true, std::memory_order_release);
+    return true;
+}
+
 bool verify_final_hash(const hash256& header_hash, const hash256& mix_hash, uint64_t nonce,
     const hash256& boundary) noexcept
 {
@@ -1542,7 +1718,7 @@ bool verify_progpow(const epoch_context& context, const hash256& header_hash, co
 
     uint64_t seed = keccak_f800(header_hash_reversed, nonce, result);
 
-    const hash256 expected_mix_hash = progpow_kernel(context, seed, calculate_dataset_item_progpow, calculate_L1dataset_item);
+    const hash256 expected_mix_hash = progpow_kernel(context, seed, calculate_dataset_item_progpow);
     return std::memcmp(expected_mix_hash.bytes, mix_hash.bytes, sizeof(mix_hash)) == 0;
 }
 
@@ -1569,6 +1745,13 @@ RetVal check_progpow_nonce_light(const epoch_context& context, const hash256& he
     return {false, r};
 }
 
+RetVal check_progpow_nonce(const epoch_context_full& context, const hash256& header_hash,
+    const hash256& boundary, uint64_t nonce) noexcept
+{
+    result r = progpow(context, header_hash, nonce);
+    return {is_less_or_equal(r.final_hash, boundary), r};
+}
+
 ///////////////////////////////////////////////
 
 bool verify(const epoch_context& context, const hash256& header_hash, const hash256& mix_hash,
@@ -1643,12 +1826,14 @@ namespace
 {
 epoch_context_full* create_epoch_context(int epoch_number, bool full) noexcept
 {
-    static_assert(sizeof(epoch_context_full) < sizeof(hash512), "epoch_context too big");
+    static_assert(sizeof(epoch_context_full) <= sizeof(hash512), "epoch_context too big");
     static constexpr size_t context_alloc_size = sizeof(hash512);
 
     const int light_cache_num_items = calculate_light_cache_num_items(epoch_number);
     const size_t light_cache_size = get_light_cache_size(light_cache_num_items);
-    const size_t alloc_size = context_alloc_size + light_cache_size;
+    static constexpr size_t l1_cache_size = PROGPOW_CACHE_BYTES;
+    static constexpr size_t program_size = sizeof(ethash_progpow_program);
+    const size_t alloc_size = context_alloc_size + light_cache_size + l1_cache_size + program_size;
 
 	if (alloc_size >= 131088776768) return nullptr;
     char* const alloc_data = static_cast<char*>(std::malloc(alloc_size));
@@ -1659,19 +1844,26 @@ epoch_context_full* create_epoch_context(int epoch_number, bool full) noexcept
     const hash256 epoch_seed = calculate_epoch_seed(epoch_number);
     build_light_cache(light_cache, light_cache_num_items, epoch_seed);
 
+    uint32_t* const l1_cache =
+        reinterpret_cast<uint32_t*>(alloc_data + context_alloc_size + light_cache_size);
+
+    ethash_progpow_program* const program = reinterpret_cast<ethash_progpow_program*>(
+        alloc_data + context_alloc_size + light_cache_size + l1_cache_size);
+    build_progpow_program(*program, static_cast<uint64_t>(epoch_number));
+
     const int full_dataset_num_items = calculate_full_dataset_num_items(epoch_number);
-    const int full_l1_dataset_num_items = 4*1024;
     hash2048* full_dataset = nullptr;
-    hash32* full_l1_dataset = nullptr;
+    ethash_full_dataset_state* full_dataset_state = nullptr;
     if (full)
     {
         // TODO: This can be "optimized" by doing single allocation for light and full caches.
         const size_t num_items = static_cast<size_t>(full_dataset_num_items);
-        const size_t num_l1_items = static_cast<size_t>(full_l1_dataset_num_items);
         full_dataset = static_cast<hash2048*>(std::calloc(num_items, sizeof(hash2048)));
-        full_l1_dataset = static_cast<hash32*>(std::calloc(num_l1_items, sizeof(hash32)));
-        if (!full_dataset)
+        full_dataset_state = new (std::nothrow) ethash_full_dataset_state;
+        if (!full_dataset || !full_dataset_state)
         {
+            std::free(full_dataset);
+            delete full_dataset_state;
             std::free(alloc_data);
             return nullptr;
         }
@@ -1681,11 +1873,16 @@ epoch_context_full* create_epoch_context(int epoch_number, bool full) noexcept
         epoch_number,
         light_cache_num_items,
         light_cache,
+        l1_cache,
+        program,
         full_dataset_num_items,
         full_dataset,
-        full_l1_dataset,
-
+        full_dataset_state,
     };
+
+    // The L1 cache only depends on the light cache, so build it once here
+    // instead of deriving every accessed word from the light cache on each hash.
+    build_l1_cache(l1_cache, *context);
     return context;
 }
 }  // namespace
@@ -1703,6 +1900,7 @@ epoch_context_full* ethash_create_epoch_context_full(int epoch_number) noexcept
 void ethash_destroy_epoch_context_full(epoch_context_full* context) noexcept
 {
     std::free(context->full_dataset);
+    delete context->full_dataset_state;
     ethash_destroy_epoch_context(context);
 }
 
@@ -1713,3 +1911,32 @@ void ethash_destroy_epoch_context(epoch_context* context) noexcept
 }
 
 }  // extern "C"
+
+namespace ethash
+{
+epoch_context* create_epoch_context_with_caches(
+    int epoch_number, const hash512* light_cache, const uint32_t* l1_cache) noexcept
+{
+    static constexpr size_t context_alloc_size = sizeof(hash512);
+    static constexpr size_t program_size = sizeof(ethash_progpow_program);
+
+    char* const alloc_data = static_cast<char*>(std::malloc(context_alloc_size + program_size));
+    if (!alloc_data)
+        return nullptr;
+
+    ethash_progpow_program* const program =
+        reinterpret_cast<ethash_progpow_program*>(alloc_data + context_alloc_size);
+    build_progpow_program(*program, static_cast<uint64_t>(epoch_number));
+
+    return new (alloc_data) epoch_context_full{
+        epoch_number,
+        calculate_light_cache_num_items(epoch_number),
+        light_cache,
+        l1_cache,
+        program,
+        calculate_full_dataset_num_items(epoch_number),
+        nullptr,
+        nullptr,
+    };
+}
+}  // namespace ethash
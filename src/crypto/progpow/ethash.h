@@ -29,12 +29,21 @@ extern "C" {
 #define ETHASH_MIX_BYTES 256
 #define ETHASH_DATASET_PARENTS 256
 #define ETHASH_HASH_BYTES 64
+#define ETHASH_PROGPOW_L1_CACHE_SIZE (16 * 1024)
+#define ETHASH_PROGPOW_LANES 32
+#define ETHASH_PROGPOW_REGS 16
+#define ETHASH_PROGPOW_CNT_CACHE 8
+#define ETHASH_PROGPOW_CNT_MATH 8
+
+struct ethash_progpow_program;
 
 struct ethash_epoch_context
 {
     const int epoch_number;
     const int light_cache_num_items;
     const union ethash_hash512* const light_cache;
+    const uint32_t* const l1_cache;
+    const struct ethash_progpow_program* const program;
     const int full_dataset_num_items;
     uint64_t block_number;
 };
@@ -79,8 +88,8 @@ struct ethash_epoch_context* ethash_create_epoch_context(int epoch_number) NOEXC
 /**
  * Creates the epoch context with the full dataset initialized.
  *
- * The memory for the full dataset is only allocated and marked as "not-generated".
- * The items of the full dataset are generated on the fly when hit for the first time.
+ * The memory for the full dataset is only allocated. Until the dataset is generated
+ * with ethash::build_full_dataset() hashes compute the items from the light cache.
  *
  * The memory allocated in the context MUST be freed with ethash_destroy_epoch_context_full().
  *
@@ -17,9 +17,11 @@
 #include "ethash.h"
 #include "hash_types.hpp"
 
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <string>
 
 namespace ethash
 {
@@ -112,6 +114,18 @@ inline epoch_context_full_ptr create_epoch_context_full(int epoch_number) noexce
     return {ethash_create_epoch_context_full(epoch_number), ethash_destroy_epoch_context_full};
 }
 
+/// Generates the full ProgPoW dataset of the context.
+///
+/// The item range is split across @p num_threads workers, including the
+/// calling thread. Progress is published in the full_dataset_state of the
+/// context and the dataset is marked ready when every item has been generated.
+/// A build stopped by @p cancel is resumed by the next call.
+///
+/// @param cancel  Stops the workers early when set, optional.
+/// @return        Whether the dataset is ready.
+bool build_full_dataset(epoch_context_full& context, unsigned num_threads,
+    const std::atomic<bool>* cancel = nullptr);
+
 result progpow(const epoch_context& context, const hash256& header_hash, uint64_t nonce) noexcept;
 
 result progpow(const epoch_context_full& context, const hash256& header_hash, uint64_t nonce) noexcept;
@@ -144,6 +158,9 @@ uint64_t progpow_search_light(const epoch_context& context, const hash256& heade
 
 RetVal check_progpow_nonce_light(const epoch_context& context, const hash256& header_hash,
     const hash256& boundary, uint64_t nonce) noexcept;
+
+RetVal check_progpow_nonce(const epoch_context_full& context, const hash256& header_hash,
+    const hash256& boundary, uint64_t nonce) noexcept;
 /////////////////////
 
 uint64_t search_light(const epoch_context& context, const hash256& header_hash,
@@ -164,9 +181,70 @@ uint64_t search(const epoch_context_full& context, const hash256& header_hash,
 int find_epoch_number(const hash256& seed) noexcept;
 
 
+/// Selects the fastest ProgPoW round and Keccak implementations supported by
+/// the CPU after checking them against the portable ones.
+///
+/// @return  The name of the selected implementation.
+const char* progpow_autodetect() noexcept;
+
+/// The default number of light epoch contexts kept by the global cache.
+static constexpr size_t default_epoch_context_cache_count = 3;
+
+/// The default memory limit of the global light epoch context cache.
+static constexpr size_t default_epoch_context_cache_bytes = size_t{256} * 1024 * 1024;
+
 /// Get global shared epoch context.
+///
+/// Light contexts are kept in a cache shared by all threads and evicted in
+/// least recently used order. The returned reference stays valid until the
+/// calling thread requests a context of another epoch.
+///
+/// @throws std::bad_alloc  If the context could not be created.
 const epoch_context& get_global_epoch_context(int epoch_number);
 
-/// Get global shared epoch context with full dataset initialized.
-const epoch_context_full& get_global_epoch_context_full(int epoch_number);
+/// Limits the global light epoch context cache to at most @p max_count
+/// contexts (at least 1) occupying at most @p max_bytes of memory. The most
+/// recently used context is kept regardless of its size.
+void set_epoch_context_cache_limits(size_t max_count, size_t max_bytes);
+
+/// Keeps the light epoch contexts of the global cache in files in @p dir, which
+/// must exist, and deletes the file of a context when it is evicted. An empty
+/// path keeps them in memory only.
+void set_epoch_context_dir(const std::string& dir);
+
+/// Starts building the light context of the given epoch in a background thread
+/// and adds it to the global cache, so that later lookups do not wait for it.
+///
+/// @return  False if the context is already cached or being built.
+bool prebuild_global_epoch_context(int epoch_number);
+
+/// Waits for the contexts being built in the background to be done, stopping
+/// the generation of the full dataset. Must be called before exiting while
+/// other threads may still start builds.
+void join_global_epoch_context_builds();
+
+/// Counters of the global light epoch context cache, since startup.
+struct epoch_context_cache_stats
+{
+    uint64_t hits;                     ///< Lookups served by a cached context.
+    uint64_t misses;                   ///< Lookups that had to build the context.
+    uint64_t builds;                   ///< Contexts built, prebuilt ones included.
+    uint64_t build_failures;           ///< Builds that failed to allocate.
+    uint64_t build_microseconds;       ///< Total duration of the builds.
+    uint64_t last_build_microseconds;  ///< Duration of the last build.
+    int last_build_epoch;              ///< Epoch of the last build, -1 before any.
+    size_t cached;                     ///< Contexts currently in the cache.
+};
+
+/// Returns the counters of the global light epoch context cache.
+epoch_context_cache_stats get_epoch_context_cache_stats() noexcept;
+
+/// Get global shared epoch context with full dataset.
+///
+/// The dataset of a new epoch is generated in the background on @p num_threads
+/// threads, all cores if 0; the context can be used meanwhile and is faster
+/// once the dataset is ready.
+///
+/// @throws std::bad_alloc  If the context could not be created.
+const epoch_context_full& get_global_epoch_context_full(int epoch_number, unsigned num_threads = 0);
 }  // namespace ethash
@@ -30,6 +30,35 @@ extern "C" {
 void ethash_keccakf1600(uint64_t state[25]) NOEXCEPT;
 void keccak_f800_round(uint32_t st[25], const int r) NOEXCEPT;
 
+/**
+ * The Keccak-f[800] function, all 22 rounds of keccak_f800_round() unrolled.
+ *
+ * @param state  The state of 25 32-bit words on which the permutation is to be performed.
+ */
+void ethash_keccakf800(uint32_t state[25]) NOEXCEPT;
+
+typedef void (*ethash_keccakf1600_fn)(uint64_t state[25]);
+typedef void (*ethash_keccakf800_fn)(uint32_t state[25]);
+
+/** The permutations called by ethash_keccakf1600() and ethash_keccakf800(). */
+extern ethash_keccakf1600_fn ethash_keccakf1600_impl;
+extern ethash_keccakf800_fn ethash_keccakf800_impl;
+
+/** The portable implementations of the permutations. */
+void ethash_keccakf1600_generic(uint64_t state[25]) NOEXCEPT;
+void ethash_keccakf800_generic(uint32_t state[25]) NOEXCEPT;
+
+#if (defined(__x86_64__) || defined(__amd64__)) && defined(__GNUC__)
+#define ETHASH_KECCAK_BMI2 1
+
+/** Whether the CPU supports BMI1 and BMI2. */
+int ethash_keccak_bmi2_supported(void) NOEXCEPT;
+
+/** The permutations compiled for BMI1/BMI2, only to be called if the CPU supports both. */
+void ethash_keccakf1600_bmi2(uint64_t state[25]) NOEXCEPT;
+void ethash_keccakf800_bmi2(uint32_t state[25]) NOEXCEPT;
+#endif
+
 union ethash_hash256 ethash_keccak256(const uint8_t* data, size_t size) NOEXCEPT;
 union ethash_hash256 ethash_keccak256_32(const uint8_t data[32]) NOEXCEPT;
 union ethash_hash512 ethash_keccak512(const uint8_t* data, size_t size) NOEXCEPT;
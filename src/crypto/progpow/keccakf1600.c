@@ -3,9 +3,33 @@
  * Licensed under the Apache License, Version 2.0. See the LICENSE file.
  */
 
+#include "keccak.h"
+
 #include <stdint.h>
 
-static uint64_t rol(uint64_t x, unsigned s)
+#if ETHASH_KECCAK_BMI2
+#include <cpuid.h>
+#endif
+
+#if _MSC_VER || __STDC_VERSION__
+#define INLINE inline
+#else
+#define INLINE
+#endif
+
+#if _MSC_VER
+#define ALWAYS_INLINE __forceinline
+#elif defined(__has_attribute) && __STDC_VERSION__
+#if __has_attribute(always_inline)
+#define ALWAYS_INLINE __attribute__((always_inline))
+#endif
+#endif
+
+#if !defined(ALWAYS_INLINE)
+#define ALWAYS_INLINE
+#endif
+
+static INLINE ALWAYS_INLINE uint64_t rol(uint64_t x, unsigned s)
 {
     return (x << s) | (x >> (64 - s));
 }
@@ -37,7 +61,7 @@ static const uint64_t round_constants[24] = {
     0x8000000080008008,
 };
 
-void ethash_keccakf1600(uint64_t state[25])
+static INLINE ALWAYS_INLINE void keccakf1600(uint64_t state[25])
 {
     /* The implementation based on the "simple" implementation by Ronny Van Keer. */
 
@@ -253,3 +277,33 @@ void ethash_keccakf1600(uint64_t state[25])
     state[23] = Aso;
     state[24] = Asu;
 }
+
+void ethash_keccakf1600_generic(uint64_t state[25])
+{
+    keccakf1600(state);
+}
+
+#if ETHASH_KECCAK_BMI2
+int ethash_keccak_bmi2_supported(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, 0) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return ((ebx >> 3) & 1) && ((ebx >> 8) & 1);
+}
+
+/* The same rounds compiled for BMI1/BMI2, so that the compiler can use ANDN
+   for the chi step and RORX for the rotations. */
+__attribute__((target("bmi,bmi2"))) void ethash_keccakf1600_bmi2(uint64_t state[25])
+{
+    keccakf1600(state);
+}
+#endif
+
+ethash_keccakf1600_fn ethash_keccakf1600_impl = ethash_keccakf1600_generic;
+
+void ethash_keccakf1600(uint64_t state[25])
+{
+    ethash_keccakf1600_impl(state);
+}
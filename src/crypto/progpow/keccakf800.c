@@ -3,8 +3,28 @@
  * Licensed under the Apache License, Version 2.0. See the LICENSE file.
  */
 
+#include "keccak.h"
+
 #include <stdint.h>
 
+#if _MSC_VER || __STDC_VERSION__
+#define INLINE inline
+#else
+#define INLINE
+#endif
+
+#if _MSC_VER
+#define ALWAYS_INLINE __forceinline
+#elif defined(__has_attribute) && __STDC_VERSION__
+#if __has_attribute(always_inline)
+#define ALWAYS_INLINE __attribute__((always_inline))
+#endif
+#endif
+
+#if !defined(ALWAYS_INLINE)
+#define ALWAYS_INLINE
+#endif
+
  /* Implementation based on:
 	https://github.com/mjosaarinen/tiny_sha3/blob/master/sha3.c
 	converted from 64->32 bit words*/
@@ -15,6 +35,11 @@ const uint32_t prog_keccakf_rndc[24] = {
 	0x0000800a, 0x8000000a, 0x80008081, 0x00008080, 0x80000001, 0x80008008
 };
 
+static INLINE ALWAYS_INLINE uint32_t rol32(uint32_t x, unsigned s)
+{
+    return (x << s) | (x >> (32 - s));
+}
+
 #define ROTL(x,n,w) (((x) << (n)) | ((x) >> ((w) - (n))))
 #define ROTL32(x,n) ROTL(x,n,32)	/* 32 bits word */
 
@@ -75,3 +100,240 @@ void keccak_f800_round(uint32_t st[25], const int r)
 	/* Iota*/
 	st[0] ^= prog_keccakf_rndc[r];
 }
+
+static INLINE ALWAYS_INLINE void keccakf800(uint32_t state[25])
+{
+    /* The keccakf1600() rounds on 32-bit lanes, rotations are taken modulo 32. */
+
+    int round;
+
+    uint32_t Aba, Abe, Abi, Abo, Abu;
+    uint32_t Aga, Age, Agi, Ago, Agu;
+    uint32_t Aka, Ake, Aki, Ako, Aku;
+    uint32_t Ama, Ame, Ami, Amo, Amu;
+    uint32_t Asa, Ase, Asi, Aso, Asu;
+
+    uint32_t Eba, Ebe, Ebi, Ebo, Ebu;
+    uint32_t Ega, Ege, Egi, Ego, Egu;
+    uint32_t Eka, Eke, Eki, Eko, Eku;
+    uint32_t Ema, Eme, Emi, Emo, Emu;
+    uint32_t Esa, Ese, Esi, Eso, Esu;
+
+    uint32_t Ba, Be, Bi, Bo, Bu;
+
+    uint32_t Da, De, Di, Do, Du;
+
+    Aba = state[0];
+    Abe = state[1];
+    Abi = state[2];
+    Abo = state[3];
+    Abu = state[4];
+    Aga = state[5];
+    Age = state[6];
+    Agi = state[7];
+    Ago = state[8];
+    Agu = state[9];
+    Aka = state[10];
+    Ake = state[11];
+    Aki = state[12];
+    Ako = state[13];
+    Aku = state[14];
+    Ama = state[15];
+    Ame = state[16];
+    Ami = state[17];
+    Amo = state[18];
+    Amu = state[19];
+    Asa = state[20];
+    Ase = state[21];
+    Asi = state[22];
+    Aso = state[23];
+    Asu = state[24];
+
+    for (round = 0; round < 22; round += 2)
+    {
+        /* Round (round + 0): Axx -> Exx */
+
+        Ba = Aba ^ Aga ^ Aka ^ Ama ^ Asa;
+        Be = Abe ^ Age ^ Ake ^ Ame ^ Ase;
+        Bi = Abi ^ Agi ^ Aki ^ Ami ^ Asi;
+        Bo = Abo ^ Ago ^ Ako ^ Amo ^ Aso;
+        Bu = Abu ^ Agu ^ Aku ^ Amu ^ Asu;
+
+        Da = Bu ^ rol32(Be, 1);
+        De = Ba ^ rol32(Bi, 1);
+        Di = Be ^ rol32(Bo, 1);
+        Do = Bi ^ rol32(Bu, 1);
+        Du = Bo ^ rol32(Ba, 1);
+
+        Ba = Aba ^ Da;
+        Be = rol32(Age ^ De, 12);
+        Bi = rol32(Aki ^ Di, 11);
+        Bo = rol32(Amo ^ Do, 21);
+        Bu = rol32(Asu ^ Du, 14);
+        Eba = Ba ^ (~Be & Bi) ^ prog_keccakf_rndc[round];
+        Ebe = Be ^ (~Bi & Bo);
+        Ebi = Bi ^ (~Bo & Bu);
+        Ebo = Bo ^ (~Bu & Ba);
+        Ebu = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Abo ^ Do, 28);
+        Be = rol32(Agu ^ Du, 20);
+        Bi = rol32(Aka ^ Da, 3);
+        Bo = rol32(Ame ^ De, 13);
+        Bu = rol32(Asi ^ Di, 29);
+        Ega = Ba ^ (~Be & Bi);
+        Ege = Be ^ (~Bi & Bo);
+        Egi = Bi ^ (~Bo & Bu);
+        Ego = Bo ^ (~Bu & Ba);
+        Egu = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Abe ^ De, 1);
+        Be = rol32(Agi ^ Di, 6);
+        Bi = rol32(Ako ^ Do, 25);
+        Bo = rol32(Amu ^ Du, 8);
+        Bu = rol32(Asa ^ Da, 18);
+        Eka = Ba ^ (~Be & Bi);
+        Eke = Be ^ (~Bi & Bo);
+        Eki = Bi ^ (~Bo & Bu);
+        Eko = Bo ^ (~Bu & Ba);
+        Eku = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Abu ^ Du, 27);
+        Be = rol32(Aga ^ Da, 4);
+        Bi = rol32(Ake ^ De, 10);
+        Bo = rol32(Ami ^ Di, 15);
+        Bu = rol32(Aso ^ Do, 24);
+        Ema = Ba ^ (~Be & Bi);
+        Eme = Be ^ (~Bi & Bo);
+        Emi = Bi ^ (~Bo & Bu);
+        Emo = Bo ^ (~Bu & Ba);
+        Emu = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Abi ^ Di, 30);
+        Be = rol32(Ago ^ Do, 23);
+        Bi = rol32(Aku ^ Du, 7);
+        Bo = rol32(Ama ^ Da, 9);
+        Bu = rol32(Ase ^ De, 2);
+        Esa = Ba ^ (~Be & Bi);
+        Ese = Be ^ (~Bi & Bo);
+        Esi = Bi ^ (~Bo & Bu);
+        Eso = Bo ^ (~Bu & Ba);
+        Esu = Bu ^ (~Ba & Be);
+
+
+        /* Round (round + 1): Exx -> Axx */
+
+        Ba = Eba ^ Ega ^ Eka ^ Ema ^ Esa;
+        Be = Ebe ^ Ege ^ Eke ^ Eme ^ Ese;
+        Bi = Ebi ^ Egi ^ Eki ^ Emi ^ Esi;
+        Bo = Ebo ^ Ego ^ Eko ^ Emo ^ Eso;
+        Bu = Ebu ^ Egu ^ Eku ^ Emu ^ Esu;
+
+        Da = Bu ^ rol32(Be, 1);
+        De = Ba ^ rol32(Bi, 1);
+        Di = Be ^ rol32(Bo, 1);
+        Do = Bi ^ rol32(Bu, 1);
+        Du = Bo ^ rol32(Ba, 1);
+
+        Ba = Eba ^ Da;
+        Be = rol32(Ege ^ De, 12);
+        Bi = rol32(Eki ^ Di, 11);
+        Bo = rol32(Emo ^ Do, 21);
+        Bu = rol32(Esu ^ Du, 14);
+        Aba = Ba ^ (~Be & Bi) ^ prog_keccakf_rndc[round + 1];
+        Abe = Be ^ (~Bi & Bo);
+        Abi = Bi ^ (~Bo & Bu);
+        Abo = Bo ^ (~Bu & Ba);
+        Abu = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Ebo ^ Do, 28);
+        Be = rol32(Egu ^ Du, 20);
+        Bi = rol32(Eka ^ Da, 3);
+        Bo = rol32(Eme ^ De, 13);
+        Bu = rol32(Esi ^ Di, 29);
+        Aga = Ba ^ (~Be & Bi);
+        Age = Be ^ (~Bi & Bo);
+        Agi = Bi ^ (~Bo & Bu);
+        Ago = Bo ^ (~Bu & Ba);
+        Agu = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Ebe ^ De, 1);
+        Be = rol32(Egi ^ Di, 6);
+        Bi = rol32(Eko ^ Do, 25);
+        Bo = rol32(Emu ^ Du, 8);
+        Bu = rol32(Esa ^ Da, 18);
+        Aka = Ba ^ (~Be & Bi);
+        Ake = Be ^ (~Bi & Bo);
+        Aki = Bi ^ (~Bo & Bu);
+        Ako = Bo ^ (~Bu & Ba);
+        Aku = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Ebu ^ Du, 27);
+        Be = rol32(Ega ^ Da, 4);
+        Bi = rol32(Eke ^ De, 10);
+        Bo = rol32(Emi ^ Di, 15);
+        Bu = rol32(Eso ^ Do, 24);
+        Ama = Ba ^ (~Be & Bi);
+        Ame = Be ^ (~Bi & Bo);
+        Ami = Bi ^ (~Bo & Bu);
+        Amo = Bo ^ (~Bu & Ba);
+        Amu = Bu ^ (~Ba & Be);
+
+        Ba = rol32(Ebi ^ Di, 30);
+        Be = rol32(Ego ^ Do, 23);
+        Bi = rol32(Eku ^ Du, 7);
+        Bo = rol32(Ema ^ Da, 9);
+        Bu = rol32(Ese ^ De, 2);
+        Asa = Ba ^ (~Be & Bi);
+        Ase = Be ^ (~Bi & Bo);
+        Asi = Bi ^ (~Bo & Bu);
+        Aso = Bo ^ (~Bu & Ba);
+        Asu = Bu ^ (~Ba & Be);
+    }
+
+    state[0] = Aba;
+    state[1] = Abe;
+    state[2] = Abi;
+    state[3] = Abo;
+    state[4] = Abu;
+    state[5] = Aga;
+    state[6] = Age;
+    state[7] = Agi;
+    state[8] = Ago;
+    state[9] = Agu;
+    state[10] = Aka;
+    state[11] = Ake;
+    state[12] = Aki;
+    state[13] = Ako;
+    state[14] = Aku;
+    state[15] = Ama;
+    state[16] = Ame;
+    state[17] = Ami;
+    state[18] = Amo;
+    state[19] = Amu;
+    state[20] = Asa;
+    state[21] = Ase;
+    state[22] = Asi;
+    state[23] = Aso;
+    state[24] = Asu;
+}
+
+void ethash_keccakf800_generic(uint32_t state[25])
+{
+    keccakf800(state);
+}
+
+#if ETHASH_KECCAK_BMI2
+/* See ethash_keccakf1600_bmi2(). */
+__attribute__((target("bmi,bmi2"))) void ethash_keccakf800_bmi2(uint32_t state[25])
+{
+    keccakf800(state);
+}
+#endif
+
+ethash_keccakf800_fn ethash_keccakf800_impl = ethash_keccakf800_generic;
+
+void ethash_keccakf800(uint32_t state[25])
+{
+    ethash_keccakf800_impl(state);
+}
@@ -4,8 +4,18 @@
 
 #include "ethash-internal.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <list>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
 
 #if !defined(__has_cpp_attribute)
 #define __has_cpp_attribute(x) 0
@@ -23,43 +33,278 @@ namespace ethash
 {
 namespace
 {
+using shared_context_future = std::shared_future<std::shared_ptr<epoch_context>>;
+
+/// An entry of the shared epoch context cache.
+///
+/// The context is published through a future so that it can be built without
+/// holding the cache lock: lookups of other epochs proceed meanwhile and
+/// concurrent lookups of the same epoch wait for the single build.
+struct shared_context_entry
+{
+    int epoch_number;
+    size_t size;
+    shared_context_future context;
+    /// The promise of the context while it is being built, to find the entry
+    /// again even if another one of the same epoch was inserted meanwhile.
+    const void* builder;
+};
+
 std::mutex shared_context_mutex;
-std::shared_ptr<epoch_context> shared_context;
+std::list<shared_context_entry> shared_contexts;  // Most recently used first.
+size_t shared_context_max_count = default_epoch_context_cache_count;
+size_t shared_context_max_bytes = default_epoch_context_cache_bytes;
+std::string shared_context_dir;
 thread_local std::shared_ptr<epoch_context> thread_local_context;
 
+/// The context hits of one thread. Only the owning thread writes it, so a hit
+/// is counted without a locked instruction on a cache line shared by threads.
+struct thread_hit_counter
+{
+    std::atomic<uint64_t> hits{0};
+
+    thread_hit_counter();
+    ~thread_hit_counter();
+
+    void add() noexcept { hits.store(hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+};
+
+std::mutex hit_counters_mutex;
+std::vector<const thread_hit_counter*> hit_counters;  // Guarded by hit_counters_mutex.
+uint64_t exited_threads_hits = 0;  // Guarded by hit_counters_mutex.
+
+thread_hit_counter::thread_hit_counter()
+{
+    std::lock_guard<std::mutex> lock{hit_counters_mutex};
+    hit_counters.push_back(this);
+}
+
+thread_hit_counter::~thread_hit_counter()
+{
+    std::lock_guard<std::mutex> lock{hit_counters_mutex};
+    exited_threads_hits += hits.load(std::memory_order_relaxed);
+    hit_counters.erase(std::find(hit_counters.begin(), hit_counters.end(), this));
+}
+
+thread_local thread_hit_counter context_hits;
+std::atomic<uint64_t> context_misses{0};
+// Build statistics, guarded by shared_context_mutex.
+uint64_t context_builds = 0;
+uint64_t context_build_failures = 0;
+uint64_t context_build_microseconds = 0;
+uint64_t context_last_build_microseconds = 0;
+int context_last_build_epoch = -1;
+
 std::mutex shared_context_full_mutex;
 std::shared_ptr<epoch_context_full> shared_context_full;
+std::shared_ptr<std::atomic<bool>> shared_context_full_cancel;
 thread_local std::shared_ptr<epoch_context_full> thread_local_context_full;
 
+/// A thread building a context in the background, with a flag set when it is done.
+struct background_build
+{
+    std::thread thread;
+    std::shared_ptr<std::atomic<bool>> done;
+};
+
+std::mutex background_builds_mutex;
+std::vector<background_build> background_builds;
+
+/// Runs the build in a background thread, joined by join_background_builds().
+void start_background_build(std::function<void()> build)
+{
+    std::lock_guard<std::mutex> lock{background_builds_mutex};
+
+    // Join the finished builds, which returns at once.
+    for (auto it = background_builds.begin(); it != background_builds.end();)
+    {
+        if (it->done->load())
+        {
+            it->thread.join();
+            it = background_builds.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+    background_builds.push_back({std::thread{[build, done] {
+                                     build();
+                                     *done = true;
+                                 }},
+        done});
+}
+
+void join_background_builds()
+{
+    std::vector<background_build> builds;
+    {
+        std::lock_guard<std::mutex> lock{background_builds_mutex};
+        builds.swap(background_builds);
+    }
+    for (background_build& b : builds)
+        b.thread.join();
+}
+
+/// Joins the background builds at exit, before the caches they use are destroyed.
+struct background_builds_joiner
+{
+    ~background_builds_joiner() { join_background_builds(); }
+} joiner_at_exit;
+
+/// Estimates the memory used by the light epoch context of the given epoch.
+size_t get_epoch_context_size(int epoch_number) noexcept
+{
+    return sizeof(epoch_context) +
+           get_light_cache_size(calculate_light_cache_num_items(epoch_number)) +
+           ETHASH_PROGPOW_L1_CACHE_SIZE + sizeof(ethash_progpow_program);
+}
+
+/// Drops the least recently used entries exceeding the cache limits.
+/// The most recently used entry is always kept.
+void evict_shared_contexts()
+{
+    size_t total_size = 0;
+    size_t count = 0;
+    auto it = shared_contexts.begin();
+    for (; it != shared_contexts.end(); ++it)
+    {
+        if (count > 0 && (count >= shared_context_max_count ||
+                             total_size + it->size > shared_context_max_bytes))
+            break;
+        total_size += it->size;
+        ++count;
+    }
+
+    // Contexts still referenced by threads stay alive until they are released.
+    // Their files are deleted, the directory only keeps the cached epochs.
+    if (!shared_context_dir.empty())
+    {
+        for (auto e = it; e != shared_contexts.end(); ++e)
+            remove_epoch_context_file(shared_context_dir, e->epoch_number);
+    }
+    shared_contexts.erase(it, shared_contexts.end());
+}
+
+/// Whether the cache has an entry of the given epoch.
+///
+/// Must be called with shared_context_mutex held.
+bool has_shared_context(int epoch_number)
+{
+    for (const shared_context_entry& e : shared_contexts)
+    {
+        if (e.epoch_number == epoch_number)
+            return true;
+    }
+    return false;
+}
+
+/// Builds the context promised to the cache entry of the given epoch.
+/// On failure the entry is removed so that a later lookup retries.
+void build_shared_context(int epoch_number, std::promise<std::shared_ptr<epoch_context>>& promise)
+{
+    std::string dir;
+    {
+        std::lock_guard<std::mutex> lock{shared_context_mutex};
+        dir = shared_context_dir;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<epoch_context> context = dir.empty() ?
+        std::shared_ptr<epoch_context>{create_epoch_context(epoch_number)} :
+        load_epoch_context_file(dir, epoch_number);
+    const uint64_t duration = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    {
+        std::lock_guard<std::mutex> lock{shared_context_mutex};
+        const void* const builder = &promise;
+        if (context)
+        {
+            ++context_builds;
+            context_build_microseconds += duration;
+            context_last_build_microseconds = duration;
+            context_last_build_epoch = epoch_number;
+            for (shared_context_entry& e : shared_contexts)
+            {
+                if (e.builder == builder)
+                    e.builder = nullptr;
+            }
+            // The entry was evicted during the build, after which the file
+            // was written.
+            if (!dir.empty() && dir == shared_context_dir && !has_shared_context(epoch_number))
+                remove_epoch_context_file(dir, epoch_number);
+        }
+        else
+        {
+            ++context_build_failures;
+            shared_contexts.remove_if(
+                [builder](const shared_context_entry& e) { return e.builder == builder; });
+        }
+    }
+    promise.set_value(std::move(context));
+}
+
+/// Finds the cache entry of the given epoch and marks it as most recently used
+/// or, if missing, inserts a new one with the returned promise to fulfil.
+///
+/// Must be called with shared_context_mutex held.
+std::unique_ptr<std::promise<std::shared_ptr<epoch_context>>> find_or_insert_shared_context(
+    int epoch_number, shared_context_future& context)
+{
+    for (auto it = shared_contexts.begin(); it != shared_contexts.end(); ++it)
+    {
+        if (it->epoch_number == epoch_number)
+        {
+            shared_contexts.splice(shared_contexts.begin(), shared_contexts, it);
+            context = it->context;
+            return nullptr;
+        }
+    }
+
+    std::unique_ptr<std::promise<std::shared_ptr<epoch_context>>> promise{
+        new std::promise<std::shared_ptr<epoch_context>>};
+    context = promise->get_future().share();
+    shared_contexts.push_front(
+        {epoch_number, get_epoch_context_size(epoch_number), context, promise.get()});
+    evict_shared_contexts();
+    return promise;
+}
+
 /// Update thread local epoch context.
 ///
 /// This function is on the slow path. It's separated to allow inlining the fast
 /// path.
-///
-/// @todo: Redesign to guarantee deallocation before new allocation.
 ATTRIBUTE_NOINLINE
 void update_local_context(int epoch_number)
 {
     // Release the shared pointer of the obsoleted context.
     thread_local_context.reset();
 
-    // Local context invalid, check the shared context.
-    std::lock_guard<std::mutex> lock{shared_context_mutex};
-
-    if (!shared_context || shared_context->epoch_number != epoch_number)
+    shared_context_future context;
+    std::unique_ptr<std::promise<std::shared_ptr<epoch_context>>> promise;
     {
-        // Release the shared pointer of the obsoleted context.
-        shared_context.reset();
+        std::lock_guard<std::mutex> lock{shared_context_mutex};
+        promise = find_or_insert_shared_context(epoch_number, context);
+    }
 
-        // Build new context.
-        shared_context = create_epoch_context(epoch_number);
+    // Build the missing context outside of the lock.
+    if (promise)
+    {
+        ++context_misses;
+        build_shared_context(epoch_number, *promise);
+    }
+    else
+    {
+        context_hits.add();
     }
 
-    thread_local_context = shared_context;
+    thread_local_context = context.get();
+    if (!thread_local_context)
+        throw std::bad_alloc{};
 }
 
 ATTRIBUTE_NOINLINE
-void update_local_context_full(int epoch_number)
+void update_local_context_full(int epoch_number, unsigned num_threads)
 {
     // Release the shared pointer of the obsoleted context.
     thread_local_context_full.reset();
@@ -69,11 +314,24 @@ void update_local_context_full(int epoch_number)
 
     if (!shared_context_full || shared_context_full->epoch_number != epoch_number)
     {
-        // Release the shared pointer of the obsoleted context.
+        // Stop building the dataset of the obsoleted context and release it.
+        if (shared_context_full_cancel)
+            *shared_context_full_cancel = true;
         shared_context_full.reset();
 
-        // Build new context.
-        shared_context_full = create_epoch_context_full(epoch_number);
+        // Create new context and generate its dataset in the background. It is
+        // usable meanwhile, hashes compute the items from the light cache.
+        std::shared_ptr<epoch_context_full> context{create_epoch_context_full(epoch_number)};
+        if (!context)
+            throw std::bad_alloc{};
+        std::shared_ptr<std::atomic<bool>> cancel = std::make_shared<std::atomic<bool>>(false);
+        if (num_threads == 0)
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        start_background_build(
+            [context, cancel, num_threads] { build_full_dataset(*context, num_threads, cancel.get()); });
+
+        shared_context_full = std::move(context);
+        shared_context_full_cancel = std::move(cancel);
     }
 
     thread_local_context_full = shared_context_full;
@@ -85,16 +343,81 @@ const epoch_context& get_global_epoch_context(int epoch_number)
     // Check if local context matches epoch number.
     if (!thread_local_context || thread_local_context->epoch_number != epoch_number)
         update_local_context(epoch_number);
+    else
+        context_hits.add();
 
     return *thread_local_context;
 }
 
-const epoch_context_full& get_global_epoch_context_full(int epoch_number)
+const epoch_context_full& get_global_epoch_context_full(int epoch_number, unsigned num_threads)
 {
     // Check if local context matches epoch number.
     if (!thread_local_context_full || thread_local_context_full->epoch_number != epoch_number)
-        update_local_context_full(epoch_number);
+        update_local_context_full(epoch_number, num_threads);
 
     return *thread_local_context_full;
 }
+
+void set_epoch_context_cache_limits(size_t max_count, size_t max_bytes)
+{
+    std::lock_guard<std::mutex> lock{shared_context_mutex};
+    shared_context_max_count = max_count > 0 ? max_count : 1;
+    shared_context_max_bytes = max_bytes;
+    evict_shared_contexts();
+}
+
+void set_epoch_context_dir(const std::string& dir)
+{
+    std::lock_guard<std::mutex> lock{shared_context_mutex};
+    shared_context_dir = dir;
+}
+
+epoch_context_cache_stats get_epoch_context_cache_stats() noexcept
+{
+    std::lock_guard<std::mutex> lock{shared_context_mutex};
+    epoch_context_cache_stats stats;
+    {
+        std::lock_guard<std::mutex> counters_lock{hit_counters_mutex};
+        stats.hits = exited_threads_hits;
+        for (const thread_hit_counter* counter : hit_counters)
+            stats.hits += counter->hits.load(std::memory_order_relaxed);
+    }
+    stats.misses = context_misses.load(std::memory_order_relaxed);
+    stats.builds = context_builds;
+    stats.build_failures = context_build_failures;
+    stats.build_microseconds = context_build_microseconds;
+    stats.last_build_microseconds = context_last_build_microseconds;
+    stats.last_build_epoch = context_last_build_epoch;
+    stats.cached = shared_contexts.size();
+    return stats;
+}
+
+bool prebuild_global_epoch_context(int epoch_number)
+{
+    if (epoch_number < 0)
+        return false;
+
+    shared_context_future context;
+    std::shared_ptr<std::promise<std::shared_ptr<epoch_context>>> promise;
+    {
+        std::lock_guard<std::mutex> lock{shared_context_mutex};
+        promise = find_or_insert_shared_context(epoch_number, context);
+    }
+    if (!promise)
+        return false;
+
+    // The builder owns the promise and updates the cache entry when done.
+    start_background_build([epoch_number, promise] { build_shared_context(epoch_number, *promise); });
+    return true;
+}
+
+void join_global_epoch_context_builds()
+{
+    {
+        std::lock_guard<std::mutex> lock{shared_context_full_mutex};
+        if (shared_context_full_cancel)
+            *shared_context_full_cancel = true;
+    }
+    join_background_builds();
+}
 }  // namespace ethash
@@ -0,0 +1,185 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/// @file
+/// Light epoch contexts backed by cache files. The light cache and the L1 cache
+/// of an epoch are written once to <dir>/epoch-N.cache and mapped read-only by
+/// later lookups, so restarts skip build_light_cache() and processes using the
+/// same directory share the pages. The file of an epoch is deleted when the
+/// global cache evicts its context.
+
+#include "ethash-internal.hpp"
+
+#include "keccak.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ethash
+{
+#if !defined(_WIN32)
+namespace
+{
+static constexpr char cache_file_magic[8] = {'P', 'R', 'O', 'G', 'P', 'O', 'W', 'C'};
+static constexpr uint32_t cache_file_version = 1;
+static constexpr uint32_t cache_file_byte_order = 0x01020304;
+
+/// The header of an epoch cache file, followed by the light cache items and
+/// the L1 cache words in host byte order.
+struct cache_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t epoch_number;
+    int32_t light_cache_num_items;
+    uint32_t l1_cache_size;
+    uint32_t reserved;
+    hash256 checksum;
+};
+
+static_assert(sizeof(cache_file_header) == sizeof(hash512), "cache file header must keep items aligned");
+
+/// The checksum covers both caches: keccak256 of their concatenated keccak256 hashes.
+hash256 calculate_cache_checksum(
+    const hash512* light_cache, int light_cache_num_items, const uint32_t* l1_cache) noexcept
+{
+    hash256 hashes[2];
+    hashes[0] = keccak256(reinterpret_cast<const uint8_t*>(light_cache),
+        get_light_cache_size(light_cache_num_items));
+    hashes[1] = keccak256(reinterpret_cast<const uint8_t*>(l1_cache), ETHASH_PROGPOW_L1_CACHE_SIZE);
+    return keccak256(reinterpret_cast<const uint8_t*>(hashes), sizeof(hashes));
+}
+
+std::string get_cache_file_path(const std::string& dir, int epoch_number)
+{
+    return dir + "/epoch-" + std::to_string(epoch_number) + ".cache";
+}
+
+size_t get_cache_file_size(int light_cache_num_items) noexcept
+{
+    return sizeof(cache_file_header) + get_light_cache_size(light_cache_num_items) +
+           ETHASH_PROGPOW_L1_CACHE_SIZE;
+}
+
+/// Maps the cache file of the epoch. Returns null if the file is missing or
+/// does not match the epoch and its checksum.
+std::shared_ptr<epoch_context> map_cache_file(const std::string& path, int epoch_number)
+{
+    const int light_cache_num_items = calculate_light_cache_num_items(epoch_number);
+    const size_t file_size = get_cache_file_size(light_cache_num_items);
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return {};
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != file_size)
+    {
+        close(fd);
+        return {};
+    }
+    void* const data = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return {};
+
+    const cache_file_header& header = *static_cast<const cache_file_header*>(data);
+    const hash512* const light_cache = reinterpret_cast<const hash512*>(&header + 1);
+    const uint32_t* const l1_cache = reinterpret_cast<const uint32_t*>(light_cache + light_cache_num_items);
+
+    epoch_context* context = nullptr;
+    if (std::memcmp(header.magic, cache_file_magic, sizeof(cache_file_magic)) == 0 &&
+        header.version == cache_file_version && header.byte_order == cache_file_byte_order &&
+        header.epoch_number == epoch_number &&
+        header.light_cache_num_items == light_cache_num_items &&
+        header.l1_cache_size == ETHASH_PROGPOW_L1_CACHE_SIZE &&
+        std::memcmp(header.checksum.bytes,
+            calculate_cache_checksum(light_cache, light_cache_num_items, l1_cache).bytes,
+            sizeof(header.checksum)) == 0)
+        context = create_epoch_context_with_caches(epoch_number, light_cache, l1_cache);
+
+    if (!context)
+    {
+        munmap(data, file_size);
+        return {};
+    }
+
+    return std::shared_ptr<epoch_context>{context, [data, file_size](epoch_context* c) {
+        ethash_destroy_epoch_context(c);
+        munmap(data, file_size);
+    }};
+}
+
+/// Writes the caches of the context to the file. The file is written under a
+/// temporary name and renamed, so readers never see a partial file.
+bool write_cache_file(const std::string& path, const epoch_context& context)
+{
+    cache_file_header header{};
+    std::memcpy(header.magic, cache_file_magic, sizeof(cache_file_magic));
+    header.version = cache_file_version;
+    header.byte_order = cache_file_byte_order;
+    header.epoch_number = context.epoch_number;
+    header.light_cache_num_items = context.light_cache_num_items;
+    header.l1_cache_size = ETHASH_PROGPOW_L1_CACHE_SIZE;
+    header.checksum =
+        calculate_cache_checksum(context.light_cache, context.light_cache_num_items, context.l1_cache);
+
+    const std::string tmp_path = path + "." + std::to_string(getpid()) + ".tmp";
+    FILE* const file = std::fopen(tmp_path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(context.light_cache, get_light_cache_size(context.light_cache_num_items), 1, file) == 1 &&
+              std::fwrite(context.l1_cache, ETHASH_PROGPOW_L1_CACHE_SIZE, 1, file) == 1;
+    ok = std::fclose(file) == 0 && ok;
+
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+}  // namespace
+
+std::shared_ptr<epoch_context> load_epoch_context_file(const std::string& dir, int epoch_number)
+{
+    const std::string path = get_cache_file_path(dir, epoch_number);
+    if (std::shared_ptr<epoch_context> context = map_cache_file(path, epoch_number))
+        return context;
+
+    std::shared_ptr<epoch_context> context{create_epoch_context(epoch_number)};
+    if (!context || !write_cache_file(path, *context))
+        return context;
+
+    // Prefer the mapping so that the pages are shared with other processes.
+    if (std::shared_ptr<epoch_context> mapped = map_cache_file(path, epoch_number))
+        return mapped;
+    return context;
+}
+
+void remove_epoch_context_file(const std::string& dir, int epoch_number)
+{
+    // Mappings of the file stay valid, only its name is removed.
+    std::remove(get_cache_file_path(dir, epoch_number).c_str());
+}
+#else
+std::shared_ptr<epoch_context> load_epoch_context_file(const std::string&, int epoch_number)
+{
+    // Cache files are not mapped on Windows, build the context in memory.
+    return std::shared_ptr<epoch_context>{create_epoch_context(epoch_number)};
+}
+
+void remove_epoch_context_file(const std::string&, int) {}
+#endif
+}  // namespace ethash
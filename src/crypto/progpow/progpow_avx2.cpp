@@ -0,0 +1,275 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/// @file
+/// AVX2 implementation of a ProgPoW round. All lanes execute the same program,
+/// so 8 lanes are kept in every vector and each program step is applied to
+/// them at once. Also a 4-way keccak512 for the dataset item mixes. The
+/// functions are compiled with the avx2 target attribute and must only be
+/// called after progpow_avx2::supported() returned true.
+
+#include "ethash-internal.hpp"
+
+#if defined(ETHASH_PROGPOW_AVX2)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define ATTRIBUTE_AVX2 __attribute__((target("avx2")))
+
+namespace ethash
+{
+namespace progpow_avx2
+{
+namespace
+{
+static constexpr int lanes_per_vector = 8;
+static constexpr uint32_t l1_cache_words = ETHASH_PROGPOW_L1_CACHE_SIZE / sizeof(uint32_t);
+static_assert((l1_cache_words & (l1_cache_words - 1)) == 0, "L1 cache offset must be a mask");
+static_assert(ETHASH_PROGPOW_LANES % lanes_per_vector == 0, "lanes must fill whole vectors");
+
+ATTRIBUTE_AVX2 inline __m256i popcount(__m256i x)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    const __m256i lo = _mm256_and_si256(x, low4);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low4);
+    const __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+    // Sum the four byte counts of every word into its top byte.
+    return _mm256_srli_epi32(_mm256_mullo_epi32(bytes, _mm256_set1_epi32(0x01010101)), 24);
+}
+
+ATTRIBUTE_AVX2 inline __m256i clz(__m256i x)
+{
+    // Smear the highest set bit to the right, the remaining zeros are leading.
+    x = _mm256_or_si256(x, _mm256_srli_epi32(x, 1));
+    x = _mm256_or_si256(x, _mm256_srli_epi32(x, 2));
+    x = _mm256_or_si256(x, _mm256_srli_epi32(x, 4));
+    x = _mm256_or_si256(x, _mm256_srli_epi32(x, 8));
+    x = _mm256_or_si256(x, _mm256_srli_epi32(x, 16));
+    return _mm256_sub_epi32(_mm256_set1_epi32(32), popcount(x));
+}
+
+ATTRIBUTE_AVX2 inline __m256i mul_hi(__m256i a, __m256i b)
+{
+    const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(a, b), 32);
+    const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+    return _mm256_blend_epi32(even, odd, 0xaa);
+}
+
+ATTRIBUTE_AVX2 inline __m256i rotl(__m256i a, __m256i n)
+{
+    n = _mm256_and_si256(n, _mm256_set1_epi32(31));
+    return _mm256_or_si256(_mm256_sllv_epi32(a, n),
+        _mm256_srlv_epi32(a, _mm256_sub_epi32(_mm256_set1_epi32(32), n)));
+}
+
+ATTRIBUTE_AVX2 inline __m256i rotr(__m256i a, __m256i n)
+{
+    n = _mm256_and_si256(n, _mm256_set1_epi32(31));
+    return _mm256_or_si256(_mm256_srlv_epi32(a, n),
+        _mm256_sllv_epi32(a, _mm256_sub_epi32(_mm256_set1_epi32(32), n)));
+}
+
+// Random math between two input values, see math() in ethash.cpp
+ATTRIBUTE_AVX2 inline __m256i math(__m256i a, __m256i b, uint8_t op)
+{
+    switch (op)
+    {
+    case 0: return _mm256_add_epi32(a, b);
+    case 1: return _mm256_mullo_epi32(a, b);
+    case 2: return mul_hi(a, b);
+    case 3: return _mm256_min_epu32(a, b);
+    case 4: return rotl(a, b);
+    case 5: return rotr(a, b);
+    case 6: return _mm256_and_si256(a, b);
+    case 7: return _mm256_or_si256(a, b);
+    case 8: return _mm256_xor_si256(a, b);
+    case 9: return _mm256_add_epi32(clz(a), clz(b));
+    case 10: return _mm256_add_epi32(popcount(a), popcount(b));
+    default: return _mm256_setzero_si256();
+    }
+}
+
+// Merge new data from b into the value in a, see merge() in ethash.cpp
+ATTRIBUTE_AVX2 inline __m256i merge(__m256i a, __m256i b, const ethash_progpow_merge& m)
+{
+    const __m256i k33 = _mm256_set1_epi32(33);
+    // Shifting by 32 yields zero, which makes a rotation by 0 the identity.
+    const __m128i left = _mm_cvtsi32_si128(m.rotation);
+    const __m128i right = _mm_cvtsi32_si128(32 - m.rotation);
+    switch (m.op)
+    {
+    case 0: return _mm256_add_epi32(_mm256_mullo_epi32(a, k33), b);
+    case 1: return _mm256_mullo_epi32(_mm256_xor_si256(a, b), k33);
+    case 2: return _mm256_xor_si256(_mm256_or_si256(_mm256_sll_epi32(a, left), _mm256_srl_epi32(a, right)), b);
+    case 3: return _mm256_xor_si256(_mm256_or_si256(_mm256_srl_epi32(a, left), _mm256_sll_epi32(a, right)), b);
+    default: return a;
+    }
+}
+
+static const uint64_t keccak_round_constants[24] = {
+    0x0000000000000001, 0x0000000000008082, 0x800000000000808a, 0x8000000080008000,
+    0x000000000000808b, 0x0000000080000001, 0x8000000080008081, 0x8000000000008009,
+    0x000000000000008a, 0x0000000000000088, 0x0000000080008009, 0x000000008000000a,
+    0x000000008000808b, 0x800000000000008b, 0x8000000000008089, 0x8000000000008003,
+    0x8000000000008002, 0x8000000000000080, 0x000000000000800a, 0x800000008000000a,
+    0x8000000080008081, 0x8000000000008080, 0x0000000080000001, 0x8000000080008008,
+};
+
+static const int keccak_rotations[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14, 27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44,
+};
+
+static const int keccak_pi_lanes[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4, 15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1,
+};
+
+ATTRIBUTE_AVX2 inline __m256i rol64(__m256i x, int s)
+{
+    return _mm256_or_si256(_mm256_slli_epi64(x, s), _mm256_srli_epi64(x, 64 - s));
+}
+
+/// Keccak-f[1600] on four states, lane i of every state is kept in st[i].
+ATTRIBUTE_AVX2 void keccakf1600x4(__m256i st[25])
+{
+    __m256i bc[5];
+    for (int round = 0; round < 24; ++round)
+    {
+        // Theta
+        for (int i = 0; i < 5; ++i)
+            bc[i] = _mm256_xor_si256(_mm256_xor_si256(_mm256_xor_si256(st[i], st[i + 5]),
+                _mm256_xor_si256(st[i + 10], st[i + 15])), st[i + 20]);
+        for (int i = 0; i < 5; ++i)
+        {
+            const __m256i t = _mm256_xor_si256(bc[(i + 4) % 5], rol64(bc[(i + 1) % 5], 1));
+            for (int j = 0; j < 25; j += 5)
+                st[j + i] = _mm256_xor_si256(st[j + i], t);
+        }
+
+        // Rho and pi
+        __m256i t = st[1];
+        for (int i = 0; i < 24; ++i)
+        {
+            const int j = keccak_pi_lanes[i];
+            const __m256i next = st[j];
+            st[j] = rol64(t, keccak_rotations[i]);
+            t = next;
+        }
+
+        // Chi
+        for (int j = 0; j < 25; j += 5)
+        {
+            for (int i = 0; i < 5; ++i)
+                bc[i] = st[j + i];
+            for (int i = 0; i < 5; ++i)
+                st[j + i] = _mm256_xor_si256(st[j + i], _mm256_andnot_si256(bc[(i + 1) % 5], bc[(i + 2) % 5]));
+        }
+
+        // Iota
+        st[0] = _mm256_xor_si256(st[0], _mm256_set1_epi64x(static_cast<int64_t>(keccak_round_constants[round])));
+    }
+}
+}  // namespace
+
+bool supported() noexcept
+{
+    uint32_t eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+
+    // The OS must save the YMM registers (OSXSAVE, AVX and XCR0 bits 1-2).
+    if (!((ecx >> 27) & 1) || !((ecx >> 28) & 1))
+        return false;
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6)
+        return false;
+
+    if (__get_cpuid_max(0, nullptr) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx >> 5) & 1;
+}
+
+ATTRIBUTE_AVX2
+void progpow_round(const epoch_context& context, const hash2048& data256,
+    uint32_t mix[ETHASH_PROGPOW_REGS][ETHASH_PROGPOW_LANES]) noexcept
+{
+    const ethash_progpow_program& prog = *context.program;
+    const int* const l1_cache = reinterpret_cast<const int*>(context.l1_cache);
+    const __m256i l1_mask = _mm256_set1_epi32(l1_cache_words - 1);
+
+    for (int l = 0; l < ETHASH_PROGPOW_LANES; l += lanes_per_vector)
+    {
+        __m256i v[ETHASH_PROGPOW_REGS];
+        for (int r = 0; r < ETHASH_PROGPOW_REGS; ++r)
+            v[r] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&mix[r][l]));
+
+        for (int i = 0; i < ETHASH_PROGPOW_CNT_CACHE || i < ETHASH_PROGPOW_CNT_MATH; ++i)
+        {
+            if (i < ETHASH_PROGPOW_CNT_CACHE)
+            {
+                const auto& op = prog.cache[i];
+                const __m256i offset = _mm256_and_si256(v[op.src], l1_mask);
+                const __m256i data = _mm256_i32gather_epi32(l1_cache, offset, 4);
+                v[op.dst] = merge(v[op.dst], data, op.merge);
+            }
+
+            if (i < ETHASH_PROGPOW_CNT_MATH)
+            {
+                const auto& op = prog.math[i];
+                const __m256i data = math(v[op.src1], v[op.src2], op.op);
+                v[op.dst] = merge(v[op.dst], data, op.merge);
+            }
+        }
+
+        // Split the 64-bit dataset words of the lanes into their halves.
+        alignas(32) uint32_t data_lo[lanes_per_vector];
+        alignas(32) uint32_t data_hi[lanes_per_vector];
+        for (int k = 0; k < lanes_per_vector; ++k)
+        {
+            const uint64_t data64 = data256.words[l + k];
+            data_lo[k] = static_cast<uint32_t>(data64);
+            data_hi[k] = static_cast<uint32_t>(data64 >> 32);
+        }
+        v[0] = merge(v[0], _mm256_load_si256(reinterpret_cast<const __m256i*>(data_lo)), prog.merge_lo);
+        v[prog.dst_hi] = merge(v[prog.dst_hi],
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(data_hi)), prog.merge_hi);
+
+        for (int r = 0; r < ETHASH_PROGPOW_REGS; ++r)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(&mix[r][l]), v[r]);
+    }
+}
+
+ATTRIBUTE_AVX2
+void keccak512_64x4(hash512 out[4], const hash512 in[4]) noexcept
+{
+    static constexpr int num_words = sizeof(hash512) / sizeof(uint64_t);
+
+    // A 64-byte input fits the 72-byte rate of keccak512, so the padding
+    // goes into word 8 and one permutation is enough.
+    __m256i st[25];
+    for (int i = 0; i < num_words; ++i)
+        st[i] = _mm256_set_epi64x(static_cast<int64_t>(in[3].words[i]), static_cast<int64_t>(in[2].words[i]),
+            static_cast<int64_t>(in[1].words[i]), static_cast<int64_t>(in[0].words[i]));
+    st[num_words] = _mm256_set1_epi64x(static_cast<int64_t>(0x8000000000000001));
+    for (int i = num_words + 1; i < 25; ++i)
+        st[i] = _mm256_setzero_si256();
+
+    keccakf1600x4(st);
+
+    for (int i = 0; i < num_words; ++i)
+    {
+        alignas(32) uint64_t words[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words), st[i]);
+        for (int k = 0; k < 4; ++k)
+            out[k].words[i] = words[k];
+    }
+}
+}  // namespace progpow_avx2
+}  // namespace ethash
+
+#endif
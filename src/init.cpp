@@ -14,8 +14,10 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "coinsprefetch.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/progpow/ethash.hpp"
 #include "fs.h"
 #include "httpserver.h"
 #include "httprpc.h"
@@ -28,6 +30,7 @@
 #include "policy/feerate.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
+#include "pow.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "rpc/blockchain.h"
@@ -37,6 +40,7 @@
 #include "timedata.h"
 #include "txdb.h"
 #include "txmempool.h"
+#include "stratum.h"
 #include "torcontrol.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -158,6 +162,7 @@ static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
 
 void Interrupt(boost::thread_group& threadGroup)
 {
+    InterruptStratumServer();
     InterruptHTTPServer();
     InterruptHTTPRPC();
     InterruptRPC();
@@ -186,7 +191,9 @@ void Shutdown()
     StopHTTPRPC();
     StopREST();
     StopRPC();
+    StopStratumServer();
     StopHTTPServer();
+    g_block_template_cache.reset();
 #ifdef ENABLE_WALLET
     for (CWalletRef pwallet : vpwallets) {
         pwallet->Flush(false);
@@ -230,6 +237,9 @@ void Shutdown()
     // up with our current chain to avoid any strange pruning edge cases and make
     // next startup faster by avoiding rescan.
 
+    StopCoinsPrefetch();
+    StopProgPowContextBuilds();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != nullptr) {
@@ -351,6 +361,8 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-daemon", _("Run in the background as a daemon and accept commands"));
 #endif
     }
+    strUsage += HelpMessageOpt("-coinstatsindex", strprintf(_("Maintain the UTXO set statistics of every connected block, returned by the gettxoutsetinfo rpc call with hash_type muhash at any height (default: %u)"), DEFAULT_COINSTATSINDEX));
+    strUsage += HelpMessageOpt("-coinswritebatch=<n>", strprintf(_("Write up to <n> modified coins to the chain state database every second in the background, keeping them in the cache (0 = only write them when flushing the cache, default: %u)"), DEFAULT_COINS_WRITE_BATCH));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     if (showDebug) {
         strUsage += HelpMessageOpt("-dbbatchsize", strprintf("Maximum database write batch size in bytes (default: %u)", nDefaultDbBatchSize));
@@ -360,12 +372,18 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Load the chain state from a UTXO set snapshot written by dumptxoutset when starting with a new data directory. The snapshot must match a UTXO set committed in the chain parameters and requires pruning. The blocks below it are never downloaded or validated, getblockchaininfo reports the chain state as snapshotunvalidated"));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
     strUsage += HelpMessageOpt("-blockreconstructionextratxn=<n>", strprintf(_("Extra transactions to keep in memory for compact block reconstructions (default: %u)"), DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Set the number of threads reading the coins spent by the next blocks before they are connected (0 to %d, 0 = disable, default: %d)"),
+        MAX_PREFETCH_THREADS, DEFAULT_PREFETCH_THREADS));
+    strUsage += HelpMessageOpt("-progpowcontexts=<n>", strprintf(_("Keep at most <n> ProgPoW epoch contexts in memory (default: %u)"), DEFAULT_PROGPOW_CONTEXTS));
+    strUsage += HelpMessageOpt("-progpowcachefiles", strprintf(_("Keep the ProgPoW epoch caches in files in the data directory and map them on later starts, deleting the files of the epochs evicted from the cache (default: %u)"), DEFAULT_PROGPOW_CACHE_FILES));
+    strUsage += HelpMessageOpt("-progpowcontextcache=<n>", strprintf(_("Keep the ProgPoW epoch contexts below <n> megabytes (default: %u)"), DEFAULT_PROGPOW_CONTEXT_CACHE));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -454,6 +472,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-vbparams=deployment:start:end", "Use given start/end times for specified version bits deployment (regtest-only)");
+        strUsage += HelpMessageOpt("-assumeutxo=height:blockhash:muhash:txcount", "Commit to the UTXO set snapshot at the given block, as returned by dumptxoutset, for -loadtxoutset (regtest-only)");
     }
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
         _("If <category> is not supplied or if <category> = 1, output all debugging information.") + " " + _("<category> can be:") + " " + ListLogCategories() + ".");
@@ -466,6 +485,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsolutioncachesize=<n>", strprintf("Limit size of the cache of valid block header solutions to <n> MiB (default: %u)", DEFAULT_MAX_SOLUTION_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-maxtxfee=<amt>", strprintf(_("Maximum total fees (in %s) to use in a single wallet transaction or raw transaction; setting this too low may abort large transactions (default: %s)"),
@@ -500,6 +520,16 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-genproclimit=<n>", strprintf(_("Set the number of threads searching ProgPoW nonces for generate and generatetoaddress (<= 0 = all cores, default: %d)"), DEFAULT_GENERATE_THREADS));
+
+    strUsage += HelpMessageGroup(_("Stratum server options:"));
+    strUsage += HelpMessageOpt("-stratum", strprintf(_("Serve ProgPoW jobs to miners with the Stratum protocol, requires -server (default: %u)"), DEFAULT_STRATUM_ENABLE));
+    strUsage += HelpMessageOpt("-stratumaddress=<addr>", _("Address the blocks found by the Stratum miners pay to"));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Difficulty of the shares of the Stratum miners relative to the proof-of-work limit, shares meeting the block target are submitted as blocks (default: %u)"), DEFAULT_STRATUM_DIFFICULTY));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>[:port]", _("Bind to given address to listen for Stratum connections. This option is ignored unless -stratumallowip is also passed. Port is optional and overrides -stratumport. This option can be specified multiple times (default: localhost, or all addresses if -stratumallowip has been specified)"));
+    strUsage += HelpMessageOpt("-stratumport=<port>", strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT));
+    strUsage += HelpMessageOpt("-stratumallowip=<ip>", _("Allow Stratum connections from specified source, like -rpcallowip. This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-stratumrefresh=<n>", strprintf(_("Send a new job with the new mempool transactions every <n> seconds (default: %u)"), DEFAULT_STRATUM_REFRESH));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -1022,6 +1052,9 @@ bool AppInitParameterInteraction()
         LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
         fPruneMode = true;
     }
+    // the blocks before a UTXO set snapshot are never downloaded, as if pruned
+    if (gArgs.IsArgSet("-loadtxoutset") && !fPruneMode)
+        return InitError(_("-loadtxoutset requires pruning to be enabled."));
 
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
@@ -1134,6 +1167,37 @@ bool AppInitParameterInteraction()
             }
         }
     }
+
+    if (gArgs.IsArgSet("-assumeutxo")) {
+        // Allow committing to the snapshots of chains mined by tests
+        if (!chainparams.MineBlocksOnDemand()) {
+            return InitError("UTXO set snapshots may only be committed on regtest.");
+        }
+        for (const std::string& strAssumeutxo : gArgs.GetArgs("-assumeutxo")) {
+            std::vector<std::string> vParams;
+            boost::split(vParams, strAssumeutxo, boost::is_any_of(":"));
+            if (vParams.size() != 4) {
+                return InitError("UTXO set snapshot commitment malformed, expecting height:blockhash:muhash:txcount");
+            }
+            int32_t nHeight;
+            int64_t nChainTx;
+            if (!ParseInt32(vParams[0], &nHeight) || nHeight <= 0) {
+                return InitError(strprintf("Invalid height (%s)", vParams[0]));
+            }
+            if (!IsHex(vParams[1]) || vParams[1].size() != 64 || !IsHex(vParams[2]) || vParams[2].size() != 64) {
+                return InitError(strprintf("Invalid hashes (%s:%s)", vParams[1], vParams[2]));
+            }
+            if (!ParseInt64(vParams[3], &nChainTx) || nChainTx <= 0 || nChainTx > std::numeric_limits<unsigned int>::max()) {
+                return InitError(strprintf("Invalid txcount (%s)", vParams[3]));
+            }
+            AssumeutxoData data;
+            data.hashBlock = uint256S(vParams[1]);
+            data.hashMuHash = uint256S(vParams[2]);
+            data.nChainTx = nChainTx;
+            UpdateAssumeutxo(nHeight, data);
+            LogPrintf("Committing to the UTXO set snapshot at height %d, block %s, muhash %s\n", nHeight, vParams[1], vParams[2]);
+        }
+    }
     return true;
 }
 
@@ -1172,6 +1236,8 @@ bool AppInitSanityChecks()
     // Initialize elliptic curve code
     std::string sha256_algo = SHA256AutoDetect();
     LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    std::string progpow_algo = ethash::progpow_autodetect();
+    LogPrintf("Using the '%s' ProgPoW implementation\n", progpow_algo);
     RandomInit();
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1223,11 +1289,14 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     InitSignatureCache();
     InitScriptExecutionCache();
+    InitSolutionCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadPowCheck);
+        }
     }
 
     // Start the lightweight task scheduler thread
@@ -1388,11 +1457,23 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    nCoinsWriteBatch = std::max<int64_t>(0, gArgs.GetArg("-coinswritebatch", DEFAULT_COINS_WRITE_BATCH));
+    fCoinStatsIndex = gArgs.GetBoolArg("-coinstatsindex", DEFAULT_COINSTATSINDEX);
     int64_t nMempoolSizeMax = gArgs.GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
+    int nProgPowContexts = gArgs.GetArg("-progpowcontexts", DEFAULT_PROGPOW_CONTEXTS);
+    int64_t nProgPowContextCache = gArgs.GetArg("-progpowcontextcache", DEFAULT_PROGPOW_CONTEXT_CACHE);
+    SetProgPowContextCacheLimits(nProgPowContexts, nProgPowContextCache);
+    if (gArgs.GetBoolArg("-progpowcachefiles", DEFAULT_PROGPOW_CACHE_FILES)) {
+        // Epoch caches do not depend on the network, share them between all of them
+        fs::path progpowDir = GetDataDir(false) / "progpow";
+        TryCreateDirectories(progpowDir);
+        ethash::set_epoch_context_dir(progpowDir.string());
+    }
+    LogPrintf("* Using up to %d ProgPoW epoch contexts in %dMiB\n", std::max(nProgPowContexts, 1), std::max<int64_t>(nProgPowContextCache, 0));
 
     bool fLoaded = false;
     while (!fLoaded && !fRequestShutdown) {
@@ -1477,6 +1558,18 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                if (gArgs.IsArgSet("-loadtxoutset")) {
+                    if (fReset || fReindexChainState || !pcoinsdbview->GetBestBlock().IsNull()) {
+                        LogPrintf("Ignoring -loadtxoutset, the chain state is not empty\n");
+                    } else {
+                        uiInterface.InitMessage(_("Loading UTXO set snapshot..."));
+                        if (!LoadTxOutSet(chainparams, fs::absolute(gArgs.GetArg("-loadtxoutset", ""), GetDataDir()))) {
+                            strLoadError = _("Error loading the UTXO set snapshot");
+                            break;
+                        }
+                    }
+                }
+
                 // The on-disk coinsdb is now in a good state, create the cache
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1525,6 +1618,14 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                         strLoadError = _("Corrupted block database detected");
                         break;
                     }
+
+                    if (fCoinStatsIndex) {
+                        uiInterface.InitMessage(_("Computing UTXO set statistics..."));
+                        if (!InitCoinStatsIndex()) {
+                            strLoadError = _("Error computing the UTXO set statistics");
+                            break;
+                        }
+                    }
                 }
             } catch (const std::exception& e) {
                 LogPrintf("%s\n", e.what());
@@ -1567,6 +1668,14 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
     }
 
+    int nPrefetchThreads = std::max(0, std::min<int>(gArgs.GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS), MAX_PREFETCH_THREADS));
+    LogPrintf("Using %u threads to prefetch coins\n", nPrefetchThreads);
+    StartCoinsPrefetch(nPrefetchThreads);
+    if (fCoinStatsIndex)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "coinstats", &ThreadCoinStatsIndex));
+    if (nCoinsWriteBatch > 0)
+        scheduler.scheduleEvery(WriteCoinsInBackground, COINS_WRITE_INTERVAL);
+
     fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1701,6 +1810,15 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    g_block_template_cache.reset(new BlockTemplateCache(chainparams));
+
+    if (gArgs.GetBoolArg("-stratum", DEFAULT_STRATUM_ENABLE)) {
+        if (!gArgs.GetBoolArg("-server", false))
+            return InitError(_("-stratum requires -server"));
+        if (!StartStratumServer())
+            return InitError(_("Unable to start the Stratum server. See debug log for details."));
+    }
+
     // ********************************************************* Step 12: finished
 
     SetRPCWarmupFinished();
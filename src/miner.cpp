@@ -13,6 +13,8 @@
 #include "consensus/tx_verify.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/equihash.h"
+#include "crypto/progpow/ethash.hpp"
 #include "hash.h"
 #include "validation.h"
 #include "net.h"
@@ -21,6 +23,7 @@
 #include "pow.h"
 #include "primitives/transaction.h"
 #include "script/standard.h"
+#include "streams.h"
 #include "timedata.h"
 #include "txmempool.h"
 #include "util.h"
@@ -28,9 +31,14 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <atomic>
+#include <numeric>
 #include <queue>
+#include <thread>
 #include <utility>
 
+#include <boost/bind.hpp>
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // BitcoinMiner
@@ -48,19 +56,32 @@ uint64_t nLastBlockWeight = 0;
 
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
-    int64_t nOldTime = pblock->nTime;
+    int64_t nOldTime = pblock->GetTime();
     int64_t nNewTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
 
     if (nOldTime < nNewTime)
-        pblock->nTime = nNewTime;
+        pblock->SetTime(nNewTime);
 
     // Updating time can change work required on testnet:
     if (consensusParams.fPowAllowMinDifficultyBlocks)
-        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, consensusParams);
+        pblock->SetBits(GetNextWorkRequired(pindexPrev, pblock, consensusParams));
 
     return nNewTime - nOldTime;
 }
 
+static uint256 CreateBlockNonce(int nHeight, const Consensus::Params& params)
+{
+    arith_uint256 nonce;
+    if (nHeight >= params.BCIHeight) {
+        // Randomise nonce for new block foramt.
+        nonce = UintToArith256(GetRandHash());
+        // Clear the top and bottom 16 bits (for local use as thread flags and counters)
+        nonce <<= 32;
+        nonce >>= 16;
+    }
+    return ArithToUint256(nonce);
+}
+
 BlockAssembler::Options::Options() {
     blockMinFeeRate = CFeeRate(DEFAULT_BLOCK_MIN_TX_FEE);
     nBlockMaxWeight = DEFAULT_BLOCK_MAX_WEIGHT;
@@ -124,6 +145,9 @@ void BlockAssembler::resetBlock()
     // These counters do not include coinbase tx
     nBlockTx = 0;
     nFees = 0;
+
+    nMinPackageFees = 0;
+    nMinPackageSize = 0;
 }
 
 std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx)
@@ -147,13 +171,13 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     CBlockIndex* pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
 
-    pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
+    pblock->SetVersion(ComputeBlockVersion(pindexPrev, chainparams.GetConsensus()));
     // -regtest only: allow overriding block.nVersion with
     // -blockversion=N to test forking scenarios
     if (chainparams.MineBlocksOnDemand())
-        pblock->nVersion = gArgs.GetArg("-blockversion", pblock->nVersion);
+        pblock->SetVersion(gArgs.GetArg("-blockversion", pblock->GetVersion()));
 
-    pblock->nTime = GetAdjustedTime();
+    pblock->SetTime(GetAdjustedTime());
     const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
 
     nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
@@ -178,6 +202,40 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockSize = nBlockSize;
     nLastBlockWeight = nBlockWeight;
 
+    UpdateCoinbase(*pblocktemplate, pindexPrev, scriptPubKeyIn);
+
+    const Consensus::Params& params = chainparams.GetConsensus();
+    int ser_flags = (nHeight < params.BCIHeight) ? SERIALIZE_BLOCK_LEGACY : 0;
+    uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION | ser_flags);
+    LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n",
+              nSerializeSize, GetBlockWeight(*pblock, chainparams.GetConsensus()), nBlockTx, nFees, nBlockSigOpsCost);
+
+    // Fill in header
+    pblock->SetPrevBlockHash(pindexPrev->GetBlockHash());
+    pblock->SetHeight(pindexPrev->nHeight + 1);
+    pblock->SetReserved(nullptr);
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->SetBits(GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus()));
+    pblock->SetNonce(CreateBlockNonce(nHeight, chainparams.GetConsensus()));
+    pblock->SetSolution(std::vector<unsigned char>());
+
+    CValidationState state;
+    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    }
+    int64_t nTime2 = GetTimeMicros();
+
+    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
+
+    return std::move(pblocktemplate);
+}
+
+void BlockAssembler::UpdateCoinbase(CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn)
+{
+    CBlock* pblock = &blocktemplate.block;
+    const int nHeight = pindexPrev->nHeight + 1;
+    const CAmount nFees = std::accumulate(blocktemplate.vTxFees.begin() + 1, blocktemplate.vTxFees.end(), CAmount(0));
+
     // Create coinbase transaction.
 	// With Bitcoin Interest, at least 8% of all of the block subsidy should go to the charity address.
     int64_t reward = GetBlockSubsidy(pindexPrev->nHeight+1, chainparams.GetConsensus());
@@ -203,42 +261,9 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
 
     coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
     pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
- 
-    int ser_flags = (nHeight < params.BCIHeight) ? SERIALIZE_BLOCK_LEGACY : 0;
-    uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION | ser_flags);
-    LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n",
-              nSerializeSize, GetBlockWeight(*pblock, chainparams.GetConsensus()), nBlockTx, nFees, nBlockSigOpsCost);
-
-    arith_uint256 nonce;
-    if (nHeight >= params.BCIHeight) {
-        // Randomise nonce for new block foramt.
-        nonce = UintToArith256(GetRandHash());
-        // Clear the top and bottom 16 bits (for local use as thread flags and counters)
-        nonce <<= 32;
-        nonce >>= 16;
-    }
-
-    // Fill in header
-    pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-    pblock->nHeight        = pindexPrev->nHeight + 1;
-    memset(pblock->nReserved, 0, sizeof(pblock->nReserved));
-    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-    pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-    pblock->nNonce         = ArithToUint256(nonce);
-    pblock->nSolution.clear();
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
-
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
-    }
-    int64_t nTime2 = GetTimeMicros();
-
-    LogPrint(BCLog::BENCH, "CreateNewBlock() packages: %.2fms (%d packages, %d updated descendants), validity: %.2fms (total %.2fms)\n", 0.001 * (nTime1 - nTimeStart), nPackagesSelected, nDescendantsUpdated, 0.001 * (nTime2 - nTime1), 0.001 * (nTime2 - nTimeStart));
-
-    return std::move(pblocktemplate);
+    blocktemplate.vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    blocktemplate.vTxFees[0] = -nFees;
+    blocktemplate.vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 }
 
 void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
@@ -290,9 +315,14 @@ bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& packa
 
 void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
 {
-    pblock->vtx.emplace_back(iter->GetSharedTx());
-    pblocktemplate->vTxFees.push_back(iter->GetFee());
-    pblocktemplate->vTxSigOpsCost.push_back(iter->GetSigOpCost());
+    AddToBlock(*pblocktemplate, iter);
+}
+
+void BlockAssembler::AddToBlock(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter)
+{
+    blocktemplate.block.vtx.emplace_back(iter->GetSharedTx());
+    blocktemplate.vTxFees.push_back(iter->GetFee());
+    blocktemplate.vTxSigOpsCost.push_back(iter->GetSigOpCost());
     if (fNeedSizeAccounting) {
         nBlockSize += ::GetSerializeSize(iter->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
     }
@@ -497,20 +527,160 @@ void BlockAssembler::addPackageTxs(int &nPackagesSelected, int &nDescendantsUpda
         }
 
         ++nPackagesSelected;
+        UpdateMinPackageFeeRate(packageFees, packageSize);
 
         // Update transactions that depend on each of these
         nDescendantsUpdated += UpdatePackagesForAdded(ancestors, mapModifiedTx);
     }
 }
 
+void BlockAssembler::UpdateMinPackageFeeRate(CAmount packageFees, uint64_t packageSize)
+{
+    if (nMinPackageSize == 0 || (double)packageFees * nMinPackageSize < (double)nMinPackageFees * packageSize) {
+        nMinPackageFees = packageFees;
+        nMinPackageSize = packageSize;
+    }
+}
+
+bool BlockAssembler::AddPackageToTemplate(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter)
+{
+    if (inBlock.count(iter))
+        return true;
+
+    // The package is made of the ancestors not in the block yet, as the
+    // modified entry of addPackageTxs() would be.
+    CTxMemPool::setEntries ancestors;
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+    onlyUnconfirmed(ancestors);
+    ancestors.insert(iter);
+
+    uint64_t packageSize = 0;
+    CAmount packageFees = 0;
+    int64_t packageSigOpsCost = 0;
+    for (CTxMemPool::txiter it : ancestors) {
+        packageSize += it->GetTxSize();
+        packageFees += it->GetModifiedFee();
+        packageSigOpsCost += it->GetSigOpCost();
+    }
+
+    // Packages below the minimum feerate would not be selected either; a
+    // descendant paying for them brings them in later.
+    if (packageFees < blockMinFeeRate.GetFee(packageSize))
+        return true;
+
+    if (!TestPackage(packageSize, packageSigOpsCost) || !TestPackageTransactions(ancestors)) {
+        // Selecting the packages again would give the same block if this
+        // one comes after all of those in the block.
+        return nMinPackageSize != 0 && (double)packageFees * nMinPackageSize <= (double)nMinPackageFees * packageSize;
+    }
+
+    std::vector<CTxMemPool::txiter> sortedEntries;
+    SortForBlock(ancestors, iter, sortedEntries);
+    for (CTxMemPool::txiter it : sortedEntries) {
+        AddToBlock(blocktemplate, it);
+    }
+    UpdateMinPackageFeeRate(packageFees, packageSize);
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    nLastBlockWeight = nBlockWeight;
+    return true;
+}
+
+std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
+BlockTemplateCache::BlockTemplateCache(const CChainParams& params) :
+    chainparams(params), assembler(params), pindexPrev(nullptr), fTemplateWitnessTx(false), fStale(true)
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&BlockTemplateCache::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&BlockTemplateCache::TransactionRemoved, this, _1, _2));
+    mempool.NotifyFeeDeltaChanged.connect(boost::bind(&BlockTemplateCache::FeeDeltaChanged, this, _1));
+}
+
+BlockTemplateCache::~BlockTemplateCache()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&BlockTemplateCache::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&BlockTemplateCache::TransactionRemoved, this, _1, _2));
+    mempool.NotifyFeeDeltaChanged.disconnect(boost::bind(&BlockTemplateCache::FeeDeltaChanged, this, _1));
+}
+
+void BlockTemplateCache::TransactionAdded(CTransactionRef tx)
+{
+    // Called before the entry is in mapTx, it is looked up on the next request.
+    LOCK(mempool.cs);
+    if (!fStale)
+        vAdded.push_back(tx);
+}
+
+void BlockTemplateCache::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    AssertLockHeld(mempool.cs);
+    fStale = true;
+    vAdded.clear();
+}
+
+void BlockTemplateCache::FeeDeltaChanged(const uint256& hash)
+{
+    // The modified fees decide which packages are in the template and in
+    // which order, so it is assembled again.
+    AssertLockHeld(mempool.cs);
+    fStale = true;
+    vAdded.clear();
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateCache::GetBlockTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTx)
+{
+    LOCK2(cs_main, mempool.cs);
+    int64_t nTimeStart = GetTimeMicros();
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    size_t nAdded = vAdded.size();
+    if (!fStale && pindexPrev == pindexTip && fTemplateWitnessTx == fMineWitnessTx) {
+        for (const CTransactionRef& tx : vAdded) {
+            CTxMemPool::txiter it = mempool.mapTx.find(tx->GetHash());
+            if (it != mempool.mapTx.end() && !assembler.AddPackageToTemplate(*pblocktemplate, it)) {
+                fStale = true;
+                break;
+            }
+        }
+    } else {
+        fStale = true;
+    }
+    vAdded.clear();
+
+    if (fStale) {
+        pblocktemplate = assembler.CreateNewBlock(CScript(), fMineWitnessTx);
+        pindexPrev = pindexTip;
+        fTemplateWitnessTx = fMineWitnessTx;
+        fStale = false;
+    } else {
+        LogPrint(BCLog::BENCH, "BlockTemplateCache: %u transactions added in %.2fms\n", nAdded, 0.001 * (GetTimeMicros() - nTimeStart));
+    }
+
+    std::unique_ptr<CBlockTemplate> blocktemplate(new CBlockTemplate(*pblocktemplate));
+    CBlock* pblock = &blocktemplate->block;
+    assembler.UpdateCoinbase(*blocktemplate, pindexPrev, scriptPubKeyIn);
+    UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+    pblock->SetNonce(CreateBlockNonce(pblock->GetHeight(), chainparams.GetConsensus()));
+    return blocktemplate;
+}
+
+std::unique_ptr<CBlockTemplate> CreateBlockTemplate(const CChainParams& params, const CScript& scriptPubKeyIn, bool fMineWitnessTx)
+{
+    if (g_block_template_cache)
+        return g_block_template_cache->GetBlockTemplate(scriptPubKeyIn, fMineWitnessTx);
+    return BlockAssembler(params).CreateNewBlock(scriptPubKeyIn, fMineWitnessTx);
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
     static uint256 hashPrevBlock;
-    if (hashPrevBlock != pblock->hashPrevBlock)
+    if (hashPrevBlock != pblock->GetPrevBlockHash())
     {
         nExtraNonce = 0;
-        hashPrevBlock = pblock->hashPrevBlock;
+        hashPrevBlock = pblock->GetPrevBlockHash();
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
@@ -519,5 +689,204 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
-    pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    pblock->SetMerkleRoot(BlockMerkleRoot(*pblock));
+}
+
+static std::atomic<double> dProgPowHashesPerSec{0};
+
+double GetProgPowHashesPerSec()
+{
+    return dProgPowHashesPerSec;
+}
+
+bool SolveProgPowBlock(CBlock* pblock, const CBlockIndex* pindexPrev, uint64_t& nMaxTries)
+{
+    // Hashes between two checks of the tip and of the remaining tries
+    static const int64_t nBatchSize = 64;
+
+    const ethash::hash256 header_hash = GetProgPowHeaderHash(pblock);
+    const arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->GetBits());
+    const ethash::hash256 target = GetProgPowBoundary(hashTarget);
+
+    int nThreads = gArgs.GetArg("-genproclimit", DEFAULT_GENERATE_THREADS);
+    if (nThreads <= 0) {
+        nThreads = GetNumCores();
+    }
+    nThreads = std::max(nThreads, 1);
+
+    // Generating the full dataset costs about as much as hashing once per item, so
+    // it is only used when the search is expected to take longer than that. Until
+    // it is ready the full context computes the items like the light one.
+    const int epoch = ethash::get_epoch_number(pblock->GetHeight());
+    const arith_uint256 nExpectedHashes = (~hashTarget / (hashTarget + 1)) + 1;
+    const ethash::epoch_context_full* full_ctx = nullptr;
+    if (nExpectedHashes >= arith_uint256(ethash::calculate_full_dataset_num_items(epoch))) {
+        try {
+            full_ctx = &ethash::get_global_epoch_context_full(epoch, nThreads);
+        } catch (const std::bad_alloc&) {
+            LogPrintf("%s: cannot allocate the ProgPoW dataset of epoch %d, mining with the light cache\n", __func__, epoch);
+        }
+    }
+    const ethash::epoch_context& light_ctx = ethash::get_global_epoch_context(epoch);
+
+    // The workers detect a new tip by the generation counter alone, the lock
+    // is only taken once to check that the template is not already stale.
+    const uint64_t nGeneration = nTipGeneration;
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() != pindexPrev) {
+            return false;
+        }
+    }
+
+    const uint64_t nStartNonce = pblock->GetNonce().GetUint64(3);
+    const uint64_t nRangeSize = std::numeric_limits<uint64_t>::max() / nThreads;
+    std::atomic<int64_t> nTriesLeft{(int64_t)std::min<uint64_t>(nMaxTries, std::numeric_limits<int64_t>::max())};
+    std::atomic<uint64_t> nHashes{0};
+    std::atomic<bool> fStop{false};
+    std::mutex mutexFound;
+    bool fFound = false;
+    uint64_t nFoundNonce = 0;
+    ethash::hash256 found_mix;
+
+    auto worker = [&](int nThread) {
+        // Every thread scans its own range of nonces.
+        uint64_t nonce = nStartNonce + nThread * nRangeSize;
+        while (!fStop) {
+            const int64_t nLeft = nTriesLeft.fetch_sub(nBatchSize);
+            if (nLeft <= 0) {
+                break;
+            }
+            const int64_t nBatch = std::min(nLeft, nBatchSize);
+            int64_t i = 0;
+            for (; i < nBatch && !fStop; i++, nonce++) {
+                const ethash::RetVal r = full_ctx ?
+                    ethash::check_progpow_nonce(*full_ctx, header_hash, target, nonce) :
+                    ethash::check_progpow_nonce_light(light_ctx, header_hash, target, nonce);
+                if (r.ok) {
+                    std::lock_guard<std::mutex> lock(mutexFound);
+                    if (!fFound) {
+                        fFound = true;
+                        nFoundNonce = nonce;
+                        found_mix = r.results.mix_hash;
+                    }
+                    fStop = true;
+                }
+            }
+            nHashes += i;
+
+            // Give up on a block template made stale by a new tip.
+            if (nTipGeneration != nGeneration) {
+                fStop = true;
+            }
+        }
+    };
+
+    const int64_t nStart = GetTimeMicros();
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    const int64_t nElapsed = GetTimeMicros() - nStart;
+    if (nElapsed > 0) {
+        dProgPowHashesPerSec = nHashes * 1000000.0 / nElapsed;
+    }
+
+    nMaxTries -= std::min<uint64_t>(nMaxTries, nHashes);
+    if (!fFound) {
+        return false;
+    }
+
+    // The ProgPoW nonce is the last 8 bytes of nNonce, the solution is the mix hash.
+    uint256 nNonce = pblock->GetNonce();
+    WriteLE64(nNonce.begin() + 24, nFoundNonce);
+    pblock->SetNonce(nNonce);
+    pblock->SetSolution(std::vector<unsigned char>(found_mix.bytes, found_mix.bytes + sizeof(found_mix.bytes)));
+    return true;
+}
+
+bool SolveEquihashBlock(CBlock* pblock, uint64_t nMaxNonces, uint64_t& nMaxTries)
+{
+    const CChainParams& chainparams = Params();
+    const unsigned int n = chainparams.EquihashN();
+    const unsigned int k = chainparams.EquihashK();
+
+    // H(I||... with I = the block header minus nonce and solution.
+    crypto_generichash_blake2b_state eh_state;
+    EhInitialiseState(n, k, eh_state);
+    CEquihashInput I{*pblock};
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << I;
+    crypto_generichash_blake2b_update(&eh_state, (unsigned char*)&ss[0], ss.size());
+
+    const uint64_t nTries = std::min(nMaxNonces, nMaxTries);
+    int nThreads = gArgs.GetArg("-genproclimit", DEFAULT_GENERATE_THREADS);
+    if (nThreads <= 0) {
+        nThreads = GetNumCores();
+    }
+    nThreads = (int)std::max<uint64_t>(std::min<uint64_t>(nThreads, nTries), 1);
+
+    // Threads take the nonces in order and stop at the lowest solved one. Every
+    // nonce below it is solved to the end, so the result is the one of a single
+    // thread trying the nonces one after another.
+    const arith_uint256 nStartNonce = UintToArith256(pblock->GetNonce());
+    std::atomic<uint64_t> nNextOffset{1};
+    std::atomic<uint64_t> nFoundOffset{nTries + 1};
+    std::mutex mutexFound;
+    std::vector<unsigned char> vFoundSolution;
+
+    auto worker = [&]() {
+        EhSolverArena arena;
+        CBlockHeader header = pblock->GetBlockHeader();
+        for (uint64_t nOffset = nNextOffset++; nOffset < nFoundOffset; nOffset = nNextOffset++) {
+            // H(I||V||...
+            header.SetNonce(ArithToUint256(nStartNonce + nOffset));
+            crypto_generichash_blake2b_state curr_state = eh_state;
+            crypto_generichash_blake2b_update(&curr_state, header.GetNonce().begin(), header.GetNonce().size());
+
+            // (x_1, x_2, ...) = A(I, V, n, k)
+            std::function<bool(std::vector<unsigned char>)> validBlock =
+                    [&header, &chainparams](std::vector<unsigned char> soln) {
+                header.SetSolution(soln);
+                return CheckProofOfWork(header.GetHash(), header.GetBits(), true, chainparams.GetConsensus());
+            };
+            // Give up once another thread solved a lower nonce.
+            std::function<bool(EhSolverCancelCheck)> cancelled =
+                    [nOffset, &nFoundOffset](EhSolverCancelCheck pos) {
+                return nOffset > nFoundOffset;
+            };
+            try {
+                if (EhRadixSolve(n, k, curr_state, validBlock, cancelled, arena)) {
+                    std::lock_guard<std::mutex> lock(mutexFound);
+                    if (nOffset < nFoundOffset) {
+                        nFoundOffset = nOffset;
+                        vFoundSolution = header.GetSolution();
+                    }
+                }
+            } catch (const EhSolverCancelledException&) {
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < nThreads; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    const bool fFound = nFoundOffset <= nTries;
+    const uint64_t nTried = fFound ? (uint64_t)nFoundOffset : nTries;
+    nMaxTries -= nTried;
+    pblock->SetNonce(ArithToUint256(nStartNonce + nTried));
+    if (fFound) {
+        pblock->SetSolution(vFoundSolution);
+    }
+    return fFound;
 }
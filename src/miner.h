@@ -21,6 +21,8 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genproclimit, the number of threads searching ProgPoW nonces */
+static const int DEFAULT_GENERATE_THREADS = 1;
 
 struct CBlockTemplate
 {
@@ -150,6 +152,9 @@ private:
     uint64_t nBlockSigOpsCost;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
+    // The package of the block with the lowest ancestor feerate
+    CAmount nMinPackageFees;
+    uint64_t nMinPackageSize;
 
     // Chain context for the block
     int nHeight;
@@ -170,12 +175,24 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
 
+    /** Add a transaction that entered the mempool after the last call to
+      * CreateNewBlock() to the template it returned, with its ancestors that
+      * are not in the block yet, if the package would have been selected.
+      * The coinbase is left as it is, see UpdateCoinbase(). Returns false if
+      * the package does not fit but pays more than a package of the block,
+      * in which case a new template has to be created. */
+    bool AddPackageToTemplate(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter);
+    /** Recreate the coinbase of a template returned by CreateNewBlock() for
+      * the fees of its transactions, paying to scriptPubKeyIn */
+    void UpdateCoinbase(CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, const CScript& scriptPubKeyIn);
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    void AddToBlock(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter);
 
     // Methods for how to add transactions to a block.
     /** Add transactions based on feerate including unconfirmed ancestors
@@ -202,10 +219,74 @@ private:
       * state updated assuming given transactions are inBlock. Returns number
       * of updated descendants. */
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+    /** Remember the package if it has the lowest feerate of the block */
+    void UpdateMinPackageFeeRate(CAmount packageFees, uint64_t packageSize);
+};
+
+/**
+ * A block template for the tip that is kept up to date with the mempool, so
+ * that new work does not need the packages of the whole mempool to be
+ * selected again. Transactions entering the mempool are added to the cached
+ * template with their missing ancestors when the next template is requested.
+ * A new template is assembled when the tip changes, a transaction leaves the
+ * mempool or has its fee delta changed by prioritisetransaction, or a new
+ * package does not fit but pays more than one in the block.
+ * Transactions added incrementally were validated against the tip when they
+ * were accepted to the mempool, so TestBlockValidity() only runs for new
+ * templates.
+ */
+class BlockTemplateCache
+{
+public:
+    explicit BlockTemplateCache(const CChainParams& params);
+    ~BlockTemplateCache();
+
+    /** Return a template for the tip with its coinbase paying to scriptPubKeyIn */
+    std::unique_ptr<CBlockTemplate> GetBlockTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+
+private:
+    void TransactionAdded(CTransactionRef tx);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+    void FeeDeltaChanged(const uint256& hash);
+
+    const CChainParams& chainparams;
+
+    // All the following are guarded by mempool.cs
+    BlockAssembler assembler;
+    // The cached template, with an empty coinbase script
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    bool fTemplateWitnessTx;
+    bool fStale;
+    // Transactions that entered the mempool since the template was assembled
+    std::vector<CTransactionRef> vAdded;
 };
 
+/** The template cache of getblocktemplate, generate and the Stratum server */
+extern std::unique_ptr<BlockTemplateCache> g_block_template_cache;
+
+/** Return a block template for the tip paying to scriptPubKeyIn, from
+ *  g_block_template_cache when it exists. */
+std::unique_ptr<CBlockTemplate> CreateBlockTemplate(const CChainParams& params, const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/** Search the ProgPoW nonce of a block on -genproclimit threads, each one
+ *  scanning a disjoint range of nonces. Stops when a solution is found, after
+ *  nMaxTries hashes (which is decreased by the hashes done) or when the tip is
+ *  no longer pindexPrev. Sets nNonce and nSolution and returns true on success. */
+bool SolveProgPowBlock(CBlock* pblock, const CBlockIndex* pindexPrev, uint64_t& nMaxTries);
+/** Search the Equihash solution of a block with the radix solver on
+ *  -genproclimit threads, trying at most nMaxNonces nonces after nNonce and
+ *  decreasing nMaxTries by the nonces tried. The nonce found is the lowest one
+ *  with a solution meeting the target, as in a sequential search. When that
+ *  nonce has several of them, the one kept is the first the radix solver
+ *  returns, which may not be the one EhBasicSolve would return. Sets nNonce
+ *  and nSolution and returns true on success. */
+bool SolveEquihashBlock(CBlock* pblock, uint64_t nMaxNonces, uint64_t& nMaxTries);
+/** Hashes per second of the last ProgPoW nonce search */
+double GetProgPowHashesPerSec();
+
 #endif // BITCOIN_MINER_H
@@ -8,6 +8,7 @@
 #include "arith_uint256.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "checkqueue.h"
 #include "crypto/equihash.h"
 #include "crypto/progpow/ethash.h"
 #include "crypto/progpow/ethash.hpp"
@@ -18,6 +19,9 @@
 #include "uint256.h"
 #include "util.h"
 
+#include <algorithm>
+#include <atomic>
+
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
     assert(pindexLast != nullptr);
@@ -35,6 +39,17 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
         return UintToArith256(params.powLimitStart).GetCompact();
     }
     
+    // Entries of the block index carry the running target sum and the median
+    // time past, so the window is the difference of its two ends.
+    if (pindexLast->HasDifficultyCache()) {
+        const CBlockIndex* pindexFirst = pindexLast->GetAncestor(pindexLast->nHeight - params.nPowAveragingWindow);
+        if (pindexFirst == nullptr)
+            return nProofOfWorkLimit;
+
+        arith_uint256 bnAvg {(pindexLast->nChainTarget - pindexFirst->nChainTarget) / params.nPowAveragingWindow};
+        return CalculateNextWorkRequired(bnAvg, pindexLast->nMedianTimePast, pindexFirst->nMedianTimePast, params);
+    }
+
     const CBlockIndex* pindexFirst = pindexLast;
     arith_uint256 bnTot {0};
     for (int i = 0; pindexFirst && i < params.nPowAveragingWindow; i++) {
@@ -141,97 +156,265 @@ unsigned int BitcoinCalculateNextWorkRequired(const CBlockIndex* pindexLast, int
     return bnNew.GetCompact();
 }
 
-bool CheckProgPow (const CBlockHeader *pblock, const CChainParams& params)
+namespace {
+/** The number of PowCheckSource values */
+const int POW_CHECK_SOURCES = (int)PowCheckSource::SHARE + 1;
+
+/** Counters of the checks of one algorithm and caller, updated without locking */
+struct PowCheckCounters
 {
-    //progpow nonce is 8 bytes, located the (24-32) of 32 bytes nonce 
-    //little endian
-    uint64_t nonce = (pblock->nNonce).GetUint64(3);
+    std::atomic<uint64_t> nChecks;
+    std::atomic<uint64_t> nFailures;
+    std::atomic<uint64_t> nTotalMicros;
+    std::atomic<uint64_t> vLatency[POW_LATENCY_BUCKETS];
+};
 
-    uint32_t epoch = ethash::get_epoch_number(pblock->nHeight);
-    ethash_epoch_context epoch_ctx = ethash::get_global_epoch_context(epoch);
-    epoch_ctx.block_number = pblock->nHeight;
-    
+/** The ProgPoW ([0]) and Equihash ([1]) counters of each caller, zero initialized as statics */
+PowCheckCounters powCheckCounters[2][POW_CHECK_SOURCES];
+
+/** Count one check of nMicros */
+void RecordPowCheck(bool fProgPow, PowCheckSource source, int64_t nMicros, bool fValid)
+{
+    PowCheckCounters& counters = powCheckCounters[fProgPow ? 0 : 1][(int)source];
+    counters.nChecks++;
+    if (!fValid)
+        counters.nFailures++;
+    counters.nTotalMicros += std::max<int64_t>(nMicros, 0);
+
+    int nBucket = 0;
+    while (nBucket < POW_LATENCY_BUCKETS - 1 && (int64_t(1) << nBucket) <= nMicros) {
+        nBucket++;
+    }
+    counters.vLatency[nBucket]++;
+}
+} // namespace
+
+PowCheckStats GetPowCheckStats(bool fProgPow, PowCheckSource source)
+{
+    const PowCheckCounters& counters = powCheckCounters[fProgPow ? 0 : 1][(int)source];
+    PowCheckStats stats;
+    stats.nChecks = counters.nChecks;
+    stats.nFailures = counters.nFailures;
+    stats.nTotalMicros = counters.nTotalMicros;
+    for (int i = 0; i < POW_LATENCY_BUCKETS; i++) {
+        stats.vLatency[i] = counters.vLatency[i];
+    }
+    return stats;
+}
+
+std::string GetPowCheckSourceName(PowCheckSource source)
+{
+    switch (source) {
+    case PowCheckSource::HEADER: return "header";
+    case PowCheckSource::BLOCK: return "block";
+    case PowCheckSource::DISK: return "disk";
+    case PowCheckSource::SHARE: return "share";
+    }
+    // no default case, so the compiler can warn about missing cases
+    assert(false);
+}
+
+void SetProgPowContextCacheLimits(int nContexts, int64_t nCacheMiB)
+{
+    ethash::set_epoch_context_cache_limits(std::max(nContexts, 1), std::max<int64_t>(nCacheMiB, 0) << 20);
+}
+
+void PrebuildNextProgPowContext(int nHeight, const Consensus::Params& params)
+{
+    if (nHeight < params.ProgForkHeight)
+        return;
+
+    int epoch = ethash::get_epoch_number(nHeight);
+    if (ethash::get_epoch_number(nHeight + PROGPOW_PREBUILD_DISTANCE) == epoch)
+        return;
+
+    if (ethash::prebuild_global_epoch_context(epoch + 1))
+        LogPrintf("%s: building ProgPoW epoch %d context at height %d\n", __func__, epoch + 1, nHeight);
+}
+
+void StopProgPowContextBuilds()
+{
+    ethash::join_global_epoch_context_builds();
+}
+
+ethash::hash256 GetProgPowHeaderHash(const CBlockHeader *pblock)
+{
     // I = the block header minus nonce and solution.
     // also uses CEquihashInput as custom header
     CEquihashInput I{*pblock};
     // I||V 
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << I;
-    ss << pblock->nNonce;
+    ss << pblock->GetNonce();
 
     //nonce part should be zeroed
     memset((unsigned char*)&ss[108], 0, 32); 
-    ethash::hash256 header_hash = ethash_keccak256((unsigned char*)&ss[0], 140);
-
-    ethash::hash256 mix;
-    //nSolution is 32 bytes mix hash.
-    const unsigned char *p = &*(pblock->nSolution.begin());
-    memcpy(mix.bytes, &p[0], 32);
+    return ethash_keccak256((unsigned char*)&ss[0], 140);
+}
 
-    ethash::hash256 target;
-    arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
-    //memcpy(target.bytes, ArithToUint256(hashTarget).begin(), 32);
+ethash::hash256 GetProgPowBoundary(const arith_uint256& hashTarget)
+{
     //endian conversion. ethash hash is considered as big endian.
-    uint8_t *hashTarget_p = ArithToUint256(hashTarget).begin(); 
+    ethash::hash256 boundary;
+    uint256 hashTarget_le = ArithToUint256(hashTarget);
     for (int i = 0; i < 32; i ++ ) {
-        target.bytes[i] = hashTarget_p[31-i];
+        boundary.bytes[i] = hashTarget_le.begin()[31-i];
     }
+    return boundary;
+}
 
-    //debug:
-#if 0
-    //show header_hash and nonce
-    uint256 header_v, target_v, mixhash_v;
-    memcpy(header_v.begin(), header_hash.bytes, 32);
-    memcpy(target_v.begin(), target.bytes, 32);
-    memcpy(mixhash_v.begin(), mix.bytes, 32);
-    error("CheckProgPow: input values: height %d  epoch %d  header %s  nonce %lx  NONCE_UINT64_T %ld  target %s  mixhash %s\n", pblock->nHeight, epoch, header_v.GetHex().c_str(), nonce, nonce, target_v.GetHex().c_str(), mixhash_v.GetHex().c_str());
-    
-    /*
-    // ENABLE TO TEST PROGPOW
-    //run progpow
-    ethash::result ret = ethash::progpow(epoch_ctx, header_hash, nonce);
-    uint256 final_hash, mix_hash;
-    memcpy(final_hash.begin(), ret.final_hash.bytes, 32);
-    memcpy(mix_hash.begin(), ret.mix_hash.bytes, 32);
-    error("CheckProgPow RUN PROGPOW: progpow hash results. final_hash %s, mix_hash %s\n",
-          final_hash.GetHex().c_str(), mix_hash.GetHex().c_str());
-    */
-#endif
-
-    if (ethash::verify_progpow(epoch_ctx, header_hash,
-                               mix, nonce, target)) {
-        return true;
-    } else {
-        return error("CheckProgPow(): verify_progpow failed");
-    }
- 
+static bool CheckProgPowTarget(const CBlockHeader *pblock, const arith_uint256& hashTarget, PowCheckSource source)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    //progpow nonce is 8 bytes, located the (24-32) of 32 bytes nonce 
+    //little endian
+    const uint64_t nonce = (pblock->GetNonce()).GetUint64(3);
+
+    //nSolution is 32 bytes mix hash.
+    ethash::hash256 mix_hash = {};
+    memcpy(mix_hash.bytes, pblock->GetSolution().data(), std::min<size_t>(pblock->GetSolution().size(), 32));
+
+    ethash_epoch_context epoch_ctx = ethash::get_global_epoch_context(ethash::get_epoch_number(pblock->GetHeight()));
+    epoch_ctx.block_number = pblock->GetHeight();
+
+    bool fValid = ethash::verify_progpow(epoch_ctx, GetProgPowHeaderHash(pblock), mix_hash, nonce, GetProgPowBoundary(hashTarget));
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    RecordPowCheck(true, source, nTime, fValid);
+    LogPrint(BCLog::POW, "CheckProgPow(): %s at height %u in %.3fms%s\n", GetPowCheckSourceName(source), pblock->GetHeight(), 0.001 * nTime, fValid ? "" : ", invalid");
+    return fValid;
 }
 
-bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& params)
+bool CheckProgPow(const CBlockHeader *pblock, const CChainParams& params, PowCheckSource source)
 {
-    unsigned int n = params.EquihashN();
-    unsigned int k = params.EquihashK();
+    return CheckProgPowTarget(pblock, arith_uint256().SetCompact(pblock->GetBits()), source);
+}
 
-    // Hash state
-    crypto_generichash_blake2b_state state;
-    EhInitialiseState(n, k, state);
+bool CheckProgPowShare(const CBlockHeader *pblock, const arith_uint256& hashTarget, const CChainParams& params)
+{
+    return CheckProgPowTarget(pblock, hashTarget, PowCheckSource::SHARE);
+}
+
+/** Absorbs the Equihash input I||V of the block header, the header without
+ *  the solution, into a copy of the initial hash state */
+static void GetEquihashHashState(const CBlockHeader *pblock, const eh_HashState& base_state, eh_HashState& state)
+{
+    state = base_state;
 
     // I = the block header minus nonce and solution.
     CEquihashInput I{*pblock};
     // I||V
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << I;
-    ss << pblock->nNonce;
+    ss << pblock->GetNonce();
 
     // H(I||V||...
     crypto_generichash_blake2b_update(&state, (unsigned char*)&ss[0], ss.size());
+}
+
+/** Checks the Equihash solution of a header, starting from the personalized
+ *  hash state of the Equihash parameters, which a batch initialises once */
+static bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& params, const eh_HashState& base_state, PowCheckSource source)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    unsigned int n = params.EquihashN();
+    unsigned int k = params.EquihashK();
+
+    // Hash state
+    crypto_generichash_blake2b_state state;
+    GetEquihashHashState(pblock, base_state, state);
 
     bool isValid;
-    EhIsValidSolution(n, k, state, pblock->nSolution, isValid);
-    if (!isValid)
-        return error("CheckEquihashSolution(): invalid solution");
+    EhIsValidSolution(n, k, state, pblock->GetSolution(), isValid);
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    RecordPowCheck(false, source, nTime, isValid);
+    LogPrint(BCLog::POW, "CheckEquihashSolution(): %s at height %u in %.3fms%s\n", GetPowCheckSourceName(source), pblock->GetHeight(), 0.001 * nTime, isValid ? "" : ", invalid");
+    return isValid;
+}
 
-    return true;
+bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams& params, PowCheckSource source)
+{
+    eh_HashState base_state;
+    EhInitialiseState(params.EquihashN(), params.EquihashK(), base_state);
+    return CheckEquihashSolution(pblock, params, base_state, source);
+}
+
+namespace {
+/** The proof-of-work check of one block header, run by powcheckqueue. Every
+ *  check records its own latency in the statistics of its algorithm. */
+class CPowCheck
+{
+private:
+    const CBlockHeader* pblock;
+    const CChainParams* params;
+    /** The Equihash hash state shared by the checks of a batch */
+    const eh_HashState* pbase_state;
+    PowCheckSource source;
+    char* pfValid;
+
+public:
+    CPowCheck() : pblock(nullptr), params(nullptr), pbase_state(nullptr), source(PowCheckSource::HEADER), pfValid(nullptr) {}
+    CPowCheck(const CBlockHeader* pblockIn, const CChainParams& paramsIn, const eh_HashState& base_stateIn, PowCheckSource sourceIn, char* pfValidIn) :
+        pblock(pblockIn), params(&paramsIn), pbase_state(&base_stateIn), source(sourceIn), pfValid(pfValidIn) {}
+
+    bool operator()()
+    {
+        bool fValid;
+        if (pblock->GetHeight() >= (uint32_t)params->GetConsensus().ProgForkHeight)
+            fValid = CheckProgPow(pblock, *params, source);
+        else
+            fValid = CheckEquihashSolution(pblock, *params, *pbase_state, source);
+        if (pfValid)
+            *pfValid = fValid;
+        return fValid;
+    }
+
+    void swap(CPowCheck& check)
+    {
+        std::swap(pblock, check.pblock);
+        std::swap(params, check.params);
+        std::swap(pbase_state, check.pbase_state);
+        std::swap(source, check.source);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+/** A check takes milliseconds, so the workers take them one at a time */
+CCheckQueue<CPowCheck> powcheckqueue(1);
+} // namespace
+
+void ThreadPowCheck()
+{
+    RenameThread("bitcoin-powcheck");
+    powcheckqueue.Thread();
+}
+
+bool CheckPowBatch(const std::vector<const CBlockHeader*>& headers, const CChainParams& params, PowCheckSource source, std::vector<char>* pvValid)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    if (pvValid)
+        pvValid->assign(headers.size(), false);
+    if (headers.empty())
+        return true;
+    // The checks only copy the state, it outlives them since Wait() returns
+    // once they all ran. Only batches with headers before the fork need it,
+    // EhInitialiseState does not support the parameters of main and testnet.
+    eh_HashState base_state;
+    const uint32_t nProgForkHeight = (uint32_t)params.GetConsensus().ProgForkHeight;
+    if (std::any_of(headers.begin(), headers.end(), [nProgForkHeight](const CBlockHeader* pblock) { return pblock->GetHeight() < nProgForkHeight; })) {
+        EhInitialiseState(params.EquihashN(), params.EquihashK(), base_state);
+    }
+    std::vector<CPowCheck> vChecks;
+    vChecks.reserve(headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        vChecks.emplace_back(headers[i], params, base_state, source, pvValid ? &(*pvValid)[i] : nullptr);
+    }
+
+    CCheckQueueControl<CPowCheck> control(&powcheckqueue);
+    control.Add(vChecks);
+    bool fValid = control.Wait();
+    LogPrint(BCLog::POW, "CheckPowBatch(): %u %s checks in %.3fms\n", headers.size(), GetPowCheckSourceName(source), 0.001 * (GetTimeMicros() - nTimeStart));
+    return fValid;
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, bool postfork, const Consensus::Params& params)
@@ -8,14 +8,47 @@
 
 #include "arith_uint256.h"
 #include "consensus/params.h"
+#include "crypto/progpow/hash_types.hpp"
 
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 class CBlockHeader;
 class CBlockIndex;
 class CChainParams;
 class uint256;
 
+/** Default for -progpowcontexts, the number of ProgPoW epoch contexts kept in memory */
+static const int DEFAULT_PROGPOW_CONTEXTS = 3;
+/** Default for -progpowcontextcache, the memory limit of the ProgPoW epoch contexts in MiB */
+static const int DEFAULT_PROGPOW_CONTEXT_CACHE = 256;
+/** Default for -progpowcachefiles, keep the ProgPoW epoch caches in files in the data directory */
+static const bool DEFAULT_PROGPOW_CACHE_FILES = true;
+/** Start building the next ProgPoW epoch context this many blocks before the epoch boundary */
+static const int PROGPOW_PREBUILD_DISTANCE = 100;
+
+/** The callers of the proof-of-work checks, whose statistics are kept apart */
+enum class PowCheckSource {
+    HEADER, //!< Headers received or accepted ahead of their block
+    BLOCK,  //!< Blocks checked before being accepted
+    DISK,   //!< Blocks read back from disk
+    SHARE,  //!< Work submitted by miners
+};
+
+/** Number of buckets of the check latency histograms. Bucket i counts the
+ *  checks that took less than 2^i microseconds, the last one all the others. */
+static const int POW_LATENCY_BUCKETS = 24;
+
+/** Statistics of the proof-of-work checks of one algorithm and caller */
+struct PowCheckStats
+{
+    uint64_t nChecks;
+    uint64_t nFailures;
+    uint64_t nTotalMicros;
+    uint64_t vLatency[POW_LATENCY_BUCKETS];
+};
+
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params&);
 unsigned int CalculateNextWorkRequired(arith_uint256 bnAvg, int64_t nLastBlockTime, int64_t nFirstBlockTime, const Consensus::Params& params);
 
@@ -23,13 +56,51 @@ unsigned int BitcoinGetNextWorkRequired(const CBlockIndex* pindexLast, const CBl
 unsigned int BitcoinCalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params& params);
 
 /** Check whether the Equihash solution in a block header is valid */
-bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams&);
+bool CheckEquihashSolution(const CBlockHeader *pblock, const CChainParams&, PowCheckSource source);
 
 /** Calculate the block header in ProgPow algorithm.*/
 uint256 getBlockHeaderProgPowHash(const CBlockHeader *pblock);
 
-/** Check whether the progPow in a block header is valid */
-bool CheckProgPow(const CBlockHeader *pblock, const CChainParams&);
+/** Calculate the ProgPoW header hash of a block header, the keccak256 of the
+ *  header with the nonce zeroed and without the solution */
+ethash::hash256 GetProgPowHeaderHash(const CBlockHeader *pblock);
+
+/** Convert a target to the big endian boundary ethash compares its hashes with */
+ethash::hash256 GetProgPowBoundary(const arith_uint256& hashTarget);
+
+/** Check whether the progPow in a block header is valid. Failures are only
+ *  logged in the pow category, the callers report them. */
+bool CheckProgPow(const CBlockHeader *pblock, const CChainParams&, PowCheckSource source);
+
+/** Check whether the progPow in a block header is valid and its hash below
+ *  hashTarget instead of the block target, for the shares of miners */
+bool CheckProgPowShare(const CBlockHeader *pblock, const arith_uint256& hashTarget, const CChainParams&);
+
+/** Check the ProgPoW or Equihash solutions of several block headers on the
+ *  proof-of-work check threads, returning whether all of them are valid. The
+ *  remaining checks are skipped after the first failure. If pvValid is given,
+ *  it is set to whether each header was checked and found valid. */
+bool CheckPowBatch(const std::vector<const CBlockHeader*>& headers, const CChainParams&, PowCheckSource source, std::vector<char>* pvValid = nullptr);
+
+/** Run a proof-of-work check thread, there are -par - 1 of them */
+void ThreadPowCheck();
+
+/** Return the statistics of the ProgPoW or Equihash checks made for a caller.
+ *  The checks of a batch are counted one by one with their own latency. */
+PowCheckStats GetPowCheckStats(bool fProgPow, PowCheckSource source);
+
+/** Return the name of a proof-of-work check caller, as shown by getpowstats */
+std::string GetPowCheckSourceName(PowCheckSource source);
+
+/** Set the limits of the ProgPoW epoch context cache (count and MiB) */
+void SetProgPowContextCacheLimits(int nContexts, int64_t nCacheMiB);
+
+/** Build the context of the next ProgPoW epoch in the background when the
+ *  given height is close to the epoch boundary */
+void PrebuildNextProgPowContext(int nHeight, const Consensus::Params&);
+
+/** Wait for the ProgPoW epoch contexts being built in the background, at shutdown */
+void StopProgPowContextBuilds();
 
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, bool postfork, const Consensus::Params&);
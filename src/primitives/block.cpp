@@ -22,7 +22,7 @@
 //get block header progpow hash based header, nonce and mix hash
 uint256 getBlockHeaderProgPowHash(const CBlockHeader *pblock)
 {
-    uint64_t nonce = (pblock->nNonce).GetUint64(3);
+    uint64_t nonce = (pblock->GetNonce()).GetUint64(3);
 
     // I = the block header minus nonce and solution.
     // also uses CEquihashInput as custom header
@@ -30,7 +30,7 @@ uint256 getBlockHeaderProgPowHash(const CBlockHeader *pblock)
     // I||V  nonce part should be zeroed
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << I;
-    ss << pblock->nNonce;
+    ss << pblock->GetNonce();
 
     //the nonce should be zeroed
     memset((unsigned char*)&ss[108], 0, 32);
@@ -38,7 +38,7 @@ uint256 getBlockHeaderProgPowHash(const CBlockHeader *pblock)
 
     ethash::hash256 mix;
     //solution starts with  32 bytes mix hash.
-    const unsigned char *p = &*(pblock->nSolution.begin());
+    const unsigned char *p = &*(pblock->GetSolution().begin());
     memcpy(mix.bytes, &p[0], 32);
 
     /*
@@ -65,26 +65,37 @@ uint256 getBlockHeaderProgPowHash(const CBlockHeader *pblock)
     return r;
 }
 
-uint256 CBlockHeader::GetHash(const Consensus::Params& params) const
+static uint256 ComputeBlockHeaderHash(const CBlockHeader& header, const Consensus::Params& params)
 {
     int version;
 
     //after progpow fork and has the solution.
-    if ((nHeight >= (uint32_t)params.ProgForkHeight) && 
-                            (this->nSolution.size() > 0)){
-        return getBlockHeaderProgPowHash(this);
+    if ((header.GetHeight() >= (uint32_t)params.ProgForkHeight) &&
+                            (header.GetSolution().size() > 0)){
+        return getBlockHeaderProgPowHash(&header);
     }
 
-    if (nHeight >= (uint32_t)params.BCIHeight) {
+    if (header.GetHeight() >= (uint32_t)params.BCIHeight) {
         version = PROTOCOL_VERSION;
     } else {
         version = PROTOCOL_VERSION | SERIALIZE_BLOCK_LEGACY;
     }
     CHashWriter writer(SER_GETHASH, version);
-    ::Serialize(writer, *this);
+    ::Serialize(writer, header);
     return writer.GetHash();
 }
 
+uint256 CBlockHeader::GetHash(const Consensus::Params& params) const
+{
+    uint256 hash;
+    if (hashCache.Get(params, hash))
+        return hash;
+
+    hash = ComputeBlockHeaderHash(*this, params);
+    hashCache.Set(params, hash);
+    return hash;
+}
+
 uint256 CBlockHeader::GetHash() const
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
@@ -96,10 +107,10 @@ std::string CBlock::ToString() const
     std::stringstream s;
     s << strprintf("CBlock(hash=%s, ver=0x%08x, hashPrevBlock=%s, hashMerkleRoot=%s, nHeight=%u, nTime=%u, nBits=%08x, nNonce=%s, vtx=%u)\n",
         GetHash().ToString(),
-        nVersion,
-        hashPrevBlock.ToString(),
-        hashMerkleRoot.ToString(),
-        nHeight, nTime, nBits, nNonce.GetHex(),
+        GetVersion(),
+        GetPrevBlockHash().ToString(),
+        GetMerkleRoot().ToString(),
+        GetHeight(), GetTime(), GetBits(), GetNonce().GetHex(),
         vtx.size());
     for (const auto& tx : vtx) {
         s << "  " << tx->ToString() << "\n";
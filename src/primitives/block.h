@@ -11,6 +11,7 @@
 #include "serialize.h"
 #include "uint256.h"
 #include "version.h"
+#include <atomic>
 #include <string.h>
 
 namespace Consensus {
@@ -19,6 +20,56 @@ namespace Consensus {
 
 static const int SERIALIZE_BLOCK_LEGACY = 0x04000000;
 
+/** The hash of a block header and the consensus parameters it was computed
+ * with. The first thread to compute the hash of a shared const header stores
+ * it, the others read it once it is complete.
+ */
+class CBlockHashCache
+{
+private:
+    enum { EMPTY, WRITING, READY };
+    std::atomic<int> state;
+    const Consensus::Params* params;
+    uint256 hash;
+
+public:
+    CBlockHashCache() : state(EMPTY), params(nullptr) {}
+    CBlockHashCache(const CBlockHashCache& other) : state(EMPTY), params(nullptr) { *this = other; }
+
+    CBlockHashCache& operator=(const CBlockHashCache& other)
+    {
+        if (other.state.load(std::memory_order_acquire) == READY) {
+            params = other.params;
+            hash = other.hash;
+            state.store(READY, std::memory_order_release);
+        } else {
+            Reset();
+        }
+        return *this;
+    }
+
+    bool Get(const Consensus::Params& paramsIn, uint256& hashOut) const
+    {
+        if (state.load(std::memory_order_acquire) != READY || params != &paramsIn)
+            return false;
+        hashOut = hash;
+        return true;
+    }
+
+    void Set(const Consensus::Params& paramsIn, const uint256& hashIn)
+    {
+        int expected = EMPTY;
+        if (!state.compare_exchange_strong(expected, WRITING, std::memory_order_acquire))
+            return;
+        params = &paramsIn;
+        hash = hashIn;
+        state.store(READY, std::memory_order_release);
+    }
+
+    /** Only called by the owner of a header that is being modified */
+    void Reset() { state.store(EMPTY, std::memory_order_relaxed); }
+};
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -30,17 +81,27 @@ class CBlockHeader
 {
 public:
     static const size_t HEADER_SIZE = 4+32+32+4+4+4;  // Excluding Equihash solution
-    // header
+    static const size_t RESERVED_SIZE = 7;
+
+private:
+    // header, only written through the setters so that the memoized hash
+    // is reset along with them
     int32_t nVersion;
     uint256 hashPrevBlock;
     uint256 hashMerkleRoot;
     uint32_t nHeight;
-    uint32_t nReserved[7];
+    uint32_t nReserved[RESERVED_SIZE];
     uint32_t nTime;
     uint32_t nBits;
     uint256 nNonce;
     std::vector<unsigned char> nSolution;  // Equihash solution.
 
+    // memory only: reset by SetNull, the setters and deserialization
+    mutable CBlockHashCache hashCache;
+
+    friend class CEquihashInput;
+
+public:
     CBlockHeader()
     {
         SetNull();
@@ -57,7 +118,7 @@ public:
         READWRITE(hashMerkleRoot);
         if (new_format) {
             READWRITE(nHeight);
-            for(size_t i = 0; i < (sizeof(nReserved) / sizeof(nReserved[0])); i++) {
+            for(size_t i = 0; i < RESERVED_SIZE; i++) {
                 READWRITE(nReserved[i]);
             }
         }
@@ -71,6 +132,8 @@ public:
             READWRITE(legacy_nonce);
             nNonce = ArithToUint256(arith_uint256(legacy_nonce));
         }
+        if (ser_action.ForRead())
+            hashCache.Reset();
     }
 
     void SetNull()
@@ -84,6 +147,7 @@ public:
         nBits = 0;
         nNonce.SetNull();
         nSolution.clear();
+        hashCache.Reset();
     }
 
     bool IsNull() const
@@ -91,6 +155,34 @@ public:
         return (nBits == 0);
     }
 
+    int32_t GetVersion() const { return nVersion; }
+    const uint256& GetPrevBlockHash() const { return hashPrevBlock; }
+    const uint256& GetMerkleRoot() const { return hashMerkleRoot; }
+    uint32_t GetHeight() const { return nHeight; }
+    const uint32_t* GetReserved() const { return nReserved; }
+    uint32_t GetTime() const { return nTime; }
+    uint32_t GetBits() const { return nBits; }
+    const uint256& GetNonce() const { return nNonce; }
+    const std::vector<unsigned char>& GetSolution() const { return nSolution; }
+
+    void SetVersion(int32_t nVersionIn) { nVersion = nVersionIn; hashCache.Reset(); }
+    void SetPrevBlockHash(const uint256& hashPrevBlockIn) { hashPrevBlock = hashPrevBlockIn; hashCache.Reset(); }
+    void SetMerkleRoot(const uint256& hashMerkleRootIn) { hashMerkleRoot = hashMerkleRootIn; hashCache.Reset(); }
+    void SetHeight(uint32_t nHeightIn) { nHeight = nHeightIn; hashCache.Reset(); }
+    /** Copy the RESERVED_SIZE reserved words, or clear them if pReservedIn is null */
+    void SetReserved(const uint32_t* pReservedIn)
+    {
+        if (pReservedIn)
+            memcpy(nReserved, pReservedIn, sizeof(nReserved));
+        else
+            memset(nReserved, 0, sizeof(nReserved));
+        hashCache.Reset();
+    }
+    void SetTime(uint32_t nTimeIn) { nTime = nTimeIn; hashCache.Reset(); }
+    void SetBits(uint32_t nBitsIn) { nBits = nBitsIn; hashCache.Reset(); }
+    void SetNonce(const uint256& nNonceIn) { nNonce = nNonceIn; hashCache.Reset(); }
+    void SetSolution(std::vector<unsigned char> nSolutionIn) { nSolution = std::move(nSolutionIn); hashCache.Reset(); }
+
     uint256 GetHash() const;
     uint256 GetHash(const Consensus::Params& params) const;
 
@@ -138,17 +230,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nHeight        = nHeight;
-        memcpy(block.nReserved, nReserved, sizeof(block.nReserved));
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
-        return block;
+        // Copies the header fields along with their cached hash.
+        return *this;
     }
 
     std::string ToString() const;
@@ -175,7 +258,7 @@ public:
         READWRITE(hashPrevBlock);
         READWRITE(hashMerkleRoot);
         READWRITE(nHeight);
-        for(size_t i = 0; i < (sizeof(nReserved) / sizeof(nReserved[0])); i++) {
+        for(size_t i = 0; i < RESERVED_SIZE; i++) {
             READWRITE(nReserved[i]);
         }
         READWRITE(nTime);
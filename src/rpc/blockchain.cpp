@@ -10,10 +10,12 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinstats.h"
 #include "consensus/validation.h"
 #include "consensus/params.h"
 #include "validation.h"
 #include "core_io.h"
+#include "fs.h"
 #include "policy/feerate.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
@@ -166,9 +168,9 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | ser_flags)));
     result.push_back(Pair("weight", (int)::GetBlockWeight(block, consensusParams)));
     result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("versionHex", strprintf("%08x", block.nVersion)));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
+    result.push_back(Pair("version", block.GetVersion()));
+    result.push_back(Pair("versionHex", strprintf("%08x", block.GetVersion())));
+    result.push_back(Pair("merkleroot", block.GetMerkleRoot().GetHex()));
     UniValue txs(UniValue::VARR);
     for(const auto& tx : block.vtx)
     {
@@ -184,9 +186,9 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     result.push_back(Pair("tx", txs));
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
-    result.push_back(Pair("nonceUint32", (uint64_t)((uint32_t)block.nNonce.GetUint64(0))));
-    result.push_back(Pair("nonce", block.nNonce.GetHex()));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
+    result.push_back(Pair("nonceUint32", (uint64_t)((uint32_t)block.GetNonce().GetUint64(0))));
+    result.push_back(Pair("nonce", block.GetNonce().GetHex()));
+    result.push_back(Pair("bits", strprintf("%08x", block.GetBits())));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
 
@@ -840,76 +842,6 @@ UniValue getblock(const JSONRPCRequest& request)
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nBogoSize;
-    uint256 hashSerialized;
-    uint64_t nDiskSize;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nBogoSize(0), nDiskSize(0), nTotalAmount(0) {}
-};
-
-static void ApplyStats(CCoinsStats &stats, CHashWriter& ss, const uint256& hash, const std::map<uint32_t, Coin>& outputs)
-{
-    assert(!outputs.empty());
-    ss << hash;
-    ss << VARINT(outputs.begin()->second.nHeight * 2 + outputs.begin()->second.fCoinBase);
-    stats.nTransactions++;
-    for (const auto output : outputs) {
-        ss << VARINT(output.first + 1);
-        ss << output.second.out.scriptPubKey;
-        ss << VARINT(output.second.out.nValue);
-        stats.nTransactionOutputs++;
-        stats.nTotalAmount += output.second.out.nValue;
-        stats.nBogoSize += 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
-                           2 /* scriptPubKey len */ + output.second.out.scriptPubKey.size() /* scriptPubKey */;
-    }
-    ss << VARINT(0);
-}
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
-
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    uint256 prevkey;
-    std::map<uint32_t, Coin> outputs;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        COutPoint key;
-        Coin coin;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coin)) {
-            if (!outputs.empty() && key.hash != prevkey) {
-                ApplyStats(stats, ss, prevkey, outputs);
-                outputs.clear();
-            }
-            prevkey = key.hash;
-            outputs[key.n] = std::move(coin);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    if (!outputs.empty()) {
-        ApplyStats(stats, ss, prevkey, outputs);
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nDiskSize = view->EstimateSize();
-    return true;
-}
-
 UniValue pruneblockchain(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -961,29 +893,68 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" height )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless the statistics come from -coinstatsindex.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"  (string, optional, default=\"hash_serialized_2\") The hash of the set to return:\n"
+            "                \"hash_serialized_2\" scans the set at the tip,\n"
+            "                \"muhash\" reads the statistics of -coinstatsindex, which has no transactions and disk_size\n"
+            "2. height       (numeric, optional) The height of a block of the active chain to return the statistics after,\n"
+            "                instead of the tip. Requires \"muhash\"\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, only with hash_serialized_2\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash, only with hash_serialized_2\n"
+            "  \"muhash\": \"hash\",       (string) The order independent MuHash of the unspent outputs, only with muhash\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk, only with hash_serialized_2\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
-            + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\" 1000")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\", 1000")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    const std::string strHashType = request.params[0].isNull() ? "hash_serialized_2" : request.params[0].get_str();
+    if (strHashType == "muhash") {
+        if (!fCoinStatsIndex)
+            throw JSONRPCError(RPC_MISC_ERROR, "The muhash statistics require -coinstatsindex");
+        const CBlockIndex* pindex;
+        CBlockCoinsStats stats;
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+            if (!request.params[1].isNull()) {
+                int nHeight = request.params[1].get_int();
+                if (nHeight < 0 || nHeight > chainActive.Height())
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+                pindex = chainActive[nHeight];
+            }
+            if (!ReadBlockCoinsStats(pindex, stats))
+                throw JSONRPCError(RPC_MISC_ERROR, "No UTXO set statistics for block " + pindex->GetBlockHash().GetHex() + ", the index is still being built or a block before it is pruned (see debug.log)");
+        }
+        ret.push_back(Pair("height", (int64_t)pindex->nHeight));
+        ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        ret.push_back(Pair("muhash", stats.GetMuHash().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+    if (strHashType != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+    if (!request.params[1].isNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "The statistics at a height require hash_type muhash");
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsdbview, stats)) {
@@ -1001,6 +972,111 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1)
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the unspent transaction output set at the tip, and the block headers up to it, to a snapshot file.\n"
+            "A node started with -loadtxoutset on an empty chain state loads it, if its muhash is committed in the chain parameters.\n"
+            "\nArguments:\n"
+            "1. \"path\"     (string, required) The path of the snapshot, relative to the data directory if not absolute. It must not exist.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,          (numeric) The number of coins written\n"
+            "  \"base_hash\": \"hex\",          (string) The hash of the block at which the snapshot was taken\n"
+            "  \"base_height\": n,            (numeric) The height of that block\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash of the coins, as in gettxoutsetinfo\n"
+            "  \"muhash\": \"hash\",            (string) The MuHash of the coins, which the chain parameters commit to\n"
+            "  \"txcount\": n,                (numeric) The number of transactions up to and including the base block\n"
+            "  \"path\": \"path\"               (string) The absolute path of the snapshot\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    const fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    const fs::path temppath = path.string() + ".incomplete";
+    if (fs::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CAutoFile file(fsbridge::fopen(temppath, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + temppath.string() + " for writing");
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    CCoinsStats stats;
+    unsigned int nChainTx;
+    {
+        // The cursor reads the database as it is when created, so create it
+        // right after flushing the chain state at the tip.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        const CBlockIndex* tip = chainActive.Tip();
+        if (pcursor->GetBestBlock() != tip->GetBlockHash())
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to flush the chain state");
+        stats.hashBlock = tip->GetBlockHash();
+        stats.nHeight = tip->nHeight;
+        nChainTx = tip->nChainTx;
+
+        SnapshotMetadata metadata;
+        metadata.hashBaseBlock = stats.hashBlock;
+        metadata.nHeight = stats.nHeight;
+        file.write((const char*)Params().MessageStart(), CMessageHeader::MESSAGE_START_SIZE);
+        file << metadata;
+        for (int nHeight = 1; nHeight <= tip->nHeight; nHeight++) {
+            file << chainActive[nHeight]->GetBlockHeader();
+        }
+    }
+
+    CCoinsStatsBuilder builder(stats);
+    CBlockCoinsStats blockstats;
+    uint64_t nCoins = 0;
+    CDataStream chunk(SER_DISK, CLIENT_VERSION);
+    uint32_t nChunkCoins = 0;
+    const auto WriteChunk = [&]() {
+        file << nChunkCoins;
+        file.write(chunk.data(), chunk.size());
+        file << Hash(chunk.begin(), chunk.end());
+        chunk.clear();
+        nChunkCoins = 0;
+    };
+    for (; pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        chunk << key << coin;
+        builder.Add(key, coin);
+        blockstats.Add(key, coin);
+        nCoins++;
+        if (++nChunkCoins == SNAPSHOT_CHUNK_COINS)
+            WriteChunk();
+    }
+    if (nChunkCoins > 0)
+        WriteChunk();
+    WriteChunk();
+    builder.Finish();
+
+    FileCommit(file.Get());
+    file.fclose();
+    if (!RenameOver(temppath, path))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + temppath.string());
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("coins_written", nCoins));
+    ret.push_back(Pair("base_hash", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", stats.nHeight));
+    ret.push_back(Pair("hash_serialized_2", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("muhash", blockstats.GetMuHash().GetHex()));
+    ret.push_back(Pair("txcount", (int64_t)nChainTx));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1197,6 +1273,9 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) lowest-height complete block stored\n"
+            "  \"snapshotunvalidated\": xx, (boolean) if the chain state was loaded from a UTXO set snapshot (-loadtxoutset),\n"
+            "                             whose blocks below its base are trusted and never validated\n"
+            "  \"snapshotheight\": xxxxxx, (numeric) the height of the base of the snapshot (only if snapshotunvalidated)\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -1261,6 +1340,10 @@ UniValue getblockchaininfo(const JSONRPCRequest& request)
 
         obj.push_back(Pair("pruneheight",        block->nHeight));
     }
+    const CBlockIndex* pindexSnapshotBase = GetSnapshotBase();
+    obj.push_back(Pair("snapshotunvalidated",   pindexSnapshotBase != nullptr));
+    if (pindexSnapshotBase)
+        obj.push_back(Pair("snapshotheight",     pindexSnapshotBase->nHeight));
     return obj;
 }
 
@@ -1613,7 +1696,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {"hash_type","height"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,  {"path"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
     { "blockchain",         "verifychain",            &verifychain,            true,  {"checklevel","nblocks"} },
 
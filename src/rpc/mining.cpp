@@ -11,7 +11,6 @@
 #include "consensus/params.h"
 #include "consensus/validation.h"
 #include "core_io.h"
-#include "crypto/equihash.h"
 #include "init.h"
 #include "validation.h"
 #include "miner.h"
@@ -128,11 +127,9 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
     const CChainParams& params = Params();
-    unsigned int n = params.EquihashN();
-    unsigned int k = params.EquihashK();
     while (nHeight < nHeightEnd)
     {
-        std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateBlockTemplate(Params(), coinbaseScript->reserveScript));
         if (!pblocktemplate.get())
             throw JSONRPCError(RPC_INTERNAL_ERROR, "Couldn't create new block");
         CBlock *pblock = &pblocktemplate->block;
@@ -140,114 +137,40 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        if (pblock->nHeight < (uint32_t)params.GetConsensus().BCIHeight) {
+        if (pblock->GetHeight() < (uint32_t)params.GetConsensus().BCIHeight) {
             // Solve sha256d.
-            while (nMaxTries > 0 && (int)pblock->nNonce.GetUint64(0) < nInnerLoopCount &&
-                   !CheckProofOfWork(pblock->GetHash(), pblock->nBits, false, Params().GetConsensus())) {
-                pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
+            while (nMaxTries > 0 && (int)pblock->GetNonce().GetUint64(0) < nInnerLoopCount &&
+                   !CheckProofOfWork(pblock->GetHash(), pblock->GetBits(), false, Params().GetConsensus())) {
+                pblock->SetNonce(ArithToUint256(UintToArith256(pblock->GetNonce()) + 1));
                 --nMaxTries;
             }
-        } else if (pblock->nHeight < (uint32_t)params.GetConsensus().ProgForkHeight) {
+        } else if (pblock->GetHeight() < (uint32_t)params.GetConsensus().ProgForkHeight) {
             // Solve Equihash.
-            crypto_generichash_blake2b_state eh_state;
-            EhInitialiseState(n, k, eh_state);
-
-            // I = the block header minus nonce and solution.
-            CEquihashInput I{*pblock};
-            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-            ss << I;
-
-            // H(I||...
-            crypto_generichash_blake2b_update(&eh_state, (unsigned char*)&ss[0], ss.size());
-
-            while (nMaxTries > 0 &&
-                   ((int)pblock->nNonce.GetUint64(0) & nInnerLoopEquihashMask) < nInnerLoopEquihashCount) {
-                // Yes, there is a chance every nonce could fail to satisfy the -regtest
-                // target -- 1 in 2^(2^256). That ain't gonna happen
-                pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
-
-                // H(I||V||...
-                crypto_generichash_blake2b_state curr_state;
-                curr_state = eh_state;
-                crypto_generichash_blake2b_update(&curr_state,
-                                                  pblock->nNonce.begin(),
-                                                  pblock->nNonce.size());
-
-                // (x_1, x_2, ...) = A(I, V, n, k)
-                std::function<bool(std::vector<unsigned char>)> validBlock =
-                        [&pblock](std::vector<unsigned char> soln) {
-                    pblock->nSolution = soln;
-                    // TODO(h4x3rotab): Add metrics counter like Zcash? `solutionTargetChecks.increment();`
-                    // TODO(h4x3rotab): Maybe switch to EhBasicSolve and better deal with `nMaxTries`?
-                    return CheckProofOfWork(pblock->GetHash(), pblock->nBits, true, Params().GetConsensus());
-                };
-                bool found = EhBasicSolveUncancellable(n, k, curr_state, validBlock);
-                --nMaxTries;
-                // TODO(h4x3rotab): Add metrics counter like Zcash? `ehSolverRuns.increment();`
-                if (found) {
-                    break;
-                }
-            }
+            // Yes, there is a chance every nonce could fail to satisfy the -regtest
+            // target -- 1 in 2^(2^256). That ain't gonna happen
+            const int nLowNonce = (int)pblock->GetNonce().GetUint64(0) & nInnerLoopEquihashMask;
+            SolveEquihashBlock(pblock, std::max(nInnerLoopEquihashCount - nLowNonce, 0), nMaxTries);
         } else {
-            // search ProgPow after progpow fork
-
-            // I = the block header minus nonce and solution.
-            CEquihashInput I{*pblock};
-            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-            ss << I;
-            ss << pblock->nNonce;
-
-            // H(I||V...
-            memset((unsigned char*)&ss[108], 0, 32);
-            ethash::hash256 header_hash = ethash_keccak256((unsigned char*)&ss[0], 140);
-
-            uint64_t start_nonce = pblock->nNonce.GetUint64(3);
-            uint32_t epoch = ethash::get_epoch_number(pblock->nHeight);
-            ethash_epoch_context epoch_ctx = ethash::get_global_epoch_context(epoch);
-
-            while (nMaxTries > 0) {
-                // Yes, there is a chance every nonce could fail to satisfy the -regtest
-                // target -- 1 in 2^(2^256). That ain't gonna happen
-                //pblock->nNonce = ArithToUint256(UintToArith256(pblock->nNonce) + 1);
-                
-                // H(I||V||...
-
-                ethash::hash256 target;
-                arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
-                //memcpy(target.bytes, ArithToUint256(hashTarget).begin(), 32);
-                uint8_t *pp = ArithToUint256(hashTarget).begin();
-                for(int i = 0; i < 32; i ++) {
-                    target.bytes[i] = pp[31-i];
-                }
-
-                auto r = ethash::check_progpow_nonce_light(epoch_ctx, header_hash,
-                                                           target, start_nonce);
-                if (r.ok) {
-                    //found, set nonce & mix hash
-                    pblock->nNonce = ArithToUint256(arith_uint256(start_nonce));
-
-                    std::vector<unsigned char> soln;
-                    soln.clear();
-                    unsigned char *p = &*(soln.begin());                    
-                    //soln length 1344
-                    p[0] = 0xfd;
-                    p[1] = 0x40;
-                    p[2] = 0x05;
-                    memcpy(&p[0], r.results.mix_hash.bytes, 32);
-
-                    pblock->nSolution = soln;
+            // Search ProgPoW after the ProgPoW fork.
+            const CBlockIndex* pindexPrev;
+            {
+                LOCK(cs_main);
+                pindexPrev = chainActive.Tip();
+            }
+            if (!SolveProgPowBlock(pblock, pindexPrev, nMaxTries)) {
+                if (nMaxTries == 0) {
                     break;
-                } 
-
-                --nMaxTries;
-                start_nonce ++;
+                }
+                // The tip changed, mine on a new template.
+                continue;
             }
         }
 
-        if (nMaxTries == 0) {
+        // A ProgPoW block is only left here when found, even with the last tries.
+        if (nMaxTries == 0 && pblock->GetHeight() < (uint32_t)params.GetConsensus().ProgForkHeight) {
             break;
         }
-        if ((int)pblock->nNonce.GetUint64(0) == nInnerLoopCount) {
+        if ((int)pblock->GetNonce().GetUint64(0) == nInnerLoopCount) {
             continue;
         }
         std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
@@ -313,6 +236,7 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"difficulty\": xxx.xxxxx    (numeric) The current difficulty\n"
             "  \"errors\": \"...\"            (string) Current errors\n"
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
+            "  \"hashespersec\": nnn,       (numeric) The ProgPoW hashes per second of the last generate call\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
             "}\n"
@@ -332,11 +256,88 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
     obj.push_back(Pair("errors",           GetWarnings("statusbar")));
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
+    obj.push_back(Pair("hashespersec",     GetProgPowHashesPerSec()));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
     return obj;
 }
 
+static UniValue PowCheckStatsToJSON(bool fProgPow)
+{
+    UniValue result(UniValue::VOBJ);
+    for (PowCheckSource source : {PowCheckSource::HEADER, PowCheckSource::BLOCK, PowCheckSource::DISK, PowCheckSource::SHARE}) {
+        const PowCheckStats stats = GetPowCheckStats(fProgPow, source);
+        UniValue latency(UniValue::VARR);
+        for (int i = 0; i < POW_LATENCY_BUCKETS; i++) {
+            latency.push_back(stats.vLatency[i]);
+        }
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("checks", stats.nChecks));
+        obj.push_back(Pair("failures", stats.nFailures));
+        obj.push_back(Pair("total_ms", 0.001 * stats.nTotalMicros));
+        obj.push_back(Pair("average_ms", stats.nChecks ? 0.001 * stats.nTotalMicros / stats.nChecks : 0.0));
+        obj.push_back(Pair("latency", latency));
+        result.push_back(Pair(GetPowCheckSourceName(source), obj));
+    }
+    return result;
+}
+
+UniValue getpowstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getpowstats\n"
+            "\nReturns statistics of the proof-of-work checks and of the ProgPoW epoch contexts since startup."
+            "\nThe checks are counted by caller: header (headers received or accepted ahead of their block),"
+            "\nblock (blocks checked before being accepted), disk (blocks read from disk) and share (mined work)."
+            "\n\nResult:\n"
+            "{\n"
+            "  \"progpow\": {                (json object) The ProgPoW checks\n"
+            "    \"header\": {               (json object) The checks of a caller\n"
+            "      \"checks\": n,            (numeric) The number of checks\n"
+            "      \"failures\": n,          (numeric) The number of invalid solutions\n"
+            "      \"total_ms\": x.xxx,      (numeric) The time spent in the checks in milliseconds\n"
+            "      \"average_ms\": x.xxx,    (numeric) The average time of a check in milliseconds\n"
+            "      \"latency\": [ n, ... ]   (array) Element i counts the checks that took less than 2^i\n"
+            "                                microseconds, the last one all the others\n"
+            "    },\n"
+            "    ...\n"
+            "  },\n"
+            "  \"equihash\": { ... },       (json object) The Equihash checks, as above\n"
+            "  \"epochcontexts\": {          (json object) The ProgPoW light epoch context cache\n"
+            "    \"hits\": n,                (numeric) Lookups served by a cached context\n"
+            "    \"misses\": n,              (numeric) Lookups that had to build the context\n"
+            "    \"builds\": n,              (numeric) Contexts built, including those built ahead of an epoch\n"
+            "    \"buildfailures\": n,       (numeric) Contexts that could not be allocated\n"
+            "    \"buildtotal_ms\": x.xxx,   (numeric) The time spent building contexts in milliseconds\n"
+            "    \"lastbuild_ms\": x.xxx,    (numeric) The duration of the last build in milliseconds\n"
+            "    \"lastbuildepoch\": n,      (numeric) The epoch of the last build, -1 if none\n"
+            "    \"cached\": n               (numeric) The number of contexts in the cache\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getpowstats", "")
+            + HelpExampleRpc("getpowstats", "")
+        );
+
+    const ethash::epoch_context_cache_stats cache = ethash::get_epoch_context_cache_stats();
+    UniValue contexts(UniValue::VOBJ);
+    contexts.push_back(Pair("hits", cache.hits));
+    contexts.push_back(Pair("misses", cache.misses));
+    contexts.push_back(Pair("builds", cache.builds));
+    contexts.push_back(Pair("buildfailures", cache.build_failures));
+    contexts.push_back(Pair("buildtotal_ms", 0.001 * cache.build_microseconds));
+    contexts.push_back(Pair("lastbuild_ms", 0.001 * cache.last_build_microseconds));
+    contexts.push_back(Pair("lastbuildepoch", cache.last_build_epoch));
+    contexts.push_back(Pair("cached", (uint64_t)cache.cached));
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("progpow", PowCheckStatsToJSON(true)));
+    obj.push_back(Pair("equihash", PowCheckStatsToJSON(false)));
+    obj.push_back(Pair("epochcontexts", contexts));
+    return obj;
+}
+
 
 // NOTE: Unlike wallet RPC (which use BCI values), mining RPCs follow GBT (BIP 22) in using satoshi amounts
 UniValue prioritisetransaction(const JSONRPCRequest& request)
@@ -524,9 +525,9 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
 
             CBlockIndex* const pindexPrev = chainActive.Tip();
             // TestBlockValidity only supports blocks built on the current Tip
-            if (block.hashPrevBlock != pindexPrev->GetBlockHash())
+            if (block.GetPrevBlockHash() != pindexPrev->GetBlockHash())
                 return "inconclusive-not-best-prevblk";
-            if (!legacy_format && block.nHeight != (uint32_t)pindexPrev->nHeight + 1)
+            if (!legacy_format && block.GetHeight() != (uint32_t)pindexPrev->nHeight + 1)
                 return "inconclusive-bad-height";
             CValidationState state;
             TestBlockValidity(state, Params(), block, pindexPrev, false, true);
@@ -636,7 +637,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
 
         // Create new block
         CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
+        pblocktemplate = CreateBlockTemplate(Params(), scriptDummy, fSupportsSegwit);
         if (!pblocktemplate)
             throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
 
@@ -648,8 +649,8 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
 
     // Update nTime
     UpdateTime(pblock, consensusParams, pindexPrev);
-    pblock->nNonce = uint256();
-    pblock->nSolution.clear();
+    pblock->SetNonce(uint256());
+    pblock->SetSolution(std::vector<unsigned char>());
 
     // NOTE: If at some point we support pre-segwit miners post-segwit-activation, this needs to take segwit support into consideration
     const bool fPreSegWit = (THRESHOLD_ACTIVE != VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_SEGWIT, versionbitscache));
@@ -697,7 +698,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     UniValue aux(UniValue::VOBJ);
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
-    arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+    arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->GetBits());
 
     UniValue aMutable(UniValue::VARR);
     aMutable.push_back("time");
@@ -719,7 +720,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
                 break;
             case THRESHOLD_LOCKED_IN:
                 // Ensure bit is set in block version
-                pblock->nVersion |= VersionBitsMask(consensusParams, pos);
+                pblock->SetVersion(pblock->GetVersion() | VersionBitsMask(consensusParams, pos));
                 // FALL THROUGH to get vbavailable set...
             case THRESHOLD_STARTED:
             {
@@ -728,7 +729,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
                 if (setClientRules.find(vbinfo.name) == setClientRules.end()) {
                     if (!vbinfo.gbt_force) {
                         // If the client doesn't support this, don't indicate it in the [default] version
-                        pblock->nVersion &= ~VersionBitsMask(consensusParams, pos);
+                        pblock->SetVersion(pblock->GetVersion() & ~VersionBitsMask(consensusParams, pos));
                     }
                 }
                 break;
@@ -749,7 +750,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
             }
         }
     }
-    result.push_back(Pair("version", pblock->nVersion));
+    result.push_back(Pair("version", pblock->GetVersion()));
     result.push_back(Pair("rules", aRules));
     result.push_back(Pair("vbavailable", vbavailable));
     result.push_back(Pair("vbrequired", int(0)));
@@ -762,7 +763,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         aMutable.push_back("version/force");
     }
     // TODO(h4x3rotab): Return nHeight?
-    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
+    result.push_back(Pair("previousblockhash", pblock->GetPrevBlockHash().GetHex()));
     result.push_back(Pair("transactions", transactions));
     result.push_back(Pair("coinbaseaux", aux));
 	const CChainParams& params = Params();
@@ -802,7 +803,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         result.push_back(Pair("weightlimit", (int64_t)MAX_BLOCK_WEIGHT));
     }
     result.push_back(Pair("curtime", pblock->GetBlockTime()));
-    result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
+    result.push_back(Pair("bits", strprintf("%08x", pblock->GetBits())));
     result.push_back(Pair("height", (int64_t)(pindexPrev->nHeight+1)));
 
     if (!pblocktemplate->vchCoinbaseCommitment.empty() && fSupportsSegwit) {
@@ -884,7 +885,7 @@ UniValue submitblock(const JSONRPCRequest& request)
 
     {
         LOCK(cs_main);
-        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(block.GetPrevBlockHash());
         if (mi != mapBlockIndex.end()) {
             UpdateUncommittedBlockStructures(block, mi->second, Params().GetConsensus());
         }
@@ -1143,6 +1144,7 @@ static const CRPCCommand commands[] =
   //  --------------------- ------------------------  -----------------------  ----------
     { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,  {"nblocks","height"} },
     { "mining",             "getmininginfo",          &getmininginfo,          true,  {} },
+    { "mining",             "getpowstats",            &getpowstats,            true,  {} },
     { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,  {"txid","dummy","fee_delta"} },
     { "mining",             "getblocktemplate",       &getblocktemplate,       true,  {"template_request"} },
     { "mining",             "submitblock",            &submitblock,            true,  {"hexdata","dummy"} },
@@ -274,7 +274,7 @@ UniValue verifytxoutproof(const JSONRPCRequest& request)
 
     std::vector<uint256> vMatch;
     std::vector<unsigned int> vIndex;
-    if (merkleBlock.txn.ExtractMatches(vMatch, vIndex) != merkleBlock.header.hashMerkleRoot)
+    if (merkleBlock.txn.ExtractMatches(vMatch, vIndex) != merkleBlock.header.GetMerkleRoot())
         return res;
 
     LOCK(cs_main);
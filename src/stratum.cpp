@@ -0,0 +1,675 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/params.h"
+#include "crypto/common.h"
+#include "crypto/progpow/ethash.hpp"
+#include "httpserver.h"
+#include "miner.h"
+#include "netbase.h"
+#include "pow.h"
+#include "primitives/block.h"
+#include "script/standard.h"
+#include "txmempool.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "validation.h"
+#include "validationinterface.h"
+
+#include <univalue.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/listener.h>
+#include <event2/util.h>
+
+/** Maximum length of a request line; longer lines close the connection */
+static const size_t MAX_STRATUM_LINE_LENGTH = 16 * 1024;
+/** Number of jobs of the current tip that shares are accepted for */
+static const size_t MAX_STRATUM_JOBS = 8;
+/** Number of shares waiting for the worker thread beyond which shares are refused */
+static const size_t MAX_STRATUM_QUEUE_DEPTH = 1024;
+
+static std::vector<CSubNet> stratum_allow_subnets;
+static StratumServer* stratumServer = nullptr;
+/** Whether the event thread closed the connections on interruption */
+static bool fStratumClosed = false;
+
+static bool StratumClientAllowed(const CNetAddr& netaddr)
+{
+    if (!netaddr.IsValid())
+        return false;
+    for (const CSubNet& subnet : stratum_allow_subnets)
+        if (subnet.Match(netaddr))
+            return true;
+    return false;
+}
+
+static bool InitStratumAllowList()
+{
+    stratum_allow_subnets.clear();
+    CNetAddr localv4;
+    CNetAddr localv6;
+    LookupHost("127.0.0.1", localv4, false);
+    LookupHost("::1", localv6, false);
+    stratum_allow_subnets.push_back(CSubNet(localv4, 8));      // always allow IPv4 local subnet
+    stratum_allow_subnets.push_back(CSubNet(localv6));         // always allow IPv6 localhost
+    for (const std::string& strAllow : gArgs.GetArgs("-stratumallowip")) {
+        CSubNet subnet;
+        LookupSubNet(strAllow.c_str(), subnet);
+        if (!subnet.IsValid()) {
+            LogPrintf("Invalid -stratumallowip subnet specification: %s\n", strAllow);
+            return false;
+        }
+        stratum_allow_subnets.push_back(subnet);
+    }
+    return true;
+}
+
+/** Hex of an ethash hash, which is big endian */
+static std::string EthashHashToHex(const ethash::hash256& hash)
+{
+    return "0x" + HexStr(hash.bytes, hash.bytes + sizeof(hash.bytes));
+}
+
+/** Parse a hex string with an optional 0x prefix */
+static bool ParseStratumHex(const UniValue& value, std::vector<unsigned char>& out)
+{
+    if (!value.isStr())
+        return false;
+    std::string str = value.get_str();
+    if (str.compare(0, 2, "0x") == 0)
+        str = str.substr(2);
+    if (!IsHex(str))
+        return false;
+    out = ParseHex(str);
+    return true;
+}
+
+arith_uint256 GetStratumShareTarget(uint64_t nDifficulty, const arith_uint256& blockTarget, const Consensus::Params& params)
+{
+    const arith_uint256 shareTarget = UintToArith256(params.powLimit) / std::max<uint64_t>(nDifficulty, 1);
+    return std::max(shareTarget, blockTarget);
+}
+
+bool CheckStratumExtraNonce(uint64_t nonce, const std::string& strExtraNonce)
+{
+    unsigned char vNonce[8];
+    WriteBE64(vNonce, nonce);
+    return HexStr(vNonce, vNonce + sizeof(vNonce)).compare(0, strExtraNonce.size(), strExtraNonce) == 0 &&
+           strExtraNonce.size() <= 2 * sizeof(vNonce);
+}
+
+StratumConnection::StratumConnection(StratumServer& _server, uint64_t _nId, struct bufferevent* _bev, const CService& _peer, uint16_t _nExtraNonce) :
+    server(_server), nId(_nId), bev(_bev), peer(_peer), nExtraNonce(_nExtraNonce), strExtraNonce(strprintf("%04x", _nExtraNonce)), fSubscribed(false), fAuthorized(false)
+{
+}
+
+StratumConnection::~StratumConnection()
+{
+    bufferevent_free(bev);
+}
+
+void StratumConnection::readcb(struct bufferevent* bev, void* ctx)
+{
+    StratumConnection* self = static_cast<StratumConnection*>(ctx);
+    struct evbuffer* input = bufferevent_get_input(bev);
+    size_t n_read_out = 0;
+    char* line;
+    while ((line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_CRLF)) != nullptr) {
+        std::string s(line, n_read_out);
+        free(line);
+        if (s.empty())
+            continue;
+        if (!self->server.ProcessLine(self, s))
+            return;
+    }
+    if (evbuffer_get_length(input) > MAX_STRATUM_LINE_LENGTH) {
+        LogPrint(BCLog::STRATUM, "stratum: request of %s too long, disconnecting\n", self->peer.ToString());
+        self->server.Disconnect(self);
+    }
+}
+
+void StratumConnection::eventcb(struct bufferevent* bev, short what, void* ctx)
+{
+    StratumConnection* self = static_cast<StratumConnection*>(ctx);
+    if (what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+        LogPrint(BCLog::STRATUM, "stratum: %s disconnected\n", self->peer.ToString());
+        self->server.Disconnect(self);
+    }
+}
+
+StratumServer::StratumServer(struct event_base* _base, const CScript& _coinbaseScript, int _nRefreshSeconds, uint64_t _nShareDifficulty) :
+    base(_base), coinbaseScript(_coinbaseScript), nRefreshSeconds(_nRefreshSeconds), nShareDifficulty(_nShareDifficulty),
+    nJobCounter(0), nConnectionCounter(0), nExtraNonce(0), nTransactionsUpdatedLast(0), fStopWork(false)
+{
+    tipEvent.reset(new HTTPEvent(base, false, [this] { UpdateJob(true); }));
+    refreshEvent.reset(new HTTPEvent(base, false, [this] { RefreshJob(); }));
+    threadWork = std::thread(&StratumServer::ThreadWork, this);
+}
+
+StratumServer::~StratumServer()
+{
+    StopWorker();
+    // Freeing the events waits for their handlers to return.
+    tipEvent.reset();
+    refreshEvent.reset();
+    Close();
+}
+
+void StratumServer::ThreadWork()
+{
+    RenameThread("bitcoin-stratum");
+    while (true) {
+        std::function<void()> work;
+        {
+            std::unique_lock<std::mutex> lock(csWork);
+            condWork.wait(lock, [this] { return fStopWork || !queueWork.empty(); });
+            if (fStopWork)
+                return;
+            work = std::move(queueWork.front());
+            queueWork.pop_front();
+        }
+        work();
+    }
+}
+
+bool StratumServer::PostWork(std::function<void()> work, bool fLimited)
+{
+    std::lock_guard<std::mutex> lock(csWork);
+    if (fStopWork || (fLimited && queueWork.size() >= MAX_STRATUM_QUEUE_DEPTH))
+        return false;
+    queueWork.push_back(std::move(work));
+    condWork.notify_one();
+    return true;
+}
+
+void StratumServer::StopWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(csWork);
+        fStopWork = true;
+        queueWork.clear();
+    }
+    condWork.notify_one();
+    if (threadWork.joinable())
+        threadWork.join();
+}
+
+void StratumServer::PostToEventThread(std::function<void()> handler)
+{
+    // The event deletes itself once its handler ran.
+    HTTPEvent* event = new HTTPEvent(base, true, handler);
+    event->trigger(nullptr);
+}
+
+bool StratumServer::Bind(const std::vector<std::pair<std::string, uint16_t>>& endpoints)
+{
+    for (const auto& endpoint : endpoints) {
+        CService addrBind;
+        struct sockaddr_storage sockaddr;
+        socklen_t len = sizeof(sockaddr);
+        if (!Lookup(endpoint.first.c_str(), addrBind, endpoint.second, false) ||
+            !addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len)) {
+            LogPrintf("stratum: cannot resolve -stratumbind address %s\n", endpoint.first);
+            continue;
+        }
+        LogPrint(BCLog::STRATUM, "stratum: binding on address %s\n", addrBind.ToString());
+        struct evconnlistener* listener = evconnlistener_new_bind(base, StratumServer::acceptcb, this,
+            LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE | LEV_OPT_THREADSAFE, -1, (struct sockaddr*)&sockaddr, len);
+        if (listener) {
+            listeners.push_back(listener);
+        } else {
+            LogPrintf("stratum: binding on address %s failed\n", addrBind.ToString());
+        }
+    }
+    return !listeners.empty();
+}
+
+void StratumServer::Start()
+{
+    tipEvent->trigger(nullptr);
+    struct timeval tv = {nRefreshSeconds, 0};
+    refreshEvent->trigger(&tv);
+}
+
+void StratumServer::Close()
+{
+    // A pending refresh timer would keep the event loop from exiting.
+    refreshEvent.reset();
+    for (struct evconnlistener* listener : listeners) {
+        evconnlistener_free(listener);
+    }
+    listeners.clear();
+    connections.clear();
+    setExtraNonces.clear();
+}
+
+void StratumServer::acceptcb(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* addr, int socklen, void* ctx)
+{
+    StratumServer* self = static_cast<StratumServer*>(ctx);
+    CService peer;
+    peer.SetSockAddr(addr);
+    if (!StratumClientAllowed(peer)) {
+        LogPrint(BCLog::STRATUM, "stratum: rejected connection from %s\n", peer.ToString());
+        evutil_closesocket(fd);
+        return;
+    }
+
+    struct bufferevent* bev = bufferevent_socket_new(self->base, fd, BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
+    if (!bev) {
+        evutil_closesocket(fd);
+        return;
+    }
+    if (!self->AddConnection(bev, peer)) {
+        LogPrint(BCLog::STRATUM, "stratum: rejected connection from %s, no extranonce is free\n", peer.ToString());
+        return;
+    }
+    LogPrint(BCLog::STRATUM, "stratum: accepted connection from %s\n", peer.ToString());
+}
+
+StratumConnection* StratumServer::AddConnection(struct bufferevent* bev, const CService& peer)
+{
+    // The lowest extranonce no connected miner uses, two miners searching the
+    // same nonces would submit the same shares. Unless miners left, the used
+    // ones are 0 to size - 1.
+    uint32_t nExtraNonce = setExtraNonces.size();
+    if (!setExtraNonces.empty() && *setExtraNonces.rbegin() != nExtraNonce - 1) {
+        nExtraNonce = 0;
+        for (uint16_t nUsed : setExtraNonces) {
+            if (nUsed != nExtraNonce)
+                break;
+            nExtraNonce++;
+        }
+    }
+    if (nExtraNonce > std::numeric_limits<uint16_t>::max()) {
+        bufferevent_free(bev);
+        return nullptr;
+    }
+    setExtraNonces.insert(nExtraNonce);
+
+    // The ids are never reused, replies of the worker thread to a closed
+    // connection are dropped.
+    const uint64_t nId = nConnectionCounter++;
+    StratumConnection* conn = new StratumConnection(*this, nId, bev, peer, nExtraNonce);
+    connections[nId].reset(conn);
+    bufferevent_setcb(bev, StratumConnection::readcb, nullptr, StratumConnection::eventcb, conn);
+    bufferevent_enable(bev, EV_READ | EV_WRITE);
+    return conn;
+}
+
+void StratumServer::Disconnect(StratumConnection* conn)
+{
+    setExtraNonces.erase(conn->nExtraNonce);
+    connections.erase(conn->nId);
+}
+
+void StratumServer::Send(StratumConnection* conn, const UniValue& msg)
+{
+    const std::string str = msg.write() + "\n";
+    evbuffer_add(bufferevent_get_output(conn->bev), str.data(), str.size());
+}
+
+void StratumServer::SendReply(StratumConnection* conn, const UniValue& id, const UniValue& result)
+{
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", result));
+    reply.push_back(Pair("error", NullUniValue));
+    Send(conn, reply);
+}
+
+void StratumServer::SendError(StratumConnection* conn, const UniValue& id, int code, const std::string& message)
+{
+    UniValue error(UniValue::VARR);
+    error.push_back(code);
+    error.push_back(message);
+    error.push_back(NullUniValue);
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    reply.push_back(Pair("result", NullUniValue));
+    reply.push_back(Pair("error", error));
+    Send(conn, reply);
+}
+
+void StratumServer::SendJob(StratumConnection* conn, const StratumJob& job, bool fCleanJobs)
+{
+    UniValue target(UniValue::VARR);
+    target.push_back(EthashHashToHex(job.target));
+    UniValue setTarget(UniValue::VOBJ);
+    setTarget.push_back(Pair("id", NullUniValue));
+    setTarget.push_back(Pair("method", "mining.set_target"));
+    setTarget.push_back(Pair("params", target));
+    Send(conn, setTarget);
+
+    UniValue params(UniValue::VARR);
+    params.push_back(job.id);
+    params.push_back(EthashHashToHex(job.header_hash));
+    params.push_back(EthashHashToHex(job.seed));
+    params.push_back(EthashHashToHex(job.target));
+    params.push_back(fCleanJobs);
+    params.push_back((int)job.block.GetHeight());
+    params.push_back(strprintf("%08x", job.block.GetBits()));
+    UniValue notify(UniValue::VOBJ);
+    notify.push_back(Pair("id", NullUniValue));
+    notify.push_back(Pair("method", "mining.notify"));
+    notify.push_back(Pair("params", params));
+    Send(conn, notify);
+}
+
+void StratumServer::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    if (!fInitialDownload)
+        tipEvent->trigger(nullptr);
+}
+
+void StratumServer::RefreshJob()
+{
+    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast)
+        UpdateJob(false);
+    struct timeval tv = {nRefreshSeconds, 0};
+    refreshEvent->trigger(&tv);
+}
+
+void StratumServer::UpdateJob(bool fCleanJobs)
+{
+    PostWork([this, fCleanJobs] { CreateJob(fCleanJobs); }, false);
+}
+
+void StratumServer::CreateJob(bool fCleanJobs)
+{
+    if (IsInitialBlockDownload())
+        return;
+
+    const CChainParams& chainparams = Params();
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+    std::shared_ptr<StratumJob> job = std::make_shared<StratumJob>();
+    try {
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateBlockTemplate(chainparams, coinbaseScript));
+        if (!pblocktemplate) {
+            LogPrintf("stratum: cannot create a block template\n");
+            return;
+        }
+        job->block = pblocktemplate->block;
+    } catch (const std::runtime_error& e) {
+        LogPrintf("stratum: cannot create a block template: %s\n", e.what());
+        return;
+    }
+    {
+        LOCK(cs_main);
+        if (job->block.GetPrevBlockHash() != chainActive.Tip()->GetBlockHash())
+            return;
+        // Every job has its own coinbase, so two jobs never share a header hash.
+        IncrementExtraNonce(&job->block, chainActive.Tip(), nExtraNonce);
+    }
+    if (job->block.GetHeight() < (uint32_t)chainparams.GetConsensus().ProgForkHeight) {
+        LogPrint(BCLog::STRATUM, "stratum: no ProgPoW job before the ProgPoW fork\n");
+        return;
+    }
+
+    job->nEpoch = ethash::get_epoch_number(job->block.GetHeight());
+    job->header_hash = GetProgPowHeaderHash(&job->block);
+    job->seed = ethash_calculate_epoch_seed(job->nEpoch);
+    job->shareTarget = GetStratumShareTarget(nShareDifficulty, arith_uint256().SetCompact(job->block.GetBits()), chainparams.GetConsensus());
+    job->target = GetProgPowBoundary(job->shareTarget);
+
+    PostToEventThread([this, job, fCleanJobs] { AddJob(job, fCleanJobs); });
+}
+
+void StratumServer::AddJob(const std::shared_ptr<StratumJob>& job, bool fCleanJobs)
+{
+    job->id = strprintf("%x", ++nJobCounter);
+    if (fCleanJobs) {
+        mapJobs.clear();
+    } else if (mapJobs.size() >= MAX_STRATUM_JOBS) {
+        mapJobs.erase(mapJobs.begin());
+    }
+    mapJobs[nJobCounter] = job;
+    LogPrint(BCLog::STRATUM, "stratum: new job %s at height %u with %u transactions\n", job->id, job->block.GetHeight(), job->block.vtx.size());
+
+    for (const auto& entry : connections) {
+        if (entry.second->fAuthorized)
+            SendJob(entry.second.get(), *job, fCleanJobs);
+    }
+}
+
+int StratumServer::Submit(StratumConnection* conn, const UniValue& id, const UniValue& params)
+{
+    // params: worker, job id, nonce, header hash, mix hash
+    std::vector<unsigned char> vNonce, vHeaderHash, vMixHash;
+    if (params.size() < 5 || !params[1].isStr() ||
+        !ParseStratumHex(params[2], vNonce) || vNonce.size() != 8 ||
+        !ParseStratumHex(params[3], vHeaderHash) || vHeaderHash.size() != 32 ||
+        !ParseStratumHex(params[4], vMixHash) || vMixHash.size() != 32) {
+        return STRATUM_ERROR_OTHER;
+    }
+
+    std::shared_ptr<StratumJob> job;
+    for (const auto& entry : mapJobs) {
+        if (entry.second->id == params[1].get_str())
+            job = entry.second;
+    }
+    if (!job)
+        return STRATUM_ERROR_JOB_NOT_FOUND;
+    if (memcmp(vHeaderHash.data(), job->header_hash.bytes, 32) != 0)
+        return STRATUM_ERROR_OTHER;
+
+    // The nonce is sent as a big endian number, starting with the extranonce.
+    const uint64_t nonce = ReadBE64(vNonce.data());
+    if (!CheckStratumExtraNonce(nonce, conn->strExtraNonce)) {
+        LogPrint(BCLog::STRATUM, "stratum: share of %s without its extranonce %s\n", conn->peer.ToString(), conn->strExtraNonce);
+        return STRATUM_ERROR_OTHER;
+    }
+
+    const uint64_t nConnId = conn->nId;
+    const std::string strPeer = conn->peer.ToString();
+    const bool fQueued = PostWork([this, job, nonce, vMixHash, nConnId, strPeer, id] {
+        const int code = CheckShare(*job, nonce, vMixHash, strPeer);
+        PostToEventThread([this, nConnId, id, code] {
+            auto it = connections.find(nConnId);
+            if (it != connections.end())
+                SendSubmitResult(it->second.get(), id, code);
+        });
+    }, true);
+    if (!fQueued) {
+        LogPrint(BCLog::STRATUM, "stratum: too many shares waiting, refusing the share of %s\n", strPeer);
+        return STRATUM_ERROR_OTHER;
+    }
+    return STRATUM_OK;
+}
+
+int StratumServer::CheckShare(StratumJob& job, uint64_t nonce, const std::vector<unsigned char>& vMixHash, const std::string& strPeer)
+{
+    if (job.setNonces.count(nonce))
+        return STRATUM_ERROR_DUPLICATE_SHARE;
+    // A job is as good as stale once it has this many shares.
+    if (job.setNonces.size() >= MAX_STRATUM_JOB_SHARES)
+        return STRATUM_ERROR_JOB_NOT_FOUND;
+
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>(job.block);
+    uint256 nNonce = pblock->GetNonce();
+    WriteLE64(nNonce.begin() + 24, nonce);
+    pblock->SetNonce(nNonce);
+    pblock->SetSolution(vMixHash);
+    // Shares are checked against the share target with the light epoch context.
+    if (!CheckProgPowShare(pblock.get(), job.shareTarget, Params())) {
+        LogPrint(BCLog::STRATUM, "stratum: invalid share from %s for job %s\n", strPeer, job.id);
+        return STRATUM_ERROR_LOW_DIFFICULTY_SHARE;
+    }
+    job.setNonces.insert(nonce);
+
+    if (!CheckProofOfWork(pblock->GetHash(), pblock->GetBits(), true, Params().GetConsensus()))
+        return STRATUM_OK;
+
+    LogPrintf("stratum: block %s found by %s\n", pblock->GetHash().ToString(), strPeer);
+    if (!ProcessNewBlock(Params(), pblock, true, nullptr)) {
+        LogPrintf("stratum: block %s was not accepted\n", pblock->GetHash().ToString());
+        return STRATUM_ERROR_OTHER;
+    }
+    return STRATUM_OK;
+}
+
+void StratumServer::SendSubmitResult(StratumConnection* conn, const UniValue& id, int code)
+{
+    static const std::map<int, std::string> mapMessages = {
+        {STRATUM_ERROR_OTHER, "Invalid share"},
+        {STRATUM_ERROR_JOB_NOT_FOUND, "Job not found"},
+        {STRATUM_ERROR_DUPLICATE_SHARE, "Duplicate share"},
+        {STRATUM_ERROR_LOW_DIFFICULTY_SHARE, "Low difficulty share"},
+    };
+    if (code == STRATUM_OK) {
+        SendReply(conn, id, true);
+    } else {
+        SendError(conn, id, code, mapMessages.at(code));
+    }
+}
+
+bool StratumServer::ProcessLine(StratumConnection* conn, const std::string& line)
+{
+    UniValue request;
+    if (!request.read(line) || !request.isObject()) {
+        LogPrint(BCLog::STRATUM, "stratum: invalid request from %s, disconnecting\n", conn->peer.ToString());
+        Disconnect(conn);
+        return false;
+    }
+    const UniValue& id = find_value(request, "id");
+    const UniValue& method = find_value(request, "method");
+    const UniValue& params = find_value(request, "params");
+    if (!method.isStr()) {
+        SendError(conn, id, STRATUM_ERROR_OTHER, "Invalid request");
+        return true;
+    }
+    const std::string& strMethod = method.get_str();
+    LogPrint(BCLog::STRATUM, "stratum: %s from %s\n", strMethod, conn->peer.ToString());
+
+    if (strMethod == "mining.subscribe") {
+        conn->fSubscribed = true;
+        UniValue result(UniValue::VARR);
+        result.push_back(NullUniValue);
+        result.push_back(conn->strExtraNonce);
+        SendReply(conn, id, result);
+    } else if (strMethod == "mining.authorize") {
+        if (!conn->fSubscribed) {
+            SendError(conn, id, STRATUM_ERROR_NOT_SUBSCRIBED, "Not subscribed");
+            return true;
+        }
+        // Blocks pay to -stratumaddress, the worker names are only logged.
+        conn->fAuthorized = true;
+        SendReply(conn, id, true);
+        if (!mapJobs.empty())
+            SendJob(conn, *mapJobs.rbegin()->second, true);
+    } else if (strMethod == "mining.submit") {
+        if (!conn->fAuthorized) {
+            SendError(conn, id, STRATUM_ERROR_UNAUTHORIZED, "Unauthorized worker");
+            return true;
+        }
+        // The reply of a queued share is sent once the worker checked it.
+        const int code = Submit(conn, id, params.isArray() ? params : UniValue(UniValue::VARR));
+        if (code != STRATUM_OK)
+            SendSubmitResult(conn, id, code);
+    } else {
+        SendError(conn, id, STRATUM_ERROR_OTHER, "Method not found");
+    }
+    return true;
+}
+
+bool StartStratumServer()
+{
+    if (!EventBase()) {
+        LogPrintf("stratum: the HTTP server is not running\n");
+        return false;
+    }
+    if (!InitStratumAllowList())
+        return false;
+
+    CBitcoinAddress address(gArgs.GetArg("-stratumaddress", ""));
+    if (!address.IsValid()) {
+        LogPrintf("stratum: -stratumaddress must be a valid address\n");
+        return false;
+    }
+    const CScript coinbaseScript = GetScriptForDestination(address.Get());
+
+    // Determine what addresses to bind to, like the RPC server does.
+    const int defaultPort = gArgs.GetArg("-stratumport", DEFAULT_STRATUM_PORT);
+    std::vector<std::pair<std::string, uint16_t>> endpoints;
+    if (!gArgs.IsArgSet("-stratumallowip")) { // Default to loopback if not allowing external IPs
+        endpoints.push_back(std::make_pair("::1", defaultPort));
+        endpoints.push_back(std::make_pair("127.0.0.1", defaultPort));
+        if (gArgs.IsArgSet("-stratumbind")) {
+            LogPrintf("WARNING: option -stratumbind was ignored because -stratumallowip was not specified, refusing to allow everyone to connect\n");
+        }
+    } else if (gArgs.IsArgSet("-stratumbind")) { // Specific bind address
+        for (const std::string& strBind : gArgs.GetArgs("-stratumbind")) {
+            int port = defaultPort;
+            std::string host;
+            SplitHostPort(strBind, port, host);
+            endpoints.push_back(std::make_pair(host, port));
+        }
+    } else { // No specific bind address specified, bind to any
+        endpoints.push_back(std::make_pair("::", defaultPort));
+        endpoints.push_back(std::make_pair("0.0.0.0", defaultPort));
+    }
+
+    const int nRefreshSeconds = std::max<int>(gArgs.GetArg("-stratumrefresh", DEFAULT_STRATUM_REFRESH), 1);
+    const int64_t nShareDifficulty = gArgs.GetArg("-stratumdifficulty", DEFAULT_STRATUM_DIFFICULTY);
+    if (nShareDifficulty <= 0) {
+        LogPrintf("stratum: -stratumdifficulty must be positive\n");
+        return false;
+    }
+    std::unique_ptr<StratumServer> server(new StratumServer(EventBase(), coinbaseScript, nRefreshSeconds, nShareDifficulty));
+    if (!server->Bind(endpoints))
+        return false;
+    stratumServer = server.release();
+    RegisterValidationInterface(stratumServer);
+    stratumServer->Start();
+    LogPrintf("Stratum server started on port %d\n", defaultPort);
+    return true;
+}
+
+void InterruptStratumServer()
+{
+    if (!stratumServer)
+        return;
+    UnregisterValidationInterface(stratumServer);
+    // No more replies are posted once the worker stopped, the ones already
+    // posted run before the close event.
+    stratumServer->StopWorker();
+    // The connections belong to the event thread, close them there.
+    std::shared_ptr<std::promise<void>> closed = std::make_shared<std::promise<void>>();
+    StratumServer* server = stratumServer;
+    HTTPEvent* closeEvent = new HTTPEvent(EventBase(), true, [server, closed] {
+        server->Close();
+        closed->set_value();
+    });
+    closeEvent->trigger(nullptr);
+    fStratumClosed = closed->get_future().wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+    if (!fStratumClosed) {
+        LogPrintf("stratum: the HTTP event loop did not close the connections\n");
+    }
+}
+
+void StopStratumServer()
+{
+    // A pending close event still refers to the server, leak it in that case.
+    if (fStratumClosed)
+        delete stratumServer;
+    stratumServer = nullptr;
+}
@@ -0,0 +1,204 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * Stratum mining server for ProgPoW miners, running on the HTTP server event loop.
+ */
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include "arith_uint256.h"
+#include "crypto/progpow/ethash.hpp"
+#include "netaddress.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "validationinterface.h"
+
+#include <univalue.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <event2/util.h>
+
+class HTTPEvent;
+struct bufferevent;
+struct event_base;
+struct evconnlistener;
+
+namespace Consensus {
+    struct Params;
+};
+
+static const bool DEFAULT_STRATUM_ENABLE = false;
+static const uint16_t DEFAULT_STRATUM_PORT = 3333;
+/** Default for -stratumrefresh, seconds between checks for new mempool transactions */
+static const int DEFAULT_STRATUM_REFRESH = 30;
+/** Default for -stratumdifficulty, the difficulty of the shares relative to the proof-of-work limit */
+static const int64_t DEFAULT_STRATUM_DIFFICULTY = 1024;
+/** Number of shares remembered per job to reject duplicates, a job with more is stale */
+static const size_t MAX_STRATUM_JOB_SHARES = 100000;
+
+/** Error codes of the Stratum replies */
+enum StratumErrorCode
+{
+    STRATUM_OK = 0,
+    STRATUM_ERROR_OTHER = 20,
+    STRATUM_ERROR_JOB_NOT_FOUND = 21,
+    STRATUM_ERROR_DUPLICATE_SHARE = 22,
+    STRATUM_ERROR_LOW_DIFFICULTY_SHARE = 23,
+    STRATUM_ERROR_UNAUTHORIZED = 24,
+    STRATUM_ERROR_NOT_SUBSCRIBED = 25,
+};
+
+/** A block template sent to the miners, with its ProgPoW inputs */
+struct StratumJob
+{
+    std::string id;
+    CBlock block;
+    int nEpoch;
+    ethash::hash256 header_hash;
+    ethash::hash256 seed;
+    /** The share target, big endian like ethash hashes */
+    ethash::hash256 target;
+    arith_uint256 shareTarget;
+    /** The nonces of the valid shares of this job, to reject duplicates. Only
+     *  used by the worker thread. */
+    std::set<uint64_t> setNonces;
+};
+
+class StratumServer;
+
+/** A connected miner */
+class StratumConnection
+{
+public:
+    StratumConnection(StratumServer& server, uint64_t nId, struct bufferevent* bev, const CService& peer, uint16_t nExtraNonce);
+    ~StratumConnection();
+
+    StratumServer& server;
+    /** Identifies the connection in the replies of the worker thread */
+    const uint64_t nId;
+    struct bufferevent* const bev;
+    const CService peer;
+    /** Prefix of the nonces of this miner, so that miners search different ranges */
+    const uint16_t nExtraNonce;
+    /** The extranonce in hex, as sent to the miner */
+    const std::string strExtraNonce;
+    bool fSubscribed;
+    bool fAuthorized;
+
+    static void readcb(struct bufferevent* bev, void* ctx);
+    static void eventcb(struct bufferevent* bev, short what, void* ctx);
+};
+
+/** Pushes ProgPoW jobs to the connected miners and submits their blocks.
+ *  The connections and the jobs belong to the HTTP event thread. Creating the
+ *  block templates and checking the shares runs on a worker thread, which
+ *  posts its results back to the event thread. */
+class StratumServer final : public CValidationInterface
+{
+public:
+    StratumServer(struct event_base* base, const CScript& coinbaseScript, int nRefreshSeconds, uint64_t nShareDifficulty);
+    ~StratumServer();
+
+    bool Bind(const std::vector<std::pair<std::string, uint16_t>>& endpoints);
+    /** Start sending jobs, after the listeners are bound */
+    void Start();
+    /** Close the listeners and the connections, and stop the refresh timer. Runs on the event thread. */
+    void Close();
+
+    /** Stop the worker thread, dropping the work it has not started */
+    void StopWorker();
+
+    /** Accept a miner connected through bev, which its connection frees.
+     *  Frees bev and returns null if the extranonces of all the miners are used. */
+    StratumConnection* AddConnection(struct bufferevent* bev, const CService& peer);
+    void Disconnect(StratumConnection* conn);
+    /** Handle one request, returns false if the connection was closed */
+    bool ProcessLine(StratumConnection* conn, const std::string& line);
+    /** Event thread: make a job the current one and send it */
+    void AddJob(const std::shared_ptr<StratumJob>& job, bool fCleanJobs);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+private:
+    struct event_base* const base;
+    const CScript coinbaseScript;
+    const int nRefreshSeconds;
+    const uint64_t nShareDifficulty;
+    std::vector<struct evconnlistener*> listeners;
+    std::map<uint64_t, std::unique_ptr<StratumConnection>> connections;
+    /** The extranonces of the connections */
+    std::set<uint16_t> setExtraNonces;
+    std::unique_ptr<HTTPEvent> tipEvent;
+    std::unique_ptr<HTTPEvent> refreshEvent;
+
+    /** Jobs of the current tip by number, the newest last */
+    std::map<uint64_t, std::shared_ptr<StratumJob>> mapJobs;
+    uint64_t nJobCounter;
+    uint64_t nConnectionCounter;
+    /** Only used by the worker thread */
+    unsigned int nExtraNonce;
+    std::atomic<unsigned int> nTransactionsUpdatedLast;
+
+    std::mutex csWork;
+    std::condition_variable condWork;
+    std::deque<std::function<void()>> queueWork;
+    bool fStopWork;
+    std::thread threadWork;
+
+    static void acceptcb(struct evconnlistener* listener, evutil_socket_t fd, struct sockaddr* addr, int socklen, void* ctx);
+
+    void ThreadWork();
+    /** Queue work for the worker thread, fails when too many shares wait */
+    bool PostWork(std::function<void()> work, bool fLimited);
+    /** Run a handler on the event thread */
+    void PostToEventThread(std::function<void()> handler);
+
+    /** Have the worker create a job on the current tip and send it to the
+     *  miners. Clean jobs replace all the previous ones, which are stale. */
+    void UpdateJob(bool fCleanJobs);
+    void RefreshJob();
+    /** Worker thread: create the block template of a job */
+    void CreateJob(bool fCleanJobs);
+    void SendJob(StratumConnection* conn, const StratumJob& job, bool fCleanJobs);
+    /** Parse a share and queue its check, returns a StratumErrorCode if it
+     *  is refused at once */
+    int Submit(StratumConnection* conn, const UniValue& id, const UniValue& params);
+    /** Worker thread: check a share and submit its block, returns a StratumErrorCode */
+    int CheckShare(StratumJob& job, uint64_t nonce, const std::vector<unsigned char>& vMixHash, const std::string& strPeer);
+    void SendSubmitResult(StratumConnection* conn, const UniValue& id, int code);
+
+    void Send(StratumConnection* conn, const UniValue& msg);
+    void SendReply(StratumConnection* conn, const UniValue& id, const UniValue& result);
+    void SendError(StratumConnection* conn, const UniValue& id, int code, const std::string& message);
+};
+
+/** The target of the shares of difficulty nDifficulty, never harder than the block target */
+arith_uint256 GetStratumShareTarget(uint64_t nDifficulty, const arith_uint256& blockTarget, const Consensus::Params& params);
+/** Whether a share nonce starts with the extranonce given to its miner, as hex
+ *  digits of the nonce written big endian */
+bool CheckStratumExtraNonce(uint64_t nonce, const std::string& strExtraNonce);
+
+/** Start the Stratum server. Requires the HTTP server to be initialized,
+ *  since its event loop is shared. */
+bool StartStratumServer();
+/** Stop accepting connections and close the connected miners */
+void InterruptStratumServer();
+/** Release the Stratum server. Call before the HTTP server is stopped. */
+void StopStratumServer();
+
+#endif // BITCOIN_STRATUM_H
@@ -0,0 +1,181 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Memory resource serving small allocations from chunks, for node based
+ * containers. Freed blocks are kept in a free list per size and reused; the
+ * chunks are only released when the resource is destroyed. Each allocation
+ * then costs its size rounded up to ALIGN bytes, without the bookkeeping and
+ * rounding of malloc. Not thread safe.
+ */
+class PoolResource
+{
+public:
+    //! Allocations up to this size are served from the chunks, larger ones by operator new
+    static const size_t MAX_BLOCK_SIZE = 128;
+    //! Size granularity and alignment of the blocks
+    static const size_t ALIGN = 8;
+    //! The chunks double in size from MIN_CHUNK_SIZE to MAX_CHUNK_SIZE, so that small pools stay small
+    static const size_t MIN_CHUNK_SIZE = 4096;
+    static const size_t MAX_CHUNK_SIZE = 256 * 1024;
+
+    PoolResource() : pChunkPos(nullptr), pChunkEnd(nullptr), nChunkBytes(0), nFreeBytes(0)
+    {
+        std::fill(vFree, vFree + NUM_SIZES, nullptr);
+    }
+
+    ~PoolResource()
+    {
+        for (char* chunk : vChunks) {
+            ::operator delete(chunk);
+        }
+    }
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    void* Allocate(size_t nBytes, size_t nAlign)
+    {
+        if (nBytes > MAX_BLOCK_SIZE || nAlign > ALIGN)
+            return ::operator new(nBytes);
+
+        const size_t nIndex = SizeIndex(nBytes);
+        if (vFree[nIndex] != nullptr) {
+            FreeBlock* block = vFree[nIndex];
+            vFree[nIndex] = block->pNext;
+            nFreeBytes -= nIndex * ALIGN;
+            return block;
+        }
+        const size_t nSize = nIndex * ALIGN;
+        if ((size_t)(pChunkEnd - pChunkPos) < nSize)
+            AllocateChunk();
+        void* p = pChunkPos;
+        pChunkPos += nSize;
+        return p;
+    }
+
+    void Deallocate(void* p, size_t nBytes, size_t nAlign)
+    {
+        if (nBytes > MAX_BLOCK_SIZE || nAlign > ALIGN) {
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, SizeIndex(nBytes));
+    }
+
+    //! Total size of the chunks allocated
+    size_t GetChunkBytes() const { return nChunkBytes; }
+    //! Number of chunks allocated
+    size_t GetChunkCount() const { return vChunks.size(); }
+    //! Size of the blocks in use. The chunks only grow once the freed blocks
+    //! are reused, so this bounds their size up to the last chunk.
+    size_t GetUsedBytes() const { return nChunkBytes - nFreeBytes - (pChunkEnd - pChunkPos); }
+
+private:
+    static const size_t NUM_SIZES = MAX_BLOCK_SIZE / ALIGN + 1;
+
+    struct FreeBlock {
+        FreeBlock* pNext;
+    };
+    static_assert(sizeof(FreeBlock) <= ALIGN, "a free block must fit the smallest block");
+
+    std::vector<char*> vChunks;
+    char* pChunkPos;
+    char* pChunkEnd;
+    size_t nChunkBytes;
+    //! Total size of the free blocks
+    size_t nFreeBytes;
+    //! The free blocks of each size, by size / ALIGN
+    FreeBlock* vFree[NUM_SIZES];
+
+    static size_t SizeIndex(size_t nBytes)
+    {
+        return std::max<size_t>((nBytes + ALIGN - 1) / ALIGN, 1);
+    }
+
+    void PushFree(void* p, size_t nIndex)
+    {
+        FreeBlock* block = new (p) FreeBlock;
+        block->pNext = vFree[nIndex];
+        vFree[nIndex] = block;
+        nFreeBytes += nIndex * ALIGN;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk becomes a free block.
+        const size_t nRest = pChunkEnd - pChunkPos;
+        if (nRest >= ALIGN)
+            PushFree(pChunkPos, nRest / ALIGN);
+
+        const size_t nChunkSize = vChunks.empty() ? MIN_CHUNK_SIZE : std::min(nChunkBytes, size_t{MAX_CHUNK_SIZE});
+        vChunks.push_back(static_cast<char*>(::operator new(nChunkSize)));
+        nChunkBytes += nChunkSize;
+        pChunkPos = vChunks.back();
+        pChunkEnd = pChunkPos + nChunkSize;
+    }
+};
+
+/**
+ * Allocator taking its memory from a PoolResource. A default constructed
+ * allocator creates its own resource, shared by its copies and rebound
+ * copies, so that a container and its nodes use one pool which lives as
+ * long as the container. Copied containers get a new pool.
+ */
+template <typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    PoolAllocator() : resource(std::make_shared<PoolResource>()) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : resource(other.resource) {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    PoolAllocator select_on_container_copy_construction() const { return PoolAllocator(); }
+
+    const PoolResource& GetResource() const { return *resource; }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return resource == other.resource; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return resource != other.resource; }
+
+private:
+    std::shared_ptr<PoolResource> resource;
+
+    template <typename U>
+    friend class PoolAllocator;
+};
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
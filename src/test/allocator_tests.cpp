@@ -4,9 +4,12 @@
 
 #include "util.h"
 
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
 #include "test/test_bitcoin.h"
 
+#include <unordered_map>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(allocator_tests, BasicTestingSetup)
@@ -231,4 +234,53 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     BOOST_CHECK(pool.stats().used == initial.used);
 }
 
+BOOST_AUTO_TEST_CASE(pool_tests)
+{
+    PoolResource pool;
+    BOOST_CHECK_EQUAL(pool.GetChunkBytes(), 0);
+
+    // Freed blocks are reused for the allocations of the same size.
+    void* a = pool.Allocate(24, 8);
+    void* b = pool.Allocate(20, 4);
+    BOOST_CHECK(a != b);
+    BOOST_CHECK_EQUAL(pool.GetChunkCount(), 1);
+    BOOST_CHECK_EQUAL(pool.GetChunkBytes(), size_t{PoolResource::MIN_CHUNK_SIZE});
+    pool.Deallocate(a, 24, 8);
+    BOOST_CHECK(pool.Allocate(17, 8) == a);
+    BOOST_CHECK(pool.Allocate(24, 8) != a);
+    pool.Deallocate(b, 20, 4);
+
+    // Large blocks do not come from the chunks.
+    void* large = pool.Allocate(PoolResource::MAX_BLOCK_SIZE + 1, 8);
+    BOOST_CHECK_EQUAL(pool.GetChunkCount(), 1);
+    pool.Deallocate(large, PoolResource::MAX_BLOCK_SIZE + 1, 8);
+
+    // The chunks grow up to MAX_CHUNK_SIZE.
+    for (size_t i = 0; i < 4 * PoolResource::MAX_CHUNK_SIZE / 64; i++) {
+        pool.Allocate(64, 8);
+    }
+    BOOST_CHECK(pool.GetChunkBytes() >= 4 * PoolResource::MAX_CHUNK_SIZE);
+    BOOST_CHECK(pool.GetChunkBytes() < 6 * PoolResource::MAX_CHUNK_SIZE);
+
+    // A map owns its pool, and a copy gets its own.
+    typedef std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, int> > > PoolMap;
+    PoolMap map;
+    for (int i = 0; i < 1000; i++) {
+        map[i] = i;
+    }
+    for (PoolMap::iterator it = map.begin(); it != map.end();) {
+        if (it->first % 2)
+            it = map.erase(it);
+        else
+            ++it;
+    }
+    PoolMap copy = map;
+    BOOST_CHECK(copy == map);
+    BOOST_CHECK(&copy.get_allocator().GetResource() != &map.get_allocator().GetResource());
+    BOOST_CHECK(map.get_allocator().GetResource().GetChunkBytes() > 0);
+    PoolMap().swap(map);
+    BOOST_CHECK_EQUAL(map.get_allocator().GetResource().GetChunkBytes(), 0);
+    BOOST_CHECK_EQUAL(copy.size(), 500);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
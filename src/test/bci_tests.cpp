@@ -52,20 +52,22 @@ BOOST_AUTO_TEST_CASE(zcash_header_compatible)
     CDataStream ss(SER_DISK, PROTOCOL_VERSION);
 
     // `CBlockHeader.nHeight` should be placed in the first 4 bytes of `ZcashBlockHeader.hashReserved`.
-    bci_header.nHeight = 10000000;
+    bci_header.SetHeight(10000000);
     // `CBlockHeader.nReserved[5:7]` should be placed in the last 8 bytes of `ZcashBlockHeader.hashReserved`.
-    bci_header.nReserved[5] = 1234;
-    bci_header.nReserved[6] = 0;
-    bci_header.nSolution = std::vector<unsigned char> {
+    uint32_t nReserved[CBlockHeader::RESERVED_SIZE] = {};
+    nReserved[5] = 1234;
+    nReserved[6] = 0;
+    bci_header.SetReserved(nReserved);
+    bci_header.SetSolution(std::vector<unsigned char> {
         0x11, 0x22, 0x33
-    };
+    });
 
     ss << bci_header;
     ss >> zcash_header;
 
-    BOOST_CHECK_EQUAL(bci_header.nHeight, (uint32_t)zcash_header.hashReserved.GetUint64(0));
-    BOOST_CHECK_EQUAL(bci_header.nReserved[5], (uint32_t)zcash_header.hashReserved.GetUint64(3));
-    BOOST_CHECK_EQUAL(bci_header.nSolution[2], zcash_header.nSolution[2]);
+    BOOST_CHECK_EQUAL(bci_header.GetHeight(), (uint32_t)zcash_header.hashReserved.GetUint64(0));
+    BOOST_CHECK_EQUAL(bci_header.GetReserved()[5], (uint32_t)zcash_header.hashReserved.GetUint64(3));
+    BOOST_CHECK_EQUAL(bci_header.GetSolution()[2], zcash_header.nSolution[2]);
 }
 
 // For address conversion.
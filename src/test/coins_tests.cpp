@@ -13,6 +13,7 @@
 
 #include <vector>
 #include <map>
+#include <set>
 
 #include <boost/test/unit_test.hpp>
 
@@ -52,6 +53,13 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
+    //! Unlike HaveCoin(), never true for a spent coin
+    bool HaveUnspentCoin(const COutPoint& outpoint) const
+    {
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
+        return it != map_.end() && !it->second.IsSpent();
+    }
+
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
@@ -69,6 +77,14 @@ public:
             hashBestBlock_ = hashBlock;
         return true;
     }
+
+    bool BatchWritePartial(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    {
+        nPartialWrites++;
+        return BatchWrite(mapCoins, uint256());
+    }
+
+    int nPartialWrites = 0;
 };
 
 class CCoinsViewCacheTest : public CCoinsViewCache
@@ -79,11 +95,15 @@ public:
     void SelfTest() const
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
-        size_t ret = memusage::DynamicUsage(cacheCoins);
+        size_t ret = memusage::DynamicUsage(cacheCoins) + (dirtyCoins.size() + writingCoins.size()) * sizeof(COutPoint);
         size_t count = 0;
+        std::set<COutPoint> setDirty(dirtyCoins.begin(), dirtyCoins.end());
+        setDirty.insert(writingCoins.begin(), writingCoins.end());
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
             ret += it->second.coin.DynamicMemoryUsage();
             ++count;
+            // Every modified entry is listed for WriteDirty.
+            BOOST_CHECK(!(it->second.flags & CCoinsCacheEntry::DIRTY) || setDirty.count(it->first));
         }
         BOOST_CHECK_EQUAL(GetCacheSize(), count);
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
@@ -91,6 +111,7 @@ public:
 
     CCoinsMap& map() { return cacheCoins; }
     size_t& usage() { return cachedCoinsUsage; }
+    std::deque<COutPoint>& dirty() { return dirtyCoins; }
 };
 
 } // namespace
@@ -120,6 +141,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool found_an_entry = false;
     bool missed_an_entry = false;
     bool uncached_an_entry = false;
+    bool wrote_dirty_entries = false;
+    bool evicted_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<COutPoint, Coin> result;
@@ -213,6 +236,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 stack[flushIndex]->Flush();
             }
         }
+        if (InsecureRandRange(100) == 0) {
+            // Every 100 iterations, write a part of the modifications of a
+            // cache, keeping them cached, and evict unmodified entries.
+            CCoinsViewCacheTest* cache = stack[InsecureRandRange(stack.size())];
+            BOOST_CHECK(cache->WriteDirty(InsecureRandRange(50)));
+            wrote_dirty_entries = true;
+            const unsigned int nCacheSize = cache->GetCacheSize();
+            cache->EvictClean(InsecureRandRange(cache->DynamicMemoryUsage()));
+            evicted_an_entry |= cache->GetCacheSize() < nCacheSize;
+        }
         if (InsecureRandRange(100) == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && InsecureRandBool() == 0) {
@@ -253,6 +286,121 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
     BOOST_CHECK(uncached_an_entry);
+    BOOST_CHECK(wrote_dirty_entries);
+    BOOST_CHECK(evicted_an_entry);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_write_dirty)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    const uint256 hashBlock = InsecureRand256();
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 5; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.nHeight = 1;
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.HasDirtyCoins());
+
+    // A part of the coins leaves the base without a best block.
+    BOOST_CHECK(cache.WriteDirty(2));
+    BOOST_CHECK_EQUAL(base.nPartialWrites, 1);
+    BOOST_CHECK(base.GetBestBlock().IsNull());
+    BOOST_CHECK(base.HaveCoin(outpoints[0]) && base.HaveCoin(outpoints[1]) && !base.HaveCoin(outpoints[2]));
+    BOOST_CHECK(cache.HasDirtyCoins());
+
+    // The last part completes the write.
+    BOOST_CHECK(cache.WriteDirty(10));
+    BOOST_CHECK_EQUAL(base.nPartialWrites, 1);
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+    BOOST_CHECK(!cache.HasDirtyCoins());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 5);
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK(base.HaveCoin(outpoint));
+        BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    }
+    cache.SelfTest();
+
+    // Spent coins are dropped from the cache once written.
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+    BOOST_CHECK(cache.WriteDirty(10));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 4);
+    BOOST_CHECK(!base.HaveUnspentCoin(outpoints[0]));
+
+    // Only the unmodified coins are evicted.
+    Coin coin;
+    coin.out.nValue = 6;
+    coin.nHeight = 2;
+    cache.AddCoin(outpoints[0], std::move(coin), false);
+    cache.EvictClean(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1);
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[0]));
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_get_dirty)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    const uint256 hashBlock = InsecureRand256();
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 3; i++) {
+        outpoints.emplace_back(InsecureRand256(), i);
+        Coin coin;
+        coin.out.nValue = i + 1;
+        coin.nHeight = 1;
+        cache.AddCoin(outpoints.back(), std::move(coin), false);
+    }
+    cache.SetBestBlock(hashBlock);
+
+    // The copied coins stay modified, but not FRESH, until marked written.
+    CCoinsMap mapWrite;
+    BOOST_CHECK(cache.GetDirty(10, mapWrite));
+    BOOST_CHECK_EQUAL(mapWrite.size(), 3);
+    const CCoinsMap mapWritten(mapWrite);
+    BOOST_CHECK(cache.HasDirtyCoins());
+    for (const COutPoint& outpoint : outpoints) {
+        BOOST_CHECK_EQUAL(cache.map().at(outpoint).flags, CCoinsCacheEntry::DIRTY);
+    }
+    cache.SelfTest();
+
+    // Changes made while the copy is written are kept for the next write.
+    BOOST_CHECK(cache.SpendCoin(outpoints[0]));
+    BOOST_CHECK(base.BatchWrite(mapWrite, hashBlock));
+    cache.MarkWritten(mapWritten, true);
+    BOOST_CHECK(cache.HasDirtyCoins());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 3);
+    BOOST_CHECK_EQUAL(cache.map().at(outpoints[0]).flags, CCoinsCacheEntry::DIRTY);
+    BOOST_CHECK_EQUAL(cache.map().at(outpoints[1]).flags, 0);
+    cache.SelfTest();
+    BOOST_CHECK(base.HaveCoin(outpoints[0]));
+    BOOST_CHECK(cache.WriteDirty(10));
+    BOOST_CHECK(!base.HaveUnspentCoin(outpoints[0]));
+    BOOST_CHECK(!cache.HasDirtyCoins());
+
+    // A write by others in between keeps the coins modified, and the next
+    // copy takes them again.
+    Coin coin;
+    coin.out.nValue = 4;
+    coin.nHeight = 2;
+    cache.AddCoin(outpoints[1], std::move(coin), true);
+    mapWrite.clear();
+    BOOST_CHECK(cache.GetDirty(10, mapWrite));
+    CCoinsMap mapWriteAgain;
+    BOOST_CHECK(cache.GetDirty(10, mapWriteAgain));
+    BOOST_CHECK_EQUAL(mapWriteAgain.size(), 1);
+    cache.MarkWritten(mapWrite, false);
+    BOOST_CHECK_EQUAL(cache.map().at(outpoints[1]).flags, CCoinsCacheEntry::DIRTY);
+    BOOST_CHECK(cache.HasDirtyCoins());
+    cache.SelfTest();
+    BOOST_CHECK(cache.WriteDirty(10));
+    BOOST_CHECK_EQUAL(cache.map().at(outpoints[1]).flags, 0);
+    BOOST_CHECK(!cache.HasDirtyCoins());
+    cache.SelfTest();
 }
 
 // Store of all necessary tx and undo data for next test
@@ -598,6 +746,8 @@ public:
     {
         WriteCoinsViewEntry(base, base_value, base_value == ABSENT ? NO_ENTRY : DIRTY);
         cache.usage() += InsertCoinsMapEntry(cache.map(), cache_value, cache_flags);
+        if (cache_value != ABSENT && (cache_flags & DIRTY))
+            cache.dirty().push_back(OUTPOINT);
     }
 
     CCoinsView root;
@@ -0,0 +1,95 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "coinsprefetch.h"
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, TestingSetup)
+
+static CMutableTransaction SpendingTx(const std::vector<COutPoint>& vOutPoints)
+{
+    CMutableTransaction tx;
+    for (const COutPoint& outpoint : vOutPoints) {
+        tx.vin.push_back(CTxIn(outpoint));
+    }
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_block_inputs)
+{
+    // A coin in the database, one missing and one created by the block.
+    const COutPoint stored(InsecureRand256(), 0);
+    const COutPoint missing(InsecureRand256(), 1);
+    {
+        CCoinsViewCache writer(pcoinsdbview);
+        Coin coin;
+        coin.out.nValue = 5;
+        coin.out.scriptPubKey = CScript() << OP_TRUE;
+        coin.nHeight = 1;
+        writer.AddCoin(stored, std::move(coin), false);
+        writer.SetBestBlock(InsecureRand256());
+        const uint64_t nWriteSequence = pcoinsdbview->GetWriteSequence();
+        BOOST_CHECK(writer.Flush());
+        BOOST_CHECK_EQUAL(pcoinsdbview->GetWriteSequence(), nWriteSequence + 2);
+    }
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vout.resize(1);
+    const CTransaction tx1(SpendingTx({stored, missing}));
+    const CTransaction tx2(SpendingTx({COutPoint(tx1.GetHash(), 0)}));
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    pblock->vtx.push_back(MakeTransactionRef(coinbase));
+    pblock->vtx.push_back(MakeTransactionRef(tx1));
+    pblock->vtx.push_back(MakeTransactionRef(tx2));
+
+    CCoinsPrefetcher prefetcher(*pcoinsdbview, 2);
+    prefetcher.Prefetch(pblock);
+    // Queueing a block again is a no-op.
+    prefetcher.Prefetch(pblock);
+
+    CCoinsViewCache cache(pcoinsdbview);
+    size_t nAdded = 0;
+    for (int i = 0; i < 1000 && !cache.HaveCoinInCache(stored); i++) {
+        nAdded += prefetcher.Apply(cache);
+        MilliSleep(10);
+    }
+    BOOST_CHECK(cache.HaveCoinInCache(stored));
+    BOOST_CHECK_EQUAL(nAdded, 1);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1);
+    BOOST_CHECK_EQUAL(cache.AccessCoin(stored).out.nValue, 5);
+    BOOST_CHECK(!cache.HaveCoinInCache(missing));
+}
+
+BOOST_AUTO_TEST_CASE(add_fetched_coin)
+{
+    CCoinsViewCache cache(pcoinsdbview);
+    const COutPoint outpoint(InsecureRand256(), 0);
+    Coin coin;
+    coin.out.nValue = 7;
+    coin.nHeight = 2;
+    Coin copy = coin;
+    BOOST_CHECK(cache.AddFetchedCoin(outpoint, std::move(coin)));
+    const size_t nUsage = cache.DynamicMemoryUsage();
+
+    // A cached coin is never replaced, and a clean one can be uncached.
+    copy.out.nValue = 8;
+    BOOST_CHECK(!cache.AddFetchedCoin(outpoint, std::move(copy)));
+    BOOST_CHECK_EQUAL(cache.AccessCoin(outpoint).out.nValue, 7);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsage);
+    cache.Uncache(outpoint);
+    BOOST_CHECK(!cache.HaveCoinInCache(outpoint));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,196 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coinstats.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "script/interpreter.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "undo.h"
+#include "validation.h"
+
+#include <univalue.h>
+
+#include <boost/test/unit_test.hpp>
+
+extern UniValue CallRPC(std::string args);
+
+namespace {
+
+/** A 100 block chain mined before -coinstatsindex is enabled, so that the index starts at its tip. */
+struct CoinStatsIndexSetup : public TestChain100Setup {
+    CoinStatsIndexSetup() { fCoinStatsIndex = true; }
+    ~CoinStatsIndexSetup() { fCoinStatsIndex = DEFAULT_COINSTATSINDEX; }
+};
+
+CMutableTransaction SpendCoinbase(const CTransaction& coinbase, const CKey& key, const CScript& scriptPubKey)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(coinbase.GetHash(), 0);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = coinbase.vout[0].nValue / 2;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+    tx.vout[1].nValue = coinbase.vout[0].nValue / 4;
+    tx.vout[1].scriptPubKey = CScript() << OP_RETURN;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(coinbase.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL | SIGHASH_FORKID, coinbase.vout[0].nValue, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)(SIGHASH_ALL | SIGHASH_FORKID));
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+void CheckStatsEqual(const CBlockCoinsStats& stats, const CBlockCoinsStats& expected)
+{
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, expected.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nBogoSize, expected.nBogoSize);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, expected.nTotalAmount);
+    BOOST_CHECK(stats.GetMuHash() == expected.GetMuHash());
+}
+
+/** Check the incremental statistics at the tip against those computed from the coin database. */
+void CheckTipStats()
+{
+    LOCK(cs_main);
+    FlushStateToDisk();
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == chainActive.Tip()->GetBlockHash());
+
+    CBlockCoinsStats expected;
+    BOOST_CHECK(GetBlockCoinsStats(pcoinsdbview, expected));
+    // The flush wrote the statistics along with the block index.
+    CBlockCoinsStats stats;
+    BOOST_CHECK(pblocktree->ReadCoinsStats(chainActive.Tip()->GetBlockHash(), stats));
+    CheckStatsEqual(stats, expected);
+}
+
+std::string GetMuHashAtHeight(int nHeight)
+{
+    return find_value(CallRPC(strprintf("gettxoutsetinfo %d", nHeight)).get_obj(), "muhash").get_str();
+}
+
+bool HaveTipStats()
+{
+    LOCK(cs_main);
+    CBlockCoinsStats stats;
+    return ReadBlockCoinsStats(chainActive.Tip(), stats);
+}
+
+} // anon namespace
+
+BOOST_FIXTURE_TEST_SUITE(coinstatsindex_tests, CoinStatsIndexSetup)
+
+BOOST_AUTO_TEST_CASE(coinstatsindex_reorg)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<CMutableTransaction> noTxns;
+
+    // Without the statistics of its parent, a block is connected without any:
+    // the history is not replayed while connecting it.
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    BOOST_CHECK(!HaveTipStats());
+    BOOST_CHECK_THROW(CallRPC("gettxoutsetinfo"), UniValue);
+
+    // Creating the index computes the statistics at the tip from the coin
+    // database, and the blocks after get theirs when they are connected.
+    BOOST_CHECK(InitCoinStatsIndex());
+    const int nStartHeight = chainActive.Height();
+    CreateAndProcessBlock({SpendCoinbase(coinbaseTxns[0], coinbaseKey, scriptPubKey)}, scriptPubKey);
+    for (int i = 0; i < 3; i++)
+        CreateAndProcessBlock(noTxns, scriptPubKey);
+    CheckTipStats();
+    BOOST_CHECK_THROW(CallRPC(strprintf("gettxoutsetinfo %d", nStartHeight - 1)), UniValue);
+
+    // Reorg onto a longer branch forking below the block the index started at,
+    // spending another coinbase to another key: it has no statistics yet.
+    const int nForkHeight = nStartHeight - 3;
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKeyFork = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive[nForkHeight + 1]));
+    }
+    BOOST_CHECK_EQUAL(chainActive.Height(), nForkHeight);
+    mempool.clear();
+    CreateAndProcessBlock({SpendCoinbase(coinbaseTxns[1], coinbaseKey, scriptPubKeyFork)}, scriptPubKeyFork);
+    for (int i = 0; i < 7; i++)
+        CreateAndProcessBlock(noTxns, scriptPubKeyFork);
+    BOOST_CHECK_EQUAL(chainActive.Height(), nStartHeight + 5);
+    BOOST_CHECK(!HaveTipStats());
+
+    // The background thread computes those before the block the index started
+    // at from the undo data, then those of the new branch.
+    ThreadCoinStatsIndex();
+    BOOST_CHECK(HaveTipStats());
+    CheckTipStats();
+    CBlockCoinsStats genesis;
+    BOOST_CHECK_EQUAL(GetMuHashAtHeight(0), genesis.GetMuHash().GetHex());
+    BOOST_CHECK(GetMuHashAtHeight(nForkHeight) != GetMuHashAtHeight(nForkHeight + 1));
+    bool fComplete = false;
+    BOOST_CHECK(pblocktree->ReadFlag("coinstatsindex", fComplete) && fComplete);
+
+    // The RPC returns the statistics of the tip before they are flushed too.
+    CreateAndProcessBlock(noTxns, scriptPubKeyFork);
+    CBlockCoinsStats stats;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(ReadBlockCoinsStats(chainActive.Tip(), stats));
+    }
+    UniValue info = CallRPC(strprintf("gettxoutsetinfo %d", chainActive.Height()));
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "muhash").get_str(), stats.GetMuHash().GetHex());
+    BOOST_CHECK_EQUAL(find_value(info.get_obj(), "txouts").get_int64(), (int64_t)stats.nTransactionOutputs);
+    BOOST_CHECK(CallRPC("gettxoutsetinfo").write() == info.write());
+    CheckTipStats();
+}
+
+BOOST_AUTO_TEST_CASE(coinstatsindex_bip30_repeat)
+{
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    CBlockUndo blockundo;
+    const COutPoint outpoint(block.vtx[0]->GetHash(), 0);
+
+    // The block at height 91842 repeats the coinbase of the one at 91812.
+    const uint256 hashOriginal = uint256S("0x00000000000af0aed4792b1acee3d966af36cf5def14935db8de83d6f9306f2f");
+    const uint256 hashRepeat = uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec");
+    CBlockIndex original;
+    original.nHeight = 91812;
+    original.phashBlock = &hashOriginal;
+    CBlockIndex repeat;
+    repeat.nHeight = 91842;
+    repeat.phashBlock = &hashRepeat;
+
+    CBlockCoinsStats stats;
+    ApplyBlockCoinsStats(block, blockundo, &original, stats);
+    CBlockCoinsStats before;
+    before.Add(outpoint, Coin(coinbase.vout[0], 91812, true));
+    CheckStatsEqual(stats, before);
+
+    // Like in the coin database, the repeated coinbase overwrites the coin.
+    ApplyBlockCoinsStats(block, blockundo, &repeat, stats);
+    CBlockCoinsStats after;
+    after.Add(outpoint, Coin(coinbase.vout[0], 91842, true));
+    CheckStatsEqual(stats, after);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 1U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 50 * COIN);
+
+    // Undoing it restores the coin of the original.
+    ApplyBlockCoinsStats(block, blockundo, &repeat, stats, true);
+    CheckStatsEqual(stats, before);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
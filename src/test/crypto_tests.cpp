@@ -4,6 +4,7 @@
 
 #include "crypto/aes.h"
 #include "crypto/chacha20.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -11,6 +12,8 @@
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
 #include "random.h"
+#include "streams.h"
+#include "uint256.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
@@ -505,4 +508,51 @@ BOOST_AUTO_TEST_CASE(countbits_tests)
     }
 }
 
+static MuHash3072 FromInt(unsigned char i)
+{
+    unsigned char tmp[32] = {i, 0};
+    MuHash3072 muhash;
+    muhash.Insert(tmp, sizeof(tmp));
+    return muhash;
+}
+
+static uint256 FinalizeMuHash(MuHash3072 muhash)
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // Same as the MuHash3072 test vector of Bitcoin Core
+    MuHash3072 acc = FromInt(0);
+    acc *= FromInt(1);
+    acc /= FromInt(2);
+    BOOST_CHECK(FinalizeMuHash(acc) == uint256S("10d312b100cbd32ada024a6646e40d3482fcff103668d2625f10002a607d5863"));
+
+    // The hash does not depend on the order, and removing undoes inserting
+    FastRandomContext ctx;
+    std::vector<unsigned char> a = ctx.randbytes(32), b = ctx.randbytes(17), c = ctx.randbytes(64);
+    MuHash3072 x, y, z;
+    x.Insert(a.data(), a.size()).Insert(b.data(), b.size()).Insert(c.data(), c.size()).Remove(b.data(), b.size());
+    y.Remove(b.data(), b.size()).Insert(c.data(), c.size()).Insert(b.data(), b.size()).Insert(a.data(), a.size());
+    BOOST_CHECK(FinalizeMuHash(x) == FinalizeMuHash(y));
+    z.Insert(a.data(), a.size()).Remove(a.data(), a.size());
+    BOOST_CHECK(FinalizeMuHash(z) == FinalizeMuHash(MuHash3072()));
+    BOOST_CHECK(FinalizeMuHash(x) != FinalizeMuHash(z));
+
+    // Finalizing keeps an equivalent state, which survives serialization
+    uint256 hash = FinalizeMuHash(x);
+    x.Finalize(hash.begin());
+    x.Insert(b.data(), b.size());
+    CDataStream ss(SER_DISK, 0);
+    ss << x;
+    BOOST_CHECK_EQUAL(ss.size(), 2 * Num3072::BYTE_SIZE);
+    MuHash3072 w;
+    ss >> w;
+    y.Insert(b.data(), b.size());
+    BOOST_CHECK(FinalizeMuHash(w) == FinalizeMuHash(y));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
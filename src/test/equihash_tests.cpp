@@ -81,6 +81,22 @@ void TestEquihashSolvers(unsigned int n, unsigned int k, const std::string &I, c
     BOOST_TEST_MESSAGE(strm.str());
     BOOST_CHECK(retOpt == solns);
     BOOST_CHECK(retOpt == ret);
+
+    // So should the radix solver, whose arena is reused between runs
+    static EhSolverArena arena;
+    std::set<std::vector<uint32_t>> retRadix;
+    std::function<bool(std::vector<unsigned char>)> validBlockRadix =
+            [&retRadix, cBitLen](std::vector<unsigned char> soln) {
+        retRadix.insert(GetIndicesFromMinimal(soln, cBitLen));
+        return false;
+    };
+    EhRadixSolveUncancellable(n, k, state, validBlockRadix, arena);
+    BOOST_TEST_MESSAGE("[Radix] Number of solutions: " << retRadix.size());
+    strm.str("");
+    PrintSolutions(strm, retRadix);
+    BOOST_TEST_MESSAGE(strm.str());
+    BOOST_CHECK(retRadix == solns);
+    BOOST_CHECK(retRadix == ret);
 }
 
 void TestEquihashValidator(unsigned int n, unsigned int k, const std::string &I, const arith_uint256 &nonce, std::vector<uint32_t> soln, bool expected) {
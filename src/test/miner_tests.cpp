@@ -219,8 +219,8 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     for (unsigned int i = 0; i < sizeof(blockinfo)/sizeof(*blockinfo); ++i)
     {
         CBlock *pblock = &pblocktemplate->block; // pointer for convenience
-        pblock->nVersion = 1;
-        pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
+        pblock->SetVersion(1);
+        pblock->SetTime(chainActive.Tip()->GetMedianTimePast()+1);
         CMutableTransaction txCoinbase(*pblock->vtx[0]);
         txCoinbase.nVersion = 1;
         txCoinbase.vin[0].scriptSig = CScript();
@@ -233,11 +233,11 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
             baseheight = chainActive.Height();
         if (txFirst.size() < 4)
             txFirst.push_back(pblock->vtx[0]);
-        pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
-        pblock->nNonce = ArithToUint256(arith_uint256(blockinfo[i].nonce));
+        pblock->SetMerkleRoot(BlockMerkleRoot(*pblock));
+        pblock->SetNonce(ArithToUint256(arith_uint256(blockinfo[i].nonce)));
         std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
         BOOST_CHECK(ProcessNewBlock(chainparams, shared_pblock, true, nullptr));
-        pblock->hashPrevBlock = pblock->GetHash();
+        pblock->SetPrevBlockHash(pblock->GetHash());
     }
 
     // Just to make sure we can still make simple blocks
@@ -502,4 +502,74 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+// The templates of the cache are checked without CreateNewBlock(), whose
+// TestBlockValidity() would reject the unfunded transactions below.
+BOOST_AUTO_TEST_CASE(BlockTemplateCache_incremental)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    TestMemPoolEntryHelper entry;
+
+    LOCK(cs_main);
+    BlockTemplateCache cache(chainparams);
+
+    std::unique_ptr<CBlockTemplate> pblocktemplate = cache.GetBlockTemplate(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    const CAmount nSubsidy = pblocktemplate->block.vtx[0]->GetValueOut();
+    bool fPaid = false;
+    for (const CTxOut& out : pblocktemplate->block.vtx[0]->vout)
+        fPaid |= out.scriptPubKey == scriptPubKey;
+    BOOST_CHECK(fPaid);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vin[0].prevout.hash = uint256S("0x01");
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 5000000000LL - 10000;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    const CTransaction txHighFee(tx);
+    mempool.addUnchecked(txHighFee.GetHash(), entry.Fee(10000).FromTx(txHighFee));
+
+    // Below the minimum feerate, it waits for a descendant paying for it
+    tx.vin[0].prevout.hash = uint256S("0x02");
+    tx.vout[0].nValue = 5000000000LL;
+    const CTransaction txFree(tx);
+    mempool.addUnchecked(txFree.GetHash(), entry.Fee(0).FromTx(txFree));
+
+    pblocktemplate = cache.GetBlockTemplate(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txHighFee.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), nSubsidy + 10000);
+
+    tx.vin[0].prevout.hash = txFree.GetHash();
+    tx.vout[0].nValue = 5000000000LL - 50000;
+    const CTransaction txChild(tx);
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(50000).FromTx(txChild));
+
+    pblocktemplate = cache.GetBlockTemplate(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 4);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txHighFee.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == txFree.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[3]->GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -60000);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), nSubsidy + 60000);
+
+    // A fee delta makes the next template be assembled again, here taking
+    // txHighFee below the minimum feerate
+    mempool.PrioritiseTransaction(txHighFee.GetHash(), -10000);
+    pblocktemplate = cache.GetBlockTemplate(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txFree.GetHash());
+    mempool.PrioritiseTransaction(txHighFee.GetHash(), 10000);
+
+    // Removals make the next template be assembled again
+    mempool.removeRecursive(txHighFee);
+    mempool.removeRecursive(txFree);
+    pblocktemplate = cache.GetBlockTemplate(scriptPubKey);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->GetValueOut(), nSubsidy);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -82,4 +82,31 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
         BOOST_CHECK_EQUAL(tdiff, p1->GetBlockTime() - p2->GetBlockTime());
     }
 }
+/* The cached target sums and median times must give the result of walking the window */
+BOOST_AUTO_TEST_CASE(GetNextWorkRequired_cache_test)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    const arith_uint256 bnPowLimit = UintToArith256(params.PowLimit(true));
+    std::vector<CBlockIndex> blocks(500);
+    for (int i = 0; i < 500; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1516622400 + i * params.nPowTargetSpacing + InsecureRandRange(1200) - 600;
+        blocks[i].nBits = arith_uint256(bnPowLimit >> InsecureRandRange(16)).GetCompact();
+        blocks[i].BuildSkip();
+        blocks[i].BuildDifficultyCache();
+        BOOST_CHECK_EQUAL(blocks[i].nMedianTimePast, blocks[i].GetMedianTimePast());
+    }
+
+    for (CBlockIndex& block : blocks) {
+        const unsigned int nCached = GetNextWorkRequired(&block, nullptr, params);
+        // Without the cache of the last block the window is walked.
+        const int64_t nMedianTimePast = block.nMedianTimePast;
+        block.nMedianTimePast = 0;
+        BOOST_CHECK_EQUAL(nCached, GetNextWorkRequired(&block, nullptr, params));
+        block.nMedianTimePast = nMedianTimePast;
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
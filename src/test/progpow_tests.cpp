@@ -0,0 +1,416 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "crypto/equihash.h"
+#include "fs.h"
+#include "crypto/progpow/ethash-internal.hpp"
+#include "crypto/progpow/ethash.hpp"
+#include "crypto/progpow/keccak.hpp"
+#include "miner.h"
+#include "pow.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "test/testutil.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(progpow_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(l1_cache_matches_dataset)
+{
+    const ethash::epoch_context_ptr context = ethash::create_epoch_context(0);
+    BOOST_REQUIRE(context);
+    BOOST_REQUIRE(context->l1_cache);
+
+    const uint32_t num_words = ETHASH_PROGPOW_L1_CACHE_SIZE / sizeof(uint32_t);
+    for (uint32_t i = 0; i < num_words; i += 97) {
+        BOOST_CHECK_EQUAL(context->l1_cache[i], ethash::calculate_L1dataset_item(*context, i).hwords[0]);
+    }
+    BOOST_CHECK_EQUAL(context->l1_cache[num_words - 1],
+                      ethash::calculate_L1dataset_item(*context, num_words - 1).hwords[0]);
+}
+
+BOOST_AUTO_TEST_CASE(keccak_implementations)
+{
+    const ethash::hash256 empty = ethash::keccak256(nullptr, 0);
+    BOOST_CHECK_EQUAL(HexStr(empty.bytes, empty.bytes + 32), "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470");
+
+    std::vector<std::pair<ethash_keccakf1600_fn, ethash_keccakf800_fn>> impls{
+        {ethash_keccakf1600_generic, ethash_keccakf800_generic}};
+    std::vector<ethash::keccak512_64x4_fn> impls512{ethash::keccak512_64x4};
+#if defined(ETHASH_KECCAK_BMI2)
+    if (ethash_keccak_bmi2_supported()) {
+        impls.emplace_back(ethash_keccakf1600_bmi2, ethash_keccakf800_bmi2);
+    }
+#endif
+#if defined(ETHASH_PROGPOW_AVX2)
+    if (ethash::progpow_avx2::supported()) {
+        impls512.push_back(ethash::progpow_avx2::keccak512_64x4);
+    }
+#endif
+
+    for (const auto& impl : impls) {
+        uint64_t state[25], expected[25];
+        uint32_t state32[25], expected32[25];
+        for (int i = 0; i < 25; i++) {
+            state[i] = expected[i] = InsecureRand32() * 0x100000001ULL;
+            state32[i] = expected32[i] = InsecureRand32();
+        }
+        ethash_keccakf1600_generic(expected);
+        impl.first(state);
+        BOOST_CHECK(memcmp(state, expected, sizeof(state)) == 0);
+        for (int r = 0; r < 22; r++) {
+            keccak_f800_round(expected32, r);
+        }
+        impl.second(state32);
+        BOOST_CHECK(memcmp(state32, expected32, sizeof(state32)) == 0);
+    }
+
+    for (ethash::keccak512_64x4_fn impl : impls512) {
+        ethash::hash512 in[4], out[4];
+        for (ethash::hash512& h : in) {
+            for (uint32_t& w : h.half_words) {
+                w = InsecureRand32();
+            }
+        }
+        impl(out, in);
+        for (int k = 0; k < 4; k++) {
+            const ethash::hash512 expected = ethash::keccak512(in[k]);
+            BOOST_CHECK(memcmp(&out[k], &expected, sizeof(expected)) == 0);
+        }
+    }
+}
+
+/** Corrupt or restore a byte of the mix hash of a header */
+static void FlipSolutionByte(CBlockHeader& header, size_t i)
+{
+    std::vector<unsigned char> vSolution = header.GetSolution();
+    vSolution[i] ^= 1;
+    header.SetSolution(vSolution);
+}
+
+BOOST_AUTO_TEST_CASE(check_progpow_genesis)
+{
+    const CChainParams& params = Params();
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    BOOST_CHECK(CheckProgPow(&header, params, PowCheckSource::BLOCK));
+
+    // Corrupting the mix hash must be detected.
+    FlipSolutionByte(header, 0);
+    BOOST_CHECK(!CheckProgPow(&header, params, PowCheckSource::BLOCK));
+}
+
+BOOST_AUTO_TEST_CASE(context_hits_per_thread)
+{
+    ethash::get_global_epoch_context(0);
+    const ethash::epoch_context_cache_stats before = ethash::get_epoch_context_cache_stats();
+
+    // The hits of the threads that exited are still counted.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 100; i++) {
+                ethash::get_global_epoch_context(0);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const ethash::epoch_context_cache_stats after = ethash::get_epoch_context_cache_stats();
+    BOOST_CHECK_EQUAL(after.hits - before.hits, 400U);
+    BOOST_CHECK_EQUAL(after.misses, before.misses);
+}
+
+BOOST_AUTO_TEST_CASE(check_progpow_share)
+{
+    const CChainParams& params = Params();
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    const arith_uint256 blockTarget = arith_uint256().SetCompact(header.GetBits());
+    const arith_uint256 hash = UintToArith256(header.GetHash());
+    BOOST_CHECK(CheckProgPowShare(&header, blockTarget, params));
+    BOOST_CHECK(CheckProgPowShare(&header, hash, params));
+    BOOST_CHECK(!CheckProgPowShare(&header, hash - 1, params));
+
+    FlipSolutionByte(header, 0);
+    BOOST_CHECK(!CheckProgPowShare(&header, blockTarget, params));
+}
+
+BOOST_AUTO_TEST_CASE(check_progpow_stats)
+{
+    const CChainParams& params = Params();
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    const PowCheckStats before = GetPowCheckStats(true, PowCheckSource::DISK);
+    const ethash::epoch_context_cache_stats cacheBefore = ethash::get_epoch_context_cache_stats();
+
+    BOOST_CHECK(CheckProgPow(&header, params, PowCheckSource::DISK));
+    FlipSolutionByte(header, 0);
+    BOOST_CHECK(!CheckProgPow(&header, params, PowCheckSource::DISK));
+
+    const PowCheckStats after = GetPowCheckStats(true, PowCheckSource::DISK);
+    BOOST_CHECK_EQUAL(after.nChecks, before.nChecks + 2);
+    BOOST_CHECK_EQUAL(after.nFailures, before.nFailures + 1);
+    uint64_t nBucketed = 0;
+    for (int i = 0; i < POW_LATENCY_BUCKETS; i++) {
+        nBucketed += after.vLatency[i] - before.vLatency[i];
+    }
+    BOOST_CHECK_EQUAL(nBucketed, 2);
+    BOOST_CHECK_EQUAL(GetPowCheckStats(false, PowCheckSource::DISK).nChecks, 0);
+
+    // Both checks found the epoch context in the cache or built it once.
+    const ethash::epoch_context_cache_stats cacheAfter = ethash::get_epoch_context_cache_stats();
+    BOOST_CHECK_EQUAL(cacheAfter.hits + cacheAfter.misses, cacheBefore.hits + cacheBefore.misses + 2);
+    BOOST_CHECK(cacheAfter.misses <= cacheBefore.misses + 1);
+    BOOST_CHECK(cacheAfter.builds >= 1);
+}
+
+BOOST_AUTO_TEST_CASE(block_hash_cache)
+{
+    const CChainParams& params = Params();
+    CBlock block = params.GenesisBlock();
+    const uint256 genesisHash = block.GetHash();
+    BOOST_CHECK(genesisHash == params.GetConsensus().hashGenesisBlock);
+    BOOST_CHECK(block.GetBlockHeader().GetHash() == genesisHash);
+
+    // The setters reset the cached hash.
+    std::vector<unsigned char> vSolution = block.GetSolution();
+    vSolution[0] ^= 1;
+    block.SetSolution(vSolution);
+    const uint256 mutatedHash = block.GetHash();
+    BOOST_CHECK(mutatedHash != genesisHash);
+
+    // So does deserializing into a header whose hash was computed.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block.GetBlockHeader();
+    CBlockHeader header = params.GenesisBlock().GetBlockHeader();
+    BOOST_CHECK(header.GetHash() == genesisHash);
+    ss >> header;
+    BOOST_CHECK(header.GetHash() == mutatedHash);
+
+    vSolution[0] ^= 1;
+    block.SetSolution(vSolution);
+    BOOST_CHECK(block.GetHash() == genesisHash);
+    block.SetTime(block.GetTime() + 1);
+    BOOST_CHECK(block.GetHash() != genesisHash);
+    block.SetTime(block.GetTime() - 1);
+    BOOST_CHECK(block.GetHash() == genesisHash);
+    // ProgPoW only hashes the last 8 bytes of the nonce.
+    uint256 nNonce = block.GetNonce();
+    nNonce.begin()[24] ^= 1;
+    block.SetNonce(nNonce);
+    BOOST_CHECK(block.GetHash() != genesisHash);
+    block.SetNull();
+    BOOST_CHECK(block.GetHash() == CBlockHeader().GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(check_pow_batch)
+{
+    const CChainParams& params = Params();
+    const CBlockHeader genesis = params.GenesisBlock().GetBlockHeader();
+    std::vector<CBlockHeader> headers(5, genesis);
+    std::vector<const CBlockHeader*> vHeaders;
+    for (const CBlockHeader& header : headers) {
+        vHeaders.push_back(&header);
+    }
+    BOOST_CHECK(CheckPowBatch(vHeaders, params, PowCheckSource::HEADER));
+    BOOST_CHECK(CheckPowBatch(std::vector<const CBlockHeader*>(), params, PowCheckSource::HEADER));
+
+    // Every check is recorded on its own, the ones after a failure are skipped.
+    const PowCheckStats before = GetPowCheckStats(true, PowCheckSource::HEADER);
+    FlipSolutionByte(headers[1], 3);
+    BOOST_CHECK(!CheckPowBatch(vHeaders, params, PowCheckSource::HEADER));
+    const PowCheckStats after = GetPowCheckStats(true, PowCheckSource::HEADER);
+    BOOST_CHECK_EQUAL(after.nFailures - before.nFailures, 1U);
+    BOOST_CHECK(after.nChecks - before.nChecks <= headers.size());
+    FlipSolutionByte(headers[1], 3);
+
+    headers[4].SetSolution(std::vector<unsigned char>());
+    BOOST_CHECK(!CheckPowBatch(vHeaders, params, PowCheckSource::HEADER));
+}
+
+BOOST_AUTO_TEST_CASE(check_pow_batch_progpow_only)
+{
+    // The Equihash parameters of main are not supported by EhInitialiseState,
+    // which batches of ProgPoW headers never call.
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    BOOST_REQUIRE_EQUAL(chainParams->GetConsensus().ProgForkHeight, 0);
+    eh_HashState state;
+    BOOST_CHECK_THROW(EhInitialiseState(chainParams->EquihashN(), chainParams->EquihashK(), state), std::invalid_argument);
+
+    const CBlockHeader genesis = chainParams->GenesisBlock().GetBlockHeader();
+    std::vector<const CBlockHeader*> vHeaders(3, &genesis);
+    std::vector<char> vValid;
+    BOOST_CHECK(CheckPowBatch(vHeaders, *chainParams, PowCheckSource::HEADER, &vValid));
+    BOOST_CHECK(vValid == std::vector<char>(3, true));
+    BOOST_CHECK(CheckPowBatch(std::vector<const CBlockHeader*>(), *chainParams, PowCheckSource::HEADER, &vValid));
+    BOOST_CHECK(vValid.empty());
+}
+
+BOOST_AUTO_TEST_CASE(solve_progpow_block)
+{
+    const CChainParams& params = Params();
+    CBlock block = params.GenesisBlock();
+    block.SetNonce(uint256());
+    block.SetSolution(std::vector<unsigned char>());
+    gArgs.ForceSetArg("-genproclimit", "2");
+
+    // Without a chain the tip stays null, so the search is never stale.
+    block.SetBits(0x207fffff);
+    uint64_t nMaxTries = 1000;
+    BOOST_REQUIRE(SolveProgPowBlock(&block, nullptr, nMaxTries));
+    BOOST_CHECK(nMaxTries < 1000);
+    BOOST_CHECK(CheckProgPow(&block, params, PowCheckSource::SHARE));
+    BOOST_CHECK(GetProgPowHashesPerSec() > 0);
+
+    // The tries are shared by the threads.
+    block.SetBits(0x03000001);
+    nMaxTries = 20;
+    BOOST_CHECK(!SolveProgPowBlock(&block, nullptr, nMaxTries));
+    BOOST_CHECK_EQUAL(nMaxTries, 0U);
+
+    gArgs.ForceSetArg("-genproclimit", std::to_string(DEFAULT_GENERATE_THREADS));
+}
+
+BOOST_AUTO_TEST_CASE(build_full_dataset)
+{
+    const ethash::epoch_context_ptr light = ethash::create_epoch_context(0);
+    BOOST_REQUIRE(light);
+
+    // A dataset of a few chunks of items over the epoch 0 caches.
+    const int num_items = 2 * 4096 + 1;
+    std::vector<ethash::hash2048> dataset(num_items);
+    ethash_full_dataset_state state;
+    ethash::epoch_context_full context{0, light->light_cache_num_items, light->light_cache,
+        light->l1_cache, light->program, num_items, dataset.data(), &state};
+
+    std::atomic<bool> cancel{true};
+    BOOST_CHECK(!ethash::build_full_dataset(context, 2, &cancel));
+    BOOST_CHECK(!state.ready);
+
+    const ethash::hash256 header_hash = ethash::keccak256(reinterpret_cast<const uint8_t*>("progpow"), 7);
+    const ethash::result expected = ethash::progpow(static_cast<const ethash::epoch_context&>(context), header_hash, 42);
+    BOOST_CHECK(memcmp(ethash::progpow(context, header_hash, 42).mix_hash.bytes, expected.mix_hash.bytes, 32) == 0);
+
+    // A build cancelled midway is resumed without counting items twice.
+    std::thread canceller([&] {
+        while (state.num_items_built == 0) {}
+        cancel = true;
+    });
+    cancel = false;
+    ethash::build_full_dataset(context, 1, &cancel);
+    canceller.join();
+    cancel = false;
+    BOOST_CHECK(ethash::build_full_dataset(context, 3, &cancel));
+    BOOST_CHECK(state.ready);
+    BOOST_CHECK_EQUAL(state.num_items_built.load(), num_items);
+    for (int i = 0; i < num_items; i += 37) {
+        const ethash::hash2048 item = ethash::calculate_dataset_item_progpow(context, i);
+        BOOST_CHECK(memcmp(&dataset[i], &item, sizeof(item)) == 0);
+    }
+
+    const ethash::result result = ethash::progpow(context, header_hash, 42);
+    BOOST_CHECK(memcmp(result.mix_hash.bytes, expected.mix_hash.bytes, 32) == 0);
+    BOOST_CHECK(memcmp(result.final_hash.bytes, expected.final_hash.bytes, 32) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(global_context_cache)
+{
+    ethash::set_epoch_context_cache_limits(2, ethash::default_epoch_context_cache_bytes);
+
+    BOOST_CHECK_EQUAL(ethash::get_global_epoch_context(0).epoch_number, 0);
+    BOOST_CHECK(!ethash::prebuild_global_epoch_context(0));
+
+    // A prebuild is started once and is picked up by the lookup.
+    BOOST_CHECK(ethash::prebuild_global_epoch_context(1));
+    BOOST_CHECK(!ethash::prebuild_global_epoch_context(1));
+    BOOST_CHECK_EQUAL(ethash::get_global_epoch_context(1).epoch_number, 1);
+
+    // Switching between the two cached epochs does not evict either of them.
+    BOOST_CHECK_EQUAL(ethash::get_global_epoch_context(0).epoch_number, 0);
+    BOOST_CHECK(!ethash::prebuild_global_epoch_context(1));
+
+    // A joined prebuild is done and stays cached.
+    const uint64_t nBuilds = ethash::get_epoch_context_cache_stats().builds;
+    BOOST_CHECK(ethash::prebuild_global_epoch_context(2));
+    ethash::join_global_epoch_context_builds();
+    BOOST_CHECK_EQUAL(ethash::get_epoch_context_cache_stats().builds, nBuilds + 1);
+    BOOST_CHECK(!ethash::prebuild_global_epoch_context(2));
+
+    ethash::set_epoch_context_cache_limits(ethash::default_epoch_context_cache_count,
+                                           ethash::default_epoch_context_cache_bytes);
+}
+
+BOOST_AUTO_TEST_CASE(epoch_context_file)
+{
+    const fs::path dir = GetTempPath() / strprintf("test_progpow_%lu_%i", (unsigned long)GetTime(), (int)InsecureRandRange(100000));
+    fs::create_directories(dir);
+    const fs::path file = dir / "epoch-0.cache";
+
+    const ethash::epoch_context_ptr expected = ethash::create_epoch_context(0);
+    BOOST_REQUIRE(expected);
+    const size_t light_cache_size = ethash::get_light_cache_size(expected->light_cache_num_items);
+
+    // The first load writes the file, the second one maps it.
+    for (int i = 0; i < 2; i++) {
+        std::shared_ptr<ethash::epoch_context> context = ethash::load_epoch_context_file(dir.string(), 0);
+        BOOST_REQUIRE(context);
+        BOOST_CHECK(fs::exists(file));
+        BOOST_CHECK_EQUAL(context->light_cache_num_items, expected->light_cache_num_items);
+        BOOST_CHECK(memcmp(context->light_cache, expected->light_cache, light_cache_size) == 0);
+        BOOST_CHECK(memcmp(context->l1_cache, expected->l1_cache, ETHASH_PROGPOW_L1_CACHE_SIZE) == 0);
+    }
+
+    // A corrupted file fails the checksum and is replaced.
+    {
+        FILE* f = fsbridge::fopen(file, "r+b");
+        BOOST_REQUIRE(f);
+        fseek(f, 1000, SEEK_SET);
+        int c = fgetc(f);
+        fseek(f, 1000, SEEK_SET);
+        fputc(c ^ 1, f);
+        fclose(f);
+    }
+    std::shared_ptr<ethash::epoch_context> context = ethash::load_epoch_context_file(dir.string(), 0);
+    BOOST_REQUIRE(context);
+    BOOST_CHECK(memcmp(context->light_cache, expected->light_cache, light_cache_size) == 0);
+
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(global_context_files)
+{
+    const fs::path dir = GetTempPath() / strprintf("test_progpow_%lu_%i", (unsigned long)GetTime(), (int)InsecureRandRange(100000));
+    fs::create_directories(dir);
+    ethash::set_epoch_context_cache_limits(1, ethash::default_epoch_context_cache_bytes);
+    ethash::set_epoch_context_dir(dir.string());
+
+    // Only the file of the cached epoch is kept.
+    BOOST_CHECK_EQUAL(ethash::get_global_epoch_context(4).epoch_number, 4);
+    BOOST_CHECK(fs::exists(dir / "epoch-4.cache"));
+    BOOST_CHECK_EQUAL(ethash::get_global_epoch_context(5).epoch_number, 5);
+    BOOST_CHECK(!fs::exists(dir / "epoch-4.cache"));
+    BOOST_CHECK(fs::exists(dir / "epoch-5.cache"));
+
+    // The file of a prebuild evicted before or while it is built is deleted too.
+    BOOST_CHECK(ethash::prebuild_global_epoch_context(4));
+    BOOST_CHECK(ethash::prebuild_global_epoch_context(5));
+    ethash::join_global_epoch_context_builds();
+    BOOST_CHECK(!fs::exists(dir / "epoch-4.cache"));
+    BOOST_CHECK(fs::exists(dir / "epoch-5.cache"));
+
+    ethash::set_epoch_context_dir("");
+    ethash::set_epoch_context_cache_limits(ethash::default_epoch_context_cache_count,
+                                           ethash::default_epoch_context_cache_bytes);
+    fs::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chain.h"
+#include "streams.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
@@ -177,4 +178,53 @@ BOOST_AUTO_TEST_CASE(findearliestatleast_edge_test)
     BOOST_CHECK(!chain.FindEarliestAtLeast(int64_t(std::numeric_limits<unsigned int>::max()) + 1));
 }
 
+BOOST_AUTO_TEST_CASE(blockindex_solution_test)
+{
+    // A ProgPoW mix hash is stored inline, an Equihash solution out of line.
+    for (size_t nSize : {(size_t)0, (size_t)32, (size_t)1344}) {
+        std::vector<unsigned char> vSolution(nSize);
+        for (size_t i = 0; i < nSize; i++) {
+            vSolution[i] = InsecureRandBits(8);
+        }
+
+        CBlockHeader header;
+        header.SetSolution(vSolution);
+        CBlockIndex index(header);
+        BOOST_CHECK_EQUAL(index.nSolution.size(), nSize);
+        BOOST_CHECK(std::vector<unsigned char>(index.nSolution.begin(), index.nSolution.end()) == vSolution);
+        BOOST_CHECK(index.GetBlockHeader().GetSolution() == vSolution);
+
+        // Copies are deep and serialize like the vector.
+        CDiskBlockIndex diskindex(&index);
+        index.nSolution.clear();
+        CDataStream ss(SER_DISK, CLIENT_VERSION), ssVector(SER_DISK, CLIENT_VERSION);
+        ss << diskindex.nSolution;
+        ssVector << vSolution;
+        BOOST_CHECK(ss.str() == ssVector.str());
+        std::vector<unsigned char> vRead;
+        ss >> vRead;
+        BOOST_CHECK(vRead == vSolution);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_arena_test)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < 10000; i++) {
+        CBlockIndex* pindex = arena.Allocate();
+        BOOST_CHECK(pindex->pprev == nullptr && pindex->nSolution.empty());
+        pindex->nHeight = i;
+        pindex->pprev = vIndex.empty() ? nullptr : vIndex.back();
+        pindex->BuildSkip();
+        vIndex.push_back(pindex);
+    }
+    for (int i = 0; i < 1000; i++) {
+        int from = InsecureRandRange(vIndex.size());
+        int to = InsecureRandRange(from + 1);
+        BOOST_CHECK(vIndex[from]->GetAncestor(to) == vIndex[to]);
+    }
+    arena.Clear();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
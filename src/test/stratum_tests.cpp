@@ -0,0 +1,278 @@
+// Copyright (c) 2018 The Bitcoin Interest developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "stratum.h"
+#include "test/test_bitcoin.h"
+#include "tinyformat.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
+
+#include <map>
+
+#include <univalue.h>
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/thread.h>
+
+#include <boost/test/unit_test.hpp>
+
+/** A Stratum server on its own event base, without listeners, whose jobs are
+ *  the ones the tests add */
+struct StratumTestingSetup : public BasicTestingSetup
+{
+    struct event_base* base;
+    std::unique_ptr<StratumServer> server;
+    /** The ends of the miners, which receive what the server sends */
+    std::map<StratumConnection*, struct bufferevent*> miners;
+
+    StratumTestingSetup()
+    {
+        // The worker thread posts the results of the shares to the event base.
+        evthread_use_pthreads();
+        base = event_base_new();
+        server.reset(new StratumServer(base, CScript() << OP_TRUE, DEFAULT_STRATUM_REFRESH, 1));
+    }
+
+    ~StratumTestingSetup()
+    {
+        server.reset();
+        for (const auto& miner : miners)
+            bufferevent_free(miner.second);
+        event_base_free(base);
+    }
+
+    /** A miner connected through a pair of bufferevents instead of a socket,
+     *  null if the server refused it */
+    StratumConnection* Connect()
+    {
+        struct bufferevent* pair[2];
+        BOOST_REQUIRE(bufferevent_pair_new(base, 0, pair) == 0);
+        bufferevent_enable(pair[1], EV_READ);
+        StratumConnection* conn = server->AddConnection(pair[0], CService());
+        if (!conn) {
+            bufferevent_free(pair[1]);
+            return nullptr;
+        }
+        // The end of a closed miner whose connection had the same address.
+        if (miners.count(conn))
+            bufferevent_free(miners[conn]);
+        miners[conn] = pair[1];
+        return conn;
+    }
+
+    /** The next message sent to a miner, running the event loop for the
+     *  replies of the worker thread. Null if none comes within ten seconds. */
+    UniValue Read(StratumConnection* conn)
+    {
+        struct evbuffer* input = bufferevent_get_input(miners.at(conn));
+        const int64_t nStart = GetTimeMillis();
+        do {
+            size_t n_read_out = 0;
+            char* line = evbuffer_readln(input, &n_read_out, EVBUFFER_EOL_LF);
+            if (line) {
+                UniValue msg;
+                BOOST_CHECK(msg.read(std::string(line, n_read_out)));
+                free(line);
+                return msg;
+            }
+            event_base_loop(base, EVLOOP_NONBLOCK);
+            MilliSleep(10);
+        } while (GetTimeMillis() - nStart < 10000);
+        return NullUniValue;
+    }
+
+    bool NothingSent(StratumConnection* conn)
+    {
+        event_base_loop(base, EVLOOP_NONBLOCK);
+        return evbuffer_get_length(bufferevent_get_input(miners.at(conn))) == 0;
+    }
+
+    /** Send a request and return its reply */
+    UniValue Request(StratumConnection* conn, const std::string& line)
+    {
+        BOOST_CHECK(server->ProcessLine(conn, line));
+        return Read(conn);
+    }
+};
+
+/** The code of an error reply, STRATUM_OK for a result */
+static int GetErrorCode(const UniValue& reply)
+{
+    const UniValue& error = find_value(reply, "error");
+    return error.isArray() ? error[0].get_int() : STRATUM_OK;
+}
+
+/** A ProgPoW job of the first epoch that every share meets, but no block */
+static std::shared_ptr<StratumJob> MakeJob(uint32_t nTime)
+{
+    std::shared_ptr<StratumJob> job = std::make_shared<StratumJob>();
+    job->block.SetHeight(1);
+    job->block.SetTime(nTime);
+    job->block.SetBits(0x03000001);
+    job->nEpoch = 0;
+    job->header_hash = GetProgPowHeaderHash(&job->block);
+    job->seed = ethash_calculate_epoch_seed(job->nEpoch);
+    job->shareTarget = ~arith_uint256();
+    job->target = GetProgPowBoundary(job->shareTarget);
+    return job;
+}
+
+static std::string EthashHashToHex(const ethash::hash256& hash)
+{
+    return "0x" + HexStr(hash.bytes, hash.bytes + sizeof(hash.bytes));
+}
+
+/** A mining.submit request of a share of a job, with the right mix hash */
+static std::string SubmitRequest(int id, const StratumJob& job, uint64_t nonce)
+{
+    ethash_epoch_context context = ethash::get_global_epoch_context(job.nEpoch);
+    context.block_number = job.block.GetHeight();
+    const ethash::RetVal r = ethash::check_progpow_nonce_light(context, job.header_hash, job.target, nonce);
+    BOOST_CHECK(r.ok);
+    return strprintf("{\"id\": %d, \"method\": \"mining.submit\", \"params\": [\"worker\", \"%s\", \"0x%016x\", \"%s\", \"%s\"]}",
+        id, job.id, nonce, EthashHashToHex(job.header_hash), EthashHashToHex(r.results.mix_hash));
+}
+
+BOOST_FIXTURE_TEST_SUITE(stratum_tests, StratumTestingSetup)
+
+BOOST_AUTO_TEST_CASE(share_target)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    const arith_uint256 powLimit = UintToArith256(params.powLimit);
+    const arith_uint256 blockTarget = powLimit >> 20;
+
+    BOOST_CHECK(GetStratumShareTarget(1, blockTarget, params) == powLimit);
+    BOOST_CHECK(GetStratumShareTarget(1024, blockTarget, params) == powLimit / 1024);
+    // A difficulty of 0 is taken as 1.
+    BOOST_CHECK(GetStratumShareTarget(0, blockTarget, params) == powLimit);
+    // Shares are never harder than blocks.
+    BOOST_CHECK(GetStratumShareTarget(uint64_t(1) << 40, blockTarget, params) == blockTarget);
+}
+
+BOOST_AUTO_TEST_CASE(extranonce)
+{
+    BOOST_CHECK(CheckStratumExtraNonce(0x00a1000000000000ULL, "00a1"));
+    BOOST_CHECK(CheckStratumExtraNonce(0x00a1ffffffffffffULL, "00a1"));
+    BOOST_CHECK(!CheckStratumExtraNonce(0x00a2000000000000ULL, "00a1"));
+    BOOST_CHECK(!CheckStratumExtraNonce(0x000000000000a100ULL, "00a1"));
+    BOOST_CHECK(CheckStratumExtraNonce(0x1234567890abcdefULL, ""));
+    BOOST_CHECK(CheckStratumExtraNonce(0x1234567890abcdefULL, "1234567890abcdef"));
+    BOOST_CHECK(!CheckStratumExtraNonce(0x1234567890abcdefULL, "1234567890abcdef00"));
+}
+
+BOOST_AUTO_TEST_CASE(subscribe_authorize)
+{
+    StratumConnection* conn = Connect();
+    BOOST_CHECK_EQUAL(conn->strExtraNonce, "0000");
+
+    // Authorizing and submitting need the steps before.
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, "{\"id\": 1, \"method\": \"mining.authorize\", \"params\": [\"worker\", \"\"]}")), STRATUM_ERROR_NOT_SUBSCRIBED);
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, "{\"id\": 2, \"method\": \"mining.submit\", \"params\": []}")), STRATUM_ERROR_UNAUTHORIZED);
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, "{\"id\": 3, \"method\": \"mining.unknown\", \"params\": []}")), STRATUM_ERROR_OTHER);
+
+    UniValue reply = Request(conn, "{\"id\": 4, \"method\": \"mining.subscribe\", \"params\": [\"miner/1.0\"]}");
+    BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), 4);
+    const UniValue& result = find_value(reply, "result");
+    BOOST_CHECK(result.isArray() && result.size() == 2);
+    BOOST_CHECK_EQUAL(result[1].get_str(), conn->strExtraNonce);
+
+    // Without a job, the authorization is the only reply.
+    reply = Request(conn, "{\"id\": 5, \"method\": \"mining.authorize\", \"params\": [\"worker\", \"\"]}");
+    BOOST_CHECK(find_value(reply, "result").get_bool());
+    BOOST_CHECK(NothingSent(conn));
+
+    // Authorized miners get the new jobs, the others do not.
+    StratumConnection* connOther = Connect();
+    BOOST_CHECK_EQUAL(connOther->strExtraNonce, "0001");
+    std::shared_ptr<StratumJob> job = MakeJob(1);
+    server->AddJob(job, true);
+    BOOST_CHECK(NothingSent(connOther));
+    UniValue setTarget = Read(conn);
+    BOOST_CHECK_EQUAL(find_value(setTarget, "method").get_str(), "mining.set_target");
+    BOOST_CHECK_EQUAL(find_value(setTarget, "params")[0].get_str(), EthashHashToHex(job->target));
+    UniValue notify = Read(conn);
+    BOOST_CHECK_EQUAL(find_value(notify, "method").get_str(), "mining.notify");
+    const UniValue& params = find_value(notify, "params");
+    BOOST_CHECK_EQUAL(params[0].get_str(), job->id);
+    BOOST_CHECK_EQUAL(params[1].get_str(), EthashHashToHex(job->header_hash));
+    BOOST_CHECK(params[4].get_bool());
+    BOOST_CHECK_EQUAL(params[5].get_int(), 1);
+
+    // Miners authorized later get the current job at once.
+    Request(connOther, "{\"id\": 1, \"method\": \"mining.subscribe\", \"params\": []}");
+    Request(connOther, "{\"id\": 2, \"method\": \"mining.authorize\", \"params\": [\"worker\", \"\"]}");
+    BOOST_CHECK_EQUAL(find_value(Read(connOther), "method").get_str(), "mining.set_target");
+    BOOST_CHECK_EQUAL(find_value(Read(connOther), "method").get_str(), "mining.notify");
+
+    // A request that is not JSON closes the connection.
+    BOOST_CHECK(!server->ProcessLine(connOther, "mining.subscribe"));
+}
+
+BOOST_AUTO_TEST_CASE(extranonce_reuse)
+{
+    // A new miner gets the lowest extranonce of no connected miner.
+    std::vector<StratumConnection*> conns;
+    for (int i = 0; i < 3; i++)
+        conns.push_back(Connect());
+    const uint64_t nIdClosed = conns[1]->nId;
+    BOOST_CHECK(!server->ProcessLine(conns[1], "mining.subscribe"));
+    StratumConnection* conn = Connect();
+    BOOST_REQUIRE(conn);
+    BOOST_CHECK_EQUAL(conn->strExtraNonce, "0001");
+    BOOST_CHECK(conn->nId != nIdClosed);
+    BOOST_CHECK_EQUAL(Connect()->strExtraNonce, "0003");
+
+    // Miners are refused once all the extranonces are used.
+    for (int i = 4; i <= 0xffff; i++)
+        BOOST_REQUIRE(Connect());
+    BOOST_CHECK(!Connect());
+    BOOST_CHECK(!server->ProcessLine(conns[2], "mining.subscribe"));
+    conn = Connect();
+    BOOST_REQUIRE(conn);
+    BOOST_CHECK_EQUAL(conn->strExtraNonce, "0002");
+}
+
+BOOST_AUTO_TEST_CASE(submit)
+{
+    StratumConnection* conn = Connect();
+    Request(conn, "{\"id\": 1, \"method\": \"mining.subscribe\", \"params\": []}");
+    Request(conn, "{\"id\": 2, \"method\": \"mining.authorize\", \"params\": [\"worker\", \"\"]}");
+    std::shared_ptr<StratumJob> jobStale = MakeJob(1);
+    server->AddJob(jobStale, true);
+    std::shared_ptr<StratumJob> job = MakeJob(2);
+    server->AddJob(job, true);
+    while (!NothingSent(conn))
+        Read(conn);
+
+    // The nonces of the first miner start with its extranonce 0000.
+    const uint64_t nonce = 0x0000000000000042ULL;
+    UniValue reply = Request(conn, SubmitRequest(3, *job, nonce));
+    BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), 3);
+    BOOST_CHECK_EQUAL(GetErrorCode(reply), STRATUM_OK);
+    BOOST_CHECK(find_value(reply, "result").get_bool());
+
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, SubmitRequest(4, *job, nonce))), STRATUM_ERROR_DUPLICATE_SHARE);
+
+    // The clean job replaced the first one.
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, SubmitRequest(5, *jobStale, nonce))), STRATUM_ERROR_JOB_NOT_FOUND);
+
+    // A nonce outside of the range of the miner.
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, SubmitRequest(6, *job, 0x1234000000000042ULL))), STRATUM_ERROR_OTHER);
+
+    // A mix hash that is not the one of the nonce.
+    std::string strRequest = SubmitRequest(7, *job, nonce + 1);
+    strRequest.replace(strRequest.size() - 4, 1, strRequest[strRequest.size() - 4] == '0' ? "1" : "0");
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, strRequest)), STRATUM_ERROR_LOW_DIFFICULTY_SHARE);
+
+    // Malformed shares.
+    BOOST_CHECK_EQUAL(GetErrorCode(Request(conn, "{\"id\": 8, \"method\": \"mining.submit\", \"params\": [\"worker\", \"" + job->id + "\", \"0x42\"]}")), STRATUM_ERROR_OTHER);
+    BOOST_CHECK(NothingSent(conn));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
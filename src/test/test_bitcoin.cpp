@@ -7,6 +7,7 @@
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/progpow/ethash.hpp"
 #include "crypto/sha256.h"
 #include "fs.h"
 #include "key.h"
@@ -35,12 +36,14 @@ extern void noui_connect();
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
         SHA256AutoDetect();
+        ethash::progpow_autodetect();
         RandomInit();
         ECC_Start();
         SetupEnvironment();
         SetupNetworking();
         InitSignatureCache();
         InitScriptExecutionCache();
+        InitSolutionCache();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(chainName);
@@ -138,8 +141,8 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
 
     // TODO(h4x3rotab): Generate Equihash solution if applicable.
-    while (!CheckProofOfWork(block.GetHash(), block.nBits, false, chainparams.GetConsensus())) {
-        block.nNonce = ArithToUint256(UintToArith256(block.nNonce) + 1);
+    while (!CheckProofOfWork(block.GetHash(), block.GetBits(), false, chainparams.GetConsensus())) {
+        block.SetNonce(ArithToUint256(UintToArith256(block.GetNonce()) + 1));
     }
 
     std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(block);
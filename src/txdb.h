@@ -10,12 +10,14 @@
 #include "dbwrapper.h"
 #include "chain.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
 class CBlockIndex;
+struct CBlockCoinsStats;
 class CCoinsViewDBCursor;
 class uint256;
 
@@ -68,6 +70,10 @@ class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Incremented before and after every write of coins, odd while one is in progress
+    std::atomic<uint64_t> nWriteSequence;
+
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, bool fFinal);
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -76,11 +82,17 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWritePartial(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    /** Return the write sequence number. Coins read concurrently with the
+     *  database writes are still current if the number read before them was
+     *  even and has not changed since. */
+    uint64_t GetWriteSequence() const { return nWriteSequence.load(); }
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -114,13 +126,17 @@ private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
 public:
-    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo, const std::vector<std::pair<uint256, const CBlockCoinsStats*> >& coinsstats);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadCoinsStats(const uint256 &hash, CBlockCoinsStats &stats);
+    bool WriteCoinsStats(const std::vector<std::pair<uint256, const CBlockCoinsStats*> > &list);
+    bool ReadCoinsStatsStart(uint256 &hash);
+    bool WriteCoinsStatsStart(const uint256 &hash);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
@@ -626,6 +626,8 @@ public:
 
     boost::signals2::signal<void (CTransactionRef)> NotifyEntryAdded;
     boost::signals2::signal<void (CTransactionRef, MemPoolRemovalReason)> NotifyEntryRemoved;
+    /** Called with cs held when the fee delta of a transaction changes */
+    boost::signals2::signal<void (const uint256&)> NotifyFeeDeltaChanged;
 
 private:
     /** UpdateForDescendants is used by UpdateTransactionsFromBlock to update
@@ -101,6 +101,7 @@ namespace BCLog {
         COINDB      = (1 << 18),
         QT          = (1 << 19),
         LEVELDB     = (1 << 20),
+        STRATUM     = (1 << 21),
         POW         = (1 << 30),
         ALL         = ~(uint32_t)0,
     };
@@ -10,10 +10,13 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinsprefetch.h"
+#include "coinstats.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
+#include "crypto/progpow/ethash.hpp"
 #include "cuckoocache.h"
 #include "fs.h"
 #include "hash.h"
@@ -23,6 +26,7 @@
 #include "policy/policy.h"
 #include "policy/rbf.h"
 #include "pow.h"
+#include "protocol.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "random.h"
@@ -44,6 +48,7 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <limits>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -61,21 +66,29 @@
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+/** Owns the entries of mapBlockIndex */
+static CBlockIndexArena blockIndexArena;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = nullptr;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
+std::atomic<uint64_t> nTipGeneration{0};
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
 bool fTxIndex = false;
 bool fHavePruned = false;
+bool fLoadedTxOutSet = false;
+/** The base of the loaded UTXO set snapshot, connected without its ancestors */
+static CBlockIndex* pindexSnapshotBase = nullptr;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+size_t nCoinsWriteBatch = DEFAULT_COINS_WRITE_BATCH;
+bool fCoinStatsIndex = DEFAULT_COINSTATSINDEX;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -160,6 +173,9 @@ namespace {
 
     /** Dirty block file entries. */
     std::set<int> setDirtyFileInfo;
+
+    /** UTXO set statistics of connected blocks, written with the block index. */
+    std::map<uint256, CBlockCoinsStats> mapDirtyCoinsStats;
 } // anon namespace
 
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
@@ -182,6 +198,27 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewDB *pcoinsdbview = nullptr;
 CCoinsViewCache *pcoinsTip = nullptr;
+/** Reads the coins of the blocks about to be connected, from pcoinsdbview */
+static std::unique_ptr<CCoinsPrefetcher> pcoinsPrefetcher;
+/** The blocks read ahead of the tip by ActivateBestChainStep, whose coins
+ *  pcoinsPrefetcher reads. Kept across the calls, which often connect a
+ *  single block. Guarded by cs_main. */
+static std::map<const CBlockIndex*, std::shared_ptr<const CBlock>> mapBlocksAhead;
+/** Whether the coin database holds only a part of the changes up to the best block of pcoinsTip */
+static bool fCoinsWritePartial = false;
+/** Whether WriteCoinsInBackground is writing to the coin database without cs_main */
+static bool fCoinsWriteInFlight = false;
+static CWaitableCriticalSection csCoinsWriteInFlight;
+static CConditionVariable cvCoinsWriteInFlight;
+
+/** Wait until the coins written by WriteCoinsInBackground reached the coin database */
+static void WaitForCoinsWrite()
+{
+    boost::unique_lock<boost::mutex> lock(csCoinsWriteInFlight);
+    while (fCoinsWriteInFlight)
+        cvCoinsWriteInFlight.wait(lock);
+}
+
 CBlockTreeDB *pblocktree = nullptr;
 
 enum FlushStateMode {
@@ -1003,7 +1040,7 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
     block.SetNull();
 
@@ -1020,32 +1057,39 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
+    if (!fCheckPOW)
+        return true;
+
     // Check ProgPow/Equihash solution
     bool postfork = false;
-    if (block.nHeight >= (uint32_t)consensusParams.ProgForkHeight) {
+    if (block.GetHeight() >= (uint32_t)consensusParams.ProgForkHeight) {
         postfork = true;
-        if (!CheckProgPow(&block, Params())) {
+        if (!CheckProgPow(&block, Params(), PowCheckSource::DISK)) {
             return error("ReadBlockFromDisk: Errors in block header at %s (bad Progpow solution)", 
                          pos.ToString());
         }
-    } else if (block.nHeight >= (uint32_t)consensusParams.BCIHeight) {
+    } else if (block.GetHeight() >= (uint32_t)consensusParams.BCIHeight) {
         postfork = true;
-        if (!CheckEquihashSolution(&block, Params())) {
+        if (!CheckEquihashSolution(&block, Params(), PowCheckSource::DISK)) {
             return error("ReadBlockFromDisk: Errors in block header at %s (bad Equihash solution)",
                           pos.ToString());
         }
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetHash(), block.nBits, postfork, consensusParams))
+    if (!CheckProofOfWork(block.GetHash(), block.GetBits(), postfork, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // The proof of work of headers in the block tree has been verified when
+    // they were accepted. Matching the index hash, which commits to the
+    // header and its solution, is then enough to detect a corrupted block.
+    fCheckPOW = fCheckPOW || !pindex->IsValid(BLOCK_VALID_TREE);
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, fCheckPOW))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1674,6 +1718,74 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+bool ReadBlockCoinsStats(const CBlockIndex* pindex, CBlockCoinsStats& stats)
+{
+    AssertLockHeld(cs_main);
+    auto it = mapDirtyCoinsStats.find(pindex->GetBlockHash());
+    if (it != mapDirtyCoinsStats.end()) {
+        stats = it->second;
+        return true;
+    }
+    return pblocktree->ReadCoinsStats(pindex->GetBlockHash(), stats);
+}
+
+/**
+ * The two blocks whose coinbase duplicates an earlier one that was still
+ * unspent, which ConnectBlock lets overwrite the coins of the earlier one
+ * (see BIP30). Returns the height of the overwritten coinbase, or -1.
+ */
+static int GetBIP30OverwrittenHeight(const CBlockIndex* pindex)
+{
+    if (pindex->nHeight == 91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec"))
+        return 91812;
+    if (pindex->nHeight == 91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721"))
+        return 91722;
+    return -1;
+}
+
+void ApplyBlockCoinsStats(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, CBlockCoinsStats& stats, bool fDisconnect)
+{
+    auto add = [&](const COutPoint& outpoint, const Coin& coin) {
+        if (fDisconnect) stats.Remove(outpoint, coin); else stats.Add(outpoint, coin);
+    };
+    auto remove = [&](const COutPoint& outpoint, const Coin& coin) {
+        if (fDisconnect) stats.Add(outpoint, coin); else stats.Remove(outpoint, coin);
+    };
+    const int nOverwrittenHeight = GetBIP30OverwrittenHeight(pindex);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        if (i > 0) {
+            const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+            for (size_t j = 0; j < tx.vin.size(); j++)
+                remove(tx.vin[j].prevout, txundo.vprevout[j]);
+        }
+        for (size_t j = 0; j < tx.vout.size(); j++) {
+            if (tx.vout[j].scriptPubKey.IsUnspendable())
+                continue;
+            // Same txid, so same outputs: only the height of the coin changes.
+            if (tx.IsCoinBase() && nOverwrittenHeight >= 0)
+                remove(COutPoint(tx.GetHash(), j), Coin(tx.vout[j], nOverwrittenHeight, true));
+            add(COutPoint(tx.GetHash(), j), Coin(tx.vout[j], pindex->nHeight, tx.IsCoinBase()));
+        }
+    }
+}
+
+/**
+ * Derive the UTXO set statistics after a block from those after its parent.
+ * They are kept by block hash, so disconnecting the block leaves nothing to
+ * update, and written to disk with the block index. Without statistics for
+ * the parent the index is not ready yet: ThreadCoinStatsIndex computes them
+ * for the blocks of the active chain once it has those of the parent.
+ */
+static void WriteBlockCoinsStats(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    CBlockCoinsStats stats;
+    if (!ReadBlockCoinsStats(pindex->pprev, stats))
+        return;
+    ApplyBlockCoinsStats(block, blockundo, pindex, stats);
+    mapDirtyCoinsStats[pindex->GetBlockHash()] = stats;
+}
+
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
@@ -1698,8 +1810,11 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
+        if (!fJustCheck) {
             view.SetBestBlock(pindex->GetBlockHash());
+            if (fCoinStatsIndex)
+                mapDirtyCoinsStats[pindex->GetBlockHash()] = CBlockCoinsStats();
+        }
         return true;
     }
 
@@ -1745,8 +1860,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     // two in the chain that violate it. This prevents exploiting the issue against nodes during their
     // initial block download.
     bool fEnforceBIP30 = (!pindex->phashBlock) || // Enforce on CreateNewBlock invocations which don't have a hash.
-                          !((pindex->nHeight==91842 && pindex->GetBlockHash() == uint256S("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) ||
-                           (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
+                          GetBIP30OverwrittenHeight(pindex) < 0;
 
     // Once BIP34 activated it was not possible to create new duplicate coinbases and thus other than starting
     // with the 2 existing duplicate coinbase pairs, not possible to create overwriting txs.  But by the
@@ -1910,6 +2024,9 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (fCoinStatsIndex)
+        WriteBlockCoinsStats(block, blockundo, pindex);
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -1922,6 +2039,42 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     return true;
 }
 
+/**
+ * Write the block and undo files and the modified block index entries, so
+ * that the blocks connected so far can be replayed after a crash.
+ */
+static bool WriteBlockIndex(CValidationState &state) {
+    LOCK(cs_LastBlockFile);
+    // Depend on nMinDiskSpace to ensure we can write block index
+    if (!CheckDiskSpace(0))
+        return state.Error("out of disk space");
+    // First make sure all block and undo data is flushed to disk.
+    FlushBlockFile();
+    // Then update all block file information (which may refer to block and undo files).
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+    vFiles.reserve(setDirtyFileInfo.size());
+    for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
+        vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
+        setDirtyFileInfo.erase(it++);
+    }
+    std::vector<const CBlockIndex*> vBlocks;
+    vBlocks.reserve(setDirtyBlockIndex.size());
+    for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
+        vBlocks.push_back(*it);
+        setDirtyBlockIndex.erase(it++);
+    }
+    std::vector<std::pair<uint256, const CBlockCoinsStats*> > vCoinsStats;
+    vCoinsStats.reserve(mapDirtyCoinsStats.size());
+    for (const auto& entry : mapDirtyCoinsStats) {
+        vCoinsStats.push_back(std::make_pair(entry.first, &entry.second));
+    }
+    if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks, vCoinsStats)) {
+        return AbortNode(state, "Failed to write to block index database");
+    }
+    mapDirtyCoinsStats.clear();
+    return true;
+}
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -1982,29 +2135,8 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
         // Write blocks and block index to disk.
         if (fDoFullFlush || fPeriodicWrite) {
-            // Depend on nMinDiskSpace to ensure we can write block index
-            if (!CheckDiskSpace(0))
-                return state.Error("out of disk space");
-            // First make sure all block and undo data is flushed to disk.
-            FlushBlockFile();
-            // Then update all block file information (which may refer to block and undo files).
-            {
-                std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
-                vFiles.reserve(setDirtyFileInfo.size());
-                for (std::set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); ) {
-                    vFiles.push_back(std::make_pair(*it, &vinfoBlockFile[*it]));
-                    setDirtyFileInfo.erase(it++);
-                }
-                std::vector<const CBlockIndex*> vBlocks;
-                vBlocks.reserve(setDirtyBlockIndex.size());
-                for (std::set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                    vBlocks.push_back(*it);
-                    setDirtyBlockIndex.erase(it++);
-                }
-                if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
-                    return AbortNode(state, "Failed to write to block index database");
-                }
-            }
+            if (!WriteBlockIndex(state))
+                return false;
             // Finally remove any pruned files
             if (fFlushForPrune)
                 UnlinkPrunedFiles(setFilesToPrune);
@@ -2020,8 +2152,26 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
-                return AbortNode(state, "Failed to write to coin database");
+            WaitForCoinsWrite();
+            if (nCoinsWriteBatch == 0) {
+                if (!pcoinsTip->Flush())
+                    return AbortNode(state, "Failed to write to coin database");
+            } else {
+                // The modified coins are written in the background, so that
+                // most of the cache is unmodified: make room by evicting
+                // those only, and keep the written coins cached.
+                const size_t nTargetUsage = (8 * nTotalSpace) / 10;
+                const bool fEvict = fCacheLarge || fCacheCritical;
+                if (fEvict)
+                    pcoinsTip->EvictClean(nTargetUsage);
+                if (mode == FLUSH_STATE_ALWAYS || fPeriodicFlush || fFlushForPrune || pcoinsTip->DynamicMemoryUsage() > nTargetUsage) {
+                    if (!pcoinsTip->WriteDirty(std::numeric_limits<size_t>::max()))
+                        return AbortNode(state, "Failed to write to coin database");
+                    fCoinsWritePartial = false;
+                    if (fEvict)
+                        pcoinsTip->EvictClean(nTargetUsage);
+                }
+            }
             nLastFlush = nNow;
         }
     }
@@ -2036,6 +2186,70 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
     return true;
 }
 
+void WriteCoinsInBackground() {
+    CValidationState state;
+    static uint256 hashBlockIndexWritten;
+    CCoinsMap mapWrite;
+    uint256 hashBlockWrite;
+    bool fFinal;
+    {
+        LOCK2(cs_main, cs_LastBlockFile);
+        if (nCoinsWriteBatch == 0 || pcoinsTip == nullptr || (!pcoinsTip->HasDirtyCoins() && !fCoinsWritePartial))
+            return;
+        if (!CheckDiskSpace(48 * 2 * 2 * nCoinsWriteBatch))
+            return;
+        fFinal = pcoinsTip->GetDirty(nCoinsWriteBatch, mapWrite);
+        if (mapWrite.empty() && fFinal && !fCoinsWritePartial)
+            return;
+        // The coin database refers to this best block from now on, and is
+        // only consistent with it after replaying the blocks up to it until
+        // the rest is written: the block index must have them.
+        hashBlockWrite = pcoinsTip->GetBestBlock();
+        if (hashBlockWrite != hashBlockIndexWritten) {
+            bool fIndexWritten = false;
+            try {
+                fIndexWritten = WriteBlockIndex(state);
+            } catch (const std::runtime_error& e) {
+                AbortNode(state, std::string("System error while writing coins: ") + e.what());
+            }
+            if (!fIndexWritten) {
+                pcoinsTip->MarkWritten(mapWrite, false);
+                return;
+            }
+            hashBlockIndexWritten = hashBlockWrite;
+        }
+        fCoinsWritePartial = !fFinal;
+        boost::unique_lock<boost::mutex> lock(csCoinsWriteInFlight);
+        fCoinsWriteInFlight = true;
+    }
+
+    const CCoinsMap mapWritten(mapWrite);
+    bool fOk = false;
+    try {
+        fOk = fFinal ? pcoinsdbview->BatchWrite(mapWrite, hashBlockWrite) : pcoinsdbview->BatchWritePartial(mapWrite, hashBlockWrite);
+    } catch (const std::runtime_error& e) {
+        AbortNode(state, std::string("System error while writing coins: ") + e.what());
+    }
+    const uint64_t nWriteSequence = pcoinsdbview->GetWriteSequence();
+    {
+        boost::unique_lock<boost::mutex> lock(csCoinsWriteInFlight);
+        fCoinsWriteInFlight = false;
+    }
+    cvCoinsWriteInFlight.notify_all();
+
+    LOCK(cs_main);
+    if (!fOk) {
+        pcoinsTip->MarkWritten(mapWritten, false);
+        fCoinsWritePartial = true;
+        if (state.IsValid())
+            AbortNode(state, "Failed to write to coin database");
+        return;
+    }
+    // A flush since may have written other values of these coins: only those
+    // still modified are listed again then.
+    pcoinsTip->MarkWritten(mapWritten, pcoinsdbview->GetWriteSequence() == nWriteSequence);
+}
+
 void FlushStateToDisk() {
     CValidationState state;
     const CChainParams& chainparams = Params();
@@ -2065,6 +2279,10 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
     // New best block
     mempool.AddTransactionsUpdated(1);
+    nTipGeneration++;
+
+    // Have the next ProgPoW epoch context ready before the first block needs it
+    PrebuildNextProgPowContext(pindexNew->nHeight, chainParams.GetConsensus());
 
     cvBlockChange.notify_all();
 
@@ -2127,6 +2345,10 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
+    // A replay after a crash rolls the coin database forward from its last
+    // consistent state, so complete the changes up to the tip first.
+    if (fCoinsWritePartial && !FlushStateToDisk(chainparams, state, FLUSH_STATE_ALWAYS))
+        return false;
     // Read block from disk.
     std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
     CBlock& block = *pblock;
@@ -2264,6 +2486,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    if (pcoinsPrefetcher)
+        pcoinsPrefetcher->Apply(*pcoinsTip);
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
@@ -2396,6 +2620,14 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     std::vector<CBlockIndex*> vpindexToConnect;
     bool fContinue = true;
     int nHeight = pindexFork ? pindexFork->nHeight : -1;
+
+    // Drop the blocks read ahead that are connected or off the chain to pindexMostWork.
+    for (auto it = mapBlocksAhead.begin(); it != mapBlocksAhead.end();) {
+        if (it->first->nHeight <= nHeight || pindexMostWork->GetAncestor(it->first->nHeight) != it->first)
+            it = mapBlocksAhead.erase(it);
+        else
+            ++it;
+    }
     while (fContinue && nHeight != pindexMostWork->nHeight) {
         // Don't iterate the entire list of potential improvements toward the best tip, as we likely only need
         // a few blocks along the way.
@@ -2411,7 +2643,37 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            std::shared_ptr<const CBlock> pblockConnect = pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>();
+            if (pcoinsPrefetcher) {
+                // Read the blocks following this one and the coins they spend
+                // while it is connected. ConnectTip uses the blocks read here,
+                // in this call or the next ones.
+                auto it = mapBlocksAhead.find(pindexConnect);
+                if (it != mapBlocksAhead.end()) {
+                    pblockConnect = it->second;
+                    mapBlocksAhead.erase(it);
+                }
+                for (int nAhead = 1; nAhead <= PREFETCH_BLOCKS_AHEAD && pindexConnect->nHeight + nAhead <= pindexMostWork->nHeight; nAhead++) {
+                    const CBlockIndex* pindexAhead = pindexMostWork->GetAncestor(pindexConnect->nHeight + nAhead);
+                    if (mapBlocksAhead.count(pindexAhead))
+                        continue;
+                    std::shared_ptr<const CBlock> pblockAhead;
+                    if (pindexAhead == pindexMostWork && pblock) {
+                        pblockAhead = pblock;
+                    } else if (pindexAhead->nStatus & BLOCK_HAVE_DATA) {
+                        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+                        // On failure ConnectTip reads the block again and reports the error.
+                        if (!ReadBlockFromDisk(*pblockRead, pindexAhead, chainparams.GetConsensus()))
+                            break;
+                        pblockAhead = pblockRead;
+                    } else {
+                        break;
+                    }
+                    pcoinsPrefetcher->Prefetch(pblockAhead);
+                    mapBlocksAhead.emplace(pindexAhead, pblockAhead);
+                }
+            }
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2667,15 +2929,15 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
     BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+    BlockMap::iterator miPrev = mapBlockIndex.find(block.GetPrevBlockHash());
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
@@ -2684,6 +2946,7 @@ static CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     }
     pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
+    pindexNew->BuildDifficultyCache();
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == nullptr || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
@@ -2830,29 +3093,99 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
     return true;
 }
 
-static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
+namespace {
+/**
+ * Cache of the block headers whose Equihash or ProgPoW solution is valid, to
+ * avoid verifying it again when the same block is checked as a header, as a
+ * block and as part of a template.
+ */
+class CSolutionCache
 {
-    bool postfork = block.nHeight >= (uint32_t)consensusParams.BCIHeight;
+private:
+    //! Entries are SHA256(nonce || serialized header), committing to the whole solution
+    uint256 nonce;
+    CuckooCache::cache<uint256, SignatureCacheHasher> setValid;
+    boost::shared_mutex cs_solutioncache;
+
+public:
+    CSolutionCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    uint256 ComputeEntry(const CBlockHeader& block)
+    {
+        CHashWriter ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << nonce << block;
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_solutioncache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_solutioncache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        return setValid.setup_bytes(n);
+    }
+};
+
+static CSolutionCache solutionCache;
+} // namespace
+
+void InitSolutionCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsolutioncachesize", DEFAULT_MAX_SOLUTION_CACHE_SIZE)), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = solutionCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for block solution cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
+static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, PowCheckSource source, bool fCheckPOW = true, bool fCheckSolution = true)
+{
+    bool postfork = block.GetHeight() >= (uint32_t)consensusParams.BCIHeight;
+    uint256 solutionCacheEntry;
+    bool fCacheSolution = false;
     if (fCheckPOW && postfork) {
-        if ((block.nHeight < (uint32_t)consensusParams.ProgForkHeight)) {
+        solutionCacheEntry = solutionCache.ComputeEntry(block);
+        if (fCheckSolution && solutionCache.Get(solutionCacheEntry)) {
+            fCheckSolution = false;
+        } else {
+            // Cache the solution once it is known to be valid
+            fCacheSolution = true;
+        }
+    }
+    if (fCheckPOW && fCheckSolution && postfork) {
+        if ((block.GetHeight() < (uint32_t)consensusParams.ProgForkHeight)) {
             // Check Equihash solution is valid
-            if (!CheckEquihashSolution(&block, Params())) {
-                LogPrintf("CheckBlockHeader(): Equihash solution invalid at height %d\n", block.nHeight);
+            if (!CheckEquihashSolution(&block, Params(), source)) {
+                LogPrintf("CheckBlockHeader(): Equihash solution invalid at height %d\n", block.GetHeight());
                 return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
                                  REJECT_INVALID, "invalid-solution");
             }
         } else {
             // Check ProgPow is valid 
-            if (!CheckProgPow(&block, Params())) {
-                LogPrintf("CheckBlockHeader(): ProgPow invalid at height %d\n", block.nHeight);
+            if (!CheckProgPow(&block, Params(), source)) {
+                LogPrintf("CheckBlockHeader(): ProgPow invalid at height %d\n", block.GetHeight());
                 return state.DoS(100, error("CheckBlockHeader(): ProgPow invalid"),
                                  REJECT_INVALID, "invalid-progpow");
             }
         }
     }
+    if (fCacheSolution) {
+        solutionCache.Set(solutionCacheEntry);
+    }
 
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, postfork, consensusParams))
+    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.GetBits(), postfork, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
 
     return true;
@@ -2867,14 +3200,14 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
+    if (!CheckBlockHeader(block, state, consensusParams, PowCheckSource::BLOCK, fCheckPOW))
         return false;
 
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
         uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
-        if (block.hashMerkleRoot != hashMerkleRoot2)
+        if (block.GetMerkleRoot() != hashMerkleRoot2)
             return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
 
         // Check for merkle tree malleability (CVE-2012-2459): repeating sequences
@@ -2892,7 +3225,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Size limits
     int serialization_flags = SERIALIZE_TRANSACTION_NO_WITNESS;
-    if (block.nHeight < (uint32_t)consensusParams.BCIHeight) {
+    if (block.GetHeight() < (uint32_t)consensusParams.BCIHeight) {
         serialization_flags |= SERIALIZE_BLOCK_LEGACY;
     }
     if (block.vtx.empty() || block.vtx.size() * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT || ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | serialization_flags) * WITNESS_SCALE_FACTOR > MAX_BLOCK_WEIGHT)
@@ -2997,7 +3330,7 @@ static bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationSta
 
     // Check proof of work
     const Consensus::Params& consensusParams = params.GetConsensus();
-    if (block.nBits != GetNextWorkRequired(pindexPrev, &block, consensusParams))
+    if (block.GetBits() != GetNextWorkRequired(pindexPrev, &block, consensusParams))
         return state.DoS(100, false, REJECT_INVALID, "bad-diffbits", false, "incorrect proof of work");
 
     // Check against checkpoints
@@ -3011,7 +3344,7 @@ static bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationSta
     }
 
     // Check block height for blocks after BCI fork.
-    if (nHeight >= consensusParams.BCIHeight && block.nHeight != (uint32_t)nHeight)
+    if (nHeight >= consensusParams.BCIHeight && block.GetHeight() != (uint32_t)nHeight)
         return state.Invalid(false, REJECT_INVALID, "bad-height", "incorrect block height");
 
     // Check timestamp against prev
@@ -3024,11 +3357,11 @@ static bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationSta
 
     // Reject outdated version blocks when 95% (75% on testnet) of the network has upgraded:
     // check for version 2, 3 and 4 upgrades
-    if((block.nVersion < 2 && nHeight >= consensusParams.BIP34Height) ||
-       (block.nVersion < 3 && nHeight >= consensusParams.BIP66Height) ||
-       (block.nVersion < 4 && nHeight >= consensusParams.BIP65Height))
-            return state.Invalid(false, REJECT_OBSOLETE, strprintf("bad-version(0x%08x)", block.nVersion),
-                                 strprintf("rejected nVersion=0x%08x block", block.nVersion));
+    if((block.GetVersion() < 2 && nHeight >= consensusParams.BIP34Height) ||
+       (block.GetVersion() < 3 && nHeight >= consensusParams.BIP66Height) ||
+       (block.GetVersion() < 4 && nHeight >= consensusParams.BIP65Height))
+            return state.Invalid(false, REJECT_OBSOLETE, strprintf("bad-version(0x%08x)", block.GetVersion()),
+                                 strprintf("rejected nVersion=0x%08x block", block.GetVersion()));
 
     return true;
 }
@@ -3126,7 +3459,8 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+/** fSolutionChecked: the Equihash/ProgPoW solution of the header is already known to be valid */
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fSolutionChecked = false)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3145,12 +3479,12 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), PowCheckSource::HEADER, true, !fSolutionChecked))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
         CBlockIndex* pindexPrev = nullptr;
-        BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(block.GetPrevBlockHash());
         if (mi == mapBlockIndex.end())
             return state.DoS(10, error("%s: prev block not found", __func__), 0, "prev-blk-not-found");
         pindexPrev = (*mi).second;
@@ -3173,11 +3507,98 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
+    // Check the ProgPoW and Equihash solutions of the unknown headers on the
+    // proof-of-work check threads before AcceptBlockHeader, which then only
+    // does the contextual checks. Only the headers of a chain connecting to
+    // the block index are batched, after the checks that cost nothing: their
+    // nBits, height and time against temporary index entries of the headers
+    // before them, and their hash against their target. ProgPoW ones are only
+    // batched in the epochs next to the best header, so a peer cannot make us
+    // build contexts of far epochs. The batch stops at the first header that
+    // fails these, and AcceptBlockHeader checks the solutions the batch did
+    // not verify, so the headers before an invalid one are still accepted.
+    std::vector<bool> vSolutionChecked(headers.size(), false);
+    {
+        const Consensus::Params& consensusParams = chainparams.GetConsensus();
+        std::vector<size_t> vIndexes;
+        std::vector<const CBlockHeader*> vProgPowHeaders, vEquihashHeaders;
+        std::vector<uint256> vHashes;
+        vHashes.reserve(headers.size());
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexBest = pindexBestHeader ? pindexBestHeader : chainActive.Tip();
+            const int nBestEpoch = pindexBest ? ethash::get_epoch_number(pindexBest->nHeight) : 0;
+            const int64_t nAdjustedTime = GetAdjustedTime();
+            // Reserved so that the entries do not move
+            std::vector<CBlockIndex> vTempIndex;
+            vTempIndex.reserve(headers.size());
+            for (size_t i = 0; i < headers.size(); i++) {
+                const CBlockHeader& header = headers[i];
+                vHashes.push_back(header.GetHash());
+                if (mapBlockIndex.count(vHashes[i]))
+                    continue;
+                CBlockIndex* pindexPrev;
+                BlockMap::const_iterator mi = mapBlockIndex.find(header.GetPrevBlockHash());
+                if (mi != mapBlockIndex.end()) {
+                    pindexPrev = mi->second;
+                    if (pindexPrev->nStatus & BLOCK_FAILED_MASK)
+                        break;
+                } else if (!vTempIndex.empty() && header.GetPrevBlockHash() == vHashes[i - 1]) {
+                    pindexPrev = &vTempIndex.back();
+                } else {
+                    break;
+                }
+                CValidationState stateDummy;
+                if (!ContextualCheckBlockHeader(header, stateDummy, chainparams, pindexPrev, nAdjustedTime))
+                    break;
+                const bool fPostFork = header.GetHeight() >= (uint32_t)consensusParams.BCIHeight;
+                if (!CheckProofOfWork(vHashes[i], header.GetBits(), fPostFork, consensusParams))
+                    break;
+
+                vTempIndex.emplace_back();
+                CBlockIndex& index = vTempIndex.back();
+                index.phashBlock = &vHashes[i];
+                index.pprev = pindexPrev;
+                index.nHeight = pindexPrev->nHeight + 1;
+                index.nVersion = header.GetVersion();
+                index.nTime = header.GetTime();
+                index.nBits = header.GetBits();
+                index.BuildSkip();
+                index.BuildDifficultyCache();
+
+                if (!fPostFork)
+                    continue;
+                if (header.GetHeight() >= (uint32_t)consensusParams.ProgForkHeight) {
+                    const int nEpoch = ethash::get_epoch_number(header.GetHeight());
+                    if (nEpoch < nBestEpoch - 1 || nEpoch > nBestEpoch + 1)
+                        break;
+                    vProgPowHeaders.push_back(&header);
+                } else {
+                    vEquihashHeaders.push_back(&header);
+                }
+                vIndexes.push_back(i);
+            }
+        }
+        if (vEquihashHeaders.size() + vProgPowHeaders.size() > 1) {
+            std::vector<char> vEquihashValid, vProgPowValid;
+            CheckPowBatch(vEquihashHeaders, chainparams, PowCheckSource::HEADER, &vEquihashValid);
+            CheckPowBatch(vProgPowHeaders, chainparams, PowCheckSource::HEADER, &vProgPowValid);
+            size_t nEquihash = 0, nProgPow = 0;
+            for (size_t i : vIndexes) {
+                if (headers[i].GetHeight() >= (uint32_t)consensusParams.ProgForkHeight)
+                    vSolutionChecked[i] = vProgPowValid[nProgPow++];
+                else
+                    vSolutionChecked[i] = vEquihashValid[nEquihash++];
+            }
+        }
+    }
+
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            const CBlockHeader& header = headers[i];
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindex, vSolutionChecked[i])) {
                 return false;
             }
             if (ppindex) {
@@ -3285,6 +3706,9 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
             // Store to disk
             ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, nullptr, fNewBlock);
         }
+        // Start reading the coins of a block about to be connected.
+        if (ret && pcoinsPrefetcher && pindex->nHeight > chainActive.Height() && pindex->nHeight <= chainActive.Height() + 1 + PREFETCH_BLOCKS_AHEAD)
+            pcoinsPrefetcher->Prefetch(pblock);
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
             GetMainSignals().BlockChecked(*pblock, state);
@@ -3532,9 +3956,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw std::runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -3557,11 +3979,13 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
         vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    pblocktree->ReadFlag("loadedtxoutset", fLoadedTxOutSet);
     for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
+        pindex->BuildDifficultyCache();
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -3575,6 +3999,14 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
             } else {
                 pindex->nChainTx = pindex->nTx;
             }
+        } else if (fLoadedTxOutSet && pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+            // The base of the loaded UTXO set snapshot, see LoadTxOutSet.
+            MapAssumeutxo::const_iterator it = chainparams.Assumeutxo().find(pindex->nHeight);
+            if (it == chainparams.Assumeutxo().end() || it->second.hashBlock != pindex->GetBlockHash())
+                return error("%s: the base %s of the loaded UTXO set snapshot is not committed in the chain parameters", __func__, pindex->GetBlockHash().ToString());
+            pindex->nChainTx = it->second.nChainTx;
+            pindexSnapshotBase = pindex;
+            LogPrintf("%s: the chain state was loaded from the UTXO set snapshot at height %d, the blocks below it are not validated\n", __func__, pindex->nHeight);
         }
         if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS) && (pindex->nChainTx || pindex->pprev == nullptr))
             setBlockIndexCandidates.insert(pindex);
@@ -3714,7 +4146,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         }
         CBlock block;
         // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus(), true))
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
         if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
@@ -3758,7 +4190,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
             pindex = chainActive.Next(pindex);
             CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus(), true))
                 return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             if (!ConnectBlock(block, state, pindex, coins, chainparams))
                 return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3950,6 +4382,20 @@ bool RewindBlockIndex(const CChainParams& params)
     return true;
 }
 
+void StartCoinsPrefetch(int nThreads)
+{
+    assert(pcoinsdbview != nullptr && !pcoinsPrefetcher);
+    if (nThreads > 0)
+        pcoinsPrefetcher.reset(new CCoinsPrefetcher(*pcoinsdbview, nThreads));
+}
+
+void StopCoinsPrefetch()
+{
+    LOCK(cs_main);
+    pcoinsPrefetcher.reset();
+    mapBlocksAhead.clear();
+}
+
 // May NOT be used after any connections are up as much
 // of the peer-processing logic assumes a consistent
 // block index state
@@ -3958,6 +4404,7 @@ void UnloadBlockIndex()
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
     chainActive.SetTip(nullptr);
+    fCoinsWritePartial = false;
     pindexBestInvalid = nullptr;
     pindexBestHeader = nullptr;
     mempool.clear();
@@ -3967,16 +4414,18 @@ void UnloadBlockIndex()
     nBlockSequenceId = 1;
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
+    mapDirtyCoinsStats.clear();
+    mapBlocksAhead.clear();
     versionbitscache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
+    fLoadedTxOutSet = false;
+    pindexSnapshotBase = nullptr;
 }
 
 bool LoadBlockIndex(const CChainParams& chainparams)
@@ -4087,11 +4536,11 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.GetPrevBlockHash()) == mapBlockIndex.end()) {
                     LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
+                            block.GetPrevBlockHash().ToString());
                     if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+                        mapBlocksUnknownParent.insert(std::make_pair(block.GetPrevBlockHash(), *dbp));
                     continue;
                 }
 
@@ -4197,6 +4646,13 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
     CBlockIndex* pindexFirstNotTransactionsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_TRANSACTIONS (regardless of being valid or not).
     CBlockIndex* pindexFirstNotChainValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_CHAIN (regardless of being valid or not).
     CBlockIndex* pindexFirstNotScriptsValid = nullptr; // Oldest ancestor of pindex which does not have BLOCK_VALID_SCRIPTS (regardless of being valid or not).
+    // The base of a loaded UTXO set snapshot is connected although its
+    // ancestors were never processed, so the base and its descendants are
+    // checked against the same properties of the blocks after the base only.
+    CBlockIndex* pindexSnapshotFirstNeverProcessed = nullptr;
+    CBlockIndex* pindexSnapshotFirstNotTransactionsValid = nullptr;
+    CBlockIndex* pindexSnapshotFirstNotChainValid = nullptr;
+    CBlockIndex* pindexSnapshotFirstNotScriptsValid = nullptr;
     while (pindex != nullptr) {
         nNodes++;
         if (pindexFirstInvalid == nullptr && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
@@ -4206,6 +4662,17 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindex->pprev != nullptr && pindexFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != nullptr && pindexFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        const bool fAfterSnapshot = pindexSnapshotBase != nullptr && pindex->GetAncestor(pindexSnapshotBase->nHeight) == pindexSnapshotBase;
+        if (fAfterSnapshot && pindex != pindexSnapshotBase) {
+            if (pindexSnapshotFirstNeverProcessed == nullptr && pindex->nTx == 0) pindexSnapshotFirstNeverProcessed = pindex;
+            if (pindexSnapshotFirstNotTransactionsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexSnapshotFirstNotTransactionsValid = pindex;
+            if (pindexSnapshotFirstNotChainValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexSnapshotFirstNotChainValid = pindex;
+            if (pindexSnapshotFirstNotScriptsValid == nullptr && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexSnapshotFirstNotScriptsValid = pindex;
+        }
+        CBlockIndex* pindexCheckNeverProcessed = fAfterSnapshot ? pindexSnapshotFirstNeverProcessed : pindexFirstNeverProcessed;
+        CBlockIndex* pindexCheckNotTransactionsValid = fAfterSnapshot ? pindexSnapshotFirstNotTransactionsValid : pindexFirstNotTransactionsValid;
+        CBlockIndex* pindexCheckNotChainValid = fAfterSnapshot ? pindexSnapshotFirstNotChainValid : pindexFirstNotChainValid;
+        CBlockIndex* pindexCheckNotScriptsValid = fAfterSnapshot ? pindexSnapshotFirstNotScriptsValid : pindexFirstNotScriptsValid;
 
         // Begin: actual consistency checks.
         if (pindex->pprev == nullptr) {
@@ -4219,28 +4686,28 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         if (!fHavePruned) {
             // If we've never pruned, then HAVE_DATA should be equivalent to nTx > 0
             assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
-            assert(pindexFirstMissing == pindexFirstNeverProcessed);
+            assert(pindexFirstMissing == pindexCheckNeverProcessed);
         } else {
             // If we have pruned, then we can only say that HAVE_DATA implies nTx > 0
             if (pindex->nStatus & BLOCK_HAVE_DATA) assert(pindex->nTx > 0);
         }
         if (pindex->nStatus & BLOCK_HAVE_UNDO) assert(pindex->nStatus & BLOCK_HAVE_DATA);
-        assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
+        if (pindex != pindexSnapshotBase) assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0)); // This is pruning-independent.
         // All parents having had data (at some point) is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
-        assert((pindexFirstNeverProcessed != nullptr) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
-        assert((pindexFirstNotTransactionsValid != nullptr) == (pindex->nChainTx == 0));
+        assert((pindexCheckNeverProcessed != nullptr) == (pindex->nChainTx == 0)); // nChainTx != 0 is used to signal that all parent blocks have been processed (but may have been pruned).
+        assert((pindexCheckNotTransactionsValid != nullptr) == (pindex->nChainTx == 0));
         assert(pindex->nHeight == nHeight); // nHeight must be consistent.
         assert(pindex->pprev == nullptr || pindex->nChainWork >= pindex->pprev->nChainWork); // For every block except the genesis block, the chainwork must be larger than the parent's.
         assert(nHeight < 2 || (pindex->pskip && (pindex->pskip->nHeight < nHeight))); // The pskip pointer must point back for all but the first 2 blocks.
         assert(pindexFirstNotTreeValid == nullptr); // All mapBlockIndex entries must at least be TREE valid
         if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TREE) assert(pindexFirstNotTreeValid == nullptr); // TREE valid implies all parents are TREE valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexFirstNotChainValid == nullptr); // CHAIN valid implies all parents are CHAIN valid
-        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexFirstNotScriptsValid == nullptr); // SCRIPTS valid implies all parents are SCRIPTS valid
+        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_CHAIN) assert(pindexCheckNotChainValid == nullptr); // CHAIN valid implies all parents are CHAIN valid
+        if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_SCRIPTS) assert(pindexCheckNotScriptsValid == nullptr); // SCRIPTS valid implies all parents are SCRIPTS valid
         if (pindexFirstInvalid == nullptr) {
             // Checks for not-invalid blocks.
             assert((pindex->nStatus & BLOCK_FAILED_MASK) == 0); // The failed mask cannot be set for blocks without invalid parents.
         }
-        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexFirstNeverProcessed == nullptr) {
+        if (!CBlockIndexWorkComparator()(pindex, chainActive.Tip()) && pindexCheckNeverProcessed == nullptr) {
             if (pindexFirstInvalid == nullptr) {
                 // If this block sorts at least as good as the current tip and
                 // is valid and we have all data for its parents, it must be in
@@ -4267,13 +4734,13 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed != nullptr && pindexFirstInvalid == nullptr) {
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexCheckNeverProcessed != nullptr && pindexFirstInvalid == nullptr) {
             // If this block has block data available, some parent was never received, and has no invalid parents, it must be in mapBlocksUnlinked.
             assert(foundInUnlinked);
         }
         if (!(pindex->nStatus & BLOCK_HAVE_DATA)) assert(!foundInUnlinked); // Can't be in mapBlocksUnlinked if we don't HAVE_DATA
         if (pindexFirstMissing == nullptr) assert(!foundInUnlinked); // We aren't missing data for any parent -- cannot be in mapBlocksUnlinked.
-        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexFirstNeverProcessed == nullptr && pindexFirstMissing != nullptr) {
+        if (pindex->pprev && (pindex->nStatus & BLOCK_HAVE_DATA) && pindexCheckNeverProcessed == nullptr && pindexFirstMissing != nullptr) {
             // We HAVE_DATA for this block, have received data for all parents at some point, but we're currently missing data for some parent.
             assert(fHavePruned); // We must have pruned.
             // This block may have entered mapBlocksUnlinked if:
@@ -4313,6 +4780,10 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
             if (pindex == pindexFirstNotTransactionsValid) pindexFirstNotTransactionsValid = nullptr;
             if (pindex == pindexFirstNotChainValid) pindexFirstNotChainValid = nullptr;
             if (pindex == pindexFirstNotScriptsValid) pindexFirstNotScriptsValid = nullptr;
+            if (pindex == pindexSnapshotFirstNeverProcessed) pindexSnapshotFirstNeverProcessed = nullptr;
+            if (pindex == pindexSnapshotFirstNotTransactionsValid) pindexSnapshotFirstNotTransactionsValid = nullptr;
+            if (pindex == pindexSnapshotFirstNotChainValid) pindexSnapshotFirstNotChainValid = nullptr;
+            if (pindex == pindexSnapshotFirstNotScriptsValid) pindexSnapshotFirstNotScriptsValid = nullptr;
             // Find our parent.
             CBlockIndex* pindexPar = pindex->pprev;
             // Find which child we just visited.
@@ -4483,6 +4954,292 @@ void DumpMempool(void)
     }
 }
 
+bool InitCoinStatsIndex()
+{
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Tip();
+    CBlockCoinsStats stats;
+    if (pindex == nullptr || ReadBlockCoinsStats(pindex, stats))
+        return true;
+
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Computing the UTXO set statistics at block %s, height %d\n", pindex->GetBlockHash().ToString(), pindex->nHeight);
+    FlushStateToDisk();
+    assert(pcoinsdbview->GetBestBlock() == pindex->GetBlockHash());
+    if (!GetBlockCoinsStats(pcoinsdbview, stats))
+        return false;
+    if (!pblocktree->WriteCoinsStats({std::make_pair(pindex->GetBlockHash(), &stats)}))
+        return error("%s: unable to write the UTXO set statistics", __func__);
+    // Those of the blocks before are left to ThreadCoinStatsIndex.
+    if (!pblocktree->WriteCoinsStatsStart(pindex->GetBlockHash()) || !pblocktree->WriteFlag("coinstatsindex", false))
+        return error("%s: unable to write the UTXO set statistics", __func__);
+    LogPrintf("Computed the statistics of %u coins in %dms\n", stats.nTransactionOutputs, GetTimeMillis() - nStart);
+    return true;
+}
+
+static bool ReadBlockAndUndo(const CBlockIndex* pindex, CBlock& block, CBlockUndo& blockundo, const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !(pindex->nStatus & BLOCK_HAVE_UNDO))
+        return false;
+    return ReadBlockFromDisk(block, pindex, consensusParams) &&
+           UndoReadFromDisk(blockundo, pindex->GetUndoPos(), pindex->pprev->GetBlockHash());
+}
+
+void ThreadCoinStatsIndex()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlockCoinsStats stats;
+    const CBlockIndex* pindex = nullptr;
+    {
+        LOCK(cs_main);
+        bool fComplete = false;
+        uint256 hashStart;
+        if (pblocktree->ReadFlag("coinstatsindex", fComplete) && !fComplete && pblocktree->ReadCoinsStatsStart(hashStart)) {
+            BlockMap::const_iterator mi = mapBlockIndex.find(hashStart);
+            if (mi != mapBlockIndex.end() && ReadBlockCoinsStats(mi->second, stats))
+                pindex = mi->second;
+        }
+    }
+
+    // Go back from the block the index was created at, which a reorg may have
+    // taken out of the active chain, to the genesis block, deriving the
+    // statistics before each block from those after it and writing those
+    // that are missing.
+    if (pindex != nullptr) {
+        const int nStartHeight = pindex->nHeight;
+        int nComputed = 0;
+        while (pindex->pprev != nullptr) {
+            boost::this_thread::interruption_point();
+            LOCK(cs_main);
+            CBlockCoinsStats statsPrev;
+            if (ReadBlockCoinsStats(pindex->pprev, statsPrev)) {
+                stats = statsPrev;
+                pindex = pindex->pprev;
+                continue;
+            }
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockAndUndo(pindex, block, blockundo, consensusParams)) {
+                LogPrintf("%s: block %s at height %d is not stored, no UTXO set statistics before it\n", __func__,
+                    pindex->GetBlockHash().ToString(), pindex->nHeight);
+                break;
+            }
+            ApplyBlockCoinsStats(block, blockundo, pindex, stats, true);
+            pindex = pindex->pprev;
+            if (!pblocktree->WriteCoinsStats({std::make_pair(pindex->GetBlockHash(), &stats)})) {
+                error("%s: unable to write the UTXO set statistics", __func__);
+                return;
+            }
+            if (++nComputed % 10000 == 0)
+                LogPrintf("Computed the UTXO set statistics down to height %d\n", pindex->nHeight);
+        }
+        if (pindex->pprev == nullptr) {
+            LOCK(cs_main);
+            pblocktree->WriteFlag("coinstatsindex", true);
+        }
+        LogPrintf("Computed the UTXO set statistics of %d blocks from height %d down to %d\n", nComputed, nStartHeight, pindex->nHeight);
+    }
+
+    // Blocks connected while the statistics of their parent were missing,
+    // like after a reorg below the tip the index was created at, have none.
+    // Compute them from their last ancestor that has them.
+    while (true) {
+        std::vector<const CBlockIndex*> vMissing;
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Tip();
+        }
+        for (; pindex != nullptr; pindex = pindex->pprev) {
+            boost::this_thread::interruption_point();
+            LOCK(cs_main);
+            if (ReadBlockCoinsStats(pindex, stats))
+                break;
+            vMissing.push_back(pindex);
+        }
+        if (vMissing.empty())
+            return;
+        if (pindex == nullptr) {
+            LogPrintf("%s: no UTXO set statistics before block %s\n", __func__, vMissing.front()->GetBlockHash().ToString());
+            return;
+        }
+        for (auto it = vMissing.rbegin(); it != vMissing.rend(); ++it) {
+            boost::this_thread::interruption_point();
+            LOCK(cs_main);
+            CBlock block;
+            CBlockUndo blockundo;
+            if (!ReadBlockAndUndo(*it, block, blockundo, consensusParams)) {
+                LogPrintf("%s: block %s at height %d is not stored, no UTXO set statistics from there\n", __func__,
+                    (*it)->GetBlockHash().ToString(), (*it)->nHeight);
+                return;
+            }
+            ApplyBlockCoinsStats(block, blockundo, *it, stats);
+            if (!pblocktree->WriteCoinsStats({std::make_pair((*it)->GetBlockHash(), &stats)})) {
+                error("%s: unable to write the UTXO set statistics", __func__);
+                return;
+            }
+        }
+    }
+}
+
+const CBlockIndex* GetSnapshotBase()
+{
+    AssertLockHeld(cs_main);
+    return pindexSnapshotBase;
+}
+
+bool LoadTxOutSet(const CChainParams& chainparams, const fs::path& path)
+{
+    int64_t nStart = GetTimeMillis();
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: unable to open %s", __func__, path.string());
+
+    try {
+        CMessageHeader::MessageStartChars pchMessageStart;
+        file.read((char*)pchMessageStart, sizeof(pchMessageStart));
+        if (memcmp(pchMessageStart, chainparams.MessageStart(), sizeof(pchMessageStart)) != 0)
+            return error("%s: the snapshot is for another network", __func__);
+        SnapshotMetadata metadata;
+        file >> metadata;
+        if (metadata.nVersion != SNAPSHOT_VERSION)
+            return error("%s: unknown snapshot version %d", __func__, metadata.nVersion);
+        MapAssumeutxo::const_iterator itAssumeutxo = chainparams.Assumeutxo().find(metadata.nHeight);
+        if (metadata.nHeight <= 0 || itAssumeutxo == chainparams.Assumeutxo().end() || itAssumeutxo->second.hashBlock != metadata.hashBaseBlock)
+            return error("%s: the snapshot base %s at height %d is not committed in the chain parameters", __func__, metadata.hashBaseBlock.ToString(), metadata.nHeight);
+        const AssumeutxoData& assumeutxo = itAssumeutxo->second;
+        {
+            LOCK(cs_main);
+            if (mapBlockIndex.size() > 1 || !pcoinsdbview->GetBestBlock().IsNull())
+                return error("%s: a snapshot can only be loaded in a new data directory", __func__);
+        }
+        LogPrintf("Loading the UTXO set snapshot at block %s, height %d\n", metadata.hashBaseBlock.ToString(), metadata.nHeight);
+
+        // The headers are authenticated by the hashes linking them up to the
+        // committed base only, so check the whole chain before accepting any
+        // of them. Their solutions are not checked then.
+        const long nHeadersPos = ftell(file.Get());
+        std::vector<uint256> vHashes;
+        vHashes.reserve(metadata.nHeight);
+        uint256 hashPrev = chainparams.GetConsensus().hashGenesisBlock;
+        for (int nHeight = 1; nHeight <= metadata.nHeight; nHeight++) {
+            CBlockHeader header;
+            file >> header;
+            if (header.GetPrevBlockHash() != hashPrev)
+                return error("%s: the headers of the snapshot are not a chain at height %d", __func__, nHeight);
+            hashPrev = header.GetHash();
+            vHashes.push_back(hashPrev);
+        }
+        if (hashPrev != metadata.hashBaseBlock)
+            return error("%s: the headers of the snapshot do not lead to its base", __func__);
+
+        // Check the coins against the commitment before writing anything.
+        // The chunk hashes let the second read, which writes them, detect a
+        // change of the file in between.
+        std::vector<uint256> vChunkHashes;
+        CBlockCoinsStats blockstats;
+        uint64_t nCoins = 0;
+        while (true) {
+            uint32_t nChunkCoins;
+            file >> nChunkCoins;
+            if (nChunkCoins > SNAPSHOT_CHUNK_COINS)
+                return error("%s: oversized chunk of %u coins", __func__, nChunkCoins);
+            CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+            for (uint32_t i = 0; i < nChunkCoins; i++) {
+                COutPoint outpoint;
+                Coin coin;
+                file >> outpoint >> coin;
+                hasher << outpoint << coin;
+                blockstats.Add(outpoint, coin);
+            }
+            uint256 hashChunk;
+            file >> hashChunk;
+            if (hashChunk != hasher.GetHash())
+                return error("%s: corrupted chunk after %u coins", __func__, nCoins);
+            if (nChunkCoins == 0)
+                break;
+            vChunkHashes.push_back(hashChunk);
+            nCoins += nChunkCoins;
+            if (ShutdownRequested())
+                return false;
+        }
+        const uint256 hashMuHash = blockstats.GetMuHash();
+        if (hashMuHash != assumeutxo.hashMuHash)
+            return error("%s: the UTXO set hash %s does not match the committed %s", __func__, hashMuHash.ToString(), assumeutxo.hashMuHash.ToString());
+        LogPrintf("Checked %u coins from the snapshot\n", nCoins);
+        if (nHeadersPos < 0 || fseek(file.Get(), nHeadersPos, SEEK_SET) != 0)
+            return error("%s: unable to seek in %s", __func__, path.string());
+
+        LOCK(cs_main);
+        CBlockIndex* pindexBase = nullptr;
+        for (const uint256& hash : vHashes) {
+            CBlockHeader header;
+            file >> header;
+            if (header.GetHash() != hash)
+                return error("%s: the snapshot changed while loading it", __func__);
+            CValidationState state;
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexBase, true))
+                return error("%s: invalid header %s: %s", __func__, hash.ToString(), FormatStateMessage(state));
+        }
+
+        // The coins are written in parts, leaving the coin database in
+        // transition to the base until the block index has it.
+        for (const uint256& hashChunkChecked : vChunkHashes) {
+            uint32_t nChunkCoins;
+            file >> nChunkCoins;
+            if (nChunkCoins > SNAPSHOT_CHUNK_COINS)
+                return error("%s: the snapshot changed while loading it", __func__);
+            CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+            CCoinsMap mapCoins;
+            for (uint32_t i = 0; i < nChunkCoins; i++) {
+                COutPoint outpoint;
+                Coin coin;
+                file >> outpoint >> coin;
+                hasher << outpoint << coin;
+                CCoinsCacheEntry& entry = mapCoins[outpoint];
+                entry.coin = std::move(coin);
+                entry.flags = CCoinsCacheEntry::DIRTY;
+            }
+            uint256 hashChunk;
+            file >> hashChunk;
+            if (hashChunk != hashChunkChecked || hasher.GetHash() != hashChunkChecked)
+                return error("%s: the snapshot changed while loading it", __func__);
+            if (!pcoinsdbview->BatchWritePartial(mapCoins, metadata.hashBaseBlock))
+                return error("%s: unable to write to the coin database", __func__);
+        }
+
+        // As on a pruned node, the blocks before the base have no data,
+        // and the base itself counts as connected. The base gets its
+        // nChainTx from the chain parameters again when loaded.
+        for (CBlockIndex* pindex = pindexBase; pindex->pprev != nullptr; pindex = pindex->pprev) {
+            pindex->nStatus |= BLOCK_OPT_WITNESS;
+            setDirtyBlockIndex.insert(pindex);
+        }
+        pindexBase->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        pindexBase->nChainTx = assumeutxo.nChainTx;
+        setBlockIndexCandidates.insert(pindexBase);
+        pindexSnapshotBase = pindexBase;
+        fHavePruned = true;
+        fLoadedTxOutSet = true;
+        pblocktree->WriteFlag("prunedblockfiles", true);
+        pblocktree->WriteFlag("loadedtxoutset", true);
+        if (fCoinStatsIndex)
+            mapDirtyCoinsStats[metadata.hashBaseBlock] = blockstats;
+        CValidationState state;
+        if (!WriteBlockIndex(state))
+            return error("%s: unable to write the block index", __func__);
+
+        // Finally mark the coin database as consistent with the base.
+        CCoinsMap mapCoins;
+        if (!pcoinsdbview->BatchWrite(mapCoins, metadata.hashBaseBlock))
+            return error("%s: unable to write to the coin database", __func__);
+        LogPrintf("Loaded %u coins from the snapshot in %dms\n", nCoins, GetTimeMillis() - nStart);
+    } catch (const std::exception& e) {
+        return error("%s: failed to read the snapshot: %s", __func__, e.what());
+    }
+    return true;
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, CBlockIndex *pindex) {
     if (pindex == nullptr)
@@ -4507,10 +5264,8 @@ public:
     CMainCleanup() {}
     ~CMainCleanup() {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
     }
 } instance_of_cmaincleanup;
 
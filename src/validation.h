@@ -31,6 +31,7 @@
 #include <atomic>
 
 class CBlockIndex;
+class CBlockUndo;
 class CBlockTreeDB;
 class CChainParams;
 class CCoinsViewDB;
@@ -40,6 +41,7 @@ class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
 class CValidationState;
+struct CBlockCoinsStats;
 struct ChainTxData;
 
 struct PrecomputedTransactionData;
@@ -101,6 +103,12 @@ static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Time to wait (in milliseconds) between writing parts of the modified coins in the background. */
+static const int64_t COINS_WRITE_INTERVAL = 1000;
+/** Default for -coinswritebatch, the number of modified coins written in the background at a time. */
+static const unsigned int DEFAULT_COINS_WRITE_BATCH = 100000;
+/** Default for -coinstatsindex */
+static const bool DEFAULT_COINSTATSINDEX = false;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -166,6 +174,8 @@ extern uint64_t nLastBlockWeight;
 extern const std::string strMessageMagic;
 extern CWaitableCriticalSection csBestBlock;
 extern CConditionVariable cvBlockChange;
+/** Incremented on every change of chainActive's tip, readable without cs_main */
+extern std::atomic<uint64_t> nTipGeneration;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
@@ -175,6 +185,10 @@ extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Number of modified coins written in the background at a time, 0 to only write them when flushing */
+extern size_t nCoinsWriteBatch;
+/** Whether the UTXO set statistics of each connected block are kept in the block tree database */
+extern bool fCoinStatsIndex;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
 /** Absolute maximum transaction fee (in satoshis) used by wallet and mempool (rejects high fee in sendrawtransaction) */
@@ -195,6 +209,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 /** Pruning-related variables and constants */
 /** True if any block files have ever been pruned. */
 extern bool fHavePruned;
+/** True if the chain state was loaded from a UTXO set snapshot */
+extern bool fLoadedTxOutSet;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
@@ -202,6 +218,8 @@ extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
+/** Default for -maxsolutioncachesize, maximum size of the cache of valid block header solutions in MiB */
+static const int64_t DEFAULT_MAX_SOLUTION_CACHE_SIZE = 4;
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
 
@@ -265,6 +283,12 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 bool LoadChainTip(const CChainParams& chainparams);
 /** Unload database information */
 void UnloadBlockIndex();
+/** Start reading the coins spent by the blocks about to be connected on nThreads threads */
+void StartCoinsPrefetch(int nThreads);
+/** Stop reading coins ahead of the connected blocks. Call before pcoinsdbview is deleted. */
+void StopCoinsPrefetch();
+/** Write a part of the modified coins of pcoinsTip, keeping them cached. Called periodically by the scheduler. */
+void WriteCoinsInBackground();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -389,10 +413,16 @@ public:
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
+/** Initializes the cache of valid block header solutions */
+void InitSolutionCache();
 
-/** Functions for disk access for blocks */
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+
+/** Functions for disk access for blocks
+ *  Blocks read by position have their proof of work checked. Blocks read by
+ *  index only when fCheckPOW is set or the index is not part of the block tree,
+ *  otherwise their hash is compared to the index. */
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPOW = true);
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams, bool fCheckPOW = false);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -480,6 +510,32 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Compute the UTXO set statistics at the tip if the block tree database lacks them. */
+bool InitCoinStatsIndex();
+
+/**
+ * Compute the UTXO set statistics missing before the tip the index was
+ * created at, and those of the blocks of the active chain connected without
+ * the statistics of their parent. Takes cs_main one block at a time.
+ */
+void ThreadCoinStatsIndex();
+
+/** Apply a block to the UTXO set statistics, or undo it, the spent coins coming from its undo data. */
+void ApplyBlockCoinsStats(const CBlock& block, const CBlockUndo& blockundo, const CBlockIndex* pindex, CBlockCoinsStats& stats, bool fDisconnect = false);
+
+/** Get the UTXO set statistics after a block, whether or not they are written yet. Requires cs_main. */
+bool ReadBlockCoinsStats(const CBlockIndex* pindex, CBlockCoinsStats& stats);
+
+/**
+ * Load the chain state from a UTXO set snapshot written by dumptxoutset,
+ * after checking it against the commitment of the chain parameters. The
+ * blocks below its base are never validated.
+ */
+bool LoadTxOutSet(const CChainParams& chainparams, const fs::path& path);
+
+/** The base of the loaded UTXO set snapshot, whose history is unvalidated, or null. Requires cs_main. */
+const CBlockIndex* GetSnapshotBase();
+
 /** Create ScriptPubKey script with Premined address. **/
 CScript CreatePreminedScriptPubKey();
 
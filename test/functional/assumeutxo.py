@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The Bitcoin Interest developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test dumptxoutset and -loadtxoutset.
+
+- Mine a chain with some spends on node0 and dump its UTXO set.
+- Check that node1 refuses the snapshot without a matching commitment, and
+  that the refusal leaves its data directory unused.
+- Load the snapshot on node1 with a regtest -assumeutxo commitment and
+  compare gettxoutsetinfo with node0. getblockchaininfo reports the chain
+  state of node1 as unvalidated below the base of the snapshot.
+- Restart node1, sync the blocks mined after the snapshot from node0 and
+  compare gettxoutsetinfo again.
+"""
+
+import os
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    connect_nodes_bi,
+    sync_blocks,
+)
+
+class AssumeutxoTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self):
+        # node1 must first start with the snapshot, on an empty chain state.
+        self.nodes = [self.start_node(0, self.options.tmpdir)]
+
+    def assert_same_utxo_set(self):
+        info0 = self.nodes[0].gettxoutsetinfo()
+        info1 = self.nodes[1].gettxoutsetinfo()
+        del info0['disk_size']
+        del info1['disk_size']
+        assert_equal(info0, info1)
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        node0.generate(105)
+        for i in range(5):
+            node0.sendtoaddress(node0.getnewaddress(), 1 + i)
+        node0.generate(5)
+
+        self.log.info("Dump the UTXO set of node0")
+        path = os.path.join(self.options.tmpdir, "utxo.dat")
+        dump = node0.dumptxoutset(path)
+        assert_equal(dump['base_height'], 110)
+        assert_equal(dump['base_hash'], node0.getbestblockhash())
+        assert_equal(dump['hash_serialized_2'], node0.gettxoutsetinfo()['hash_serialized_2'])
+        assert_equal(dump['coins_written'], node0.gettxoutsetinfo()['txouts'])
+        assumeutxo = "-assumeutxo=%d:%s:%s:%d" % (dump['base_height'], dump['base_hash'], dump['muhash'], dump['txcount'])
+
+        self.log.info("Refuse the snapshot without a commitment or with another one")
+        self.assert_start_raises_init_error(1, self.options.tmpdir, ["-prune=1", "-loadtxoutset=" + path], "Error loading the UTXO set snapshot")
+        bad_muhash = "%064x" % (int(dump['muhash'], 16) ^ 1)
+        bad_assumeutxo = "-assumeutxo=%d:%s:%s:%d" % (dump['base_height'], dump['base_hash'], bad_muhash, dump['txcount'])
+        self.assert_start_raises_init_error(1, self.options.tmpdir, ["-prune=1", "-loadtxoutset=" + path, bad_assumeutxo], "Error loading the UTXO set snapshot")
+
+        self.log.info("Load the snapshot on node1")
+        self.nodes.append(self.start_node(1, self.options.tmpdir, ["-prune=1", "-loadtxoutset=" + path, assumeutxo]))
+        assert_equal(self.nodes[1].getbestblockhash(), dump['base_hash'])
+        self.assert_same_utxo_set()
+        assert_equal(node0.getblockchaininfo()['snapshotunvalidated'], False)
+        assert 'snapshotheight' not in node0.getblockchaininfo()
+        info = self.nodes[1].getblockchaininfo()
+        assert_equal(info['snapshotunvalidated'], True)
+        assert_equal(info['snapshotheight'], dump['base_height'])
+
+        self.log.info("Sync the blocks after the snapshot")
+        self.stop_node(1)
+        self.nodes[1] = self.start_node(1, self.options.tmpdir, ["-prune=1", assumeutxo])
+        assert_equal(self.nodes[1].getbestblockhash(), dump['base_hash'])
+        node0.sendtoaddress(node0.getnewaddress(), 10)
+        node0.generate(3)
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        self.assert_same_utxo_set()
+        assert_equal(self.nodes[1].getblockchaininfo()['snapshotunvalidated'], True)
+
+if __name__ == '__main__':
+    AssumeutxoTest().main()
@@ -78,6 +78,7 @@ BASE_SCRIPTS= [
     'bip68-112-113-p2p.py',
     'rawtransactions.py',
     'reindex.py',
+    'assumeutxo.py',
     # vv Tests less than 30s vv
     'keypool-topup.py',
     'zmq_test.py',